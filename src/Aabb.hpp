@@ -0,0 +1,85 @@
+#ifndef AABB_H
+#define AABB_H
+
+#include "Common.hpp"
+
+namespace raytrace {
+
+// Axis aligned bounding box. Default constructed boxes are empty, so they
+// can be grown with expand().
+template <class T> class Aabb {
+  public:
+    Aabb()
+        : minimum(infinity<T>, infinity<T>, infinity<T>),
+          maximum(-infinity<T>, -infinity<T>, -infinity<T>) {}
+    Aabb(const Point3<T>& a, const Point3<T>& b) : minimum(a), maximum(b) {}
+
+    const Point3<T>& min() const { return minimum; }
+    const Point3<T>& max() const { return maximum; }
+
+    bool empty() const { return minimum.x() > maximum.x(); }
+
+    void expand(const Point3<T>& p) {
+        for (int a = 0; a < 3; ++a) {
+            minimum[a] = std::min(minimum[a], p[a]);
+            maximum[a] = std::max(maximum[a], p[a]);
+        }
+    }
+
+    void expand(const Aabb& box) {
+        if (box.empty())
+            return;
+        expand(box.minimum);
+        expand(box.maximum);
+    }
+
+    Point3<T> centroid() const { return T(0.5) * (minimum + maximum); }
+
+    T surfaceArea() const {
+        if (empty())
+            return 0;
+        Vec3<T> d = maximum - minimum;
+        return 2 * (d.x() * d.y() + d.y() * d.z() + d.z() * d.x());
+    }
+
+    int longestAxis() const {
+        Vec3<T> d = maximum - minimum;
+        if (d.x() > d.y() && d.x() > d.z())
+            return 0;
+        return d.y() > d.z() ? 1 : 2;
+    }
+
+    // Slab test against a ray given by its origin and reciprocal direction.
+    bool hit(const Point3<T>& origin, const Vec3<T>& invDir, T tMin,
+             T tMax) const {
+        for (int a = 0; a < 3; ++a) {
+            T t0 = (minimum[a] - origin[a]) * invDir[a];
+            T t1 = (maximum[a] - origin[a]) * invDir[a];
+            if (invDir[a] < 0)
+                std::swap(t0, t1);
+            // Widened by a few ulps so rounding cannot cull a box whose
+            // surface the ray grazes, such as at a mesh vertex.
+            t1 *= 1 + 4 * std::numeric_limits<T>::epsilon();
+            // Written so a NaN from 0 * inf leaves the interval unchanged.
+            tMin = t0 > tMin ? t0 : tMin;
+            tMax = t1 < tMax ? t1 : tMax;
+            if (tMax < tMin)
+                return false;
+        }
+        return true;
+    }
+
+    inline friend Aabb surroundingBox(const Aabb& a, const Aabb& b) {
+        Aabb box = a;
+        box.expand(b);
+        return box;
+    }
+
+  private:
+    Point3<T> minimum;
+    Point3<T> maximum;
+};
+
+} // namespace raytrace
+
+#endif // AABB_H
@@ -0,0 +1,176 @@
+#ifndef ADAPTIVE_H
+#define ADAPTIVE_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+#include "Framebuffer.hpp"
+#include "TileRenderer.hpp"
+
+namespace raytrace {
+
+struct AdaptiveSettings {
+    int minSamples = 16;
+    int maxSamples = 100;
+    int samplesPerPass = 4;
+    // Standard error a pixel must reach on screen (after gamma 2, 0..1).
+    double threshold = 0.02;
+};
+
+// Renders in passes and stops sampling each pixel once the standard error
+// of its mean luminance drops below the threshold, leaving the rest of the
+// budget to noisy pixels. The variance is estimated from the per pass means,
+// so it works with any integrator.
+template <class T> class AdaptiveSampler {
+  public:
+    AdaptiveSampler(int width, int height, const AdaptiveSettings& settings)
+        : settings(settings), fb(width, height), active(size_t(width) * height, 1),
+          stats(size_t(width) * height), activeCount(size_t(width) * height) {}
+
+    bool done() const {
+        return activeCount == 0 || passSamples >= settings.maxSamples;
+    }
+
+    // Render one pass over the pixels still active.
+    void pass(TileRenderer<T>& renderer, const Hittable<T>& world,
+              const MaterialTable<T>& materials, const Camera<T>& cam) {
+        int first = passSamples;
+        int last = std::min(settings.maxSamples,
+                            first + settings.samplesPerPass);
+        renderer.setActivePixels(&active);
+        renderer.render(world, materials, cam, fb, first, last,
+                        [](const Tile&) {});
+        renderer.setActivePixels(nullptr);
+        passSamples = last;
+        update(last - first);
+    }
+
+    size_t activePixels() const { return activeCount; }
+    uint64_t totalSamples() const { return sampleTotal; }
+    int maxSamplesTaken() const { return passSamples; }
+
+    void printStats(std::ostream& out) const {
+        double pixels = double(fb.width()) * fb.height();
+        double uniform = pixels * settings.maxSamples;
+        out << "Adaptive: " << sampleTotal << " samples, "
+            << sampleTotal / pixels << " spp average, "
+            << 100.0 * sampleTotal / uniform << "% of uniform "
+            << settings.maxSamples << " spp, " << activeCount
+            << " pixels unconverged\n";
+    }
+
+    // Copy with every pixel rescaled to the same sample count, so it can be
+    // shown and written like a uniformly sampled frame.
+    Framebuffer<T> resolve() const {
+        Framebuffer<T> out(fb.width(), fb.height());
+        out.addSamples(passSamples);
+        for (int y = 0; y < fb.height(); ++y) {
+            for (int x = 0; x < fb.width(); ++x) {
+                const auto& s = stats[index(x, y)];
+                if (s.samples > 0)
+                    out.at(x, y) = fb.at(x, y) * (T(passSamples) / s.samples);
+            }
+        }
+        return out;
+    }
+
+    // Samples per pixel from blue (minimum) to red (maximum).
+    Framebuffer<T> heatmap() const {
+        Framebuffer<T> out(fb.width(), fb.height());
+        out.addSamples(1);
+        int lo = std::min(settings.minSamples, passSamples);
+        T range = std::max(1, passSamples - lo);
+        for (int y = 0; y < fb.height(); ++y) {
+            for (int x = 0; x < fb.width(); ++x) {
+                T t = clamp<T>((stats[index(x, y)].samples - lo) / range, 0, 1);
+                Color<T> c(t, T(0.2) * (1 - t), 1 - t);
+                out.at(x, y) = c * c; // Undo the gamma 2 of the output.
+            }
+        }
+        return out;
+    }
+
+  private:
+    struct PixelStats {
+        int samples = 0;
+        int batches = 0;
+        double lumSum = 0; // Luminance of the accumulated sum so far.
+        double mean = 0;   // Running mean and M2 of per pass luminance.
+        double m2 = 0;
+        double error = infinity<double>; // Estimated on screen error.
+    };
+
+    AdaptiveSettings settings;
+    Framebuffer<T> fb;
+    std::vector<uint8_t> active;
+    std::vector<PixelStats> stats;
+    size_t activeCount;
+    int passSamples = 0;
+    uint64_t sampleTotal = 0;
+
+    size_t index(int x, int y) const { return size_t(y) * fb.width() + x; }
+
+    static double luminance(const Color<T>& c) {
+        return 0.2126 * double(c.x()) + 0.7152 * double(c.y()) +
+               0.0722 * double(c.z());
+    }
+
+    void update(int k) {
+        for (int y = 0; y < fb.height(); ++y) {
+            for (int x = 0; x < fb.width(); ++x) {
+                size_t i = index(x, y);
+                if (!active[i])
+                    continue;
+
+                // Welford update with this pass's mean luminance.
+                auto& s = stats[i];
+                double lum = luminance(fb.at(x, y));
+                double batch = (lum - s.lumSum) / k;
+                s.lumSum = lum;
+                s.samples += k;
+                s.batches++;
+                sampleTotal += k;
+
+                double delta = batch - s.mean;
+                s.mean += delta / s.batches;
+                s.m2 += delta * (batch - s.mean);
+
+                // Error of the mean, taken through the gamma 2 curve.
+                if (s.samples >= settings.minSamples && s.batches >= 2) {
+                    double variance = s.m2 / (s.batches - 1);
+                    double stdErr = std::sqrt(variance / s.batches);
+                    s.error = stdErr / (2 * std::sqrt(std::max(s.mean, 1e-4)));
+                }
+            }
+        }
+
+        // A pixel stops once its whole 3x3 neighbourhood is below the
+        // threshold. Few samples easily miss rare bright paths, a neighbour
+        // that caught one keeps the pixel going.
+        for (int y = 0; y < fb.height(); ++y) {
+            for (int x = 0; x < fb.width(); ++x) {
+                size_t i = index(x, y);
+                if (!active[i])
+                    continue;
+
+                double error = 0;
+                for (int ny = std::max(0, y - 1);
+                     ny <= std::min(fb.height() - 1, y + 1); ++ny)
+                    for (int nx = std::max(0, x - 1);
+                         nx <= std::min(fb.width() - 1, x + 1); ++nx)
+                        error = std::max(error, stats[index(nx, ny)].error);
+                if (error < settings.threshold) {
+                    active[i] = 0;
+                    activeCount--;
+                }
+            }
+        }
+    }
+};
+
+} // namespace raytrace
+
+#endif // ADAPTIVE_H
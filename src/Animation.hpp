@@ -0,0 +1,200 @@
+#ifndef ANIMATION_H
+#define ANIMATION_H
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#include "Common.hpp"
+
+#include "Camera.hpp"
+#include "Hittable.hpp"
+#include "Instance.hpp"
+#include "Sphere.hpp"
+#include "Transform.hpp"
+
+namespace raytrace {
+
+// One step of a transform as a scene file lists it, kept apart so keyed
+// transforms can be blended step by step: a rotation keyed from 0 to 360
+// degrees turns all the way round instead of blending two equal matrices.
+template <class T> struct TransformStep {
+    enum Kind { Scale, Rotate, Translate, Matrix };
+
+    Kind kind;
+    T values[12]; // Scale x y z, rotate axis and degrees, translate x y z
+                  // or the matrix rows.
+
+    int size() const {
+        return kind == Matrix ? 12 : kind == Rotate ? 4 : 3;
+    }
+
+    Transform<T> transform() const {
+        Vec3<T> v(values[0], values[1], values[2]);
+        switch (kind) {
+        case Scale:
+            return Transform<T>::scale(v);
+        case Rotate:
+            return Transform<T>::rotate(v, values[3]);
+        case Translate:
+            return Transform<T>::translate(v);
+        default:
+            return Transform<T>::fromRows(values);
+        }
+    }
+};
+
+// Steps applied in order, each after the ones before it.
+template <class T>
+Transform<T> composeSteps(const std::vector<TransformStep<T>>& steps) {
+    Transform<T> t;
+    for (const auto& step : steps)
+        t = step.transform() * t;
+    return t;
+}
+
+// A transform at a frame, frames between keys blend their steps.
+template <class T> struct TransformKey {
+    T frame;
+    std::vector<TransformStep<T>> steps;
+
+    // Whether the steps of other can be blended with these.
+    bool matches(const TransformKey& other) const {
+        if (steps.size() != other.steps.size())
+            return false;
+        for (size_t i = 0; i < steps.size(); ++i)
+            if (steps[i].kind != other.steps[i].kind)
+                return false;
+        return true;
+    }
+};
+
+// Where the camera is and looks at a frame, and what it focuses on. Field
+// of view, up and aperture stay as the scene's camera sets them.
+template <class T> struct CameraKey {
+    T frame;
+    Point3<T> lookFrom;
+    Point3<T> lookAt;
+    T focusDist;
+};
+
+// Keyframed camera path and object motion over a sequence of frames. The
+// camera follows a Catmull-Rom spline through its keys, so a few keys make
+// a smooth fly-through; keyed objects blend their transform steps linearly.
+// Before the first key and after the last, things stay at that key.
+//
+// Keys move spheres and instances from where their scene file line puts
+// them. Only top level objects move, so a Bvh over them can be refit to
+// the new bounds instead of rebuilt.
+template <class T> class Animation {
+  public:
+    // A keyed object, a Sphere or an Instance.
+    struct Track {
+        std::shared_ptr<Sphere<T>> sphere;
+        Point3<T> center; // As placed, before the keys move it.
+        std::shared_ptr<Instance<T>> instance;
+        Transform<T> placement;
+        std::vector<TransformKey<T>> keys; // In frame order.
+    };
+
+    int frames = 0; // 0 for a still scene.
+    std::vector<CameraKey<T>> cameraKeys; // In frame order.
+    std::vector<Track> tracks;
+
+    bool empty() const {
+        return frames == 0 && cameraKeys.empty() && tracks.empty();
+    }
+
+    bool tracked(const Hittable<T>* object) const {
+        for (const auto& track : tracks)
+            if (track.sphere.get() == object || track.instance.get() == object)
+                return true;
+        return false;
+    }
+
+    CameraSettings<T> camera(const CameraSettings<T>& base, T frame) const {
+        CameraSettings<T> c = base;
+        if (cameraKeys.empty())
+            return c;
+
+        size_t i = segment(cameraKeys, frame);
+        size_t last = cameraKeys.size() - 1;
+        const auto& k1 = cameraKeys[i];
+        const auto& k2 = cameraKeys[std::min(i + 1, last)];
+        if (i == last || frame <= k1.frame) {
+            c.lookFrom = k1.lookFrom;
+            c.lookAt = k1.lookAt;
+            c.focusDist = k1.focusDist;
+            return c;
+        }
+        const auto& k0 = cameraKeys[i > 0 ? i - 1 : 0];
+        const auto& k3 = cameraKeys[std::min(i + 2, last)];
+        T u = std::min<T>(1, (frame - k1.frame) / (k2.frame - k1.frame));
+        c.lookFrom = catmullRom(k0.lookFrom, k1.lookFrom, k2.lookFrom,
+                                k3.lookFrom, u);
+        c.lookAt =
+            catmullRom(k0.lookAt, k1.lookAt, k2.lookAt, k3.lookAt, u);
+        c.focusDist = k1.focusDist + (k2.focusDist - k1.focusDist) * u;
+        return c;
+    }
+
+    // The keyed part of a track's transform at frame.
+    static Transform<T> motion(const Track& track, T frame) {
+        if (track.keys.empty())
+            return Transform<T>();
+        size_t i = segment(track.keys, frame);
+        const auto& a = track.keys[i];
+        if (i + 1 == track.keys.size() || frame <= a.frame)
+            return composeSteps(a.steps);
+
+        const auto& b = track.keys[i + 1];
+        T u = std::min<T>(1, (frame - a.frame) / (b.frame - a.frame));
+        std::vector<TransformStep<T>> steps = a.steps;
+        for (size_t s = 0; s < steps.size(); ++s)
+            for (int j = 0; j < steps[s].size(); ++j)
+                steps[s].values[j] +=
+                    (b.steps[s].values[j] - a.steps[s].values[j]) * u;
+        return composeSteps(steps);
+    }
+
+    // Move every keyed object to where it is at frame. Not safe while a
+    // frame is rendering. Spheres also get the motion that takes them to
+    // the next frame, for a camera shutter to blur. Returns the number of
+    // objects moved.
+    size_t apply(T frame) const {
+        for (const auto& track : tracks) {
+            Transform<T> m = motion(track, frame);
+            if (track.sphere) {
+                Point3<T> center = m.point(track.center);
+                track.sphere->setCenter(center);
+                track.sphere->setMotion(
+                    motion(track, frame + 1).point(track.center) - center);
+            } else
+                track.instance->setTransform(m * track.placement);
+        }
+        return tracks.size();
+    }
+
+  private:
+    // Index of the last key at or before frame, 0 before the first.
+    template <class Key>
+    static size_t segment(const std::vector<Key>& keys, T frame) {
+        size_t i = 0;
+        while (i + 1 < keys.size() && keys[i + 1].frame <= frame)
+            ++i;
+        return i;
+    }
+
+    static Point3<T> catmullRom(const Point3<T>& p0, const Point3<T>& p1,
+                                const Point3<T>& p2, const Point3<T>& p3,
+                                T u) {
+        T u2 = u * u, u3 = u2 * u;
+        return T(0.5) * (2 * p1 + (p2 - p0) * u +
+                         (2 * p0 - 5 * p1 + 4 * p2 - p3) * u2 +
+                         (3 * p1 - p0 - 3 * p2 + p3) * u3);
+    }
+};
+
+} // namespace raytrace
+
+#endif // ANIMATION_H
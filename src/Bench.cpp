@@ -0,0 +1,992 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+#include "Common.hpp"
+
+#include "Bench.hpp"
+#include "Bvh.hpp"
+#include "DisplayBuffer.hpp"
+#include "Framebuffer.hpp"
+#include "Instance.hpp"
+#include "Material.hpp"
+#include "Resolve.hpp"
+#include "Sampling.hpp"
+#include "Scenes.hpp"
+#include "Simd.hpp"
+#include "Sphere.hpp"
+#include "ThreadPool.hpp"
+#include "TileRenderer.hpp"
+
+using namespace raytrace;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double secondsSince(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// Bytes of the process resident in memory, 0 where that is not known.
+// Linux gives the current resident set; other systems only the peak, so a
+// change in it is a lower bound.
+size_t residentBytes() {
+#if defined(__linux__)
+    std::ifstream statm("/proc/self/statm");
+    size_t pages = 0, resident = 0;
+    if (!(statm >> pages >> resident))
+        return 0;
+    return resident * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+#elif defined(__unix__) || defined(__APPLE__)
+    rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+#if defined(__APPLE__)
+    return static_cast<size_t>(usage.ru_maxrss); // Bytes on macOS.
+#else
+    return static_cast<size_t>(usage.ru_maxrss) * 1024;
+#endif
+#else
+    return 0;
+#endif
+}
+
+struct BenchOptions {
+    int repetitions = 5;
+    unsigned threads = 0; // Most threads for render and scaling runs.
+    int width = 384;
+    int samplesPerPixel = 4;
+    bool quick = false; // Skip the 1M sphere scene.
+    std::string json;
+    SimdLevel simd = detectSimd();
+    IntegratorKind integrator = IntegratorKind::Path;
+
+    bool parse(int argc, char** argv) {
+        for (int i = 1; i < argc; ++i) {
+            std::string arg = argv[i];
+            auto value = [&]() -> std::string {
+                return i + 1 < argc ? argv[++i] : "";
+            };
+
+            if (arg == "--reps") {
+                repetitions = std::max(1, std::atoi(value().c_str()));
+            } else if (arg == "--threads") {
+                threads = static_cast<unsigned>(std::atoi(value().c_str()));
+            } else if (arg == "--width") {
+                width = std::max(16, std::atoi(value().c_str()));
+            } else if (arg == "--spp") {
+                samplesPerPixel = std::max(1, std::atoi(value().c_str()));
+            } else if (arg == "--quick") {
+                quick = true;
+            } else if (arg == "--json") {
+                json = value();
+            } else if (arg == "--simd") {
+                std::string level = value();
+                if (level == "scalar")
+                    simd = SimdLevel::Scalar;
+                else if (level == "sse")
+                    simd = SimdLevel::Sse;
+                else if (level != "avx2")
+                    return usage(argv[0]);
+            } else if (arg == "--integrator") {
+                std::string kind = value();
+                if (kind == "recursive")
+                    integrator = IntegratorKind::Recursive;
+                else if (kind == "wavefront")
+                    integrator = IntegratorKind::Wavefront;
+                else if (kind != "path")
+                    return usage(argv[0]);
+            } else {
+                return usage(argv[0]);
+            }
+        }
+        return true;
+    }
+
+    bool usage(const char* program) const {
+        std::cerr << "Usage: " << program << " [options]\n"
+                  << "  --reps N           timed repetitions (default 5)\n"
+                  << "  --threads N        most threads to use (default: cores)\n"
+                  << "  --width N          render width (default 384)\n"
+                  << "  --spp N            render samples per pixel (default 4)\n"
+                  << "  --quick            skip the 1M sphere scene\n"
+                  << "  --json FILE        write the results as JSON\n"
+                  << "  --simd LEVEL       scalar, sse or avx2\n"
+                  << "  --integrator KIND  path, recursive or wavefront\n";
+        return false;
+    }
+};
+
+// Camera rays through random points of the image, from a fixed seed.
+template <class T>
+std::vector<Ray<T>> cameraRays(const Camera<T>& cam, size_t count,
+                               uint64_t seed) {
+    threadRng().seed(mix64(seed), mix64(count));
+    std::vector<Ray<T>> rays;
+    rays.reserve(count);
+    for (size_t i = 0; i < count; ++i)
+        rays.push_back(cam.getRay(randomReal<T>(), randomReal<T>()));
+    return rays;
+}
+
+// Rays from a shell around the unit sphere aimed near it, about half hit.
+template <class T> std::vector<Ray<T>> sphereRays(size_t count, uint64_t seed) {
+    threadRng().seed(mix64(seed), mix64(count));
+    std::vector<Ray<T>> rays;
+    rays.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+        Point3<T> origin = 5 * sampleUniformSphere(randomSample2<T>());
+        Point3<T> target = Vec3<T>::random(-1.5, 1.5);
+        rays.emplace_back(origin, target - origin);
+    }
+    return rays;
+}
+
+// The rejection sampling Sampling.hpp replaced: points of the enclosing
+// square or cube are drawn until one falls inside.
+template <class T> Vec3<T> rejectionDisk() {
+    while (true) {
+        Vec3<T> p(randomReal<T>(-1, 1), randomReal<T>(-1, 1), 0);
+        if (p.lengthSquared() < 1)
+            return p;
+    }
+}
+
+template <class T> Vec3<T> rejectionBall() {
+    while (true) {
+        Vec3<T> p = Vec3<T>::random(-1, 1);
+        if (p.lengthSquared() < 1)
+            return p;
+    }
+}
+
+// Pearson's chi-square of count draws of sample() over bins equally likely
+// bins, bin(v) telling which one v falls in. About bins - 1 if the draws
+// follow the distribution the bins were cut for; over 1.6 times that is
+// unlikely at 64 bins.
+template <class Sample, class Bin>
+double chiSquare(Sample sample, Bin bin, size_t bins, size_t count) {
+    std::vector<size_t> counts(bins);
+    for (size_t i = 0; i < count; ++i)
+        counts[std::min(bins - 1, bin(sample()))]++;
+    double expected = double(count) / bins, sum = 0;
+    for (size_t c : counts)
+        sum += (c - expected) * (c - expected) / expected;
+    return sum;
+}
+
+// 8 x 8 bins equally likely for a distribution uniform in a and b in [0, 1).
+inline size_t grid8(double a, double b) {
+    auto cell = [](double x) {
+        return size_t(std::min(7.0, std::max(0.0, x * 8)));
+    };
+    return cell(a) * 8 + cell(b);
+}
+
+inline double turn(double y, double x) {
+    return std::atan2(y, x) / (2 * pi<double>) + 0.5;
+}
+
+// Equal area bins of the unit disk by r^2 and angle, the unit sphere by z
+// and angle, the unit ball by r^3 and z, and the cosine weighted
+// hemisphere about +z by z^2 and angle.
+inline size_t diskBin(const Vec3<real>& v) {
+    double x = v.x(), y = v.y();
+    return grid8(x * x + y * y, turn(y, x));
+}
+
+inline size_t sphereBin(const Vec3<real>& v) {
+    return grid8((1 - double(v.z())) / 2, turn(v.y(), v.x()));
+}
+
+inline size_t ballBin(const Vec3<real>& v) {
+    double r = v.length(), z = v.z();
+    return grid8(r * r * r, r > 0 ? (1 - z / r) / 2 : 0);
+}
+
+inline size_t hemisphereBin(const Vec3<real>& v) {
+    double z = v.z();
+    return grid8(z * z, turn(v.y(), v.x()));
+}
+
+// Throughput of a warp, and its distribution against bin's.
+template <class Sample, class Bin>
+BenchResult benchSampling(const std::string& name, Sample sample, Bin bin,
+                          uint64_t seed, const BenchOptions& options) {
+    const size_t count = size_t(1) << 20;
+    BenchResult result;
+    result.name = name;
+    result.group = "sampling";
+    result.unit = "sample";
+
+    threadRng().seed(mix64(seed), mix64(count));
+    std::vector<double> msamples, ns;
+    real sum = 0;
+    for (int rep = -1; rep < options.repetitions; ++rep) {
+        auto start = Clock::now();
+        for (size_t i = 0; i < count; ++i) {
+            Vec3<real> v = sample();
+            sum += v.x() + v.y() + v.z();
+        }
+        double seconds = secondsSince(start);
+        if (rep >= 0) {
+            msamples.push_back(count / seconds * 1e-6);
+            ns.push_back(seconds * 1e9 / count);
+        }
+    }
+    if (!std::isfinite(sum))
+        std::cerr << name << ": samples are not finite\n";
+
+    result.mitemsPerSec = BenchStats::of(msamples);
+    result.nsPerItem = BenchStats::of(ns);
+    result.chiSquare = chiSquare(sample, bin, 64, count);
+    return result;
+}
+
+// m.scatter() as a function, for benchScatter.
+template <class M> auto scatterOf(const M& m) {
+    return [&m](const Ray<real>& rIn, const HitRecord<real>& rec,
+                Color<real>& attenuation, Ray<real>& scattered) {
+        return m.scatter(rIn, rec, attenuation, scattered);
+    };
+}
+
+// Throughput of scatter(rIn, rec, attenuation, scattered) at hits facing
+// every way. For diffuse scatters
+// the cosine to the normal is checked to be cosine distributed, by cos^2
+// in 64 equal bins.
+template <class Scatter>
+BenchResult benchScatter(const std::string& name, Scatter scatter,
+                         bool diffuse, uint64_t seed,
+                         const BenchOptions& options) {
+    const size_t count = size_t(1) << 20;
+    const size_t hitCount = 1024;
+    BenchResult result;
+    result.name = name;
+    result.group = "sampling";
+    result.unit = "scatter";
+
+    threadRng().seed(mix64(seed), mix64(count));
+    std::vector<Ray<real>> rays;
+    std::vector<HitRecord<real>> hits(hitCount);
+    for (auto& rec : hits) {
+        Vec3<real> normal = sampleUniformSphere(randomSample2<real>());
+        Vec3<real> in = sampleUniformSphere(randomSample2<real>());
+        rays.emplace_back(Point3<real>(0, 0, 0) - in, in);
+        rec.p = Point3<real>(0, 0, 0);
+        rec.mat = 0;
+        rec.t = 1;
+        rec.setFaceNormal(rays.back(), normal);
+    }
+
+    std::vector<double> mscatters, ns;
+    real sum = 0;
+    for (int rep = -1; rep < options.repetitions; ++rep) {
+        auto start = Clock::now();
+        for (size_t i = 0; i < count; ++i) {
+            size_t h = i % hitCount;
+            Color<real> attenuation;
+            Ray<real> scattered;
+            if (scatter(rays[h], hits[h], attenuation, scattered))
+                sum += scattered.direction().x();
+        }
+        double seconds = secondsSince(start);
+        if (rep >= 0) {
+            mscatters.push_back(count / seconds * 1e-6);
+            ns.push_back(seconds * 1e9 / count);
+        }
+    }
+    if (!std::isfinite(sum))
+        std::cerr << name << ": directions are not finite\n";
+
+    result.mitemsPerSec = BenchStats::of(mscatters);
+    result.nsPerItem = BenchStats::of(ns);
+    if (diffuse) {
+        size_t i = 0;
+        auto cosine = [&] {
+            size_t h = i++ % hitCount;
+            Color<real> attenuation;
+            Ray<real> scattered;
+            scatter(rays[h], hits[h], attenuation, scattered);
+            return dot(unit(scattered.direction()), hits[h].normal);
+        };
+        auto bin = [](real c) { return size_t(double(c) * double(c) * 64); };
+        result.chiSquare = chiSquare(cosine, bin, 64, count);
+    }
+    return result;
+}
+
+// Closest hit queries only, on the calling thread.
+template <class T>
+BenchResult benchKernel(const std::string& name, const std::string& scene,
+                        size_t objects, const Hittable<T>& world,
+                        const std::vector<Ray<T>>& rays,
+                        const BenchOptions& options) {
+    BenchResult result;
+    result.name = name;
+    result.group = "kernel";
+    result.scene = scene;
+    result.objects = objects;
+
+    std::vector<double> mrays, ns;
+    size_t hits = 0;
+    for (int rep = -1; rep < options.repetitions; ++rep) {
+        HitRecord<T> rec;
+        auto start = Clock::now();
+        for (const auto& r : rays)
+            hits += world.hit(r, T(0.001), infinity<T>, rec);
+        double seconds = secondsSince(start);
+
+        // The first run warms the caches and is not counted.
+        if (rep >= 0) {
+            mrays.push_back(rays.size() / seconds * 1e-6);
+            ns.push_back(seconds * 1e9 / rays.size());
+        }
+    }
+    if (hits == 0)
+        std::cerr << name << ": no ray hit anything\n";
+
+    result.mitemsPerSec = BenchStats::of(mrays);
+    result.nsPerItem = BenchStats::of(ns);
+    return result;
+}
+
+// Full path tracing of the scene through the tile renderer. With
+// displayFps the tiles are also converted into a display buffer, which
+// another thread takes from that often as the window's presenter does,
+// minus the SDL calls.
+template <class T>
+BenchResult benchRender(const std::string& name, const std::string& group,
+                        const std::string& scene, size_t objects,
+                        const Hittable<T>& world,
+                        const MaterialTable<T>& materials,
+                        const Camera<T>& cam, unsigned threads,
+                        const BenchOptions& options, double displayFps = 0) {
+    RenderSettings settings;
+    settings.width = options.width;
+    settings.height = options.width * 9 / 16;
+    settings.samplesPerPixel = options.samplesPerPixel;
+    settings.maxDepth = 50;
+    settings.tileSize = 32;
+    settings.integrator = options.integrator;
+
+    BenchResult result;
+    result.name = name;
+    result.group = group;
+    result.scene = scene;
+    result.objects = objects;
+    result.threads = threads;
+    result.width = settings.width;
+    result.height = settings.height;
+    result.samplesPerPixel = settings.samplesPerPixel;
+
+    ThreadPool pool(threads);
+    TileRenderer<T> renderer(pool, settings);
+    double samples =
+        double(settings.width) * settings.height * settings.samplesPerPixel;
+
+    std::vector<double> mrays, ns, samplesPerSec;
+    for (int rep = -1; rep < options.repetitions; ++rep) {
+        Framebuffer<T> fb(settings.width, settings.height);
+        DisplayBuffer display(settings.width, settings.height);
+        std::atomic<bool> finished{false};
+        std::thread presenter;
+        if (displayFps > 0)
+            presenter = std::thread([&] {
+                std::vector<uint32_t> texture(fb.width() * size_t(fb.height()));
+                auto period = std::chrono::duration<double>(1 / displayFps);
+                while (!finished) {
+                    DisplayRect rect;
+                    if (display.swap(rect))
+                        for (int y = rect.y0; y < rect.y1; ++y)
+                            std::copy_n(display.frontRow(y) + rect.x0,
+                                        rect.width(),
+                                        &texture[size_t(y) * fb.width() +
+                                                 rect.x0]);
+                    std::this_thread::sleep_for(period);
+                }
+            });
+        renderer.resetStats();
+        renderer.render(world, materials, cam, fb, 0,
+                        settings.samplesPerPixel, [&](const Tile& tile) {
+                            if (displayFps > 0)
+                                display.update(fb, tile.x0, tile.y0, tile.x1,
+                                               tile.y1,
+                                               settings.samplesPerPixel);
+                        });
+        finished = true;
+        if (presenter.joinable())
+            presenter.join();
+        double seconds = renderer.seconds();
+        double rays = static_cast<double>(renderer.rays());
+
+        if (rep >= 0) {
+            mrays.push_back(rays / seconds * 1e-6);
+            ns.push_back(seconds * 1e9 / rays);
+            samplesPerSec.push_back(samples / seconds);
+        }
+    }
+
+    result.mitemsPerSec = BenchStats::of(mrays);
+    result.nsPerItem = BenchStats::of(ns);
+    result.samplesPerSec = BenchStats::of(samplesPerSec);
+    return result;
+}
+
+// Root mean square difference of two images as displayed, gamma 2 of
+// the clamped average, over every pixel's channels.
+template <class T>
+double displayRmse(const Framebuffer<T>& a, const Framebuffer<T>& b) {
+    auto display = [](T sum, int samples) {
+        double v = double(sum) / samples;
+        return std::sqrt(std::min(std::max(v, 0.0), 1.0));
+    };
+    double squares = 0;
+    for (int y = 0; y < a.height(); ++y)
+        for (int x = 0; x < a.width(); ++x)
+            for (int c = 0; c < 3; ++c) {
+                double e = display(a.at(x, y)[c], a.samples()) -
+                           display(b.at(x, y)[c], b.samples());
+                squares += e * e;
+            }
+    return std::sqrt(squares / (3 * double(a.width()) * a.height()));
+}
+
+// Error against a reference as samples double, for each sampler. The
+// reference is a sobol render of referenceSpp on another frame's seeds,
+// so the random sampler's numbers are independent of it. Each sampler
+// adds samples to one framebuffer and is measured at every power of two;
+// throughput is over all its samples so far.
+template <class T>
+void benchConvergence(const Hittable<T>& world,
+                      const MaterialTable<T>& materials, const Camera<T>& cam,
+                      size_t objects, unsigned threads,
+                      const BenchOptions& options, BenchReport& report,
+                      std::ostream& out) {
+    const int referenceSpp = 256, maxSpp = 32;
+    RenderSettings settings;
+    settings.width = std::max(16, options.width / 2);
+    settings.height = settings.width * 9 / 16;
+    settings.maxDepth = 50;
+    settings.tileSize = 32;
+    settings.integrator = options.integrator;
+    ThreadPool pool(threads);
+
+    settings.sampler = SamplerKind::Sobol;
+    settings.frame = 1;
+    Framebuffer<T> reference(settings.width, settings.height);
+    TileRenderer<T>(pool, settings)
+        .render(world, materials, cam, reference, 0, referenceSpp,
+                [](const Tile&) {});
+    reference.addSamples(referenceSpp);
+    settings.frame = 0;
+    BlueNoise::instance(); // Built on first use, not in the timings.
+
+    std::vector<double> randomRmse;
+    for (SamplerKind kind : {SamplerKind::Random, SamplerKind::Sobol,
+                             SamplerKind::BlueNoise}) {
+        settings.sampler = kind;
+        TileRenderer<T> renderer(pool, settings);
+        Framebuffer<T> fb(settings.width, settings.height);
+        for (int spp = 1, step = 0; spp <= maxSpp; spp *= 2, ++step) {
+            renderer.render(world, materials, cam, fb, fb.samples(), spp,
+                            [](const Tile&) {});
+            fb.addSamples(spp - fb.samples());
+            double seconds = renderer.seconds();
+            double rays = static_cast<double>(renderer.rays());
+            double samples = double(settings.width) * settings.height * spp;
+
+            BenchResult result;
+            result.name = std::string("convergence/") + samplerName(kind) +
+                          "/spp" + std::to_string(spp);
+            result.group = "convergence";
+            result.scene = "random";
+            result.objects = objects;
+            result.threads = threads;
+            result.width = settings.width;
+            result.height = settings.height;
+            result.samplesPerPixel = spp;
+            result.mitemsPerSec = BenchStats::of({rays / seconds * 1e-6});
+            result.nsPerItem = BenchStats::of({seconds * 1e9 / rays});
+            result.samplesPerSec = BenchStats::of({samples / seconds});
+            result.rmse = displayRmse(fb, reference);
+            if (kind == SamplerKind::Random)
+                randomRmse.push_back(result.rmse);
+            double ratio = randomRmse[size_t(step)] / result.rmse;
+            result.samplesSaved = ratio * ratio;
+            report.add(result, out);
+        }
+    }
+}
+
+// A frame of pixels converted to RGBA8 by convert().
+template <class F>
+BenchResult benchResolve(const std::string& name, unsigned threads,
+                         size_t pixels, F convert,
+                         const BenchOptions& options) {
+    BenchResult result;
+    result.name = name;
+    result.group = "resolve";
+    result.unit = "pixel";
+    result.threads = threads;
+
+    std::vector<double> mpixels, ns;
+    for (int rep = -1; rep < options.repetitions; ++rep) {
+        auto start = Clock::now();
+        convert();
+        double seconds = secondsSince(start);
+        if (rep >= 0) {
+            mpixels.push_back(pixels / seconds * 1e-6);
+            ns.push_back(seconds * 1e9 / pixels);
+        }
+    }
+    result.mitemsPerSec = BenchStats::of(mpixels);
+    result.nsPerItem = BenchStats::of(ns);
+    return result;
+}
+
+// Thread counts for the scaling runs: powers of two up to max, then max.
+std::vector<unsigned> threadCounts(unsigned max) {
+    std::vector<unsigned> counts;
+    for (unsigned n = 1; n < max; n *= 2)
+        counts.push_back(n);
+    counts.push_back(max);
+    return counts;
+}
+
+} // namespace
+
+// Fixed, seeded scenes rendered headless, for comparing commits.
+int main(int argc, char** argv) {
+    BenchOptions options;
+    if (!options.parse(argc, argv))
+        return 1;
+    setSimd(options.simd);
+
+    unsigned maxThreads = options.threads;
+    if (maxThreads == 0)
+        maxThreads = std::max(1u, std::thread::hardware_concurrency());
+    const real aspectRatio = real(16) / 9;
+    const uint64_t seed = 2021;
+    std::ostream& out = std::cout;
+
+    BenchReport report;
+    report.setInfo("benchmark", "raytrace_bench");
+    report.setInfo("precision", sizeof(real) == 4 ? "float" : "double");
+    report.setInfo("simd", simdName(activeSimd()));
+    report.setInfo("integrator", integratorName(options.integrator));
+#ifdef NDEBUG
+    report.setInfo("build", "release");
+#else
+    report.setInfo("build", "debug");
+#endif
+    report.setInfo("repetitions", std::to_string(options.repetitions));
+    report.setInfo("max_threads", std::to_string(maxThreads));
+
+    // A single sphere, the innermost kernel.
+    {
+        Sphere<real> sphere(Point3<real>(0, 0, 0), 1, 0);
+        auto rays = sphereRays<real>(size_t(1) << 20, seed);
+        report.add(benchKernel("kernel/sphere.hit", "sphere", 1, sphere, rays,
+                               options),
+                   out);
+    }
+
+    // The closed form warps of Sampling.hpp and the scatters drawing from
+    // them, against the rejection sampling they replaced.
+    {
+        auto result = benchSampling("sampling/disk/rejection",
+                                    rejectionDisk<real>, diskBin, seed,
+                                    options);
+        double rejection = result.mitemsPerSec.mean;
+        report.add(result, out);
+        result = benchSampling(
+            "sampling/disk/concentric",
+            [] { return sampleConcentricDisk(randomSample2<real>()); },
+            diskBin, seed, options);
+        result.overRejection = result.mitemsPerSec.mean / rejection;
+        report.add(result, out);
+
+        result = benchSampling(
+            "sampling/sphere/rejection",
+            [] { return unit(rejectionBall<real>()); }, sphereBin, seed,
+            options);
+        rejection = result.mitemsPerSec.mean;
+        report.add(result, out);
+        result = benchSampling(
+            "sampling/sphere/closed",
+            [] { return sampleUniformSphere(randomSample2<real>()); },
+            sphereBin, seed, options);
+        result.overRejection = result.mitemsPerSec.mean / rejection;
+        report.add(result, out);
+
+        result = benchSampling("sampling/ball/rejection", rejectionBall<real>,
+                               ballBin, seed, options);
+        rejection = result.mitemsPerSec.mean;
+        report.add(result, out);
+        result = benchSampling(
+            "sampling/ball/closed",
+            [] {
+                Vec2<real> u = randomSample2<real>();
+                return sampleUniformBall(u, randomReal<real>());
+            },
+            ballBin, seed, options);
+        result.overRejection = result.mitemsPerSec.mean / rejection;
+        report.add(result, out);
+
+        // The old diffuse direction, the normal plus a unit vector.
+        const Vec3<real> up(0, 0, 1);
+        result = benchSampling(
+            "sampling/hemisphere/rejection",
+            [&] { return unit(up + unit(rejectionBall<real>())); },
+            hemisphereBin, seed, options);
+        rejection = result.mitemsPerSec.mean;
+        report.add(result, out);
+        result = benchSampling(
+            "sampling/hemisphere/cosine",
+            [] { return sampleCosineHemisphere(randomSample2<real>()); },
+            hemisphereBin, seed, options);
+        result.overRejection = result.mitemsPerSec.mean / rejection;
+        report.add(result, out);
+
+        // Materials by their own class, as the rejection versions are, and
+        // not through Material's dispatch.
+        Lambertian<real> lambertian(Color<real>(0.5, 0.5, 0.5));
+        result = benchScatter(
+            "scatter/lambertian/rejection",
+            [&](const Ray<real>& rIn, const HitRecord<real>& rec,
+                Color<real>& attenuation, Ray<real>& scattered) {
+                Vec3<real> direction = rec.normal + unit(rejectionBall<real>());
+                if (direction.nearZero())
+                    direction = rec.normal;
+                scattered = Ray<real>(rec.p, direction, rIn.time());
+                attenuation = lambertian.getAlbedo();
+                return true;
+            },
+            true, seed, options);
+        rejection = result.mitemsPerSec.mean;
+        report.add(result, out);
+        result = benchScatter("scatter/lambertian", scatterOf(lambertian),
+                              true, seed, options);
+        result.overRejection = result.mitemsPerSec.mean / rejection;
+        report.add(result, out);
+
+        Metal<real> metal(Color<real>(0.7, 0.6, 0.5), 0.3);
+        result = benchScatter(
+            "scatter/metal/rejection",
+            [&](const Ray<real>& rIn, const HitRecord<real>& rec,
+                Color<real>& attenuation, Ray<real>& scattered) {
+                Vec3<real> reflected =
+                    reflect(unit(rIn.direction()), rec.normal);
+                scattered = Ray<real>(rec.p,
+                                      reflected + real(0.3) *
+                                                      rejectionBall<real>(),
+                                      rIn.time());
+                attenuation = metal.getAlbedo();
+                return dot(scattered.direction(), rec.normal) > 0;
+            },
+            false, seed, options);
+        rejection = result.mitemsPerSec.mean;
+        report.add(result, out);
+        result = benchScatter("scatter/metal", scatterOf(metal), false, seed,
+                              options);
+        result.overRejection = result.mitemsPerSec.mean / rejection;
+        report.add(result, out);
+
+        Dielectric<real> glass(1.5);
+        report.add(benchScatter("scatter/dielectric", scatterOf(glass), false,
+                                seed, options),
+                   out);
+    }
+
+    // Sums of a 4K frame resolved to RGBA8 for display or 8 bit files, in
+    // Mpixels/s, against convertRGBA a pixel at a time or one thread. Every
+    // kernel must give convertRGBA's bytes for gamma 2 and the curve's,
+    // evaluated directly, for the others.
+    bool resolveMismatch = false;
+    {
+        const int w = 3840, h = 2160, spp = 16;
+        const size_t pixels = size_t(w) * h;
+        Framebuffer<real> fb(w, h);
+        fb.addSamples(spp);
+        Pcg32 rng(seed, 7);
+        // Mostly dark, some past white, as renders are.
+        auto sum = [&] {
+            real u = rng.uniform<real>();
+            return u * u * real(2 * spp);
+        };
+        for (int y = 0; y < h; ++y)
+            for (int x = 0; x < w; ++x)
+                fb.at(x, y) = Color<real>(sum(), sum(), sum());
+
+        std::vector<uint32_t> expected(pixels), image(pixels);
+        auto check = [&](const std::string& name) {
+            if (image != expected) {
+                std::cerr << name << ": bytes differ from the reference\n";
+                resolveMismatch = true;
+            }
+        };
+        auto convert = [&] {
+            for (int y = 0; y < h; ++y)
+                for (int x = 0; x < w; ++x)
+                    expected[size_t(h - 1 - y) * w + x] =
+                        convertRGBA(fb.at(x, y), spp);
+        };
+        auto base = benchResolve("resolve/gamma2/convert", 1, pixels,
+                                 convert, options);
+        report.add(base, out);
+
+        std::vector<SimdLevel> levels = {SimdLevel::Scalar};
+        if (detectSimd() >= SimdLevel::Sse)
+            levels.push_back(SimdLevel::Sse);
+        if (detectSimd() >= SimdLevel::Avx2)
+            levels.push_back(SimdLevel::Avx2);
+        std::vector<std::pair<ToneMap, std::string>> curves = {
+            {ToneMap::Gamma2, "gamma2"},
+            {ToneMap::Srgb, "srgb"},
+            {ToneMap::Filmic, "filmic"}};
+        for (const auto& curve : curves) {
+            ResolveSettings settings;
+            settings.toneMap = curve.first;
+            Resolver resolver(settings);
+            if (curve.first != ToneMap::Gamma2) {
+                real scale = real(1) / real(spp);
+                for (int y = 0; y < h; ++y)
+                    for (int x = 0; x < w; ++x) {
+                        uint32_t c = 0;
+                        for (int i = 0; i < 3; ++i)
+                            c = c << 8 | resolver.curveByte(static_cast<float>(
+                                             scale * fb.at(x, y)[i]));
+                        expected[size_t(h - 1 - y) * w + x] = c << 8;
+                    }
+            }
+            for (SimdLevel level : levels) {
+                // No SSE kernel for the tables.
+                if (level == SimdLevel::Sse &&
+                    curve.first != ToneMap::Gamma2)
+                    continue;
+                std::string name =
+                    "resolve/" + curve.second + "/" + simdName(level);
+                setSimd(level);
+                auto result = benchResolve(
+                    name, 1, pixels,
+                    [&] { resolver.frame(fb, image.data()); }, options);
+                result.overConvert = result.mitemsPerSec.mean /
+                                     base.mitemsPerSec.mean;
+                report.add(result, out);
+                check(name);
+            }
+            setSimd(options.simd);
+        }
+
+        Resolver gamma2;
+        convert();
+        double single = 0;
+        for (unsigned n : threadCounts(maxThreads)) {
+            ThreadPool pool(n);
+            std::string name = "resolve/gamma2/t" + std::to_string(n);
+            auto result = benchResolve(
+                name, n, pixels,
+                [&] { gamma2.frame(fb, image.data(), &pool); }, options);
+            if (n == 1)
+                single = result.mitemsPerSec.mean;
+            result.overOneThread = result.mitemsPerSec.mean / single;
+            report.add(result, out);
+            check(name);
+        }
+    }
+
+    // The final scene of the book, also used for thread scaling and
+    // against double precision.
+    double floatKernel = 0, floatRender = 0;
+    {
+        auto start = Clock::now();
+        threadRng() = Pcg32(); // randomScene draws from the default stream.
+        auto scene = randomScene<real>();
+        Bvh<real> world(scene.objects);
+        double setupMs = secondsSince(start) * 1e3;
+        size_t objects = scene.objects.getObjects().size();
+        auto cam = randomSceneCamera<real>(aspectRatio);
+
+        auto rays = cameraRays(cam, size_t(1) << 16, seed);
+        report.add(benchKernel("kernel/list.hit/random", "random", objects,
+                               scene.objects, rays, options),
+                   out);
+        auto result = benchKernel("kernel/bvh.hit/random", "random", objects,
+                                  world, rays, options);
+        result.setupMs = setupMs;
+        floatKernel = result.mitemsPerSec.mean;
+        report.add(result, out);
+
+        result = benchRender("render/random", "render", "random", objects,
+                             world, scene.materials, cam, maxThreads, options);
+        result.setupMs = setupMs;
+        floatRender = result.mitemsPerSec.mean;
+        report.add(result, out);
+
+        // Against the headless render above, what showing it costs.
+        result = benchRender("display/random", "display", "random", objects,
+                             world, scene.materials, cam, maxThreads, options,
+                             30);
+        result.overHeadless = result.mitemsPerSec.mean / floatRender;
+        report.add(result, out);
+
+        double single = 0;
+        for (unsigned n : threadCounts(maxThreads)) {
+            result = benchRender("scaling/random/t" + std::to_string(n),
+                                 "scaling", "random", objects, world,
+                                 scene.materials, cam, n, options);
+            if (n == 1)
+                single = result.mitemsPerSec.mean;
+            result.overOneThread = result.mitemsPerSec.mean / single;
+            report.add(result, out);
+        }
+
+        benchConvergence(world, scene.materials, cam, objects, maxThreads,
+                         options, report, out);
+    }
+
+    // The same scene, rays and image in double, against float.
+    {
+        auto start = Clock::now();
+        threadRng() = Pcg32();
+        auto scene = randomScene<double>();
+        Bvh<double> world(scene.objects);
+        double setupMs = secondsSince(start) * 1e3;
+        size_t objects = scene.objects.getObjects().size();
+        auto cam = randomSceneCamera<double>(double(aspectRatio));
+
+        auto rays = cameraRays(cam, size_t(1) << 16, seed);
+        auto kernel = benchKernel("double/bvh.hit/random", "random",
+                                  objects, world, rays, options);
+        kernel.group = "precision";
+        kernel.setupMs = setupMs;
+        kernel.floatOverDouble = floatKernel / kernel.mitemsPerSec.mean;
+        report.add(kernel, out);
+
+        auto render = benchRender("double/render/random",
+                                  "precision", "random", objects, world,
+                                  scene.materials, cam, maxThreads, options);
+        render.setupMs = setupMs;
+        render.floatOverDouble = floatRender / render.mitemsPerSec.mean;
+        report.add(render, out);
+    }
+
+    // Larger sphere fields, where the acceleration structure dominates.
+    std::vector<std::pair<std::string, size_t>> fields = {{"field10k", 10000}};
+    if (!options.quick)
+        fields.emplace_back("field1M", 1000000);
+    for (const auto& field : fields) {
+        const std::string& name = field.first;
+        size_t count = field.second;
+        auto cam = sphereFieldCamera<real>(count, aspectRatio);
+        auto rays = cameraRays(cam, size_t(1) << 16, seed);
+
+        auto start = Clock::now();
+        auto scene = sphereFieldScene<real>(count, seed);
+        Bvh<real> world(scene.objects);
+        double setupMs = secondsSince(start) * 1e3;
+        size_t objects = scene.objects.getObjects().size();
+
+        // A linear scan of 1M spheres per ray would take minutes.
+        if (count <= 10000) {
+            auto few = std::vector<Ray<real>>(rays.begin(), rays.begin() + 1024);
+            report.add(benchKernel("kernel/list.hit/" + name, name, objects,
+                                   scene.objects, few, options),
+                       out);
+        }
+        auto result = benchKernel("kernel/bvh.hit/" + name, name, objects,
+                                  world, rays, options);
+        result.setupMs = setupMs;
+        report.add(result, out);
+
+        start = Clock::now();
+        auto packed = sphereFieldScene<real>(count, seed, true);
+        result = benchKernel("kernel/packed.hit/" + name, name, count + 1,
+                             packed.objects, rays, options);
+        result.setupMs = secondsSince(start) * 1e3;
+        report.add(result, out);
+
+        result = benchRender("render/" + name, "render", name, objects, world,
+                             scene.materials, cam, maxThreads, options);
+        result.setupMs = setupMs;
+        report.add(result, out);
+    }
+
+    // Copies of one torus mesh, a two level hierarchy: the scene Bvh over
+    // the instances and the mesh's own BVH below.
+    {
+        const size_t count = 100000;
+        const std::string name = "instances100k";
+        auto cam = sphereFieldCamera<real>(count, aspectRatio);
+        auto rays = cameraRays(cam, size_t(1) << 16, seed);
+
+        // Measured as the resident set grows over the build, so it counts
+        // the BVH and the allocator's overhead too. Memory freed by earlier
+        // runs and reused here does not show, so it can read a little low.
+        size_t residentBefore = residentBytes();
+        auto start = Clock::now();
+        auto scene = instanceFieldScene<real>(count, seed);
+        Bvh<real> world(scene.objects);
+        double setupMs = secondsSince(start) * 1e3;
+        size_t residentAfter = residentBytes();
+        size_t objects = scene.objects.getObjects().size();
+        double mib = residentAfter > residentBefore
+                         ? (residentAfter - residentBefore) / (1024.0 * 1024.0)
+                         : 0;
+
+        std::cerr << name << ": " << count << " instances";
+        if (mib > 0)
+            std::cerr << ", " << mib << " MiB";
+        const Instance<real>* instance = nullptr;
+        if (objects > 1)
+            instance = dynamic_cast<const Instance<real>*>(
+                scene.objects.getObjects()[1].get());
+        auto mesh = instance ? dynamic_cast<const TriangleMesh<real>*>(
+                                   instance->getGeometry().get())
+                             : nullptr;
+        if (mesh) {
+            const auto& geometry = *mesh->getGeometry();
+            std::cerr << ", sharing " << geometry.triangleCount()
+                      << " triangles that would take "
+                      << count * geometry.memoryBytes() / (1024.0 * 1024.0)
+                      << " MiB as separate meshes";
+        }
+        std::cerr << '\n';
+
+        auto result = benchKernel("kernel/bvh.hit/" + name, name, objects,
+                                  world, rays, options);
+        result.setupMs = setupMs;
+        result.sceneMiB = mib;
+        report.add(result, out);
+
+        result = benchRender("render/" + name, "render", name, objects, world,
+                             scene.materials, cam, maxThreads, options);
+        result.setupMs = setupMs;
+        result.sceneMiB = mib;
+        report.add(result, out);
+    }
+
+    if (!options.json.empty()) {
+        std::ofstream file(options.json);
+        report.writeJson(file);
+        if (!file) {
+            std::cerr << "Could not write " << options.json << '\n';
+            return 1;
+        }
+        std::cerr << "Wrote " << options.json << '\n';
+    }
+    return resolveMismatch ? 1 : 0;
+}
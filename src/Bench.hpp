@@ -0,0 +1,208 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iomanip>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace raytrace {
+
+// Mean and spread of repeated measurements of one quantity.
+struct BenchStats {
+    double mean = 0;
+    double stddev = 0; // Sample standard deviation, 0 for a single run.
+    double min = 0;
+    double max = 0;
+    std::vector<double> runs;
+
+    static BenchStats of(const std::vector<double>& runs) {
+        BenchStats stats;
+        stats.runs = runs;
+        if (runs.empty())
+            return stats;
+
+        double sum = 0;
+        for (double v : runs)
+            sum += v;
+        stats.mean = sum / runs.size();
+
+        double squares = 0;
+        for (double v : runs)
+            squares += (v - stats.mean) * (v - stats.mean);
+        if (runs.size() > 1)
+            stats.stddev = std::sqrt(squares / (runs.size() - 1));
+
+        stats.min = *std::min_element(runs.begin(), runs.end());
+        stats.max = *std::max_element(runs.begin(), runs.end());
+        return stats;
+    }
+};
+
+// One benchmark case, a kernel or a render of a scene.
+struct BenchResult {
+    std::string name;  // Stable key for comparing between commits.
+    std::string group; // kernel, render, scaling, precision, sampling,
+                       // convergence, display or resolve.
+    std::string scene;
+    size_t objects = 0;
+    unsigned threads = 1;
+    int width = 0; // Image size and spp, renders only.
+    int height = 0;
+    int samplesPerPixel = 0;
+    double setupMs = 0; // Scene and acceleration structure build.
+    double sceneMiB = 0; // Geometry and acceleration structures, if known.
+    // What the rates count: ray, sample, scatter or pixel. Keys in the
+    // JSON are named after it, so unlike rates never share one.
+    std::string unit = "ray";
+    BenchStats mitemsPerSec;
+    BenchStats nsPerItem;
+    BenchStats samplesPerSec; // Camera samples, renders only.
+    // Throughput ratios, each against its own baseline, 0 where there is
+    // none.
+    double overOneThread = 0;   // Scaling, and resolve on a pool.
+    double floatOverDouble = 0; // Precision: float's over these.
+    double overRejection = 0;   // Sampling: over the rejection version.
+    double overHeadless = 0;    // Display: shown over the headless render.
+    double overConvert = 0;     // Resolve: over convertRGBA.
+    double samplesSaved = 0;    // Convergence: the random sampler's squared
+                                // error over this one's.
+    // Pearson's chi-square of the sample distribution over 64 equally likely
+    // bins, sampling only: about 63 if samples follow it.
+    double chiSquare = 0;
+    // Displayed error against a reference image, convergence only.
+    double rmse = 0;
+};
+
+// A named ratio of a result, for printing and JSON.
+struct BenchRatio {
+    const char* label;
+    const char* key;
+    double value;
+};
+
+inline std::vector<BenchRatio> benchRatios(const BenchResult& r) {
+    return {{"vs 1 thread", "speedup_over_one_thread", r.overOneThread},
+            {"float/double", "float_over_double", r.floatOverDouble},
+            {"vs rejection", "speedup_over_rejection", r.overRejection},
+            {"vs headless", "throughput_over_headless", r.overHeadless},
+            {"vs convertRGBA", "speedup_over_convert", r.overConvert},
+            {"samples saved", "samples_saved", r.samplesSaved}};
+}
+
+// Collects results, prints them as they come and writes them as JSON.
+class BenchReport {
+  public:
+    void setInfo(const std::string& key, const std::string& value) {
+        info.emplace_back(key, value);
+    }
+
+    void add(const BenchResult& result, std::ostream& out) {
+        results.push_back(result);
+        out << std::left << std::setw(28) << result.name << std::right
+            << std::fixed << std::setprecision(2) << std::setw(10)
+            << result.mitemsPerSec.mean << " M" << result.unit << "s/s +- "
+            << std::setw(6) << result.mitemsPerSec.stddev << std::setw(10)
+            << result.nsPerItem.mean << " ns/" << result.unit;
+        if (result.samplesPerSec.mean > 0)
+            out << std::setw(12) << std::setprecision(0)
+                << result.samplesPerSec.mean << " samples/s";
+        for (const auto& ratio : benchRatios(result))
+            if (ratio.value > 0)
+                out << std::setprecision(2) << "  x" << ratio.value << ' '
+                    << ratio.label;
+        if (result.chiSquare > 0)
+            out << std::setprecision(1) << "  chi2 " << result.chiSquare;
+        if (result.rmse > 0)
+            out << std::setprecision(5) << "  rmse " << result.rmse;
+        if (result.sceneMiB > 0)
+            out << std::setprecision(1) << std::setw(10) << result.sceneMiB
+                << " MiB";
+        out << '\n' << std::defaultfloat << std::flush;
+    }
+
+    const std::vector<BenchResult>& getResults() const { return results; }
+
+    // Keys are stable and results keep their run order, so two reports
+    // diff cleanly line by line.
+    void writeJson(std::ostream& out) const {
+        out << "{\n";
+        for (const auto& entry : info)
+            out << "  " << quote(entry.first) << ": " << quote(entry.second)
+                << ",\n";
+        out << "  \"results\": [";
+        for (size_t i = 0; i < results.size(); ++i) {
+            const auto& r = results[i];
+            out << (i ? ",\n" : "\n") << "    {\n"
+                << "      \"name\": " << quote(r.name) << ",\n"
+                << "      \"group\": " << quote(r.group) << ",\n"
+                << "      \"scene\": " << quote(r.scene) << ",\n"
+                << "      \"objects\": " << r.objects << ",\n"
+                << "      \"threads\": " << r.threads << ",\n";
+            if (r.width > 0)
+                out << "      \"width\": " << r.width << ",\n"
+                    << "      \"height\": " << r.height << ",\n"
+                    << "      \"spp\": " << r.samplesPerPixel << ",\n";
+            for (const auto& ratio : benchRatios(r))
+                if (ratio.value > 0)
+                    out << "      \"" << ratio.key
+                        << "\": " << number(ratio.value) << ",\n";
+            if (r.chiSquare > 0)
+                out << "      \"chi_square\": " << number(r.chiSquare)
+                    << ",\n";
+            if (r.rmse > 0)
+                out << "      \"rmse\": " << number(r.rmse) << ",\n";
+            out << "      \"setup_ms\": " << number(r.setupMs) << ",\n";
+            if (r.sceneMiB > 0)
+                out << "      \"scene_mib\": " << number(r.sceneMiB) << ",\n";
+            if (r.samplesPerSec.mean > 0)
+                out << "      \"samples_per_sec\": " << stats(r.samplesPerSec)
+                    << ",\n";
+            out << "      \"unit\": " << quote(r.unit) << ",\n"
+                << "      \"m" << r.unit
+                << "s_per_sec\": " << stats(r.mitemsPerSec) << ",\n"
+                << "      \"ns_per_" << r.unit
+                << "\": " << stats(r.nsPerItem) << "\n"
+                << "    }";
+        }
+        out << "\n  ]\n}\n";
+    }
+
+  private:
+    std::vector<std::pair<std::string, std::string>> info;
+    std::vector<BenchResult> results;
+
+    static std::string quote(const std::string& s) {
+        std::string out = "\"";
+        for (char c : s) {
+            if (c == '"' || c == '\\')
+                out += '\\';
+            out += c;
+        }
+        return out + "\"";
+    }
+
+    static std::string number(double v) {
+        std::ostringstream out;
+        out << std::setprecision(6) << v;
+        return out.str();
+    }
+
+    static std::string stats(const BenchStats& s) {
+        std::string out = "{\"mean\": " + number(s.mean) +
+                          ", \"stddev\": " + number(s.stddev) +
+                          ", \"min\": " + number(s.min) +
+                          ", \"max\": " + number(s.max) + ", \"runs\": [";
+        for (size_t i = 0; i < s.runs.size(); ++i)
+            out += (i ? ", " : "") + number(s.runs[i]);
+        return out + "]}";
+    }
+};
+
+} // namespace raytrace
+
+#endif // BENCH_H
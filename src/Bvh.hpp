@@ -0,0 +1,113 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include <memory>
+#include <vector>
+
+#include "BvhTree.hpp"
+#include "Hittable.hpp"
+#include "HittableList.hpp"
+
+namespace raytrace {
+
+// Bounding volume hierarchy over hittable objects, a drop in replacement for
+// the linear scan in HittableList::hit.
+template <class T> class Bvh : public Hittable<T> {
+  public:
+    Bvh() {}
+    Bvh(const HittableList<T>& list) { build(list.getObjects()); }
+
+    void build(const std::vector<std::shared_ptr<Hittable<T>>>& objects) {
+        std::vector<Aabb<T>> bounds(objects.size());
+        for (size_t i = 0; i < objects.size(); ++i)
+            bounds[i] = objects[i]->boundingBox();
+        tree.build(bounds);
+
+        // Store primitives in leaf order so each leaf is a contiguous run.
+        prims.resize(objects.size());
+        ordered.resize(objects.size());
+        for (size_t i = 0; i < objects.size(); ++i) {
+            prims[i] = objects[tree.primitive(static_cast<uint32_t>(i))];
+            ordered[i] = prims[i].get();
+        }
+    }
+
+    // Follow objects that moved since the build, see BvhTree::refit.
+    // Returns the seconds taken.
+    double refit() {
+        return tree.refit(
+            [&](uint32_t slot) { return ordered[slot]->boundingBox(); });
+    }
+
+    virtual bool hit(const Ray<T>& r, T tMin, T tMax,
+                     HitRecord<T>& rec) const override {
+        return tree.traverse(
+            r, tMin, tMax,
+            [&](uint32_t first, uint32_t count, T& closestSoFar) {
+                bool hitAnything = false;
+                for (uint32_t i = first; i < first + count; ++i) {
+                    if (ordered[i]->hit(r, tMin, closestSoFar, rec)) {
+                        hitAnything = true;
+                        closestSoFar = rec.t;
+                    }
+                }
+                return hitAnything;
+            },
+            collectStats ? &rayStats : nullptr);
+    }
+
+    virtual bool occluded(const Ray<T>& r, T tMin, T tMax) const override {
+        return tree.traverseAny(
+            r, tMin, tMax,
+            [&](uint32_t first, uint32_t count, T& tMaxLeaf) {
+                for (uint32_t i = first; i < first + count; ++i)
+                    if (ordered[i]->occluded(r, tMin, tMaxLeaf))
+                        return true;
+                return false;
+            },
+            collectStats ? &rayStats : nullptr);
+    }
+
+    virtual Aabb<T> boundingBox() const override { return tree.bounds(); }
+
+    const BvhBuildStats& buildStats() const { return tree.stats(); }
+    double areaGrowth() const { return tree.areaGrowth(); }
+
+    // Traversal counters are off by default, they cost a few atomics a ray.
+    void setCollectStats(bool enabled) { collectStats = enabled; }
+    const BvhRayStats& traversalStats() const { return rayStats; }
+    void resetTraversalStats() { rayStats.reset(); }
+
+    size_t size() const { return prims.size(); }
+
+  private:
+    BvhTree<T> tree;
+    std::vector<std::shared_ptr<Hittable<T>>> prims;
+    std::vector<const Hittable<T>*> ordered;
+    bool collectStats = false;
+    mutable BvhRayStats rayStats;
+};
+
+// Summary of build time and per ray work, compared against testing every
+// primitive as the linear HittableList does.
+template <class T> void printBvhStats(std::ostream& out, const Bvh<T>& bvh) {
+    const auto& build = bvh.buildStats();
+    out << "BVH: " << build.primitives << " primitives, " << build.nodes
+        << " nodes, " << build.leaves << " leaves, depth " << build.maxDepth
+        << ", built in " << build.seconds * 1000 << "ms\n";
+
+    const auto& rays = bvh.traversalStats();
+    if (rays.rays() > 0) {
+        double perRay = 1.0 / rays.rays();
+        out << "BVH: " << rays.rays() << " rays, "
+            << rays.nodesVisited() * perRay << " nodes visited/ray, "
+            << rays.primitivesTested() * perRay
+            << " primitives tested/ray (linear list: " << build.primitives
+            << ")\n";
+    }
+    out << std::flush;
+}
+
+} // namespace raytrace
+
+#endif // BVH_H
@@ -0,0 +1,388 @@
+#ifndef BVHTREE_H
+#define BVHTREE_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+#include "Common.hpp"
+
+#include "Aabb.hpp"
+#include "ThreadPool.hpp"
+
+namespace raytrace {
+
+// Flattened BVH node. Interior nodes keep their first child directly after
+// themselves and store the index of the second child in offset, leaves
+// store a range of the reordered primitive indices.
+template <class T> struct BvhNode {
+    Aabb<T> box;
+    uint32_t offset;
+    uint16_t count; // 0 for interior nodes.
+    uint16_t axis;  // Split axis, used to visit the nearer child first.
+};
+
+struct BvhBuildStats {
+    size_t primitives = 0;
+    size_t nodes = 0;
+    size_t leaves = 0;
+    int maxDepth = 0;
+    double seconds = 0;
+};
+
+// Traversal counters, sharded per pool worker so rays never contend on a
+// shared cache line.
+class BvhRayStats {
+  public:
+    void record(uint64_t nodes, uint64_t prims) {
+        auto& slot =
+            slots[static_cast<size_t>(ThreadPool::currentWorker() + 1) %
+                  numSlots];
+        slot.rays.fetch_add(1, std::memory_order_relaxed);
+        slot.nodes.fetch_add(nodes, std::memory_order_relaxed);
+        slot.prims.fetch_add(prims, std::memory_order_relaxed);
+    }
+
+    void reset() {
+        for (auto& slot : slots) {
+            slot.rays = 0;
+            slot.nodes = 0;
+            slot.prims = 0;
+        }
+    }
+
+    uint64_t rays() const { return sum(&Slot::rays); }
+    uint64_t nodesVisited() const { return sum(&Slot::nodes); }
+    uint64_t primitivesTested() const { return sum(&Slot::prims); }
+
+  private:
+    struct alignas(64) Slot {
+        std::atomic<uint64_t> rays{0};
+        std::atomic<uint64_t> nodes{0};
+        std::atomic<uint64_t> prims{0};
+    };
+    static constexpr size_t numSlots = 64;
+    Slot slots[numSlots];
+
+    uint64_t sum(std::atomic<uint64_t> Slot::*field) const {
+        uint64_t total = 0;
+        for (const auto& slot : slots)
+            total += (slot.*field).load(std::memory_order_relaxed);
+        return total;
+    }
+};
+
+// Bounding volume hierarchy over abstract primitives, built with binned SAH.
+// Owners supply the primitive bounds and a leaf intersection callback, so the
+// same tree serves lists of hittables, packed spheres and triangle meshes.
+template <class T> class BvhTree {
+  public:
+    static constexpr int numBins = 16;
+    static constexpr int maxLeafSize = 4;
+    static constexpr int maxSahDepth = 64;
+    static constexpr int maxStackDepth = 128;
+    // Relative cost of one traversal step vs. one primitive test.
+    static constexpr double traversalCost = 0.125;
+
+    BvhTree() {}
+
+    // Build over the given primitive bounds. Afterwards primitive(i) maps
+    // the i-th leaf slot back to the caller's primitive index.
+    void build(const std::vector<Aabb<T>>& bounds) {
+        auto start = std::chrono::steady_clock::now();
+
+        nodes.clear();
+        external = nullptr;
+        externalCount = 0;
+        indices.resize(bounds.size());
+        std::vector<Point3<T>> centroids(bounds.size());
+        for (size_t i = 0; i < bounds.size(); ++i) {
+            indices[i] = static_cast<uint32_t>(i);
+            centroids[i] = bounds[i].centroid();
+        }
+
+        buildStats = BvhBuildStats();
+        buildStats.primitives = bounds.size();
+        nodes.reserve(2 * bounds.size() / maxLeafSize + 1);
+        if (!bounds.empty())
+            buildRecursive(bounds, centroids, 0,
+                           static_cast<uint32_t>(bounds.size()), 0);
+        nodes.shrink_to_fit();
+        builtArea.resize(nodes.size());
+        for (size_t i = 0; i < nodes.size(); ++i)
+            builtArea[i] = nodes[i].box.surfaceArea();
+
+        std::chrono::duration<double> elapsed =
+            std::chrono::steady_clock::now() - start;
+        buildStats.nodes = nodes.size();
+        buildStats.seconds = elapsed.count();
+    }
+
+    // Recompute every box for primitives that moved, keeping the tree as
+    // built. boundsOf(slot) gives the bounds of leaf slot slot's primitive.
+    // Much cheaper than a build, though traversal slows as the tree drifts
+    // from what SAH would pick. Trees attached from a file cannot be refit.
+    // Returns the seconds taken.
+    template <class BoundsFn> double refit(BoundsFn&& boundsOf) {
+        auto start = std::chrono::steady_clock::now();
+        // Children follow their parent, so a reverse sweep sees them first.
+        for (size_t i = nodes.size(); i-- > 0;) {
+            BvhNode<T>& node = nodes[i];
+            Aabb<T> box;
+            if (node.count > 0) {
+                for (uint32_t j = node.offset; j < node.offset + node.count;
+                     ++j)
+                    box.expand(boundsOf(j));
+            } else {
+                box = surroundingBox(nodes[i + 1].box, nodes[node.offset].box);
+            }
+            node.box = box;
+        }
+        std::chrono::duration<double> elapsed =
+            std::chrono::steady_clock::now() - start;
+        return elapsed.count();
+    }
+
+    // Mean factor by which node surface areas have grown through refits
+    // since the build. Boxes stretched by objects travelling away from
+    // each other overlap more, so rays visit more nodes; a large growth
+    // calls for a rebuild.
+    double areaGrowth() const {
+        double sum = 0;
+        size_t counted = 0;
+        for (size_t i = 0; i < builtArea.size(); ++i) {
+            if (builtArea[i] > 0) {
+                sum += double(nodes[i].box.surfaceArea()) /
+                       double(builtArea[i]);
+                counted++;
+            }
+        }
+        return counted ? sum / counted : 1;
+    }
+
+    // Use nodes built earlier, e.g. stored in a mapped scene file, without
+    // copying them. The primitives must already be in leaf order and the
+    // memory must outlive the tree.
+    void attach(const BvhNode<T>* data, size_t count) {
+        nodes.clear();
+        indices.clear();
+        builtArea.clear();
+        external = data;
+        externalCount = count;
+        buildStats = BvhBuildStats();
+        buildStats.nodes = count;
+    }
+
+    const BvhNode<T>* nodeData() const {
+        return external ? external : nodes.data();
+    }
+    size_t nodeCount() const { return external ? externalCount : nodes.size(); }
+
+    bool empty() const { return nodeCount() == 0; }
+    Aabb<T> bounds() const { return empty() ? Aabb<T>() : nodeData()[0].box; }
+    uint32_t primitive(uint32_t slot) const {
+        return indices.empty() ? slot : indices[slot];
+    }
+    const std::vector<uint32_t>& primitiveOrder() const { return indices; }
+    const BvhBuildStats& stats() const { return buildStats; }
+
+    // Visit the leaves a ray may hit, nearest first. leafHit(first, count,
+    // tMax) tests leaf slots [first, first + count) and shrinks tMax on a
+    // hit, which prunes every box further away than the closest hit so far.
+    template <class LeafFn>
+    bool traverse(const Ray<T>& r, T tMin, T tMax, LeafFn&& leafHit,
+                  BvhRayStats* rayStats = nullptr) const {
+        return walk<false>(r, tMin, tMax, leafHit, rayStats);
+    }
+
+    // Like traverse, but stops at the first leaf that reports a hit. For
+    // shadow rays, where any occluder will do.
+    template <class LeafFn>
+    bool traverseAny(const Ray<T>& r, T tMin, T tMax, LeafFn&& leafHit,
+                     BvhRayStats* rayStats = nullptr) const {
+        return walk<true>(r, tMin, tMax, leafHit, rayStats);
+    }
+
+  private:
+    std::vector<BvhNode<T>> nodes;
+    std::vector<uint32_t> indices;
+    std::vector<T> builtArea; // Of each node, for areaGrowth.
+    BvhBuildStats buildStats;
+    const BvhNode<T>* external = nullptr;
+    size_t externalCount = 0;
+
+    struct Bin {
+        Aabb<T> box;
+        uint32_t count = 0;
+    };
+
+    // Body of traverse and traverseAny.
+    template <bool AnyHit, class LeafFn>
+    bool walk(const Ray<T>& r, T tMin, T tMax, LeafFn& leafHit,
+              BvhRayStats* rayStats) const {
+        if (empty())
+            return false;
+        const BvhNode<T>* nodes = nodeData();
+
+        Point3<T> origin = r.origin();
+        Vec3<T> dir = r.direction();
+        Vec3<T> invDir(1 / dir.x(), 1 / dir.y(), 1 / dir.z());
+        bool dirIsNeg[3] = {invDir.x() < 0, invDir.y() < 0, invDir.z() < 0};
+
+        uint32_t stack[maxStackDepth];
+        int stackSize = 0;
+        uint32_t current = 0;
+        bool hitAnything = false;
+        uint64_t nodesVisited = 0;
+        uint64_t primsTested = 0;
+
+        while (true) {
+            const BvhNode<T>& node = nodes[current];
+            ++nodesVisited;
+            if (node.box.hit(origin, invDir, tMin, tMax)) {
+                if (node.count > 0) {
+                    primsTested += node.count;
+                    if (leafHit(node.offset, node.count, tMax)) {
+                        hitAnything = true;
+                        if (AnyHit)
+                            break;
+                    }
+                    if (stackSize == 0)
+                        break;
+                    current = stack[--stackSize];
+                } else if (dirIsNeg[node.axis]) {
+                    stack[stackSize++] = current + 1;
+                    current = node.offset;
+                } else {
+                    stack[stackSize++] = node.offset;
+                    current = current + 1;
+                }
+            } else {
+                if (stackSize == 0)
+                    break;
+                current = stack[--stackSize];
+            }
+        }
+
+        if (rayStats)
+            rayStats->record(nodesVisited, primsTested);
+        return hitAnything;
+    }
+
+    uint32_t makeLeaf(const Aabb<T>& box, uint32_t begin, uint32_t end,
+                      int depth) {
+        BvhNode<T> leaf;
+        leaf.box = box;
+        leaf.offset = begin;
+        leaf.count = static_cast<uint16_t>(end - begin);
+        leaf.axis = 0;
+        nodes.push_back(leaf);
+        buildStats.leaves++;
+        buildStats.maxDepth = std::max(buildStats.maxDepth, depth);
+        return static_cast<uint32_t>(nodes.size() - 1);
+    }
+
+    uint32_t buildRecursive(const std::vector<Aabb<T>>& bounds,
+                            const std::vector<Point3<T>>& centroids,
+                            uint32_t begin, uint32_t end, int depth) {
+        Aabb<T> box;
+        Aabb<T> centroidBox;
+        for (uint32_t i = begin; i < end; ++i) {
+            box.expand(bounds[indices[i]]);
+            centroidBox.expand(centroids[indices[i]]);
+        }
+
+        uint32_t count = end - begin;
+        if (count <= maxLeafSize)
+            return makeLeaf(box, begin, end, depth);
+
+        int axis = centroidBox.longestAxis();
+        T cMin = centroidBox.min()[axis];
+        T extent = centroidBox.max()[axis] - cMin;
+
+        uint32_t mid = begin + count / 2;
+        if (extent > 0 && depth >= maxSahDepth) {
+            // Degenerate input, fall back to median splits to bound depth.
+            std::nth_element(indices.data() + begin, indices.data() + mid,
+                             indices.data() + end,
+                             [&](uint32_t a, uint32_t b) {
+                                 return centroids[a][axis] < centroids[b][axis];
+                             });
+        } else if (extent > 0) {
+            // Bin centroids along the axis and sweep for the cheapest split.
+            Bin bins[numBins];
+            T toBin = numBins / extent;
+            auto binOf = [&](uint32_t prim) {
+                int b = static_cast<int>((centroids[prim][axis] - cMin) * toBin);
+                return std::min(b, numBins - 1);
+            };
+            for (uint32_t i = begin; i < end; ++i) {
+                Bin& bin = bins[binOf(indices[i])];
+                bin.count++;
+                bin.box.expand(bounds[indices[i]]);
+            }
+
+            T rightArea[numBins - 1];
+            uint32_t rightCount[numBins - 1];
+            Aabb<T> acc;
+            uint32_t n = 0;
+            for (int b = numBins - 1; b > 0; --b) {
+                acc.expand(bins[b].box);
+                n += bins[b].count;
+                rightArea[b - 1] = acc.surfaceArea();
+                rightCount[b - 1] = n;
+            }
+
+            int bestSplit = -1;
+            T bestCost = infinity<T>;
+            acc = Aabb<T>();
+            n = 0;
+            for (int b = 0; b < numBins - 1; ++b) {
+                acc.expand(bins[b].box);
+                n += bins[b].count;
+                T cost = n * acc.surfaceArea() +
+                         rightCount[b] * rightArea[b];
+                if (n > 0 && rightCount[b] > 0 && cost < bestCost) {
+                    bestCost = cost;
+                    bestSplit = b;
+                }
+            }
+
+            T leafCost = count * box.surfaceArea();
+            T splitCost = T(traversalCost) * box.surfaceArea() + bestCost;
+            if (bestSplit < 0 ||
+                (splitCost >= leafCost && count <= 4 * maxLeafSize))
+                return makeLeaf(box, begin, end, depth);
+
+            auto* first = indices.data() + begin;
+            auto* pivot = std::partition(first, indices.data() + end,
+                                         [&](uint32_t prim) {
+                                             return binOf(prim) <= bestSplit;
+                                         });
+            mid = static_cast<uint32_t>(pivot - indices.data());
+        } else {
+            // All centroids coincide, split by count so leaves stay small.
+            std::nth_element(indices.data() + begin, indices.data() + mid,
+                             indices.data() + end);
+        }
+
+        uint32_t self = static_cast<uint32_t>(nodes.size());
+        nodes.emplace_back();
+        buildRecursive(bounds, centroids, begin, mid, depth + 1);
+        uint32_t second = buildRecursive(bounds, centroids, mid, end, depth + 1);
+
+        BvhNode<T>& node = nodes[self];
+        node.box = box;
+        node.offset = second;
+        node.count = 0;
+        node.axis = static_cast<uint16_t>(axis);
+        return self;
+    }
+};
+
+} // namespace raytrace
+
+#endif // BVHTREE_H
@@ -3,15 +3,23 @@
 
 #include "Common.hpp"
 
+#include "Sampler.hpp"
+#include "Sampling.hpp"
+
 namespace raytrace {
 
 template <class T> class Camera {
   public:
+    // The shutter is open from time shutterOpen to shutterClose, in frames:
+    // moving objects travel their motion over a time of 1, and are bounded
+    // for times in [0, 1] only, which the shutter must stay within.
     Camera(Point3<T> lookFrom, Point3<T> lookAt, Vec3<T> vUp, T vFovDeg,
-           T aspectRatio, T aperture, T focusDist) {
+           T aspectRatio, T aperture, T focusDist, T shutterOpen = 0,
+           T shutterClose = 0)
+        : time0(shutterOpen), time1(shutterClose) {
         auto theta = degToRad(vFovDeg);
         auto h = std::tan(theta / 2);
-        auto viewportHeight = 2.0 * h;
+        auto viewportHeight = 2 * h;
         auto viewportWidth = aspectRatio * viewportHeight;
 
         // Orthonormalise from vUp and lookAt/lookFrom.
@@ -28,12 +36,22 @@ template <class T> class Camera {
     }
 
     Ray<T> getRay(T s, T t) const {
-        // Sample a ray from within the lens radius
-        Vec3<T> rd = lensRadius * Vec3<T>::randomInUnitDisk();
-        Vec3<T> offset = u * rd.x() + v * rd.y();
+        profileCount(Counter::CameraRays);
+        // Sample a ray from within the lens radius, a pinhole needs none.
+        Vec3<T> offset(0, 0, 0);
+        if (lensRadius > 0) {
+            Vec3<T> rd = lensRadius * sampleConcentricDisk(sample2D<T>());
+            offset = u * rd.x() + v * rd.y();
+        }
+        // No random number for a closed shutter, so still images keep
+        // their samples.
+        T time = time1 > time0 ? time0 + (time1 - time0) * sample1D<T>()
+                               : time0;
 
-        return Ray<T>(origin + offset, lowerLeftCorner + s * horizontal +
-                                           t * vertical - origin - offset);
+        return Ray<T>(origin + offset,
+                      lowerLeftCorner + s * horizontal + t * vertical -
+                          origin - offset,
+                      time);
     }
 
   private:
@@ -43,6 +61,25 @@ template <class T> class Camera {
     Vec3<T> vertical;
     Vec3<T> u, v, w;
     T lensRadius;
+    T time0, time1;
+};
+
+// Camera placement as passed to the Camera constructor, less the aspect
+// ratio, which follows the image size. Scene files store this.
+template <class T> struct CameraSettings {
+    Point3<T> lookFrom{0, 0, 1};
+    Point3<T> lookAt{0, 0, 0};
+    Vec3<T> vUp{0, 1, 0};
+    T vFovDeg = 90;
+    T aperture = 0;
+    T focusDist = 1;
+    T shutterOpen = 0; // Equal times take every ray at that instant.
+    T shutterClose = 0;
+
+    Camera<T> camera(T aspectRatio) const {
+        return Camera<T>(lookFrom, lookAt, vUp, vFovDeg, aspectRatio, aperture,
+                         focusDist, shutterOpen, shutterClose);
+    }
 };
 
 } // namespace raytrace
@@ -12,16 +12,17 @@ uint32_t convertRGBA(const Color<T>& pixelColor, int samplesPerPixel) {
     auto b = pixelColor.z();
 
     // Div color by number of samples & gamma correct for gamma 2.0
-    auto scale = 1.0 / samplesPerPixel;
+    T scale = T(1) / T(samplesPerPixel);
     r = std::sqrt(scale * r);
     g = std::sqrt(scale * g);
     b = std::sqrt(scale * b);
 
-    uint32_t c = static_cast<uint8_t>(255.999 * clamp<T>(r, 0.0, 0.999));
+    const T top = T(255.999), most = T(0.999);
+    uint32_t c = static_cast<uint8_t>(top * clamp<T>(r, 0, most));
     c <<= 8;
-    c |= static_cast<uint8_t>(255.999 * clamp<T>(g, 0.0, 0.999));
+    c |= static_cast<uint8_t>(top * clamp<T>(g, 0, most));
     c <<= 8;
-    c |= static_cast<uint8_t>(255.999 * clamp<T>(b, 0.0, 0.999));
+    c |= static_cast<uint8_t>(top * clamp<T>(b, 0, most));
     c <<= 8;
     return c;
 }
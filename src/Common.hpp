@@ -4,25 +4,36 @@
 #include <cmath>
 #include <limits>
 #include <memory>
-#include <random>
+
+#include "Random.hpp"
 
 namespace raytrace {
 
-// Precision
+// Default precision. The renderer is templated on it and the executables
+// carry float and double instances, --precision picks one per run.
 using real = float;
 
-// Constants
-const real infinity = std::numeric_limits<real>::infinity();
-const real pi = 3.1415926535897932385;
-const real epsilon = 1e-8;
+enum class Precision { Float, Double };
+
+inline const char* precisionName(Precision p) {
+    return p == Precision::Double ? "double" : "float";
+}
+
+// Constants, in the precision of the code using them so float code never
+// computes in double.
+template <class T>
+constexpr T infinity = std::numeric_limits<T>::infinity();
+template <class T> constexpr T pi = T(3.1415926535897932385L);
+template <class T> constexpr T epsilon = T(1e-8);
 
 // Utility functions
-template <class T> inline T degToRad(T deg) { return deg * pi / 180.0; }
+template <class T> inline T degToRad(T deg) {
+    return deg * (pi<T> / T(180));
+}
 
-template <class T> inline T randomReal(T min = 0.0, T max = 1.0) {
-    static std::uniform_real_distribution<T> dist(min, max);
-    static std::mt19937 gen;
-    return dist(gen);
+// Uniform in [min, max), drawn from the calling thread's generator.
+template <class T> inline T randomReal(T min = 0, T max = 1) {
+    return min + (max - min) * threadRng().uniform<T>();
 }
 
 template <class T> inline T clamp(T x, T min, T max) {
@@ -36,6 +47,7 @@ template <class T> inline T clamp(T x, T min, T max) {
 } // namespace raytrace
 
 // Common Headers
+#include "Profile.hpp"
 #include "Ray.hpp"
 #include "Vec3.hpp"
 
@@ -0,0 +1,217 @@
+#ifndef DENOISER_H
+#define DENOISER_H
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "Common.hpp"
+
+#include "Framebuffer.hpp"
+#include "Profile.hpp"
+#include "ThreadPool.hpp"
+
+namespace raytrace {
+
+// Path for the buffer called name beside the image at path, e.g.
+// render_albedo.png for render.png.
+inline std::string aovPath(const std::string& path, const std::string& name) {
+    auto dot = path.find_last_of('.');
+    auto slash = path.find_last_of('/');
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+        return path + "_" + name;
+    return path.substr(0, dot) + "_" + name + path.substr(dot);
+}
+
+struct DenoiseSettings {
+    int passes = 5; // The last one reaches 2^passes pixels away.
+    // Differences at which neighbours lose most of their weight. Colour is
+    // of the light reaching the surface, the albedo divided out; it halves
+    // every pass as the image gets smoother.
+    double colorSigma = 0.5;
+    double normalSigma = 0.3;
+    double depthSigma = 0.02; // Relative to depth, per pixel of spacing.
+};
+
+// Edge avoiding a-trous wavelet filter (Dammertz et al. 2010) guided by a
+// FeatureBuffer. Each pass blurs with a 5x5 B3 spline kernel whose taps
+// are spread twice as far apart as the pass before, so a few passes cover a
+// wide footprint at 25 taps a pixel. Every tap is weighted down by how far
+// its colour, normal and depth differ from the centre's, so edges between
+// objects stay sharp.
+//
+// The albedo is divided out before filtering and multiplied back after, so
+// the colours of neighbouring surfaces do not bleed into each other, and
+// fireflies are clamped first. Rows are split into bands filtered on the
+// pool.
+template <class T> class Denoiser {
+  public:
+    Denoiser(ThreadPool& pool,
+             const DenoiseSettings& settings = DenoiseSettings())
+        : pool(pool), settings(settings) {}
+
+    // The filtered image of fb, as sums over the same samples, so it can
+    // be shown and written like fb itself.
+    Framebuffer<T> denoise(const Framebuffer<T>& fb,
+                           const FeatureBuffer<T>& features) {
+        ScopedTimer timer(Stage::Denoise);
+        auto start = std::chrono::steady_clock::now();
+        w = fb.width();
+        h = fb.height();
+        size_t n = size_t(w) * h;
+        T scale = fb.samples() > 0 ? T(1) / fb.samples() : T(0);
+
+        albedo.resize(n);
+        normal.resize(n);
+        depth.resize(n);
+        light.resize(n);
+        filtered.resize(n);
+        parallelRows([&](int y) {
+            for (int x = 0; x < w; ++x) {
+                size_t i = size_t(y) * w + x;
+                const Features<T>& f = features.at(x, y);
+                const Color<T>& a = albedo[i] =
+                    f.albedo * scale + Color<T>(1, 1, 1) * albedoFloor;
+                normal[i] = f.normal * scale;
+                depth[i] = f.depth * scale;
+                Color<T> c = fb.at(x, y) * scale;
+                filtered[i] =
+                    Color<T>(c.x() / a.x(), c.y() / a.y(), c.z() / a.z());
+            }
+        });
+        parallelRows([&](int y) { clampFireflies(y); });
+        T colorSigma = T(settings.colorSigma);
+        for (int pass = 0; pass < settings.passes; ++pass) {
+            int step = 1 << pass;
+            T colorScale = 1 / (colorSigma * colorSigma);
+            parallelRows([&](int y) { filterRow(y, step, colorScale); });
+            std::swap(light, filtered);
+            colorSigma /= 2;
+        }
+
+        Framebuffer<T> out(w, h);
+        T samples = T(fb.samples());
+        parallelRows([&](int y) {
+            for (int x = 0; x < w; ++x) {
+                size_t i = size_t(y) * w + x;
+                out.at(x, y) = light[i] * albedo[i] * samples;
+            }
+        });
+        out.addSamples(fb.samples());
+
+        std::chrono::duration<double> elapsed =
+            std::chrono::steady_clock::now() - start;
+        lastSeconds = elapsed.count();
+        return out;
+    }
+
+    // Time the last denoise() took.
+    double seconds() const { return lastSeconds; }
+
+    void printStats(std::ostream& out) const {
+        out << std::fixed << std::setprecision(3) << "Denoised: "
+            << settings.passes << " passes on " << pool.size()
+            << " threads in " << lastSeconds * 1000 << "ms, "
+            << double(w) * h / lastSeconds * 1e-6 << " Mpixels/s\n"
+            << std::defaultfloat << std::flush;
+    }
+
+  private:
+    // Added to the albedo before dividing by it, so black surfaces keep
+    // their colour.
+    static constexpr T albedoFloor = T(0.01);
+    static constexpr int bandRows = 16;
+
+    ThreadPool& pool;
+    DenoiseSettings settings;
+    int w = 0, h = 0;
+    double lastSeconds = 0;
+    std::vector<Color<T>> albedo;
+    std::vector<Vec3<T>> normal;
+    std::vector<T> depth;
+    std::vector<Color<T>> light;
+    std::vector<Color<T>> filtered;
+
+    static T luminance(const Color<T>& c) {
+        return T(0.2126) * c.x() + T(0.7152) * c.y() + T(0.0722) * c.z();
+    }
+
+    // Lone samples far brighter than anything around them would otherwise
+    // spread into blotches, so no pixel is brighter than the second
+    // brightest of its neighbours, which also catches fireflies in pairs.
+    // Reads filtered, writes light.
+    void clampFireflies(int y) {
+        for (int x = 0; x < w; ++x) {
+            size_t i = size_t(y) * w + x;
+            T brightest = 0, second = 0;
+            for (int qy = std::max(0, y - 1); qy <= std::min(h - 1, y + 1);
+                 ++qy)
+                for (int qx = std::max(0, x - 1);
+                     qx <= std::min(w - 1, x + 1); ++qx)
+                    if (qx != x || qy != y) {
+                        T q = luminance(filtered[size_t(qy) * w + qx]);
+                        second = std::max(second, std::min(brightest, q));
+                        brightest = std::max(brightest, q);
+                    }
+            T l = luminance(filtered[i]);
+            light[i] = l > second ? filtered[i] * (second / l) : filtered[i];
+        }
+    }
+
+    // f(y) for every row, bands of rows at a time on the pool.
+    template <class F> void parallelRows(F f) {
+        for (int y0 = 0; y0 < h; y0 += bandRows) {
+            int y1 = std::min(h, y0 + bandRows);
+            pool.submit([=, &f] {
+                for (int y = y0; y < y1; ++y)
+                    f(y);
+            });
+        }
+        pool.wait();
+    }
+
+    void filterRow(int y, int step, T colorScale) {
+        static constexpr T kernel[5] = {T(1) / 16, T(1) / 4, T(3) / 8,
+                                        T(1) / 4, T(1) / 16};
+        T normalScale = T(1 / (settings.normalSigma * settings.normalSigma));
+        T depthScale = T(1 / (settings.depthSigma * step));
+
+        for (int x = 0; x < w; ++x) {
+            size_t i = size_t(y) * w + x;
+            const Color<T> c = light[i];
+            const Vec3<T> n = normal[i];
+            T z = depth[i];
+            // Escaped rays have depth 0 and only blend with each other.
+            T zScale = z > 0 ? depthScale / z : T(1e30);
+
+            Color<T> sum(0, 0, 0);
+            T weightSum = 0;
+            for (int dy = -2; dy <= 2; ++dy) {
+                int qy = y + dy * step;
+                if (qy < 0 || qy >= h)
+                    continue;
+                for (int dx = -2; dx <= 2; ++dx) {
+                    int qx = x + dx * step;
+                    if (qx < 0 || qx >= w)
+                        continue;
+                    size_t j = size_t(qy) * w + qx;
+                    T e = (light[j] - c).lengthSquared() * colorScale +
+                          (normal[j] - n).lengthSquared() * normalScale +
+                          std::abs(depth[j] - z) * zScale;
+                    T weight = kernel[dx + 2] * kernel[dy + 2] * std::exp(-e);
+                    sum += weight * light[j];
+                    weightSum += weight;
+                }
+            }
+            filtered[i] = sum / weightSum;
+        }
+    }
+};
+
+} // namespace raytrace
+
+#endif // DENOISER_H
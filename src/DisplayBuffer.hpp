@@ -0,0 +1,138 @@
+#ifndef DISPLAYBUFFER_H
+#define DISPLAYBUFFER_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+#include "Framebuffer.hpp"
+#include "Profile.hpp"
+#include "Resolve.hpp"
+#include "ThreadPool.hpp"
+
+namespace raytrace {
+
+// Rectangle [x0, x1) x [y0, y1) of a display image, in top left
+// coordinates as textures are. Empty when x0 >= x1.
+struct DisplayRect {
+    int x0 = 0, y0 = 0, x1 = 0, y1 = 0;
+
+    bool empty() const { return x0 >= x1 || y0 >= y1; }
+    int width() const { return x1 - x0; }
+    int height() const { return y1 - y0; }
+
+    // Grow to cover r too.
+    void add(const DisplayRect& r) {
+        if (r.empty())
+            return;
+        if (empty()) {
+            *this = r;
+            return;
+        }
+        x0 = std::min(x0, r.x0);
+        y0 = std::min(y0, r.y0);
+        x1 = std::max(x1, r.x1);
+        y1 = std::max(y1, r.y1);
+    }
+};
+
+// The frame as shown, RGBA8 in two copies between the renderer and the
+// window. The render side converts finished regions into the back image,
+// tone mapped by a Resolver, and marks them dirty; the presenter copies
+// the dirty region to the front image whenever it gets round to it and
+// uploads from there. Regions are converted before taking the lock and
+// each side holds it only for its own copy, so neither waits on the other's
+// conversion, upload, present or vsync, tiles convert in parallel, and
+// regions updated several times between presents are uploaded once.
+class DisplayBuffer {
+  public:
+    DisplayBuffer(int width, int height,
+                  const ResolveSettings& settings = ResolveSettings())
+        : w(width), h(height), resolver(settings),
+          back(size_t(width) * height), front(size_t(width) * height) {}
+
+    int width() const { return w; }
+    int height() const { return h; }
+
+    // Convert [x0, x1) x [y0, y1) of fb, in its bottom left coordinates,
+    // as the average of samples per pixel into the back image.
+    template <class T>
+    void update(const Framebuffer<T>& fb, int x0, int y0, int x1, int y1,
+                int samples) {
+        ScopedTimer timer(Stage::Pixels);
+        DisplayRect rect{x0, h - y1, x1, h - y0};
+        int n = x1 - x0;
+        uint32_t* pixels = scratch(size_t(n) * (y1 - y0));
+        for (int y = y0; y < y1; ++y)
+            resolver.row(&fb.at(x0, y), n, samples,
+                         pixels + size_t(y1 - 1 - y) * n);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        for (int y = rect.y0; y < rect.y1; ++y)
+            std::memcpy(&back[size_t(y) * w + x0],
+                        pixels + size_t(y - rect.y0) * n,
+                        sizeof(uint32_t) * n);
+        dirty.add(rect);
+        updateCount++;
+    }
+
+    // All of fb at its samples, in bands of rows on pool when given.
+    template <class T>
+    void update(const Framebuffer<T>& fb, ThreadPool* pool = nullptr) {
+        ScopedTimer timer(Stage::Pixels);
+        uint32_t* pixels = scratch(back.size());
+        resolver.frame(fb, pixels, pool);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        std::memcpy(back.data(), pixels, sizeof(uint32_t) * back.size());
+        dirty.add(DisplayRect{0, 0, w, h});
+        updateCount++;
+    }
+
+    // Copy what changed since the last call to the front image, false if
+    // nothing did. Presenter side.
+    bool swap(DisplayRect& changed) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (dirty.empty())
+            return false;
+        for (int y = dirty.y0; y < dirty.y1; ++y)
+            std::memcpy(&front[size_t(y) * w + dirty.x0],
+                        &back[size_t(y) * w + dirty.x0],
+                        sizeof(uint32_t) * dirty.width());
+        changed = dirty;
+        dirty = DisplayRect();
+        return true;
+    }
+
+    // Row y of the front image, top first. Presenter side, between swaps.
+    const uint32_t* frontRow(int y) const { return &front[size_t(y) * w]; }
+
+    // Regions converted so far, for comparing with presents.
+    size_t updates() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return updateCount;
+    }
+
+  private:
+    int w, h;
+    Resolver resolver;
+    std::vector<uint32_t> back, front;
+    DisplayRect dirty;
+    size_t updateCount = 0;
+    mutable std::mutex mutex;
+
+    // Room for a region converted on the calling thread, kept between
+    // calls so updates do not allocate.
+    static uint32_t* scratch(size_t size) {
+        thread_local std::vector<uint32_t> pixels;
+        if (pixels.size() < size)
+            pixels.resize(size);
+        return pixels.data();
+    }
+};
+
+} // namespace raytrace
+
+#endif // DISPLAYBUFFER_H
@@ -0,0 +1,918 @@
+#ifndef DISTRIBUTED_H
+#define DISTRIBUTED_H
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Common.hpp"
+
+#include "Bvh.hpp"
+#include "Framebuffer.hpp"
+#include "Light.hpp"
+#include "MappedFile.hpp"
+#include "Options.hpp"
+#include "SceneFile.hpp"
+#include "Scenes.hpp"
+#include "Simd.hpp"
+#include "ThreadPool.hpp"
+#include "TileRenderer.hpp"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define RAYTRACE_SOCKETS 1
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#else
+#define RAYTRACE_SOCKETS 0
+#endif
+
+namespace raytrace {
+
+// Rendering across processes: a coordinator holds the scene and the
+// accumulation buffer, workers connect to it over TCP ("host:port") or a
+// Unix socket ("unix:/path"), receive the scene once and then render tiles
+// it hands out, a few at a time so none sits idle between results. Samples
+// are seeded by pixel and index, so a tile handed to a second worker after
+// the first one dropped comes back with the same pixels.
+//
+// Messages are a MessageHeader and its payload, in the byte order of the
+// machines involved, which must agree.
+
+enum class MessageType : uint32_t {
+    Hello = 1, // Worker: magic, version, threads.
+    Job,       // Coordinator: render settings and the scene.
+    Tile,      // Coordinator: tile id, bounds, sample range and frame.
+    Result,    // Worker: tile id, rays, seconds, then RGB sums as floats.
+    Bye,       // Coordinator: no more tiles.
+};
+
+struct MessageHeader {
+    uint32_t type;
+    uint32_t reserved;
+    uint64_t size; // Of the payload that follows.
+};
+
+constexpr uint32_t distributedMagic = 0x52415954; // "RAYT"
+constexpr uint32_t distributedVersion = 3;
+
+// Largest payload either side accepts, so a corrupt or hostile size cannot
+// make the reader allocate without bound.
+constexpr uint64_t maxMessageSize = uint64_t(1) << 30;
+
+// Payload built field by field.
+class MessageWriter {
+  public:
+    template <class V> void put(const V& value) {
+        const uint8_t* p = reinterpret_cast<const uint8_t*>(&value);
+        bytes.insert(bytes.end(), p, p + sizeof(V));
+    }
+
+    void putBytes(const void* data, size_t size) {
+        put(uint64_t(size));
+        const uint8_t* p = static_cast<const uint8_t*>(data);
+        bytes.insert(bytes.end(), p, p + size);
+    }
+
+    void putString(const std::string& s) { putBytes(s.data(), s.size()); }
+
+    std::vector<uint8_t> bytes;
+};
+
+// Reads a payload back in the order it was written. Running past the end
+// clears ok and returns zeros.
+class MessageReader {
+  public:
+    MessageReader(const uint8_t* data, size_t size)
+        : p(data), end(data + size) {}
+
+    template <class V> V get() {
+        V value{};
+        if (size_t(end - p) < sizeof(V)) {
+            ok = false;
+            return value;
+        }
+        std::memcpy(&value, p, sizeof(V));
+        p += sizeof(V);
+        return value;
+    }
+
+    std::vector<uint8_t> getBytes() {
+        uint64_t size = get<uint64_t>();
+        if (uint64_t(end - p) < size) {
+            ok = false;
+            return {};
+        }
+        std::vector<uint8_t> out(p, p + size);
+        p += size;
+        return out;
+    }
+
+    std::string getString() {
+        auto b = getBytes();
+        return std::string(b.begin(), b.end());
+    }
+
+    const uint8_t* rest() const { return p; }
+    size_t remaining() const { return size_t(end - p); }
+
+    bool ok = true;
+
+  private:
+    const uint8_t* p;
+    const uint8_t* end;
+};
+
+// What every worker needs to render: settings, and the scene as the
+// coordinator read it, a file's bytes or the name of a builtin.
+struct DistributedJob {
+    RenderSettings settings;
+    bool lightSampling = true;
+    SimdLevel simd = SimdLevel::Scalar;
+    Precision precision = Precision::Float;
+    std::string builtin; // Used when sceneBytes is empty.
+    bool packed = false;
+    std::string directory; // Meshes in the scene file are relative to it.
+    std::vector<uint8_t> sceneBytes;
+
+    // The scene the options name. Only a file's bytes travel, so meshes it
+    // refers to must be at the same paths on every worker.
+    bool fromOptions(const Options& options,
+                     const RenderSettings& renderSettings,
+                     std::string& error) {
+        settings = renderSettings;
+        lightSampling = options.lightSampling;
+        simd = activeSimd();
+        precision = options.precision;
+        builtin = options.builtin;
+        packed = options.packed;
+        if (options.scene.empty())
+            return true;
+
+        std::ifstream file(options.scene, std::ios::binary | std::ios::ate);
+        if (!file) {
+            error = "could not open " + options.scene;
+            return false;
+        }
+        sceneBytes.resize(static_cast<size_t>(file.tellg()));
+        file.seekg(0);
+        file.read(reinterpret_cast<char*>(sceneBytes.data()),
+                  sceneBytes.size());
+        auto slash = options.scene.find_last_of('/');
+        directory = slash == std::string::npos
+                        ? ""
+                        : options.scene.substr(0, slash);
+        return static_cast<bool>(file);
+    }
+
+    std::vector<uint8_t> encode() const {
+        MessageWriter w;
+        w.put(int32_t(settings.width));
+        w.put(int32_t(settings.height));
+        w.put(int32_t(settings.samplesPerPixel));
+        w.put(int32_t(settings.maxDepth));
+        w.put(int32_t(settings.rouletteDepth));
+        w.put(int32_t(settings.tileSize));
+        w.put(uint64_t(settings.frame));
+        w.put(uint32_t(settings.integrator));
+        w.put(uint32_t(settings.sampler));
+        w.put(uint8_t(lightSampling));
+        w.put(uint8_t(simd));
+        w.put(uint8_t(precision));
+        w.put(uint8_t(packed));
+        w.putString(builtin);
+        w.putString(directory);
+        w.putBytes(sceneBytes.data(), sceneBytes.size());
+        return w.bytes;
+    }
+
+    bool decode(MessageReader& r) {
+        settings.width = r.get<int32_t>();
+        settings.height = r.get<int32_t>();
+        settings.samplesPerPixel = r.get<int32_t>();
+        settings.maxDepth = r.get<int32_t>();
+        settings.rouletteDepth = r.get<int32_t>();
+        settings.tileSize = r.get<int32_t>();
+        settings.frame = r.get<uint64_t>();
+        settings.integrator = static_cast<IntegratorKind>(r.get<uint32_t>());
+        settings.sampler = static_cast<SamplerKind>(r.get<uint32_t>());
+        lightSampling = r.get<uint8_t>() != 0;
+        simd = static_cast<SimdLevel>(r.get<uint8_t>());
+        precision = static_cast<Precision>(r.get<uint8_t>());
+        packed = r.get<uint8_t>() != 0;
+        builtin = r.getString();
+        directory = r.getString();
+        sceneBytes = r.getBytes();
+        return r.ok && settings.width > 0 && settings.height > 0 &&
+               settings.tileSize > 0;
+    }
+};
+
+#if RAYTRACE_SOCKETS
+
+namespace net {
+
+#ifdef MSG_NOSIGNAL
+constexpr int sendFlags = MSG_NOSIGNAL; // A dead peer is an error, not a signal.
+#else
+constexpr int sendFlags = 0;
+#endif
+
+inline bool isUnix(const std::string& address) {
+    return address.compare(0, 5, "unix:") == 0;
+}
+
+inline bool unixAddress(const std::string& address, sockaddr_un& sa,
+                        std::string& error) {
+    std::string path = address.substr(5);
+    std::memset(&sa, 0, sizeof(sa));
+    if (path.empty() || path.size() >= sizeof(sa.sun_path)) {
+        error = "bad socket path in " + address;
+        return false;
+    }
+    sa.sun_family = AF_UNIX;
+    std::memcpy(sa.sun_path, path.c_str(), path.size() + 1);
+    return true;
+}
+
+// Addresses for "host:port", an empty host meaning any interface.
+inline addrinfo* tcpAddresses(const std::string& address, bool passive,
+                              std::string& error) {
+    auto colon = address.find_last_of(':');
+    if (colon == std::string::npos) {
+        error = "expected host:port or unix:path, got " + address;
+        return nullptr;
+    }
+    std::string host = address.substr(0, colon);
+    std::string port = address.substr(colon + 1);
+    addrinfo hints;
+    std::memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = passive ? AI_PASSIVE : 0;
+    addrinfo* list = nullptr;
+    int rc = getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(),
+                         &hints, &list);
+    if (rc != 0) {
+        error = address + ": " + gai_strerror(rc);
+        return nullptr;
+    }
+    return list;
+}
+
+// Tiles are small messages, so do not wait to fill packets.
+inline void noDelay(int fd) {
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+// Listening socket, or -1 with a message in error.
+inline int listenOn(const std::string& address, std::string& error) {
+    if (isUnix(address)) {
+        sockaddr_un sa;
+        if (!unixAddress(address, sa, error))
+            return -1;
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        unlink(sa.sun_path);
+        if (fd < 0 || bind(fd, reinterpret_cast<sockaddr*>(&sa),
+                           sizeof(sa)) != 0 || listen(fd, 64) != 0) {
+            error = address + ": " + std::strerror(errno);
+            if (fd >= 0)
+                close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    addrinfo* list = tcpAddresses(address, true, error);
+    if (!list)
+        return -1;
+    int fd = -1;
+    for (addrinfo* a = list; a && fd < 0; a = a->ai_next) {
+        fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+        if (fd < 0)
+            continue;
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (bind(fd, a->ai_addr, a->ai_addrlen) != 0 || listen(fd, 64) != 0) {
+            error = address + ": " + std::strerror(errno);
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(list);
+    return fd;
+}
+
+// Connected socket, or -1 with a message in error.
+inline int connectTo(const std::string& address, std::string& error) {
+    if (isUnix(address)) {
+        sockaddr_un sa;
+        if (!unixAddress(address, sa, error))
+            return -1;
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0 || connect(fd, reinterpret_cast<sockaddr*>(&sa),
+                              sizeof(sa)) != 0) {
+            error = address + ": " + std::strerror(errno);
+            if (fd >= 0)
+                close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    addrinfo* list = tcpAddresses(address, false, error);
+    if (!list)
+        return -1;
+    int fd = -1;
+    for (addrinfo* a = list; a && fd < 0; a = a->ai_next) {
+        fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+        if (fd < 0)
+            continue;
+        if (connect(fd, a->ai_addr, a->ai_addrlen) != 0) {
+            error = address + ": " + std::strerror(errno);
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(list);
+    if (fd >= 0)
+        noDelay(fd);
+    return fd;
+}
+
+inline bool sendAll(int fd, const void* data, size_t size) {
+    const char* p = static_cast<const char*>(data);
+    while (size > 0) {
+        ssize_t n = send(fd, p, size, sendFlags);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        size -= size_t(n);
+    }
+    return true;
+}
+
+inline bool recvAll(int fd, void* data, size_t size) {
+    char* p = static_cast<char*>(data);
+    while (size > 0) {
+        ssize_t n = recv(fd, p, size, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        size -= size_t(n);
+    }
+    return true;
+}
+
+inline bool sendMessage(int fd, MessageType type,
+                        const std::vector<uint8_t>& payload) {
+    MessageHeader header{uint32_t(type), 0, payload.size()};
+    return sendAll(fd, &header, sizeof(header)) &&
+           sendAll(fd, payload.data(), payload.size());
+}
+
+inline bool recvMessage(int fd, MessageType& type,
+                        std::vector<uint8_t>& payload) {
+    MessageHeader header;
+    if (!recvAll(fd, &header, sizeof(header)))
+        return false;
+    type = static_cast<MessageType>(header.type);
+    if (header.size > maxMessageSize)
+        return false;
+    payload.resize(header.size);
+    return recvAll(fd, payload.data(), payload.size());
+}
+
+} // namespace net
+
+// Hands out tiles to whichever workers are connected and adds their
+// results into the caller's framebuffer. Workers may join at any time; one
+// that drops has its outstanding tiles handed out again.
+template <class T> class TileCoordinator {
+  public:
+    explicit TileCoordinator(const DistributedJob& job)
+        : job(job), jobMessage(job.encode()), tiles(makeTiles(job.settings)) {}
+
+    TileCoordinator(const TileCoordinator&) = delete;
+    TileCoordinator& operator=(const TileCoordinator&) = delete;
+
+    ~TileCoordinator() {
+        for (auto& w : workers)
+            if (w.fd >= 0) {
+                net::sendMessage(w.fd, MessageType::Bye, {});
+                close(w.fd);
+            }
+        if (listenFd >= 0)
+            close(listenFd);
+        if (net::isUnix(address))
+            unlink(address.c_str() + 5);
+        for (pid_t pid : children)
+            waitpid(pid, nullptr, 0);
+    }
+
+    bool listen(const std::string& where, std::string& error) {
+        if (jobMessage.size() > maxMessageSize) {
+            error = "Scene too large to send to workers";
+            return false;
+        }
+        address = where;
+        listenFd = net::listenOn(address, error);
+        return listenFd >= 0;
+    }
+
+    // Start count workers on this machine, the same executable with
+    // --worker, of threads threads each (0 shares out the cores).
+    bool spawnWorkers(int count, unsigned threads, const char* program,
+                      std::string& error) {
+        if (count <= 0)
+            return true;
+        if (threads == 0)
+            threads = std::max(1u, std::thread::hardware_concurrency() /
+                                       unsigned(count));
+        std::string threadArg = std::to_string(threads);
+        for (int i = 0; i < count; ++i) {
+            pid_t pid = fork();
+            if (pid < 0) {
+                error = std::string("fork: ") + std::strerror(errno);
+                return false;
+            }
+            if (pid == 0) {
+                const char* args[] = {program, "--worker", address.c_str(),
+                                      "--threads", threadArg.c_str(), nullptr};
+                char** argv = const_cast<char**>(args);
+                execv("/proc/self/exe", argv);
+                execvp(program, argv);
+                _exit(127);
+            }
+            children.push_back(pid);
+        }
+        spawned = true;
+        return true;
+    }
+
+    // Add samples [sampleBegin, sampleEnd) of every pixel to fb, as
+    // TileRenderer::render does, with onTileDone(const Tile&) invoked on
+    // the calling thread as results arrive. Waits for workers if none are
+    // connected, false if none can come any more: every spawned one has
+    // exited and nothing else is connected.
+    template <class F>
+    bool render(Framebuffer<T>& fb, int sampleBegin, int sampleEnd,
+                F onTileDone, std::string& error) {
+        auto start = std::chrono::steady_clock::now();
+        std::deque<uint32_t> pending;
+        for (uint32_t i = 0; i < tiles.size(); ++i)
+            pending.push_back(i);
+        std::vector<uint8_t> finished(tiles.size(), 0);
+        size_t completed = 0;
+        bool waiting = false;
+
+        while (completed < tiles.size()) {
+            // Top every worker up to twice its threads in flight, so its
+            // pool stays busy while results travel.
+            size_t alive = 0, connected = 0;
+            for (size_t k = 0; k < workers.size(); ++k) {
+                Worker& w = workers[k];
+                if (w.fd >= 0)
+                    connected++;
+                if (w.fd < 0 || w.threads == 0)
+                    continue;
+                alive++;
+                while (!pending.empty() &&
+                       w.inFlight.size() < 2 * size_t(w.threads)) {
+                    uint32_t id = pending.front();
+                    if (!sendTile(w, id, sampleBegin, sampleEnd)) {
+                        drop(k, pending);
+                        break;
+                    }
+                    pending.pop_front();
+                }
+            }
+            if (connected == 0 && spawned && !reapChildren()) {
+                error = "All workers have exited";
+                return false;
+            }
+            if (alive == 0 && !waiting) {
+                std::cerr << "Waiting for workers on " << address << std::endl;
+                waiting = true;
+            }
+
+            std::vector<pollfd> fds;
+            std::vector<size_t> owners;
+            fds.push_back({listenFd, POLLIN, 0});
+            for (size_t k = 0; k < workers.size(); ++k) {
+                if (workers[k].fd < 0)
+                    continue;
+                fds.push_back({workers[k].fd, POLLIN, 0});
+                owners.push_back(k);
+            }
+            // Wake now and then while waiting on spawned workers, to notice
+            // any that exit before connecting.
+            int timeout = connected == 0 && spawned ? 100 : -1;
+            int ready = poll(fds.data(), fds.size(), timeout);
+            if (ready < 0) {
+                if (errno == EINTR)
+                    continue;
+                error = std::string("poll: ") + std::strerror(errno);
+                return false;
+            }
+            if (ready == 0)
+                continue;
+
+            if (fds[0].revents & POLLIN)
+                accept();
+            for (size_t i = 1; i < fds.size(); ++i) {
+                if (!fds[i].revents)
+                    continue;
+                size_t k = owners[i - 1];
+                if (!receive(workers[k])) {
+                    drop(k, pending);
+                    continue;
+                }
+                if (!handle(k, fb, finished, completed, onTileDone))
+                    drop(k, pending);
+            }
+        }
+
+        std::chrono::duration<double> elapsed =
+            std::chrono::steady_clock::now() - start;
+        wallSeconds += elapsed.count();
+        passCount++;
+        return true;
+    }
+
+    size_t passes() const { return passCount; }
+    double seconds() const { return wallSeconds; }
+
+    // Per worker throughput over every render() so far.
+    void printStats(std::ostream& out) const {
+        size_t tilesDone = 0;
+        uint64_t rays = 0, bytes = 0;
+        for (const auto& w : workers) {
+            tilesDone += w.tiles;
+            rays += w.rays;
+            bytes += w.bytes;
+        }
+        out << "Tiles: " << tilesDone << " (" << job.settings.tileSize
+            << "px) on " << workers.size() << " workers in " << std::fixed
+            << std::setprecision(3) << wallSeconds << "s, "
+            << tilesDone / wallSeconds << " tiles/s, "
+            << rays / wallSeconds * 1e-6 << " Mrays/s ("
+            << integratorName(job.settings.integrator) << "), "
+            << reissued << " re-issued, " << bytes / double(1 << 20)
+            << " MiB of results\n";
+        for (size_t k = 0; k < workers.size(); ++k) {
+            const Worker& w = workers[k];
+            double busy = w.threads ? w.busySeconds / w.threads : 0;
+            out << "  worker " << k << " (" << w.threads << " threads"
+                << (w.fd < 0 ? ", lost" : "") << "): " << w.tiles
+                << " tiles, " << w.tiles / wallSeconds << " tiles/s, "
+                << w.rays / wallSeconds * 1e-6 << " Mrays/s, "
+                << 100.0 * busy / wallSeconds << "% busy\n";
+        }
+        out << std::defaultfloat << std::flush;
+    }
+
+  private:
+    struct Worker {
+        int fd = -1;
+        unsigned threads = 0; // 0 until its Hello arrives.
+        std::vector<uint8_t> inbox;
+        std::vector<uint32_t> inFlight;
+        size_t tiles = 0;
+        uint64_t rays = 0;
+        uint64_t bytes = 0;
+        double busySeconds = 0; // Summed over its threads.
+    };
+
+    DistributedJob job;
+    std::vector<uint8_t> jobMessage;
+    std::vector<Tile> tiles;
+    std::string address;
+    int listenFd = -1;
+    std::vector<Worker> workers;
+    std::vector<pid_t> children;
+    bool spawned = false;
+    size_t reissued = 0;
+    double wallSeconds = 0;
+    size_t passCount = 0;
+
+    void accept() {
+        int fd = ::accept(listenFd, nullptr, nullptr);
+        if (fd < 0)
+            return;
+        if (!net::isUnix(address))
+            net::noDelay(fd);
+        Worker w;
+        w.fd = fd;
+        workers.push_back(std::move(w));
+    }
+
+    // Wait for any spawned workers that have exited, true while some still
+    // run.
+    bool reapChildren() {
+        children.erase(std::remove_if(children.begin(), children.end(),
+                                      [](pid_t pid) {
+                                          return waitpid(pid, nullptr,
+                                                         WNOHANG) == pid;
+                                      }),
+                       children.end());
+        return !children.empty();
+    }
+
+    bool sendTile(Worker& w, uint32_t id, int sampleBegin, int sampleEnd) {
+        const Tile& t = tiles[id];
+        MessageWriter m;
+        m.put(id);
+        m.put(int32_t(t.x0));
+        m.put(int32_t(t.y0));
+        m.put(int32_t(t.x1));
+        m.put(int32_t(t.y1));
+        m.put(int32_t(sampleBegin));
+        m.put(int32_t(sampleEnd));
+        m.put(uint64_t(job.settings.frame));
+        if (!net::sendMessage(w.fd, MessageType::Tile, m.bytes))
+            return false;
+        w.inFlight.push_back(id);
+        return true;
+    }
+
+    // Close a worker's connection and queue its tiles again, first so the
+    // frame does not wait on them at the end.
+    void drop(size_t k, std::deque<uint32_t>& pending) {
+        Worker& w = workers[k];
+        if (w.fd < 0)
+            return;
+        close(w.fd);
+        w.fd = -1;
+        if (!w.inFlight.empty())
+            std::cerr << "\nWorker " << k << " lost, re-issuing "
+                      << w.inFlight.size() << " tiles" << std::endl;
+        for (auto it = w.inFlight.rbegin(); it != w.inFlight.rend(); ++it)
+            pending.push_front(*it);
+        reissued += w.inFlight.size();
+        w.inFlight.clear();
+        w.inbox.clear();
+    }
+
+    // Read what the socket has, false once the worker has gone.
+    bool receive(Worker& w) {
+        uint8_t buffer[1 << 16];
+        ssize_t n = recv(w.fd, buffer, sizeof(buffer), 0);
+        if (n < 0 && errno == EINTR)
+            return true;
+        if (n <= 0)
+            return false;
+        w.inbox.insert(w.inbox.end(), buffer, buffer + n);
+        return true;
+    }
+
+    // Act on the complete messages in a worker's inbox, false if it broke
+    // the protocol.
+    template <class F>
+    bool handle(size_t k, Framebuffer<T>& fb, std::vector<uint8_t>& finished,
+                size_t& completed, F& onTileDone) {
+        Worker& w = workers[k];
+        size_t used = 0;
+        while (w.inbox.size() - used >= sizeof(MessageHeader)) {
+            MessageHeader header;
+            std::memcpy(&header, w.inbox.data() + used, sizeof(header));
+            if (header.size > maxMessageSize)
+                return false;
+            if (w.inbox.size() - used - sizeof(header) < header.size)
+                break;
+            MessageReader r(w.inbox.data() + used + sizeof(header),
+                            header.size);
+            used += sizeof(header) + header.size;
+
+            if (MessageType(header.type) == MessageType::Hello) {
+                uint32_t magic = r.get<uint32_t>();
+                uint32_t version = r.get<uint32_t>();
+                uint32_t threads = r.get<uint32_t>();
+                if (!r.ok || magic != distributedMagic ||
+                    version != distributedVersion || threads == 0)
+                    return false;
+                if (!net::sendMessage(w.fd, MessageType::Job, jobMessage))
+                    return false;
+                w.threads = threads;
+                std::cerr << "\nWorker " << k << " joined with " << threads
+                          << " threads" << std::endl;
+            } else if (MessageType(header.type) == MessageType::Result) {
+                uint32_t id = r.get<uint32_t>();
+                uint64_t rays = r.get<uint64_t>();
+                double busy = r.get<double>();
+                auto it = std::find(w.inFlight.begin(), w.inFlight.end(), id);
+                if (!r.ok || it == w.inFlight.end())
+                    return false;
+                const Tile& t = tiles[id];
+                size_t floats = size_t(t.width()) * t.height() * 3;
+                if (r.remaining() != floats * sizeof(float))
+                    return false;
+                w.inFlight.erase(it);
+                w.tiles++;
+                w.rays += rays;
+                w.busySeconds += busy;
+                w.bytes += header.size;
+                if (finished[id])
+                    continue;
+
+                const uint8_t* p = r.rest();
+                for (int y = t.y0; y < t.y1; ++y)
+                    for (int x = t.x0; x < t.x1; ++x) {
+                        float c[3];
+                        std::memcpy(c, p, sizeof(c));
+                        p += sizeof(c);
+                        fb.at(x, y) += Color<T>(c[0], c[1], c[2]);
+                    }
+                finished[id] = 1;
+                completed++;
+                onTileDone(t);
+            } else {
+                return false;
+            }
+        }
+        w.inbox.erase(w.inbox.begin(), w.inbox.begin() + used);
+        return true;
+    }
+};
+
+// Worker side, once the job is in: build the scene it names in precision T
+// and render tiles until the coordinator says Bye or goes away.
+template <class T>
+bool serveTiles(int fd, ThreadPool& pool, DistributedJob& job) {
+    std::string error;
+    Scene<T> scene;
+    bool loaded;
+    if (job.sceneBytes.empty()) {
+        loaded = builtinScene(job.builtin, scene, job.packed);
+        error = "unknown scene " + job.builtin;
+    } else {
+        auto file = std::make_shared<MappedFile>();
+        file->assign(std::move(job.sceneBytes));
+        loaded = loadSceneData(file, job.directory, scene, error);
+    }
+    if (!loaded) {
+        std::cerr << error << std::endl;
+        return false;
+    }
+
+    Bvh<T> world(scene.objects);
+    LightList<T> lights(scene.objects, scene.materials);
+    TileRenderer<T> renderer(pool, job.settings);
+    if (job.lightSampling && !lights.empty())
+        renderer.setLights(&lights);
+    auto cam = scene.animation.camera(scene.camera, 0)
+                   .camera(T(job.settings.width) / job.settings.height);
+    Framebuffer<T> fb(job.settings.width, job.settings.height);
+    std::mutex sendMutex;
+
+    // Results go out from the pool threads as tiles finish, while this
+    // thread keeps reading so the coordinator never blocks on us.
+    MessageType type;
+    std::vector<uint8_t> payload;
+    while (net::recvMessage(fd, type, payload) && type == MessageType::Tile) {
+        MessageReader r(payload.data(), payload.size());
+        uint32_t id = r.get<uint32_t>();
+        int x0 = r.get<int32_t>(), y0 = r.get<int32_t>();
+        int x1 = r.get<int32_t>(), y1 = r.get<int32_t>();
+        Tile tile(x0, y0, x1, y1);
+        int sampleBegin = r.get<int32_t>();
+        int sampleEnd = r.get<int32_t>();
+        uint64_t frame = r.get<uint64_t>();
+        if (!r.ok || frame != job.settings.frame || tile.x0 < 0 ||
+            tile.y0 < 0 || tile.x1 > fb.width() || tile.y1 > fb.height() ||
+            tile.width() <= 0 || tile.height() <= 0)
+            break;
+
+        pool.submit([=, &renderer, &world, &scene, &cam, &fb, &sendMutex] {
+            auto start = std::chrono::steady_clock::now();
+            uint64_t raysBefore = raysTraced();
+            for (int y = tile.y0; y < tile.y1; ++y)
+                for (int x = tile.x0; x < tile.x1; ++x)
+                    fb.at(x, y) = Color<T>(0, 0, 0);
+            renderer.renderSingleTile(tile, world, scene.materials, cam, fb,
+                                      sampleBegin, sampleEnd);
+            std::chrono::duration<double> busy =
+                std::chrono::steady_clock::now() - start;
+
+            MessageWriter m;
+            m.put(id);
+            m.put(uint64_t(raysTraced() - raysBefore));
+            m.put(busy.count());
+            m.bytes.reserve(m.bytes.size() +
+                            size_t(tile.width()) * tile.height() * 3 *
+                                sizeof(float));
+            for (int y = tile.y0; y < tile.y1; ++y)
+                for (int x = tile.x0; x < tile.x1; ++x) {
+                    const Color<T>& c = fb.at(x, y);
+                    m.put(float(c.x()));
+                    m.put(float(c.y()));
+                    m.put(float(c.z()));
+                }
+            std::lock_guard<std::mutex> lock(sendMutex);
+            net::sendMessage(fd, MessageType::Result, m.bytes);
+        });
+    }
+    pool.wait();
+    return true;
+}
+
+// Worker side: connect to the coordinator at address, build the scene it
+// sends and render tiles until it says Bye or goes away. Returns false if
+// it never got as far as rendering.
+inline bool runWorker(const std::string& address, unsigned threads) {
+    // The coordinator may still be starting, give it a few seconds.
+    std::string error;
+    int fd = -1;
+    for (int attempt = 0; attempt < 50 && fd < 0; ++attempt) {
+        fd = net::connectTo(address, error);
+        if (fd < 0)
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    if (fd < 0) {
+        std::cerr << error << std::endl;
+        return false;
+    }
+
+    ThreadPool pool(threads);
+    MessageWriter hello;
+    hello.put(distributedMagic);
+    hello.put(distributedVersion);
+    hello.put(uint32_t(pool.size()));
+    MessageType type;
+    std::vector<uint8_t> payload;
+    if (!net::sendMessage(fd, MessageType::Hello, hello.bytes) ||
+        !net::recvMessage(fd, type, payload) || type != MessageType::Job) {
+        std::cerr << address << ": no job from the coordinator" << std::endl;
+        close(fd);
+        return false;
+    }
+    DistributedJob job;
+    MessageReader jobReader(payload.data(), payload.size());
+    if (!job.decode(jobReader)) {
+        std::cerr << address << ": malformed job" << std::endl;
+        close(fd);
+        return false;
+    }
+    setSimd(job.simd);
+
+    bool served = job.precision == Precision::Double
+                      ? serveTiles<double>(fd, pool, job)
+                      : serveTiles<float>(fd, pool, job);
+    close(fd);
+    return served;
+}
+
+#else
+
+template <class T> class TileCoordinator {
+  public:
+    explicit TileCoordinator(const DistributedJob&) {}
+    bool listen(const std::string&, std::string& error) {
+        error = "distributed rendering needs POSIX sockets";
+        return false;
+    }
+    bool spawnWorkers(int, unsigned, const char*, std::string&) {
+        return false;
+    }
+    template <class F>
+    bool render(Framebuffer<T>&, int, int, F, std::string& error) {
+        error = "distributed rendering needs POSIX sockets";
+        return false;
+    }
+    size_t passes() const { return 0; }
+    double seconds() const { return 0; }
+    void printStats(std::ostream&) const {}
+};
+
+inline bool runWorker(const std::string&, unsigned) {
+    std::cerr << "distributed rendering needs POSIX sockets" << std::endl;
+    return false;
+}
+
+#endif // RAYTRACE_SOCKETS
+
+} // namespace raytrace
+
+#endif // DISTRIBUTED_H
@@ -0,0 +1,126 @@
+#ifndef FRAMEBUFFER_H
+#define FRAMEBUFFER_H
+
+#include <algorithm>
+#include <vector>
+
+#include "Pixel.hpp"
+#include "Profile.hpp"
+#include "Vec3.hpp"
+
+namespace raytrace {
+
+// Floating point accumulation buffer. Each pixel holds the sum of its
+// samples so far, in bottom left coordinates.
+template <class T> class Framebuffer {
+  public:
+    Framebuffer(int width, int height)
+        : w(width), h(height), accum(size_t(width) * height) {}
+
+    int width() const { return w; }
+    int height() const { return h; }
+
+    Color<T>& at(int x, int y) { return accum[size_t(y) * w + x]; }
+    const Color<T>& at(int x, int y) const { return accum[size_t(y) * w + x]; }
+
+    // Samples accumulated into every pixel.
+    int samples() const { return sampleCount; }
+    void addSamples(int n) { sampleCount += n; }
+
+    void clear() {
+        std::fill(accum.begin(), accum.end(), Color<T>(0, 0, 0));
+        sampleCount = 0;
+    }
+
+    // Pixels of [x0, x1) x [y0, y1), for PixelWindow::setPixels.
+    std::vector<Pixel<T>> pixels(int x0, int y0, int x1, int y1) const {
+        ScopedTimer timer(Stage::Pixels);
+        std::vector<Pixel<T>> out;
+        out.reserve(size_t(x1 - x0) * (y1 - y0));
+        for (int y = y1 - 1; y >= y0; --y)
+            for (int x = x0; x < x1; ++x)
+                out.emplace_back(Point2<int>(x, y), at(x, y));
+        return out;
+    }
+
+    std::vector<Pixel<T>> pixels() const { return pixels(0, 0, w, h); }
+
+  private:
+    int w, h;
+    std::vector<Color<T>> accum;
+    int sampleCount = 0;
+};
+
+// What a camera ray first hits, to guide the denoiser: the surface's
+// albedo, its unit normal and its distance. A ray that escapes sees a
+// white albedo, no normal and depth 0.
+template <class T> struct Features {
+    Color<T> albedo;
+    Vec3<T> normal;
+    T depth = 0;
+
+    Features& operator+=(const Features& f) {
+        albedo += f.albedo;
+        normal += f.normal;
+        depth += f.depth;
+        return *this;
+    }
+};
+
+// Auxiliary buffers beside a Framebuffer, holding the sums of the first
+// hit features of the same samples.
+template <class T> class FeatureBuffer {
+  public:
+    FeatureBuffer(int width, int height)
+        : w(width), h(height), accum(size_t(width) * height) {}
+
+    int width() const { return w; }
+    int height() const { return h; }
+
+    Features<T>& at(int x, int y) { return accum[size_t(y) * w + x]; }
+    const Features<T>& at(int x, int y) const {
+        return accum[size_t(y) * w + x];
+    }
+
+    void clear() { std::fill(accum.begin(), accum.end(), Features<T>()); }
+
+    // The albedo, normal (mapped to 0..1) and depth (over the deepest) of
+    // samples as images, for writing out.
+    Framebuffer<T> albedo(int samples) const {
+        return image(samples, [](const Features<T>& f) { return f.albedo; });
+    }
+
+    Framebuffer<T> normal(int samples) const {
+        return image(samples, [=](const Features<T>& f) {
+            return T(0.5) * (f.normal + T(samples) * Vec3<T>(1, 1, 1));
+        });
+    }
+
+    Framebuffer<T> depth(int samples) const {
+        T deepest = 0;
+        for (const auto& f : accum)
+            deepest = std::max(deepest, f.depth);
+        T scale = deepest > 0 ? samples / deepest : 0;
+        return image(samples, [&](const Features<T>& f) {
+            return f.depth * scale * Color<T>(1, 1, 1);
+        });
+    }
+
+  private:
+    int w, h;
+    std::vector<Features<T>> accum;
+
+    // The images are sums over samples, as a Framebuffer holds them.
+    template <class F> Framebuffer<T> image(int samples, F value) const {
+        Framebuffer<T> out(w, h);
+        for (int y = 0; y < h; ++y)
+            for (int x = 0; x < w; ++x)
+                out.at(x, y) = value(at(x, y));
+        out.addSamples(samples);
+        return out;
+    }
+};
+
+} // namespace raytrace
+
+#endif // FRAMEBUFFER_H
@@ -0,0 +1,359 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "Common.hpp"
+
+#include "Adaptive.hpp"
+#include "Bvh.hpp"
+#include "Denoiser.hpp"
+#include "Distributed.hpp"
+#include "Framebuffer.hpp"
+#include "ImageWriter.hpp"
+#include "Options.hpp"
+#include "SceneFile.hpp"
+#include "Scenes.hpp"
+#include "Sequence.hpp"
+#include "ThreadPool.hpp"
+#include "TileRenderer.hpp"
+
+using namespace raytrace;
+
+// Tiles rendered by worker processes and gathered here, in passes when
+// progressive.
+template <class T>
+static int renderDistributed(const Options& options,
+                             const RenderSettings& settings,
+                             const char* program) {
+    std::string error;
+    DistributedJob job;
+    if (!job.fromOptions(options, settings, error)) {
+        std::cerr << error << std::endl;
+        return 1;
+    }
+    TileCoordinator<T> coordinator(job);
+    if (!coordinator.listen(options.coordinator, error) ||
+        !coordinator.spawnWorkers(options.spawnWorkers, options.threads,
+                                  program, error)) {
+        std::cerr << error << std::endl;
+        return 1;
+    }
+
+    Framebuffer<T> fb(settings.width, settings.height);
+    auto start = std::chrono::high_resolution_clock::now();
+    int passSamples = options.progressive ? options.passSamples()
+                                          : settings.samplesPerPixel;
+    while (fb.samples() < settings.samplesPerPixel) {
+        int first = fb.samples();
+        int last = std::min(settings.samplesPerPixel, first + passSamples);
+        size_t tilesDone = 0;
+        if (!coordinator.render(fb, first, last, [&](const Tile&) {
+                std::cerr << "\rSamples " << last << ", tiles: "
+                          << ++tilesDone << ' ' << std::flush;
+            }, error)) {
+            std::cerr << '\n' << error << std::endl;
+            return 1;
+        }
+        fb.addSamples(last - first);
+
+        std::chrono::duration<double> elapsed =
+            std::chrono::high_resolution_clock::now() - start;
+        if (options.timeBudget > 0 && elapsed.count() >= options.timeBudget)
+            break;
+    }
+
+    std::chrono::duration<double> elapsed =
+        std::chrono::high_resolution_clock::now() - start;
+    std::cerr << "\nCompleted: " << fb.samples() << " spp in "
+              << elapsed.count() << "s\n"
+              << std::flush;
+    coordinator.printStats(std::cerr);
+
+    ImageWriter<T> writer;
+    writer.submit(fb, options.outputs, options.resolve);
+    return writer.flush() ? 0 : 1;
+}
+
+// Frames of the scene's animation, each frame's files written while the
+// next one renders.
+template <class T>
+static int renderSequence(const Options& options, Scene<T>& scene,
+                          Bvh<T>& world, const RenderSettings& settings) {
+    int last = options.lastFrame >= 0 ? options.lastFrame
+                                      : std::max(1, scene.animation.frames) - 1;
+    ThreadPool pool(options.threads);
+    SequenceRenderer<T> sequence(scene, world, pool, settings,
+                                 options.lightSampling, options.rebuildBvh);
+    Framebuffer<T> fb(settings.width, settings.height);
+    ImageWriter<T> writer;
+    for (int frame = options.firstFrame; frame <= last; ++frame) {
+        sequence.render(frame, fb, [](const Tile&) {});
+        sequence.printFrame(std::cerr);
+        printProfile(std::cerr, sequence.frameStats().back().rays);
+
+        std::vector<std::string> paths;
+        for (const auto& output : options.outputs)
+            paths.push_back(framePath(output, frame));
+        writer.throttle(1);
+        writer.submit(fb, paths, options.resolve);
+    }
+    sequence.printSummary(std::cerr);
+    return writer.flush() ? 0 : 1;
+}
+
+// One frame, or the frames of a sequence, in precision T.
+template <class T>
+static int render(const Options& options, const char* program) {
+    Scene<T> scene;
+    if (!loadOptionsScene(options, scene))
+        return 1;
+    if (!options.saveScene.empty()) {
+        std::string error;
+        if (!saveScene(options.saveScene, scene, error)) {
+            std::cerr << error << std::endl;
+            return 1;
+        }
+    }
+    RenderSettings settings = sceneSettings(options, scene);
+
+    if (!options.coordinator.empty())
+        return renderDistributed<T>(options, settings, program);
+    Bvh<T> world(scene.objects);
+    world.setCollectStats(true);
+    if (options.sequence)
+        return renderSequence(options, scene, world, settings);
+
+    // Camera, where the animation has it at the first frame.
+    auto cam = scene.animation.camera(scene.camera, 0)
+                   .camera(T(settings.width) / settings.height);
+
+    // Render (with timer)
+    ThreadPool pool(options.threads);
+    TileRenderer<T> renderer(pool, settings);
+    LightList<T> lights(scene.objects, scene.materials);
+    if (options.lightSampling && !lights.empty()) {
+        renderer.setLights(&lights);
+        std::cerr << "Sampling " << lights.size() << " lights\n";
+    }
+    Framebuffer<T> fb(settings.width, settings.height);
+    FeatureBuffer<T> features(0, 0);
+    if (options.denoise || !options.aov.empty()) {
+        features = FeatureBuffer<T>(settings.width, settings.height);
+        renderer.setFeatures(&features);
+    }
+    ImageWriter<T> writer;
+    auto start = std::chrono::high_resolution_clock::now();
+
+    if (options.adaptive) {
+        AdaptiveSettings adaptive;
+        adaptive.minSamples = options.minSamples;
+        adaptive.maxSamples = settings.samplesPerPixel;
+        adaptive.samplesPerPass = options.passSamples();
+        adaptive.threshold = options.noiseThreshold;
+
+        AdaptiveSampler<T> sampler(settings.width, settings.height,
+                                      adaptive);
+        while (!sampler.done()) {
+            sampler.pass(renderer, world, scene.materials, cam);
+            std::cerr << "\rSamples " << sampler.maxSamplesTaken()
+                      << ", active pixels: " << sampler.activePixels() << ' '
+                      << std::flush;
+
+            std::chrono::duration<double> elapsed =
+                std::chrono::high_resolution_clock::now() - start;
+            if (options.timeBudget > 0 && elapsed.count() >= options.timeBudget)
+                break;
+        }
+        fb = sampler.resolve();
+        std::cerr << '\n';
+        sampler.printStats(std::cerr);
+        if (!options.heatmap.empty())
+            writer.submit(sampler.heatmap(), {options.heatmap});
+    } else {
+        // Progressive mode only matters here for its time budget.
+        int passSamples = options.progressive ? options.passSamples()
+                                              : settings.samplesPerPixel;
+        while (fb.samples() < settings.samplesPerPixel) {
+            int first = fb.samples();
+            int last = std::min(settings.samplesPerPixel, first + passSamples);
+            size_t tilesDone = 0;
+            renderer.render(world, scene.materials, cam, fb, first, last,
+                            [&](const Tile&) {
+                                std::cerr << "\rSamples " << last
+                                          << ", tiles: " << ++tilesDone << ' '
+                                          << std::flush;
+                            });
+            fb.addSamples(last - first);
+
+            std::chrono::duration<double> elapsed =
+                std::chrono::high_resolution_clock::now() - start;
+            if (options.timeBudget > 0 && elapsed.count() >= options.timeBudget)
+                break;
+        }
+    }
+
+    // Display timing info.
+    std::chrono::duration<double> elapsed =
+        std::chrono::high_resolution_clock::now() - start;
+    std::cerr << "\nCompleted: " << fb.samples() << " spp in "
+              << elapsed.count() << "s\n"
+              << std::flush;
+    renderer.printStats(std::cerr);
+    printBvhStats(std::cerr, world);
+
+    if (!options.aov.empty()) {
+        writer.submit(features.albedo(fb.samples()),
+                      {aovPath(options.aov, "albedo")});
+        writer.submit(features.normal(fb.samples()),
+                      {aovPath(options.aov, "normal")});
+        writer.submit(features.depth(fb.samples()),
+                      {aovPath(options.aov, "depth")});
+    }
+    if (options.denoise) {
+        Denoiser<T> denoiser(pool);
+        fb = denoiser.denoise(fb, features);
+        denoiser.printStats(std::cerr);
+    }
+    writer.submit(fb, options.outputs, options.resolve);
+    bool written = writer.flush();
+    printProfile(std::cerr, renderer.rays());
+    return written ? 0 : 1;
+}
+
+// A frame rendered for --compare-precision.
+template <class T> struct PrecisionRun {
+    Framebuffer<T> fb{0, 0};
+    double seconds = 0;
+    uint64_t rays = 0;
+};
+
+// Every sample of the options' frame in precision T, tile by tile. The
+// generator restarts first so a random scene comes out the same in both.
+template <class T>
+static bool renderFrame(const Options& options, Precision precision,
+                        PrecisionRun<T>& run) {
+    threadRng() = Pcg32();
+    Scene<T> scene;
+    if (!loadOptionsScene(options, scene))
+        return false;
+    RenderSettings settings = sceneSettings(options, scene);
+    Bvh<T> world(scene.objects);
+    auto cam = scene.animation.camera(scene.camera, 0)
+                   .camera(T(settings.width) / settings.height);
+    ThreadPool pool(options.threads);
+    TileRenderer<T> renderer(pool, settings);
+    LightList<T> lights(scene.objects, scene.materials);
+    if (options.lightSampling && !lights.empty())
+        renderer.setLights(&lights);
+
+    run.fb = Framebuffer<T>(settings.width, settings.height);
+    auto start = std::chrono::high_resolution_clock::now();
+    renderer.render(world, scene.materials, cam, run.fb, 0,
+                    settings.samplesPerPixel, [](const Tile&) {});
+    run.fb.addSamples(settings.samplesPerPixel);
+    std::chrono::duration<double> elapsed =
+        std::chrono::high_resolution_clock::now() - start;
+    run.seconds = elapsed.count();
+    run.rays = renderer.rays();
+    std::cerr << std::fixed << std::setprecision(3)
+              << precisionName(precision) << ": "
+              << run.seconds << "s, " << run.rays / run.seconds * 1e-6
+              << " Mrays/s\n"
+              << std::defaultfloat << std::flush;
+    return true;
+}
+
+// The same frame in float and double, compared as it is displayed: gamma 2
+// values and the bytes of an 8 bit image. The float image goes to the
+// outputs, the double one beside them.
+static int comparePrecision(const Options& options) {
+    PrecisionRun<float> f;
+    PrecisionRun<double> d;
+    if (!renderFrame(options, Precision::Float, f) ||
+        !renderFrame(options, Precision::Double, d))
+        return 1;
+
+    auto display = [](double sum, int samples) {
+        return std::sqrt(clamp(sum / samples, 0.0, 1.0));
+    };
+    double squares = 0;
+    int largest = 0;
+    size_t differing = 0;
+    int w = f.fb.width(), h = f.fb.height();
+    for (int y = 0; y < h; ++y) {
+        for (int x = 0; x < w; ++x) {
+            const Color<float>& a = f.fb.at(x, y);
+            const Color<double>& b = d.fb.at(x, y);
+            uint32_t pa = convertRGBA(a, f.fb.samples());
+            uint32_t pb = convertRGBA(b, d.fb.samples());
+            for (int c = 0; c < 3; ++c) {
+                double e = display(double(a[c]), f.fb.samples()) -
+                           display(b[c], d.fb.samples());
+                squares += e * e;
+                int shift = 24 - 8 * c;
+                int diff = std::abs(int((pa >> shift) & 0xff) -
+                                    int((pb >> shift) & 0xff));
+                largest = std::max(largest, diff);
+            }
+            differing += pa != pb;
+        }
+    }
+    size_t pixels = size_t(w) * h;
+    std::cerr << std::fixed << std::setprecision(3)
+              << "Float speedup: " << d.seconds / f.seconds << "x\n"
+              << "Difference: RMSE " << std::setprecision(5)
+              << std::sqrt(squares / (3 * double(pixels)))
+              << ", largest 8 bit step " << largest << ", "
+              << std::setprecision(2) << 100.0 * differing / pixels
+              << "% of pixels differ\n"
+              << std::defaultfloat << std::flush;
+
+    std::vector<std::string> doublePaths;
+    for (const auto& output : options.outputs)
+        doublePaths.push_back(aovPath(output, "double"));
+    ImageWriter<float> floatWriter;
+    ImageWriter<double> doubleWriter;
+    floatWriter.submit(f.fb, options.outputs, options.resolve);
+    doubleWriter.submit(d.fb, doublePaths, options.resolve);
+    bool written = floatWriter.flush();
+    written = doubleWriter.flush() && written;
+    return written ? 0 : 1;
+}
+
+// Writes the trace --trace asks for once everything has rendered.
+static int finishTrace(const Options& options, int status) {
+    if (options.trace.empty())
+        return status;
+    std::string error;
+    if (!Profiler::instance().writeTrace(options.trace, error)) {
+        std::cerr << error << std::endl;
+        return 1;
+    }
+    std::cerr << "Wrote " << options.trace << '\n';
+    return status;
+}
+
+// Same renderer as raytrace, without a window: frames go to image files.
+int main(int argc, char** argv) {
+    Options options;
+    if (!options.parse(argc, argv))
+        return 1;
+    setSimd(options.simd);
+    profileThreadName("main");
+    if (!options.trace.empty())
+        Profiler::instance().setTracing(true);
+    if (!options.worker.empty())
+        return runWorker(options.worker, options.threads) ? 0 : 1;
+    if (options.outputs.empty())
+        options.outputs.push_back("render.png");
+    if (options.comparePrecision)
+        return comparePrecision(options);
+    if (options.precision == Precision::Double)
+        return finishTrace(options, render<double>(options, argv[0]));
+    return finishTrace(options, render<float>(options, argv[0]));
+}
+
@@ -1,17 +1,19 @@
 #ifndef HITTABLE_H
 #define HITTABLE_H
 
+#include <cstdint>
+
 #include "Common.hpp"
 
-namespace raytrace {
+#include "Aabb.hpp"
 
-template <class T> class Material;
+namespace raytrace {
 
 template <class T> class HitRecord {
   public:
     Point3<T> p;
     Vec3<T> normal;
-    std::shared_ptr<Material<T>> mat;
+    uint32_t mat; // Index into the scene's MaterialTable.
     T t;
     bool frontFace;
 
@@ -24,8 +26,22 @@ template <class T> class HitRecord {
 // Generic object that rays can interact with
 template <class T> class Hittable {
   public:
+    virtual ~Hittable() {}
+
+    // Only writes rec when returning true, so callers may pass the record of
+    // the closest hit so far and shrink tMax as they go.
     virtual bool hit(const Ray<T>& r, T tMin, T tMax,
                      HitRecord<T>& rec) const = 0;
+
+    // Whether anything lies along the ray within [tMin, tMax]. Shadow rays
+    // only need that, so objects may stop at the first hit they find.
+    virtual bool occluded(const Ray<T>& r, T tMin, T tMax) const {
+        HitRecord<T> rec;
+        return hit(r, tMin, tMax, rec);
+    }
+
+    // Box enclosing the whole object, used by acceleration structures.
+    virtual Aabb<T> boundingBox() const = 0;
 };
 
 } // namespace raytrace
@@ -20,21 +20,38 @@ template <class T> class HittableList : public Hittable<T> {
 
     virtual bool hit(const Ray<T>& r, T tMin, T tMax,
                      HitRecord<T>& rec) const override {
-        HitRecord<T> tempRec;
         bool hitAnything = false;
         auto closestSoFar = tMax;
 
+        // Hittables only write rec on a hit, so no temporary is needed.
         for (const auto& object : objects) {
-            if (object->hit(r, tMin, closestSoFar, tempRec)) {
+            if (object->hit(r, tMin, closestSoFar, rec)) {
                 hitAnything = true;
-                closestSoFar = tempRec.t;
-                rec = tempRec;
+                closestSoFar = rec.t;
             }
         }
 
         return hitAnything;
     }
 
+    virtual bool occluded(const Ray<T>& r, T tMin, T tMax) const override {
+        for (const auto& object : objects)
+            if (object->occluded(r, tMin, tMax))
+                return true;
+        return false;
+    }
+
+    virtual Aabb<T> boundingBox() const override {
+        Aabb<T> box;
+        for (const auto& object : objects)
+            box.expand(object->boundingBox());
+        return box;
+    }
+
+    const std::vector<std::shared_ptr<Hittable<T>>>& getObjects() const {
+        return objects;
+    }
+
   private:
     std::vector<std::shared_ptr<Hittable<T>>> objects;
 };
@@ -0,0 +1,259 @@
+#ifndef IMAGESINK_H
+#define IMAGESINK_H
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Resolve.hpp"
+
+namespace raytrace {
+
+// Destination for a rendered frame, fed one row at a time. Rows hold the
+// accumulated sums of samples; 8 bit sinks convert them with the resolver,
+// float sinks keep them linear.
+template <class T> class ImageSink {
+  public:
+    virtual ~ImageSink() {}
+
+    // Returns false if the output could not be opened.
+    virtual bool begin(const std::string& path, int width, int height) = 0;
+    virtual void writeRow(const Color<T>* row, int samplesPerPixel,
+                          const Resolver& resolver) = 0;
+    // Finish and close the file, false if anything failed to write.
+    virtual bool end() = 0;
+
+    // Most formats store the top row first, PFM stores the bottom row first.
+    virtual bool bottomUp() const { return false; }
+};
+
+// Binary PPM (P6), gamma 2 like the window.
+template <class T> class PpmSink : public ImageSink<T> {
+  public:
+    virtual bool begin(const std::string& path, int width,
+                       int height) override {
+        out.open(path, std::ios::binary);
+        if (!out)
+            return false;
+        w = width;
+        out << "P6\n" << width << ' ' << height << "\n255\n";
+        bytes.resize(size_t(width) * 3);
+        words.resize(width);
+        return true;
+    }
+
+    virtual void writeRow(const Color<T>* row, int samplesPerPixel,
+                          const Resolver& resolver) override {
+        resolver.row(row, w, samplesPerPixel, words.data());
+        for (int x = 0; x < w; ++x) {
+            uint32_t c = words[x];
+            bytes[3 * x + 0] = static_cast<char>(c >> 24);
+            bytes[3 * x + 1] = static_cast<char>(c >> 16);
+            bytes[3 * x + 2] = static_cast<char>(c >> 8);
+        }
+        out.write(bytes.data(), bytes.size());
+    }
+
+    virtual bool end() override {
+        out.close();
+        return !out.fail();
+    }
+
+  private:
+    std::ofstream out;
+    int w = 0;
+    std::vector<char> bytes;
+    std::vector<uint32_t> words;
+};
+
+// 8 bit RGB PNG, gamma 2 like the window. Rows are written as they arrive
+// in uncompressed deflate blocks, one IDAT chunk per row, so nothing but the
+// current row is held in memory and no zlib dependency is needed.
+template <class T> class PngSink : public ImageSink<T> {
+  public:
+    virtual bool begin(const std::string& path, int width,
+                       int height) override {
+        out.open(path, std::ios::binary);
+        if (!out)
+            return false;
+        w = width;
+        adlerA = 1;
+        adlerB = 0;
+
+        static const uint8_t signature[8] = {0x89, 'P',  'N',  'G',
+                                             '\r', '\n', 0x1a, '\n'};
+        out.write(reinterpret_cast<const char*>(signature), 8);
+
+        std::vector<uint8_t> ihdr;
+        putU32(ihdr, width);
+        putU32(ihdr, height);
+        ihdr.push_back(8); // Bit depth.
+        ihdr.push_back(2); // Truecolour RGB.
+        ihdr.push_back(0); // Deflate.
+        ihdr.push_back(0); // Adaptive filtering.
+        ihdr.push_back(0); // No interlace.
+        writeChunk("IHDR", ihdr);
+
+        writeChunk("IDAT", {0x78, 0x01}); // zlib header, no compression.
+        words.resize(width);
+        return true;
+    }
+
+    virtual void writeRow(const Color<T>* row, int samplesPerPixel,
+                          const Resolver& resolver) override {
+        resolver.row(row, w, samplesPerPixel, words.data());
+        std::vector<uint8_t> raw;
+        raw.reserve(1 + size_t(w) * 3);
+        raw.push_back(0); // Filter type none.
+        for (int x = 0; x < w; ++x) {
+            uint32_t c = words[x];
+            raw.push_back(static_cast<uint8_t>(c >> 24));
+            raw.push_back(static_cast<uint8_t>(c >> 16));
+            raw.push_back(static_cast<uint8_t>(c >> 8));
+        }
+        updateAdler(raw);
+
+        // Stored blocks hold at most 65535 bytes each.
+        std::vector<uint8_t> data;
+        for (size_t offset = 0; offset < raw.size(); offset += 65535) {
+            uint16_t len = static_cast<uint16_t>(
+                std::min<size_t>(65535, raw.size() - offset));
+            data.push_back(0); // Not final, stored.
+            data.push_back(len & 0xff);
+            data.push_back(len >> 8);
+            data.push_back(~len & 0xff);
+            data.push_back((~len >> 8) & 0xff);
+            data.insert(data.end(), raw.begin() + offset,
+                        raw.begin() + offset + len);
+        }
+        writeChunk("IDAT", data);
+    }
+
+    virtual bool end() override {
+        // Empty final stored block, then the zlib checksum.
+        std::vector<uint8_t> data = {1, 0, 0, 0xff, 0xff};
+        putU32(data, (adlerB << 16) | adlerA);
+        writeChunk("IDAT", data);
+        writeChunk("IEND", {});
+        out.close();
+        return !out.fail();
+    }
+
+  private:
+    std::ofstream out;
+    int w = 0;
+    uint32_t adlerA = 1, adlerB = 0;
+    std::vector<uint32_t> words;
+
+    static void putU32(std::vector<uint8_t>& v, uint32_t x) {
+        v.push_back(x >> 24);
+        v.push_back((x >> 16) & 0xff);
+        v.push_back((x >> 8) & 0xff);
+        v.push_back(x & 0xff);
+    }
+
+    static uint32_t crc(uint32_t c, const uint8_t* data, size_t n) {
+        static const std::array<uint32_t, 256> table = [] {
+            std::array<uint32_t, 256> t;
+            for (uint32_t i = 0; i < 256; ++i) {
+                uint32_t k = i;
+                for (int j = 0; j < 8; ++j)
+                    k = k & 1 ? 0xedb88320u ^ (k >> 1) : k >> 1;
+                t[i] = k;
+            }
+            return t;
+        }();
+        for (size_t i = 0; i < n; ++i)
+            c = table[(c ^ data[i]) & 0xff] ^ (c >> 8);
+        return c;
+    }
+
+    void updateAdler(const std::vector<uint8_t>& data) {
+        for (uint8_t byte : data) {
+            adlerA = (adlerA + byte) % 65521;
+            adlerB = (adlerB + adlerA) % 65521;
+        }
+    }
+
+    void writeChunk(const char* type, const std::vector<uint8_t>& data) {
+        std::vector<uint8_t> header;
+        putU32(header, static_cast<uint32_t>(data.size()));
+        header.insert(header.end(), type, type + 4);
+
+        uint32_t c = crc(0xffffffffu, header.data() + 4, 4);
+        c = crc(c, data.data(), data.size()) ^ 0xffffffffu;
+        std::vector<uint8_t> footer;
+        putU32(footer, c);
+
+        out.write(reinterpret_cast<const char*>(header.data()), header.size());
+        out.write(reinterpret_cast<const char*>(data.data()), data.size());
+        out.write(reinterpret_cast<const char*>(footer.data()), footer.size());
+    }
+};
+
+// Portable float map, linear 32 bit float RGB for compositing.
+template <class T> class PfmSink : public ImageSink<T> {
+  public:
+    virtual bool begin(const std::string& path, int width,
+                       int height) override {
+        out.open(path, std::ios::binary);
+        if (!out)
+            return false;
+        w = width;
+        // A negative scale marks little endian data.
+        uint16_t probe = 1;
+        bool little = *reinterpret_cast<uint8_t*>(&probe) == 1;
+        out << "PF\n"
+            << width << ' ' << height << '\n'
+            << (little ? "-1.0" : "1.0") << '\n';
+        floats.resize(size_t(width) * 3);
+        return true;
+    }
+
+    virtual void writeRow(const Color<T>* row, int samplesPerPixel,
+                          const Resolver&) override {
+        T scale = T(1) / samplesPerPixel;
+        for (int x = 0; x < w; ++x)
+            for (int c = 0; c < 3; ++c)
+                floats[3 * x + c] = static_cast<float>(row[x][c] * scale);
+        out.write(reinterpret_cast<const char*>(floats.data()),
+                  floats.size() * sizeof(float));
+    }
+
+    virtual bool end() override {
+        out.close();
+        return !out.fail();
+    }
+
+    virtual bool bottomUp() const override { return true; }
+
+  private:
+    std::ofstream out;
+    int w = 0;
+    std::vector<float> floats;
+};
+
+// Pick a sink from the file extension, nullptr if it is not supported.
+template <class T>
+std::unique_ptr<ImageSink<T>> makeImageSink(const std::string& path) {
+    auto endsWith = [&](const std::string& ext) {
+        return path.size() >= ext.size() &&
+               path.compare(path.size() - ext.size(), ext.size(), ext) == 0;
+    };
+    if (endsWith(".ppm"))
+        return std::make_unique<PpmSink<T>>();
+    if (endsWith(".png"))
+        return std::make_unique<PngSink<T>>();
+    if (endsWith(".pfm"))
+        return std::make_unique<PfmSink<T>>();
+    return nullptr;
+}
+
+} // namespace raytrace
+
+#endif // IMAGESINK_H
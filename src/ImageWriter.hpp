@@ -0,0 +1,147 @@
+#ifndef IMAGEWRITER_H
+#define IMAGEWRITER_H
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Framebuffer.hpp"
+#include "ImageSink.hpp"
+#include "Profile.hpp"
+#include "Resolve.hpp"
+
+namespace raytrace {
+
+// Writes frames to image files on its own thread. submit() takes a copy of
+// the framebuffer and returns at once, so file I/O never stalls rendering.
+// 8 bit files are tone mapped as the frame's settings say; feature
+// buffers and heatmaps keep the default, gamma 2 without exposure.
+template <class T> class ImageWriter {
+  public:
+    ImageWriter() : thread([this] { run(); }) {}
+
+    ~ImageWriter() {
+        {
+            std::lock_guard<std::mutex> lock(m);
+            stopping = true;
+        }
+        cv.notify_all();
+        thread.join();
+    }
+
+    void submit(const Framebuffer<T>& frame,
+                const std::vector<std::string>& paths,
+                const ResolveSettings& settings = ResolveSettings()) {
+        {
+            std::lock_guard<std::mutex> lock(m);
+            jobs.push_back(Job{frame, paths, settings});
+        }
+        cv.notify_all();
+    }
+
+    // Block until at most maxQueued frames wait to be written, so a
+    // sequence rendering faster than its files are written stays in
+    // bounded memory.
+    void throttle(size_t maxQueued) {
+        std::unique_lock<std::mutex> lock(m);
+        idleCv.wait(lock, [&] { return jobs.size() <= maxQueued; });
+    }
+
+    // Block until every submitted frame has been written. False if any
+    // file so far could not be, each already reported.
+    bool flush() {
+        std::unique_lock<std::mutex> lock(m);
+        idleCv.wait(lock, [this] { return jobs.empty() && !busy; });
+        return failures == 0;
+    }
+
+    ImageWriter(const ImageWriter& other) = delete;
+    ImageWriter(ImageWriter&& other) = delete;
+    ImageWriter& operator=(const ImageWriter& other) = delete;
+    ImageWriter& operator=(ImageWriter&& other) = delete;
+
+  private:
+    struct Job {
+        Framebuffer<T> frame;
+        std::vector<std::string> paths;
+        ResolveSettings settings;
+    };
+
+    std::mutex m;
+    std::condition_variable cv;
+    std::condition_variable idleCv;
+    std::deque<Job> jobs;
+    bool busy = false;
+    bool stopping = false;
+    size_t failures = 0;
+    std::thread thread;
+
+    void run() {
+        profileThreadName("writer");
+        while (true) {
+            Job job{Framebuffer<T>(0, 0), {}, {}};
+            {
+                std::unique_lock<std::mutex> lock(m);
+                cv.wait(lock, [this] { return !jobs.empty() || stopping; });
+                if (jobs.empty())
+                    return;
+                job = std::move(jobs.front());
+                jobs.pop_front();
+                busy = true;
+            }
+
+            Resolver resolver(job.settings);
+            size_t failed = 0;
+            for (const auto& path : job.paths)
+                failed += !write(job.frame, path, resolver);
+
+            {
+                std::lock_guard<std::mutex> lock(m);
+                busy = false;
+                failures += failed;
+            }
+            idleCv.notify_all();
+        }
+    }
+
+    static bool write(const Framebuffer<T>& frame, const std::string& path,
+                      const Resolver& resolver) {
+        ScopedTimer timer(Stage::Write);
+        auto start = std::chrono::steady_clock::now();
+        auto sink = makeImageSink<T>(path);
+        if (!sink) {
+            std::cerr << "Unsupported image format: " << path << std::endl;
+            return false;
+        }
+        if (!sink->begin(path, frame.width(), frame.height())) {
+            std::cerr << "Could not open " << path << std::endl;
+            return false;
+        }
+
+        // Stream row by row in the order the format stores them.
+        int h = frame.height();
+        for (int i = 0; i < h; ++i) {
+            int y = sink->bottomUp() ? i : h - 1 - i;
+            sink->writeRow(&frame.at(0, y), frame.samples(), resolver);
+        }
+        if (!sink->end()) {
+            std::cerr << "Could not write " << path << std::endl;
+            return false;
+        }
+
+        std::chrono::duration<double, std::milli> elapsed =
+            std::chrono::steady_clock::now() - start;
+        std::cerr << "Wrote " << path << " in " << elapsed.count() << "ms"
+                  << std::endl;
+        return true;
+    }
+};
+
+} // namespace raytrace
+
+#endif // IMAGEWRITER_H
@@ -0,0 +1,78 @@
+#ifndef INSTANCE_H
+#define INSTANCE_H
+
+#include <cstdint>
+#include <memory>
+
+#include "Hittable.hpp"
+#include "Transform.hpp"
+
+namespace raytrace {
+
+// A placed copy of shared geometry: a reference to it, where it goes and
+// optionally a different material. The geometry, with its own acceleration
+// structure, is stored once however many instances show it, so a Bvh over
+// instances is the top level of a two level hierarchy.
+template <class T> class Instance : public Hittable<T> {
+  public:
+    static constexpr uint32_t keepMaterial = UINT32_MAX;
+
+    Instance(std::shared_ptr<const Hittable<T>> geometry,
+             const Transform<T>& objectToWorld,
+             uint32_t material = keepMaterial)
+        : geometry(std::move(geometry)), objectToWorld(objectToWorld),
+          worldToObject(objectToWorld.inverse()),
+          bounds(objectToWorld.box(this->geometry->boundingBox())),
+          mat(material) {}
+
+    // The ray is moved into object space without normalising its direction,
+    // so distances along it are the same in both spaces.
+    virtual bool hit(const Ray<T>& r, T tMin, T tMax,
+                     HitRecord<T>& rec) const override {
+        Ray<T> local(worldToObject.point(r.origin()),
+                     worldToObject.vector(r.direction()), r.time());
+        if (!geometry->hit(local, tMin, tMax, rec))
+            return false;
+
+        // The inverse transpose keeps the sign of dot(direction, normal),
+        // so frontFace still holds.
+        rec.p = r.at(rec.t);
+        rec.normal = unit(worldToObject.transposedVector(rec.normal));
+        if (mat != keepMaterial)
+            rec.mat = mat;
+        return true;
+    }
+
+    virtual bool occluded(const Ray<T>& r, T tMin, T tMax) const override {
+        Ray<T> local(worldToObject.point(r.origin()),
+                     worldToObject.vector(r.direction()), r.time());
+        return geometry->occluded(local, tMin, tMax);
+    }
+
+    virtual Aabb<T> boundingBox() const override { return bounds; }
+
+    const std::shared_ptr<const Hittable<T>>& getGeometry() const {
+        return geometry;
+    }
+    const Transform<T>& getTransform() const { return objectToWorld; }
+    uint32_t getMaterial() const { return mat; }
+
+    // Move the instance, e.g. between frames of an animation. Bounds
+    // follow, a Bvh holding it needs a refit afterwards.
+    void setTransform(const Transform<T>& t) {
+        objectToWorld = t;
+        worldToObject = t.inverse();
+        bounds = t.box(geometry->boundingBox());
+    }
+
+  private:
+    std::shared_ptr<const Hittable<T>> geometry;
+    Transform<T> objectToWorld; // As given, so files write it back exactly.
+    Transform<T> worldToObject;
+    Aabb<T> bounds;
+    uint32_t mat;
+};
+
+} // namespace raytrace
+
+#endif // INSTANCE_H
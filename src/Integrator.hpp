@@ -0,0 +1,291 @@
+#ifndef INTEGRATOR_H
+#define INTEGRATOR_H
+
+#include <algorithm>
+#include <cstdint>
+
+#include "Common.hpp"
+
+#include "Framebuffer.hpp"
+#include "Hittable.hpp"
+#include "Light.hpp"
+#include "Material.hpp"
+
+namespace raytrace {
+
+enum class IntegratorKind { Path, Recursive, Wavefront };
+
+inline const char* integratorName(IntegratorKind kind) {
+    switch (kind) {
+    case IntegratorKind::Recursive:
+        return "recursive";
+    case IntegratorKind::Wavefront:
+        return "wavefront";
+    default:
+        return "path";
+    }
+}
+
+// Rays intersected by the calling thread, for rays/sec reporting.
+inline uint64_t& raysTraced() {
+    thread_local uint64_t count = 0;
+    return count;
+}
+
+// Lengths of the paths traced by the iterative path tracer, in rays: a
+// camera ray that escapes or is absorbed has length 1. The last bin also
+// counts every longer path.
+struct PathHistogram {
+    static constexpr int bins = 64;
+    uint64_t lengths[bins] = {};
+    uint64_t roulette = 0; // Paths ended by Russian roulette.
+
+    void record(int length) { lengths[std::min(length, bins - 1)]++; }
+
+    uint64_t paths() const {
+        uint64_t total = 0;
+        for (uint64_t n : lengths)
+            total += n;
+        return total;
+    }
+
+    // Adds the difference between two readings of a running histogram.
+    void addDelta(const PathHistogram& now, const PathHistogram& before) {
+        for (int i = 0; i < bins; ++i)
+            lengths[i] += now.lengths[i] - before.lengths[i];
+        roulette += now.roulette - before.roulette;
+    }
+};
+
+// Running histogram of the calling thread.
+inline PathHistogram& pathHistogram() {
+    thread_local PathHistogram histogram;
+    return histogram;
+}
+
+// Sky gradient seen by rays that escape the scene.
+template <class T> Color<T> environment(const Ray<T>& r) {
+    Vec3<T> unitDirection = unit(r.direction());
+    T t = T(0.5) * (unitDirection.y() + 1);
+    return (1 - t) * Color<T>(1, 1, 1) + t * Color<T>(0.5, 0.7, 1.0);
+}
+
+// Picks the features of a camera sample along its path: those of the first
+// surface that is not a mirror or glass, which show what they reflect, so
+// the denoiser keeps reflections sharp. The albedo is scaled by what the
+// bounces before let through and the depth is the distance along the path.
+// Adds them to the buffer's sums once, or nothing given no buffer.
+template <class T> class FeatureTracker {
+  public:
+    explicit FeatureTracker(Features<T>* out = nullptr) : out(out) {}
+
+    bool pending() const { return out != nullptr; }
+
+    // r, reached with throughput, hits rec.
+    void hit(const Ray<T>& r, const HitRecord<T>& rec,
+             const Material<T>& material, const Color<T>& throughput) {
+        if (!out)
+            return;
+        last.albedo = throughput * material.albedo();
+        last.normal = rec.normal;
+        last.depth += rec.t * r.direction().length();
+        if (material.diffuse() ||
+            material.kind() == Material<T>::EmissiveKind)
+            end();
+    }
+
+    // The path escapes with throughput, the sky counts as white.
+    void miss(const Color<T>& throughput) {
+        if (!out)
+            return;
+        last = Features<T>();
+        last.albedo = throughput;
+        end();
+    }
+
+    // The path ends, its last hit stands in if nothing was picked yet.
+    void end() {
+        if (!out)
+            return;
+        *out += last;
+        out = nullptr;
+    }
+
+  private:
+    Features<T>* out;
+    Features<T> last;
+};
+
+// Recursive path tracer, returns the radiance along a single ray. Given a
+// pending tracker, follows the ray's features for it, throughput being what
+// reaches r. depth counts the bounces left, bounce those taken, which picks
+// the sampler's dimensions as in pathColor.
+template <class T>
+Color<T> rayColor(const Ray<T>& r, const Hittable<T>& world,
+                  const MaterialTable<T>& materials, int depth,
+                  FeatureTracker<T>* features = nullptr,
+                  const Color<T>& throughput = Color<T>(1, 1, 1),
+                  int bounce = 0) {
+    threadSampler().startBounce(bounce);
+    HitRecord<T> rec;
+
+    // Limit ray bounce
+    if (depth <= 0) {
+        if (features)
+            features->end();
+        return Color<T>(0, 0, 0);
+    }
+
+    ++raysTraced();
+    if (world.hit(r, T(0.001), infinity<T>, rec)) {
+        Ray<T> scattered;
+        Color<T> attenuation;
+        const Material<T>& material = materials[rec.mat];
+        Color<T> emitted = material.emitted();
+        if (features)
+            features->hit(r, rec, material, throughput);
+        if (material.scatter(r, rec, attenuation, scattered)) {
+            bool follow = features && features->pending();
+            return emitted +
+                   attenuation * rayColor<T>(scattered, world, materials,
+                                             depth - 1,
+                                             follow ? features : nullptr,
+                                             throughput * attenuation,
+                                             bounce + 1);
+        }
+        if (features)
+            features->end();
+        return emitted;
+    }
+
+    if (features)
+        features->miss(throughput);
+    // Environment coloring.
+    return environment(r);
+}
+
+// Weight of a sample drawn with density a when the other strategy would
+// have drawn it with density b (Veach's power heuristic).
+template <class T> T powerHeuristic(T a, T b) {
+    return a * a / (a * a + b * b);
+}
+
+// Light reaching rec from a point picked on a light, as scattered back
+// along r, weighted against finding the same light by scattering. Traces
+// one shadow ray.
+template <class T>
+Color<T> sampleLight(const Ray<T>& r, const HitRecord<T>& rec,
+                     const Material<T>& material, const Hittable<T>& world,
+                     const MaterialTable<T>& materials,
+                     const LightList<T>& lights) {
+    LightSample<T> light = lights.sample(materials, r.time());
+    Vec3<T> toLight = light.p - rec.p;
+    T distanceSquared = toLight.lengthSquared();
+    T distance = std::sqrt(distanceSquared);
+    Vec3<T> direction = toLight / distance;
+    T cosine = -dot(light.normal, direction);
+    if (!light.sphere)
+        cosine = std::abs(cosine);
+    if (!(cosine > 0))
+        return Color<T>(0, 0, 0);
+
+    Color<T> f = material.evaluate(r, rec, direction);
+    if (f.nearZero())
+        return Color<T>(0, 0, 0);
+    ++raysTraced();
+    if (world.occluded(Ray<T>(rec.p, direction, r.time()), T(0.001),
+                       distance * T(0.999)))
+        return Color<T>(0, 0, 0);
+
+    T lightPdf = light.pdfArea * distanceSquared / cosine;
+    T weight = powerHeuristic(lightPdf, material.pdf(r, rec, direction));
+    return f * light.radiance * (weight / lightPdf);
+}
+
+// Iterative path tracer, the same estimate as rayColor without recursion:
+// the path throughput is carried forward instead of multiplied in on the
+// way back out. After rouletteDepth bounces each path survives with a
+// probability that falls with its throughput and survivors are divided by
+// it, which ends dim paths early without biasing the result.
+//
+// Given lights, every hit on a diffuse surface also samples a point on
+// one of them with a shadow ray (next event estimation). Both that and a
+// scattered path hitting the light can find the same light, so each is
+// weighted by multiple importance sampling.
+//
+// Given features, adds those of the path to them, see FeatureTracker.
+template <class T>
+Color<T> pathColor(Ray<T> r, const Hittable<T>& world,
+                   const MaterialTable<T>& materials, int maxDepth,
+                   int rouletteDepth, const LightList<T>* lights = nullptr,
+                   Features<T>* features = nullptr) {
+    PathHistogram& histogram = pathHistogram();
+    bool sampleLights = lights && !lights->empty();
+    Color<T> radiance(0, 0, 0);
+    Color<T> throughput(1, 1, 1);
+    T scatterPdf = 0; // Of the last bounce, 0 if it was not diffuse.
+    HitRecord<T> rec;
+    FeatureTracker<T> tracker(features);
+
+    for (int depth = 0; depth < maxDepth; ++depth) {
+        threadSampler().startBounce(depth);
+        ++raysTraced();
+        if (!world.hit(r, T(0.001), infinity<T>, rec)) {
+            tracker.miss(throughput);
+            histogram.record(depth + 1);
+            return radiance + throughput * environment(r);
+        }
+
+        const Material<T>& material = materials[rec.mat];
+        tracker.hit(r, rec, material, throughput);
+        if (material.kind() == Material<T>::EmissiveKind) {
+            Color<T> emitted = material.emitted();
+            if (sampleLights && scatterPdf > 0 && lights->sampled(rec.mat)) {
+                T length = r.direction().length();
+                T distance = rec.t * length;
+                T cosine = std::abs(dot(rec.normal, r.direction())) / length;
+                T lightPdf =
+                    lights->pdfArea(emitted) * distance * distance / cosine;
+                emitted *= powerHeuristic(scatterPdf, lightPdf);
+            }
+            radiance += throughput * emitted;
+        }
+
+        Ray<T> scattered;
+        Color<T> attenuation;
+        if (!material.scatter(r, rec, attenuation, scattered)) {
+            tracker.end();
+            histogram.record(depth + 1);
+            return radiance;
+        }
+
+        scatterPdf = 0;
+        if (sampleLights && material.diffuse()) {
+            radiance += throughput * sampleLight(r, rec, material, world,
+                                                 materials, *lights);
+            scatterPdf = material.pdf(r, rec, unit(scattered.direction()));
+        }
+        throughput = throughput * attenuation;
+        r = scattered;
+
+        if (depth + 1 >= rouletteDepth) {
+            T brightest =
+                std::max({throughput.x(), throughput.y(), throughput.z()});
+            T survive = std::min<T>(1, brightest);
+            if (sample1D<T>() >= survive) {
+                tracker.end();
+                histogram.record(depth + 1);
+                histogram.roulette++;
+                return radiance;
+            }
+            throughput /= survive;
+        }
+    }
+    tracker.end();
+    histogram.record(maxDepth);
+    return radiance;
+}
+
+} // namespace raytrace
+
+#endif // INTEGRATOR_H
@@ -0,0 +1,213 @@
+#ifndef LIGHT_H
+#define LIGHT_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "Common.hpp"
+
+#include "HittableList.hpp"
+#include "Instance.hpp"
+#include "Material.hpp"
+#include "Sphere.hpp"
+#include "SphereSet.hpp"
+#include "Transform.hpp"
+#include "TriangleMesh.hpp"
+
+namespace raytrace {
+
+// A point picked on a light by LightList::sample.
+template <class T> struct LightSample {
+    Point3<T> p;
+    Vec3<T> normal; // Unit and outward on spheres.
+    Color<T> radiance;
+    T pdfArea; // Density per unit area, light choice included.
+    bool sphere; // Only seen from outside, triangles from both sides.
+};
+
+// The scene's emissive primitives, for sampling them directly. A light is
+// picked in proportion to its power, luminance times area, then a point
+// uniformly on its surface. The density per unit area of any point is then
+// just its luminance over the total power, so the density of a point found
+// by other means follows from its radiance alone.
+//
+// Emissive Spheres, SphereSet entries and TriangleMesh triangles are
+// collected, in lists and instances too, placed in world space. A sphere
+// instanced with an uneven scale is no longer a sphere and cannot be
+// sampled; its material is then left out altogether, since the integrator
+// weighs every hit on a material that sampled() reports against light
+// samples that would never pick it.
+template <class T> class LightList {
+  public:
+    LightList() {}
+    LightList(const HittableList<T>& objects,
+              const MaterialTable<T>& materials) {
+        std::vector<uint8_t> missed(materials.size(), 0);
+        for (const auto& object : objects.getObjects())
+            collect(object.get(), materials, Transform<T>(),
+                    Instance<T>::keepMaterial, missed);
+        emitters.erase(std::remove_if(emitters.begin(), emitters.end(),
+                                      [&](const Emitter& e) {
+                                          return missed[e.mat] != 0;
+                                      }),
+                       emitters.end());
+        sampledMaterials.resize(materials.size());
+        for (const auto& e : emitters)
+            sampledMaterials[e.mat] = 1;
+
+        cdf.reserve(emitters.size());
+        for (const auto& e : emitters) {
+            power += luminance(materials[e.mat].emitted()) * e.area;
+            cdf.push_back(power);
+        }
+    }
+
+    bool empty() const { return emitters.empty(); }
+    size_t size() const { return emitters.size(); }
+
+    // Whether surfaces of material mat are among the lights.
+    bool sampled(uint32_t mat) const {
+        return mat < sampledMaterials.size() && sampledMaterials[mat];
+    }
+
+    // Picks a light and a point on it, where it is at time.
+    LightSample<T> sample(const MaterialTable<T>& materials,
+                          T time = 0) const {
+        T pick = sample1D<T>() * power;
+        size_t i = std::upper_bound(cdf.begin(), cdf.end(), pick) -
+                   cdf.begin();
+        const Emitter& e = emitters[std::min(i, emitters.size() - 1)];
+
+        LightSample<T> s;
+        Vec2<T> u = sample2D<T>();
+        T u1 = u.x(), u2 = u.y();
+        s.sphere = e.sphere;
+        if (e.sphere) {
+            T z = 1 - 2 * u1;
+            T r = std::sqrt(std::max<T>(0, 1 - z * z));
+            T phi = 2 * pi<T> * u2;
+            s.normal = Vec3<T>(r * std::cos(phi), r * std::sin(phi), z);
+            s.p = e.a + time * e.b + e.radius * s.normal;
+        } else {
+            T su = std::sqrt(u1);
+            T b1 = su * (1 - u2), b2 = su * u2;
+            s.p = e.a + b1 * e.b + b2 * e.c;
+            s.normal = unit(cross(e.b, e.c));
+        }
+        s.radiance = materials[e.mat].emitted();
+        s.pdfArea = pdfArea(s.radiance);
+        return s;
+    }
+
+    // Density per unit area with which sample() picks a point emitting
+    // radiance.
+    T pdfArea(const Color<T>& radiance) const {
+        return luminance(radiance) / power;
+    }
+
+  private:
+    // A sphere (center a at time 0, motion b) or a triangle (corner a,
+    // edges b and c).
+    struct Emitter {
+        Point3<T> a;
+        Vec3<T> b, c;
+        T radius;
+        T area;
+        uint32_t mat;
+        bool sphere;
+    };
+
+    std::vector<Emitter> emitters;
+    std::vector<T> cdf; // Running sum of power.
+    std::vector<uint8_t> sampledMaterials;
+    T power = 0;
+
+    static T luminance(const Color<T>& c) {
+        return T(0.2126) * c.x() + T(0.7152) * c.y() + T(0.0722) * c.z();
+    }
+
+    bool emissive(uint32_t mat, const MaterialTable<T>& materials) const {
+        return luminance(materials[mat].emitted()) > 0;
+    }
+
+    // Scale of a transform that keeps spheres round, 0 if it does not.
+    static T uniformScale(const Transform<T>& t) {
+        Vec3<T> x = t.vector(Vec3<T>(1, 0, 0));
+        Vec3<T> y = t.vector(Vec3<T>(0, 1, 0));
+        Vec3<T> z = t.vector(Vec3<T>(0, 0, 1));
+        T scale = x.length();
+        T tolerance = T(1e-4) * scale * scale;
+        bool uniform = std::abs(y.lengthSquared() - scale * scale) <=
+                           tolerance &&
+                       std::abs(z.lengthSquared() - scale * scale) <=
+                           tolerance &&
+                       std::abs(dot(x, y)) <= tolerance &&
+                       std::abs(dot(x, z)) <= tolerance &&
+                       std::abs(dot(y, z)) <= tolerance;
+        return uniform ? scale : 0;
+    }
+
+    void addSphere(const Point3<T>& center, const Vec3<T>& motion, T radius,
+                   uint32_t mat, const Transform<T>& toWorld, T scale,
+                   std::vector<uint8_t>& missed) {
+        if (scale == 0) {
+            missed[mat] = 1;
+            return;
+        }
+        radius *= scale;
+        emitters.push_back({toWorld.point(center), toWorld.vector(motion),
+                            Vec3<T>(), radius, 4 * pi<T> * radius * radius,
+                            mat, true});
+    }
+
+    // Emitters of object, placed by toWorld. mat overrides the materials
+    // found unless it is Instance::keepMaterial, as an instance's does.
+    void collect(const Hittable<T>* object, const MaterialTable<T>& materials,
+                 const Transform<T>& toWorld, uint32_t mat,
+                 std::vector<uint8_t>& missed) {
+        auto own = [&](uint32_t m) {
+            return mat == Instance<T>::keepMaterial ? m : mat;
+        };
+        if (auto instance = dynamic_cast<const Instance<T>*>(object)) {
+            collect(instance->getGeometry().get(), materials,
+                    toWorld * instance->getTransform(),
+                    own(instance->getMaterial()), missed);
+        } else if (auto list = dynamic_cast<const HittableList<T>*>(object)) {
+            for (const auto& child : list->getObjects())
+                collect(child.get(), materials, toWorld, mat, missed);
+        } else if (auto sphere = dynamic_cast<const Sphere<T>*>(object)) {
+            uint32_t m = own(sphere->getMaterial());
+            if (emissive(m, materials))
+                addSphere(sphere->getCenter(), sphere->getMotion(),
+                          sphere->getRadius(), m, toWorld,
+                          uniformScale(toWorld), missed);
+        } else if (auto set = dynamic_cast<const SphereSet<T>*>(object)) {
+            T scale = uniformScale(toWorld);
+            for (size_t i = 0; i < set->size(); ++i) {
+                uint32_t m = own(set->material(i));
+                if (emissive(m, materials))
+                    addSphere(set->center(i), Vec3<T>(0, 0, 0),
+                              set->radius(i), m, toWorld, scale, missed);
+            }
+        } else if (auto mesh = dynamic_cast<const TriangleMesh<T>*>(object)) {
+            uint32_t m = own(mesh->getMaterial());
+            if (!emissive(m, materials))
+                return;
+            const auto& geometry = *mesh->getGeometry();
+            for (size_t i = 0; i < geometry.triangleCount(); ++i) {
+                Point3<T> a = toWorld.point(geometry.vertex(i, 0));
+                Vec3<T> b = toWorld.point(geometry.vertex(i, 1)) - a;
+                Vec3<T> c = toWorld.point(geometry.vertex(i, 2)) - a;
+                T area = cross(b, c).length() / 2;
+                if (area > 0)
+                    emitters.push_back({a, b, c, 0, area, m, false});
+            }
+        }
+    }
+};
+
+} // namespace raytrace
+
+#endif // LIGHT_H
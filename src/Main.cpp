@@ -1,144 +1,319 @@
+#include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <iostream>
+#include <string>
+#include <memory>
 #include <vector>
 
 #include "Common.hpp"
 
-#include "Camera.hpp"
-#include "Color.hpp"
-#include "HittableList.hpp"
-#include "Material.hpp"
-#include "Sphere.hpp"
+#include "Adaptive.hpp"
+#include "Bvh.hpp"
+#include "Denoiser.hpp"
+#include "Distributed.hpp"
+#include "DisplayBuffer.hpp"
+#include "Framebuffer.hpp"
+#include "ImageWriter.hpp"
+#include "Options.hpp"
+#include "SceneFile.hpp"
+#include "Scenes.hpp"
+#include "Sequence.hpp"
+#include "ThreadPool.hpp"
+#include "TileRenderer.hpp"
 
 #include "PixelWindow.hpp"
 
 using namespace raytrace;
 
+// Tiles rendered by worker processes and shown as they arrive here, in
+// passes when progressive.
 template <class T>
-Color<T> rayColor(const Ray<T>& r, const Hittable<T>& world, int depth) {
-    HitRecord<T> rec;
-
-    // Limit ray bounce
-    if (depth <= 0)
-        return Color<T>(0, 0, 0);
-
-    if (world.hit(r, 0.001, infinity, rec)) {
-        Ray<T> scattered;
-        Color<T> attenuation;
-        if (rec.mat->scatter(r, rec, attenuation, scattered)) {
-            return attenuation * rayColor<T>(scattered, world, depth - 1);
-        }
-        return Color<T>(0, 0, 0);
+static int renderDistributed(const Options& options,
+                             const RenderSettings& settings,
+                             const char* program) {
+    std::string error;
+    DistributedJob job;
+    if (!job.fromOptions(options, settings, error)) {
+        std::cerr << error << std::endl;
+        return 1;
+    }
+    TileCoordinator<T> coordinator(job);
+    if (!coordinator.listen(options.coordinator, error) ||
+        !coordinator.spawnWorkers(options.spawnWorkers, options.threads,
+                                  program, error)) {
+        std::cerr << error << std::endl;
+        return 1;
     }
 
-    // Environment coloring.
-    Vec3<T> unitDirection = unit(r.direction());
-    auto t = 0.5 * (unitDirection.y() + 1.0);
-    return (1.0 - t) * Color<T>(1, 1, 1) + t * Color<T>(0.5, 0.7, 1.0);
-}
-
-template <class T> HittableList<T> randomScene() {
-    using std::make_shared;
-
-    HittableList<T> world;
-
-    auto groundMaterial = make_shared<Lambertian<T>>(Color<T>(0.5, 0.5, 0.5));
-    world.add(
-        make_shared<Sphere<T>>(Point3<T>(0, -1000, 0), 1000, groundMaterial));
-
-    // Scattered little spheres.
-    for (int a = -11; a < 11; ++a) {
-        for (int b = -11; b < 11; ++b) {
-            auto chooseMat = randomReal<T>();
-            Point3<T> center(a + 0.9 * randomReal<T>(), 0.2,
-                             b + 0.9 * randomReal<T>());
-
-            if ((center - Point3<T>(4, 0.2, 0)).length() > 0.9) {
-                std::shared_ptr<Material<T>> sphereMat;
-
-                if (chooseMat < 0.8) {
-                    // Diffuse
-                    auto albedo = Color<T>::random() * Color<T>::random();
-                    sphereMat = make_shared<Lambertian<T>>(albedo);
-                    world.add(make_shared<Sphere<T>>(center, 0.2, sphereMat));
-                } else if (chooseMat < 0.95) {
-                    // Metal
-                    auto albedo = Color<T>::random(0.5, 1);
-                    auto fuzz = randomReal<T>(0, 0.5);
-                    sphereMat = make_shared<Metal<T>>(albedo, fuzz);
-                    world.add(make_shared<Sphere<T>>(center, 0.2, sphereMat));
-                } else {
-                    // Glass
-                    sphereMat = make_shared<Dielectric<T>>(1.5);
-                    world.add(make_shared<Sphere<T>>(center, 0.2, sphereMat));
-                }
+    PixelWindow<T> pw(settings.width, settings.height);
+    DisplayBuffer display(settings.width, settings.height, options.resolve);
+    Framebuffer<T> fb(settings.width, settings.height);
+    auto start = std::chrono::high_resolution_clock::now();
+    int passSamples = options.progressive ? options.passSamples()
+                                          : settings.samplesPerPixel;
+    bool failed = false;
+    bool quit = pw.presentWhile(display, options.displayFps,
+                                [&](std::atomic<bool>& stop) {
+        while (fb.samples() < settings.samplesPerPixel && !stop) {
+            int first = fb.samples();
+            int last = std::min(settings.samplesPerPixel, first + passSamples);
+            if (!coordinator.render(fb, first, last, [&](const Tile& tile) {
+                    // Sums so far over the samples this pass brings them to.
+                    display.update(fb, tile.x0, tile.y0, tile.x1, tile.y1,
+                                   last);
+                }, error)) {
+                failed = true;
+                break;
             }
+            fb.addSamples(last - first);
+
+            std::chrono::duration<double> elapsed =
+                std::chrono::high_resolution_clock::now() - start;
+            std::cerr << "\rPass " << coordinator.passes() << ": "
+                      << fb.samples() << " spp in " << elapsed.count() << "s "
+                      << std::flush;
+            if (options.timeBudget > 0 &&
+                elapsed.count() >= options.timeBudget)
+                break;
         }
-    }
+    });
 
-    // Three big lads.
-    auto mat1 = make_shared<Dielectric<T>>(1.5);
-    world.add(make_shared<Sphere<T>>(Point3<T>(0, 1, 0), 1.0, mat1));
+    std::cerr << '\n';
+    if (failed) {
+        std::cerr << error << std::endl;
+        return 1;
+    }
+    coordinator.printStats(std::cerr);
+    pw.printStats(std::cerr, display);
+    ImageWriter<T> writer;
+    if (!options.outputs.empty())
+        writer.submit(fb, options.outputs, options.resolve);
+    if (!quit)
+        pw.awaitQuit();
+    return writer.flush() ? 0 : 1;
+}
 
-    auto mat2 = make_shared<Lambertian<T>>(Color<T>(0.4, 0.2, 0.1));
-    world.add(make_shared<Sphere<T>>(Point3<T>(-4, 1, 0), 1.0, mat2));
+// Frames of the scene's animation in one window, shown as their tiles
+// land, with any files written while the next frame renders.
+template <class T>
+static int renderSequence(const Options& options, Scene<T>& scene,
+                          Bvh<T>& world, const RenderSettings& settings) {
+    int last = options.lastFrame >= 0 ? options.lastFrame
+                                      : std::max(1, scene.animation.frames) - 1;
+    PixelWindow<T> pw(settings.width, settings.height);
+    DisplayBuffer display(settings.width, settings.height, options.resolve);
+    ThreadPool pool(options.threads);
+    SequenceRenderer<T> sequence(scene, world, pool, settings,
+                                 options.lightSampling, options.rebuildBvh);
+    Framebuffer<T> fb(settings.width, settings.height);
+    ImageWriter<T> writer;
+    bool quit = pw.presentWhile(display, options.displayFps,
+                                [&](std::atomic<bool>& stop) {
+        for (int frame = options.firstFrame; frame <= last && !stop;
+             ++frame) {
+            sequence.render(frame, fb, [&](const Tile& tile) {
+                display.update(fb, tile.x0, tile.y0, tile.x1, tile.y1,
+                               settings.samplesPerPixel);
+            });
+            sequence.printFrame(std::cerr);
+            printProfile(std::cerr, sequence.frameStats().back().rays);
 
-    auto mat3 = make_shared<Metal<T>>(Color<T>(0.7, 0.6, 0.5), 0.0);
-    world.add(make_shared<Sphere<T>>(Point3<T>(4, 1, 0), 1.0, mat3));
+            if (!options.outputs.empty()) {
+                std::vector<std::string> paths;
+                for (const auto& output : options.outputs)
+                    paths.push_back(framePath(output, frame));
+                writer.throttle(1);
+                writer.submit(fb, paths, options.resolve);
+            }
+        }
+    });
+    sequence.printSummary(std::cerr);
+    pw.printStats(std::cerr, display);
 
-    return world;
+    bool written = writer.flush();
+    if (!quit)
+        pw.awaitQuit();
+    return written ? 0 : 1;
 }
 
-int main() {
-    std::cout << "Hello Raytrace" << std::endl;
+// One frame, or the frames of a sequence, in precision T.
+template <class T>
+static int render(const Options& options, const char* program) {
+    Scene<T> scene;
+    if (!loadOptionsScene(options, scene))
+        return 1;
+    if (!options.saveScene.empty()) {
+        std::string error;
+        if (!saveScene(options.saveScene, scene, error)) {
+            std::cerr << error << std::endl;
+            return 1;
+        }
+    }
+    RenderSettings settings = sceneSettings(options, scene);
 
-    // Image.
-    const auto aspectRatio = 16.0 / 9.0;
-    const int width = 1024;
-    const int height = static_cast<int>(width / aspectRatio);
-    const int samplesPerPixel = 100;
-    const int maxDepth = 50;
+    if (!options.coordinator.empty())
+        return renderDistributed<T>(options, settings, program);
+    Bvh<T> world(scene.objects);
+    world.setCollectStats(true);
+    if (options.sequence)
+        return renderSequence(options, scene, world, settings);
 
-    // World.
-    auto world = randomScene<real>();
+    // Camera, where the animation has it at the first frame.
+    auto cam = scene.animation.camera(scene.camera, 0)
+                   .camera(T(settings.width) / settings.height);
 
-    // Camera.
-    Point3<real> lookFrom(13, 2, 3);
-    Point3<real> lookAt(0, 0, 0);
-    Vec3<real> vUp(0, 1, 0);
-    real distToFocus = 10.0;
-    real aperture = 0.1;
+    // Render (with timer), shown by this thread while another renders.
+    PixelWindow<T> pw(settings.width, settings.height);
+    DisplayBuffer display(settings.width, settings.height, options.resolve);
+    ThreadPool pool(options.threads);
+    TileRenderer<T> renderer(pool, settings);
+    LightList<T> lights(scene.objects, scene.materials);
+    if (options.lightSampling && !lights.empty()) {
+        renderer.setLights(&lights);
+        std::cerr << "Sampling " << lights.size() << " lights\n";
+    }
+    Framebuffer<T> fb(settings.width, settings.height);
+    FeatureBuffer<T> features(0, 0);
+    if (options.denoise || !options.aov.empty()) {
+        features = FeatureBuffer<T>(settings.width, settings.height);
+        renderer.setFeatures(&features);
+    }
+    auto start = std::chrono::high_resolution_clock::now();
+    std::unique_ptr<AdaptiveSampler<T>> sampler;
 
-    Camera<real> cam(lookFrom, lookAt, vUp, 20, aspectRatio, aperture,
-                     distToFocus);
+    bool quit = pw.presentWhile(display, options.displayFps,
+                                [&](std::atomic<bool>& stop) {
+        if (options.adaptive) {
+            AdaptiveSettings adaptive;
+            adaptive.minSamples = options.minSamples;
+            adaptive.maxSamples = settings.samplesPerPixel;
+            adaptive.samplesPerPass = options.passSamples();
+            adaptive.threshold = options.noiseThreshold;
+            sampler = std::make_unique<AdaptiveSampler<T>>(
+                settings.width, settings.height, adaptive);
 
-    // Render (with timer)
-    PixelWindow<real> pw(width, height);
-    auto start = std::chrono::high_resolution_clock::now();
+            // Passes over the pixels still noisy, shown as they land.
+            while (!sampler->done() && !stop) {
+                sampler->pass(renderer, world, scene.materials, cam);
+                fb = sampler->resolve();
+                display.update(fb, &pool);
 
-    for (int y = height - 1; y >= 0; --y) {
-        std::cerr << "\rScanlines remaining: " << y << ' ' << std::flush;
-        std::vector<Pixel<real>> line(width);
-        for (int x = 0; x < width; ++x) {
-            Color<real> pixelColor(0, 0, 0);
-            for (int s = 0; s < samplesPerPixel; ++s) {
-                auto u = (real(x) + randomReal<real>()) / (width - 1);
-                auto v = (real(y) + randomReal<real>()) / (height - 1);
-                Ray<real> r = cam.getRay(u, v);
-                pixelColor += rayColor(r, world, maxDepth);
+                std::chrono::duration<double> elapsed =
+                    std::chrono::high_resolution_clock::now() - start;
+                std::cerr << "\rPass " << renderer.passes() << ": "
+                          << sampler->activePixels() << " active pixels in "
+                          << elapsed.count() << "s " << std::flush;
+                if (options.timeBudget > 0 &&
+                    elapsed.count() >= options.timeBudget)
+                    break;
             }
-            line[x] = Pixel<real>(Point2<int>(x, y), pixelColor);
+        } else if (options.progressive) {
+            // Whole frame passes of a few samples each, tiles shown as they
+            // land with the samples their pass brings them to.
+            while (fb.samples() < settings.samplesPerPixel && !stop) {
+                int first = fb.samples();
+                int last = std::min(settings.samplesPerPixel,
+                                    first + options.passSamples());
+                renderer.render(world, scene.materials, cam, fb, first,
+                                last, [&](const Tile& tile) {
+                                    display.update(fb, tile.x0, tile.y0,
+                                                   tile.x1, tile.y1, last);
+                                });
+                fb.addSamples(last - first);
+
+                std::chrono::duration<double> elapsed =
+                    std::chrono::high_resolution_clock::now() - start;
+                std::cerr << "\rPass " << renderer.passes() << ": "
+                          << fb.samples() << " spp in " << elapsed.count()
+                          << "s " << std::flush;
+                if (options.timeBudget > 0 &&
+                    elapsed.count() >= options.timeBudget)
+                    break;
+            }
+        } else {
+            size_t tilesDone = 0;
+            renderer.render(world, scene.materials, cam, fb, 0,
+                            settings.samplesPerPixel, [&](const Tile& tile) {
+                                std::cerr << "\rTiles completed: "
+                                          << ++tilesDone << ' ' << std::flush;
+                                display.update(fb, tile.x0, tile.y0, tile.x1,
+                                               tile.y1,
+                                               settings.samplesPerPixel);
+                            });
+            fb.addSamples(settings.samplesPerPixel);
         }
-        pw.setPixels(line, samplesPerPixel);
-        pw.draw();
-    }
+    });
 
     // Display timing info.
     auto stop = std::chrono::high_resolution_clock::now();
     auto duration =
         std::chrono::duration_cast<std::chrono::seconds>(stop - start);
     std::cerr << "\nCompleted: " << duration.count() << "s\n" << std::flush;
+    renderer.printStats(std::cerr);
+    pw.printStats(std::cerr, display);
+    printBvhStats(std::cerr, world);
+    if (sampler)
+        sampler->printStats(std::cerr);
 
-    pw.awaitQuit();
-    return 0;
+    ImageWriter<T> writer;
+    if (!options.aov.empty()) {
+        writer.submit(features.albedo(fb.samples()),
+                      {aovPath(options.aov, "albedo")});
+        writer.submit(features.normal(fb.samples()),
+                      {aovPath(options.aov, "normal")});
+        writer.submit(features.depth(fb.samples()),
+                      {aovPath(options.aov, "depth")});
+    }
+    if (options.denoise) {
+        Denoiser<T> denoiser(pool);
+        fb = denoiser.denoise(fb, features);
+        denoiser.printStats(std::cerr);
+        display.update(fb, &pool);
+        pw.present(display);
+    }
+    if (!options.outputs.empty())
+        writer.submit(fb, options.outputs, options.resolve);
+    if (sampler && !options.heatmap.empty())
+        writer.submit(sampler->heatmap(), {options.heatmap});
+    printProfile(std::cerr, renderer.rays());
+
+    if (!quit)
+        pw.awaitQuit();
+    return writer.flush() ? 0 : 1;
 }
+
+// Writes the trace --trace asks for once everything has rendered.
+static int finishTrace(const Options& options, int status) {
+    if (options.trace.empty())
+        return status;
+    std::string error;
+    if (!Profiler::instance().writeTrace(options.trace, error)) {
+        std::cerr << error << std::endl;
+        return 1;
+    }
+    std::cerr << "Wrote " << options.trace << '\n';
+    return status;
+}
+
+int main(int argc, char** argv) {
+    std::cout << "Hello Raytrace" << std::endl;
+
+    Options options;
+    if (!options.parse(argc, argv))
+        return 1;
+    setSimd(options.simd);
+    profileThreadName("main");
+    if (!options.trace.empty())
+        Profiler::instance().setTracing(true);
+    if (!options.worker.empty())
+        return runWorker(options.worker, options.threads) ? 0 : 1;
+    if (options.comparePrecision) {
+        std::cerr << "--compare-precision is for raytrace_headless\n";
+        return 1;
+    }
+    if (options.precision == Precision::Double)
+        return finishTrace(options, render<double>(options, argv[0]));
+    return finishTrace(options, render<float>(options, argv[0]));
+}
+
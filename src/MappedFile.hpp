@@ -0,0 +1,102 @@
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define RAYTRACE_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#define RAYTRACE_MMAP 0
+#endif
+
+namespace raytrace {
+
+// Read only view of a whole file. Memory mapped where the platform allows,
+// so pages are only read when touched; elsewhere the file is read into one
+// buffer. Not copyable, the mapping lives as long as the object.
+class MappedFile {
+  public:
+    MappedFile() {}
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile() { close(); }
+
+    bool open(const std::string& path) {
+        close();
+#if RAYTRACE_MMAP
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            ::close(fd);
+            return false;
+        }
+        length = static_cast<size_t>(st.st_size);
+        if (length > 0) {
+            void* p = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p == MAP_FAILED) {
+                ::close(fd);
+                length = 0;
+                return false;
+            }
+            madvise(p, length, MADV_SEQUENTIAL);
+            bytes = static_cast<const uint8_t*>(p);
+            mapped = true;
+        }
+        ::close(fd);
+        return true;
+#else
+        std::ifstream file(path, std::ios::binary | std::ios::ate);
+        if (!file)
+            return false;
+        buffer.resize(static_cast<size_t>(file.tellg()));
+        file.seekg(0);
+        file.read(reinterpret_cast<char*>(buffer.data()), buffer.size());
+        bytes = buffer.data();
+        length = buffer.size();
+        return static_cast<bool>(file);
+#endif
+    }
+
+    // Takes over bytes already in memory, such as a file received over a
+    // socket, to be read like an opened file.
+    void assign(std::vector<uint8_t> data) {
+        close();
+        buffer = std::move(data);
+        bytes = buffer.data();
+        length = buffer.size();
+    }
+
+    void close() {
+#if RAYTRACE_MMAP
+        if (mapped)
+            munmap(const_cast<uint8_t*>(bytes), length);
+#endif
+        buffer.clear();
+        mapped = false;
+        bytes = nullptr;
+        length = 0;
+    }
+
+    const uint8_t* data() const { return bytes; }
+    size_t size() const { return length; }
+
+  private:
+    const uint8_t* bytes = nullptr;
+    size_t length = 0;
+    bool mapped = false;
+    std::vector<uint8_t> buffer;
+};
+
+} // namespace raytrace
+
+#endif // MAPPEDFILE_H
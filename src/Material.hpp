@@ -1,99 +1,287 @@
 #ifndef MATERIAL_H
 #define MATERIAL_H
 
+#include <cstdint>
+#include <variant>
+#include <vector>
+
 #include "Common.hpp"
 
+#include "Hittable.hpp"
+#include "Sampler.hpp"
+#include "Sampling.hpp"
+
 namespace raytrace {
 
-// Abstract class for materials
-template <class T> class Material {
-  public:
-    // Returns if the ray is absorbed, optionally outputs scatter ray with
-    // attenuation information.
-    virtual bool scatter(const Ray<T>& rIn, const HitRecord<T>& rec,
-                         Color<T>& attenuation, Ray<T>& scattered) const = 0;
-};
+// Each material type exposes the same non-virtual scatter():
+// returns if the ray is absorbed, optionally outputs scatter ray with
+// attenuation information.
+//
+// Materials that scatter over a spread of directions also describe that
+// spread, so the integrator can sample lights directly: evaluate() gives
+// the scattered fraction towards a unit direction times the cosine at the
+// surface, pdf() the density over solid angle with which scatter() picks
+// that direction. Their ratio is scatter()'s attenuation.
 
 // Lambertian (diffuse) material.
-template <class T> class Lambertian : public Material<T> {
+template <class T> class Lambertian {
   public:
     Lambertian(const Color<T>& a) : albedo(a) {}
 
-    virtual bool scatter(const Ray<T>& rIn, const HitRecord<T>& rec,
-                         Color<T>& attenuation,
-                         Ray<T>& scattered) const override {
-        auto scatterDirection = rec.normal + Vec3<T>::randomUnitVec();
-
-        // Catch degenerate scatter direction
-        if (scatterDirection.nearZero())
-            scatterDirection = rec.normal;
-
-        scattered = Ray<T>(rec.p, scatterDirection);
+    bool scatter(const Ray<T>& rIn, const HitRecord<T>& rec,
+                 Color<T>& attenuation, Ray<T>& scattered) const {
+        Vec3<T> local = sampleCosineHemisphere(sample2D<T>());
+        scattered =
+            Ray<T>(rec.p, Onb<T>(rec.normal).toWorld(local), rIn.time());
         attenuation = albedo;
         return true;
     }
 
+    Color<T> evaluate(const Ray<T>& rIn, const HitRecord<T>& rec,
+                      const Vec3<T>& direction) const {
+        return albedo * pdf(rIn, rec, direction);
+    }
+
+    // scatter() samples the hemisphere about the normal by cosine.
+    T pdf(const Ray<T>& rIn, const HitRecord<T>& rec,
+          const Vec3<T>& direction) const {
+        T cosine = dot(rec.normal, direction);
+        return cosine > 0 ? cosine / pi<T> : 0;
+    }
+
+    Color<T> getAlbedo() const { return albedo; }
+
   private:
     Color<T> albedo;
 };
 
 // Metal (reflective) material
-template <class T> class Metal : public Material<T> {
+template <class T> class Metal {
   public:
     Metal(const Color<T>& a, T f) : albedo(a), fuzz(f < 1 ? f : 1) {}
 
-    virtual bool scatter(const Ray<T>& rIn, const HitRecord<T>& rec,
-                         Color<T>& attenuation,
-                         Ray<T>& scattered) const override {
+    bool scatter(const Ray<T>& rIn, const HitRecord<T>& rec,
+                 Color<T>& attenuation, Ray<T>& scattered) const {
         Vec3<T> reflected = reflect(unit(rIn.direction()), rec.normal);
-        scattered =
-            Ray<T>(rec.p, reflected + fuzz * Vec3<T>::randomInUnitSphere());
+        Vec2<T> u = sample2D<T>();
+        Vec3<T> offset = fuzz * sampleUniformBall(u, sample1D<T>());
+        scattered = Ray<T>(rec.p, reflected + offset, rIn.time());
         attenuation = albedo;
         return dot(scattered.direction(), rec.normal) > 0;
     }
 
+    // Rays scattered below the surface are absorbed, so the rest keep the
+    // albedo and the scattered fraction follows the sampling density.
+    Color<T> evaluate(const Ray<T>& rIn, const HitRecord<T>& rec,
+                      const Vec3<T>& direction) const {
+        if (dot(direction, rec.normal) <= 0)
+            return Color<T>(0, 0, 0);
+        return albedo * pdf(rIn, rec, direction);
+    }
+
+    // The scattered direction points at a uniform point of a ball of radius
+    // fuzz about the unit mirror direction. The density of a direction is
+    // the ball's volume along that line, integral of t^2 dt over the chord,
+    // over the volume of the ball.
+    T pdf(const Ray<T>& rIn, const HitRecord<T>& rec,
+          const Vec3<T>& direction) const {
+        if (fuzz <= 0)
+            return 0;
+        Vec3<T> reflected = reflect(unit(rIn.direction()), rec.normal);
+        T c = dot(direction, reflected);
+        T discriminant = c * c - 1 + fuzz * fuzz;
+        if (discriminant <= 0)
+            return 0;
+        T h = std::sqrt(discriminant);
+        T far = c + h, near = std::max<T>(0, c - h);
+        if (far <= 0)
+            return 0;
+        return (far * far * far - near * near * near) /
+               (4 * pi<T> * fuzz * fuzz * fuzz);
+    }
+
+    // A perfect mirror has no spread to sample lights against.
+    bool diffuse() const { return fuzz > 0; }
+
+    Color<T> getAlbedo() const { return albedo; }
+    T getFuzz() const { return fuzz; }
+
   private:
     Color<T> albedo;
     T fuzz;
 };
 
 // Dielectric (transparent/refractive) material
-template <class T> class Dielectric : public Material<T> {
+template <class T> class Dielectric {
   public:
     Dielectric(T indexOfRefraction) : ir(indexOfRefraction) {}
 
-    virtual bool scatter(const Ray<T>& rIn, const HitRecord<T>& rec,
-                         Color<T>& attenuation,
-                         Ray<T>& scattered) const override {
+    bool scatter(const Ray<T>& rIn, const HitRecord<T>& rec,
+                 Color<T>& attenuation, Ray<T>& scattered) const {
         attenuation = Color<T>(1, 1, 1);
-        T refractionRatio = rec.frontFace ? (1.0 / ir) : ir;
+        T refractionRatio = rec.frontFace ? 1 / ir : ir;
         Vec3<T> unitDir = unit(rIn.direction());
 
-        T cosTheta = std::min<T>(dot(-unitDir, rec.normal), 1.0);
-        T sinTheta = std::sqrt(1.0 - cosTheta * cosTheta);
+        T cosTheta = std::min<T>(dot(-unitDir, rec.normal), 1);
+        T sinTheta = std::sqrt(1 - cosTheta * cosTheta);
 
-        bool cannotRefract = refractionRatio * sinTheta > 1.0;
+        bool cannotRefract = refractionRatio * sinTheta > 1;
         Vec3<T> direction;
 
         if (cannotRefract ||
-            reflectance(cosTheta, refractionRatio) > randomReal<T>())
+            reflectance(cosTheta, refractionRatio) > sample1D<T>())
             direction = reflect(unitDir, rec.normal);
         else
             direction = refract(unitDir, rec.normal, refractionRatio);
 
-        scattered = Ray<T>(rec.p, direction);
+        scattered = Ray<T>(rec.p, direction, rIn.time());
         return true;
     }
 
+    T getIndex() const { return ir; }
+
   private:
     T ir;
 
-    // Using Christope Schlick's approximation for reflectance.
+    // Using Christope Schlick's approximation for reflectance. The fifth
+    // power is multiplied out, std::pow with an int exponent computes in
+    // double.
     static T reflectance(T cos, T refRatio) {
-        auto r0 = (1 - refRatio) / (1 + refRatio);
+        T r0 = (1 - refRatio) / (1 + refRatio);
         r0 *= r0;
-        return r0 + (1 - r0) * std::pow(1 - cos, 5);
+        T x = 1 - cos, x2 = x * x;
+        return r0 + (1 - r0) * (x2 * x2 * x);
+    }
+};
+
+// Emits light of its own on both sides and scatters nothing.
+template <class T> class Emissive {
+  public:
+    Emissive(const Color<T>& radiance) : radiance(radiance) {}
+
+    bool scatter(const Ray<T>& rIn, const HitRecord<T>& rec,
+                 Color<T>& attenuation, Ray<T>& scattered) const {
+        return false;
+    }
+
+    Color<T> getRadiance() const { return radiance; }
+
+  private:
+    Color<T> radiance;
+};
+
+// Any material, stored by value. Dispatch is a switch on the variant's tag,
+// no virtual calls or reference counting on the shading path.
+template <class T> class Material {
+  public:
+    enum Kind : uint32_t {
+        LambertianKind,
+        MetalKind,
+        DielectricKind,
+        EmissiveKind
+    };
+
+    Material(const Lambertian<T>& m) : value(m) {}
+    Material(const Metal<T>& m) : value(m) {}
+    Material(const Dielectric<T>& m) : value(m) {}
+    Material(const Emissive<T>& m) : value(m) {}
+
+    Kind kind() const { return static_cast<Kind>(value.index()); }
+
+    // The wrapped material if it is an M, else nullptr.
+    template <class M> const M* as() const { return std::get_if<M>(&value); }
+
+    bool scatter(const Ray<T>& rIn, const HitRecord<T>& rec,
+                 Color<T>& attenuation, Ray<T>& scattered) const {
+        bool scatters = false;
+        switch (kind()) {
+        case LambertianKind:
+            profileCount(Counter::ScatterLambertian);
+            scatters = std::get_if<LambertianKind>(&value)->scatter(
+                rIn, rec, attenuation, scattered);
+            break;
+        case MetalKind:
+            profileCount(Counter::ScatterMetal);
+            scatters = std::get_if<MetalKind>(&value)->scatter(
+                rIn, rec, attenuation, scattered);
+            break;
+        case DielectricKind:
+            profileCount(Counter::ScatterDielectric);
+            scatters = std::get_if<DielectricKind>(&value)->scatter(
+                rIn, rec, attenuation, scattered);
+            break;
+        case EmissiveKind:
+            break;
+        }
+        if (!scatters)
+            profileCount(Counter::Absorbed);
+        return scatters;
+    }
+
+    // Light given off by the surface itself, black unless Emissive.
+    Color<T> emitted() const {
+        if (kind() == EmissiveKind)
+            return std::get_if<EmissiveKind>(&value)->getRadiance();
+        return Color<T>(0, 0, 0);
     }
+
+    // Fraction of light the surface passes on, for the denoiser to tell
+    // surfaces apart by: white for glass and lights.
+    Color<T> albedo() const {
+        if (kind() == LambertianKind)
+            return std::get_if<LambertianKind>(&value)->getAlbedo();
+        if (kind() == MetalKind)
+            return std::get_if<MetalKind>(&value)->getAlbedo();
+        return Color<T>(1, 1, 1);
+    }
+
+    // Whether evaluate() and pdf() describe scatter(), so lights may be
+    // sampled at hits on this material. False for mirrors and glass.
+    bool diffuse() const {
+        if (kind() == MetalKind)
+            return std::get_if<MetalKind>(&value)->diffuse();
+        return kind() == LambertianKind;
+    }
+
+    Color<T> evaluate(const Ray<T>& rIn, const HitRecord<T>& rec,
+                      const Vec3<T>& direction) const {
+        if (kind() == LambertianKind)
+            return std::get_if<LambertianKind>(&value)->evaluate(rIn, rec,
+                                                                 direction);
+        if (kind() == MetalKind)
+            return std::get_if<MetalKind>(&value)->evaluate(rIn, rec,
+                                                            direction);
+        return Color<T>(0, 0, 0);
+    }
+
+    T pdf(const Ray<T>& rIn, const HitRecord<T>& rec,
+          const Vec3<T>& direction) const {
+        if (kind() == LambertianKind)
+            return std::get_if<LambertianKind>(&value)->pdf(rIn, rec,
+                                                            direction);
+        if (kind() == MetalKind)
+            return std::get_if<MetalKind>(&value)->pdf(rIn, rec, direction);
+        return 0;
+    }
+
+  private:
+    std::variant<Lambertian<T>, Metal<T>, Dielectric<T>, Emissive<T>> value;
+};
+
+// Scene owned, contiguous store of materials. Hit records refer to entries
+// by their 32 bit index.
+template <class T> class MaterialTable {
+  public:
+    uint32_t add(const Material<T>& m) {
+        materials.push_back(m);
+        return static_cast<uint32_t>(materials.size() - 1);
+    }
+
+    const Material<T>& operator[](uint32_t id) const { return materials[id]; }
+    size_t size() const { return materials.size(); }
+
+  private:
+    std::vector<Material<T>> materials;
 };
 
 } // namespace raytrace
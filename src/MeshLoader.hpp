@@ -0,0 +1,589 @@
+#ifndef MESHLOADER_H
+#define MESHLOADER_H
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "Common.hpp"
+
+#include "ParseNumber.hpp"
+#include "TriangleMesh.hpp"
+
+namespace raytrace {
+
+// Both loaders stream the file through a fixed size buffer straight into
+// the vertex and index arrays, the file itself is never held in memory.
+
+struct MeshLoadStats {
+    size_t bytes = 0;
+    size_t vertices = 0;
+    size_t triangles = 0;
+    double readSeconds = 0; // Parsing the file into vertices and indices.
+    double bvhSeconds = 0;
+    size_t memoryBytes = 0; // Held by the geometry afterwards.
+};
+
+namespace detail {
+
+// Buffered reads from a FILE, for the loaders.
+class FileStream {
+  public:
+    static constexpr size_t bufferSize = 1 << 20;
+
+    FileStream() : buffer(bufferSize) {}
+    FileStream(const FileStream&) = delete;
+    FileStream& operator=(const FileStream&) = delete;
+    ~FileStream() {
+        if (file)
+            std::fclose(file);
+    }
+
+    bool open(const std::string& path) {
+        file = std::fopen(path.c_str(), "rb");
+        if (!file)
+            return false;
+        if (std::fseek(file, 0, SEEK_END) == 0) {
+            long end = std::ftell(file);
+            fileSize = end > 0 ? size_t(end) : 0;
+        }
+        std::rewind(file);
+        return true;
+    }
+
+    size_t bytesRead() const { return total; }
+
+    // Bytes not yet consumed, for bounding counts a header claims.
+    size_t remaining() const {
+        size_t consumed = total - (length - pos);
+        return fileSize > consumed ? fileSize - consumed : 0;
+    }
+
+    // Copy n bytes out, false if the file ends first.
+    bool read(void* out, size_t n) {
+        auto* dst = static_cast<char*>(out);
+        while (n > 0) {
+            if (pos == length && !refill(0))
+                return false;
+            size_t count = std::min(n, length - pos);
+            std::memcpy(dst, &buffer[pos], count);
+            pos += count;
+            dst += count;
+            n -= count;
+        }
+        return true;
+    }
+
+    // Next line without its terminator, valid until the next call. Lines
+    // longer than the buffer are cut. False at the end of the file.
+    bool line(const char*& begin, const char*& end) {
+        while (true) {
+            const char* start = &buffer[pos];
+            const char* stop = &buffer[0] + length;
+            auto* newline =
+                static_cast<const char*>(std::memchr(start, '\n', stop - start));
+            if (newline) {
+                begin = start;
+                end = newline;
+                pos = newline - &buffer[0] + 1;
+                return true;
+            }
+            // Keep the partial line and read more behind it.
+            size_t partial = length - pos;
+            if (partial == bufferSize || !refill(partial)) {
+                if (partial == 0)
+                    return false;
+                begin = &buffer[pos];
+                end = begin + partial;
+                pos = length;
+                return true;
+            }
+        }
+    }
+
+  private:
+    std::FILE* file = nullptr;
+    std::vector<char> buffer;
+    size_t pos = 0;
+    size_t length = 0;
+    size_t total = 0;
+    size_t fileSize = 0;
+
+    // Move the unread tail of length keep to the front and fill the rest.
+    bool refill(size_t keep) {
+        std::memmove(&buffer[0], &buffer[length - keep], keep);
+        size_t count =
+            std::fread(&buffer[keep], 1, buffer.size() - keep, file);
+        total += count;
+        pos = 0;
+        length = keep + count;
+        return count > 0;
+    }
+};
+
+inline void skipSpaces(const char*& p, const char* end) {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+        ++p;
+}
+
+// A face's vertex reference, a whole number optionally followed by
+// /texture/normal references, which are skipped. False with p unmoved if
+// there is no number, with ok cleared if there is one but not a valid
+// reference: fractional, or too large for any vertex.
+inline bool parseIndex(const char*& p, const char* end, int64_t& out,
+                       bool& ok) {
+    const char* q = p;
+    bool negative = q < end && *q == '-';
+    if (q < end && (*q == '-' || *q == '+'))
+        ++q;
+    if (q == end || *q < '0' || *q > '9')
+        return false;
+    int64_t value = 0;
+    for (; q < end && *q >= '0' && *q <= '9'; ++q)
+        value = std::min<int64_t>(value * 10 + (*q - '0'), int64_t(1) << 40);
+    ok = value <= UINT32_MAX &&
+         (q == end || *q == '/' || *q == ' ' || *q == '\t' || *q == '\r');
+    while (q < end && *q != ' ' && *q != '\t' && *q != '\r')
+        ++q;
+    out = negative ? -value : value;
+    p = q;
+    return true;
+}
+
+// Scalar property types of PLY files.
+enum class PlyType { Int8, UInt8, Int16, UInt16, Int32, UInt32, Float, Double };
+
+inline bool plyType(const std::string& name, PlyType& type, int& bytes) {
+    static const struct {
+        const char* names[2];
+        PlyType type;
+        int bytes;
+    } types[] = {{{"char", "int8"}, PlyType::Int8, 1},
+                 {{"uchar", "uint8"}, PlyType::UInt8, 1},
+                 {{"short", "int16"}, PlyType::Int16, 2},
+                 {{"ushort", "uint16"}, PlyType::UInt16, 2},
+                 {{"int", "int32"}, PlyType::Int32, 4},
+                 {{"uint", "uint32"}, PlyType::UInt32, 4},
+                 {{"float", "float32"}, PlyType::Float, 4},
+                 {{"double", "float64"}, PlyType::Double, 8}};
+    for (const auto& t : types) {
+        if (name == t.names[0] || name == t.names[1]) {
+            type = t.type;
+            bytes = t.bytes;
+            return true;
+        }
+    }
+    return false;
+}
+
+inline double plyValue(const uint8_t* p, PlyType type, bool swap) {
+    uint8_t b[8];
+    int n = type == PlyType::Double                           ? 8
+            : type == PlyType::Float || type == PlyType::Int32 ||
+                      type == PlyType::UInt32
+                ? 4
+            : type == PlyType::Int16 || type == PlyType::UInt16 ? 2
+                                                                : 1;
+    for (int i = 0; i < n; ++i)
+        b[i] = swap ? p[n - 1 - i] : p[i];
+
+    switch (type) {
+    case PlyType::Int8:
+        return static_cast<int8_t>(b[0]);
+    case PlyType::UInt8:
+        return b[0];
+    case PlyType::Int16: {
+        int16_t v;
+        std::memcpy(&v, b, 2);
+        return v;
+    }
+    case PlyType::UInt16: {
+        uint16_t v;
+        std::memcpy(&v, b, 2);
+        return v;
+    }
+    case PlyType::Int32: {
+        int32_t v;
+        std::memcpy(&v, b, 4);
+        return v;
+    }
+    case PlyType::UInt32: {
+        uint32_t v;
+        std::memcpy(&v, b, 4);
+        return v;
+    }
+    case PlyType::Float: {
+        float v;
+        std::memcpy(&v, b, 4);
+        return v;
+    }
+    case PlyType::Double: {
+        double v;
+        std::memcpy(&v, b, 8);
+        return v;
+    }
+    }
+    return 0;
+}
+
+struct PlyProperty {
+    std::string name;
+    PlyType type;
+    int bytes;
+    bool list = false;
+    PlyType countType; // Lists only.
+    int countBytes = 0;
+};
+
+struct PlyElement {
+    std::string name;
+    size_t count;
+    std::vector<PlyProperty> properties;
+};
+
+inline bool hostIsLittleEndian() {
+    const uint16_t probe = 1;
+    uint8_t first;
+    std::memcpy(&first, &probe, 1);
+    return first == 1;
+}
+
+} // namespace detail
+
+// Wavefront OBJ: 'v' positions and 'f' faces, polygons are split into fans.
+// Texture coordinates, normals, groups and materials are skipped.
+template <class T>
+bool loadObj(const std::string& path, std::vector<Point3<T>>& vertices,
+             std::vector<uint32_t>& indices, std::string& error,
+             size_t* bytes = nullptr) {
+    detail::FileStream in;
+    if (!in.open(path)) {
+        error = "could not open " + path;
+        return false;
+    }
+
+    const char* begin;
+    const char* end;
+    size_t lineNumber = 0;
+    std::vector<uint32_t> face;
+    while (in.line(begin, end)) {
+        lineNumber++;
+        const char* p = begin;
+        detail::skipSpaces(p, end);
+        if (end - p < 2 || (p[1] != ' ' && p[1] != '\t'))
+            continue;
+
+        if (p[0] == 'v') {
+            double x, y, z;
+            p += 2;
+            bool ok = (detail::skipSpaces(p, end), parseNumber(p, end, x)) &&
+                      (detail::skipSpaces(p, end), parseNumber(p, end, y)) &&
+                      (detail::skipSpaces(p, end), parseNumber(p, end, z));
+            if (!ok) {
+                error = "line " + std::to_string(lineNumber) + ": bad vertex";
+                return false;
+            }
+            vertices.emplace_back(x, y, z);
+        } else if (p[0] == 'f') {
+            face.clear();
+            p += 2;
+            while (true) {
+                detail::skipSpaces(p, end);
+                int64_t index;
+                bool ok = true;
+                if (!detail::parseIndex(p, end, index, ok))
+                    break;
+                index = index < 0 ? int64_t(vertices.size()) + index
+                                  : index - 1;
+                if (!ok || index < 0) {
+                    error = "line " + std::to_string(lineNumber) +
+                            ": bad vertex reference";
+                    return false;
+                }
+                face.push_back(static_cast<uint32_t>(index));
+            }
+            for (size_t i = 2; i < face.size(); ++i) {
+                indices.push_back(face[0]);
+                indices.push_back(face[i - 1]);
+                indices.push_back(face[i]);
+            }
+        }
+    }
+
+    // Faces may name vertices that come later, so check at the end.
+    for (uint32_t index : indices) {
+        if (index >= vertices.size()) {
+            error = "face references missing vertex " + std::to_string(index);
+            return false;
+        }
+    }
+    if (bytes)
+        *bytes = in.bytesRead();
+    return true;
+}
+
+// Binary PLY, either byte order: x, y, z of the vertex element and the
+// vertex index list of the face element. Polygons are split into fans.
+template <class T>
+bool loadPly(const std::string& path, std::vector<Point3<T>>& vertices,
+             std::vector<uint32_t>& indices, std::string& error,
+             size_t* bytes = nullptr) {
+    using namespace detail;
+    FileStream in;
+    if (!in.open(path)) {
+        error = "could not open " + path;
+        return false;
+    }
+
+    // Header.
+    const char* begin;
+    const char* end;
+    std::vector<PlyElement> elements;
+    bool swap = false;
+    bool magic = false;
+    while (true) {
+        if (!in.line(begin, end)) {
+            error = "missing end_header";
+            return false;
+        }
+        std::string text(begin, end);
+        if (!text.empty() && text.back() == '\r')
+            text.pop_back();
+        std::istringstream words(text);
+        std::string word;
+        words >> word;
+
+        if (!magic) {
+            if (word != "ply") {
+                error = "not a PLY file";
+                return false;
+            }
+            magic = true;
+        } else if (word == "format") {
+            std::string format;
+            words >> format;
+            if (format == "binary_little_endian")
+                swap = !hostIsLittleEndian();
+            else if (format == "binary_big_endian")
+                swap = hostIsLittleEndian();
+            else {
+                error = "only binary PLY is supported, not " + format;
+                return false;
+            }
+        } else if (word == "element") {
+            PlyElement element;
+            long long count = -1;
+            words >> element.name >> count;
+            if (!words || count < 0) {
+                error = "bad element count";
+                return false;
+            }
+            element.count = size_t(count);
+            elements.push_back(element);
+        } else if (word == "property" && !elements.empty()) {
+            PlyProperty property;
+            std::string type;
+            words >> type;
+            if (type == "list") {
+                std::string countType;
+                words >> countType >> type;
+                property.list = true;
+                if (!plyType(countType, property.countType,
+                             property.countBytes)) {
+                    error = "unknown PLY type " + countType;
+                    return false;
+                }
+            }
+            if (!plyType(type, property.type, property.bytes)) {
+                error = "unknown PLY type " + type;
+                return false;
+            }
+            words >> property.name;
+            elements.back().properties.push_back(property);
+        } else if (word == "end_header") {
+            break;
+        }
+    }
+
+    // Body, one record at a time through the stream buffer.
+    std::vector<uint8_t> record;
+    std::vector<uint32_t> face;
+    for (const auto& element : elements) {
+        bool isVertex = element.name == "vertex";
+        bool isFace = element.name == "face";
+        int position[3] = {-1, -1, -1};
+        int listIndex = -1;
+        for (size_t i = 0; i < element.properties.size(); ++i) {
+            const auto& property = element.properties[i];
+            if (property.list) {
+                if (property.name == "vertex_indices" ||
+                    property.name == "vertex_index")
+                    listIndex = static_cast<int>(i);
+                continue;
+            }
+            for (int axis = 0; axis < 3; ++axis)
+                if (property.name == std::string(1, char('x' + axis)))
+                    position[axis] = static_cast<int>(i);
+        }
+        if (isVertex && (position[0] < 0 || position[1] < 0 ||
+                         position[2] < 0)) {
+            error = "vertex element without x, y and z";
+            return false;
+        }
+        // Every record takes at least its scalars and list counts, so the
+        // file bounds the count before anything is reserved for it.
+        size_t recordBytes = 0;
+        for (const auto& property : element.properties)
+            recordBytes += property.list ? property.countBytes : property.bytes;
+        if (element.count > in.remaining() / std::max<size_t>(recordBytes, 1)) {
+            error = "truncated " + element.name + " data";
+            return false;
+        }
+        if (isVertex)
+            vertices.reserve(vertices.size() + element.count);
+        if (isFace)
+            indices.reserve(indices.size() + 3 * element.count);
+
+        double coords[3];
+        for (size_t n = 0; n < element.count; ++n) {
+            face.clear();
+            for (size_t i = 0; i < element.properties.size(); ++i) {
+                const auto& property = element.properties[i];
+                uint8_t value[8];
+                if (!property.list) {
+                    if (!in.read(value, property.bytes)) {
+                        error = "truncated " + element.name + " data";
+                        return false;
+                    }
+                    for (int axis = 0; isVertex && axis < 3; ++axis)
+                        if (position[axis] == int(i))
+                            coords[axis] = plyValue(value, property.type, swap);
+                    continue;
+                }
+
+                if (!in.read(value, property.countBytes)) {
+                    error = "truncated " + element.name + " data";
+                    return false;
+                }
+                double length = plyValue(value, property.countType, swap);
+                if (!(length >= 0) || length != std::floor(length) ||
+                    length * property.bytes > double(in.remaining())) {
+                    error = "bad list length in " + element.name + " data";
+                    return false;
+                }
+                size_t count = static_cast<size_t>(length);
+                record.resize(count * property.bytes);
+                if (!in.read(record.data(), record.size())) {
+                    error = "truncated " + element.name + " data";
+                    return false;
+                }
+                if (isFace && int(i) == listIndex)
+                    for (size_t k = 0; k < count; ++k) {
+                        double index = plyValue(&record[k * property.bytes],
+                                                property.type, swap);
+                        if (!(index >= 0) || index > UINT32_MAX ||
+                            index != std::floor(index)) {
+                            error = "bad vertex reference in face data";
+                            return false;
+                        }
+                        face.push_back(static_cast<uint32_t>(index));
+                    }
+            }
+
+            if (isVertex)
+                vertices.emplace_back(coords[0], coords[1], coords[2]);
+            for (size_t k = 2; k < face.size(); ++k) {
+                indices.push_back(face[0]);
+                indices.push_back(face[k - 1]);
+                indices.push_back(face[k]);
+            }
+        }
+    }
+
+    for (uint32_t index : indices) {
+        if (index >= vertices.size()) {
+            error = "face references missing vertex " + std::to_string(index);
+            return false;
+        }
+    }
+    if (bytes)
+        *bytes = in.bytesRead();
+    return true;
+}
+
+// Load an .obj or .ply file into shared geometry, or nullptr with a message
+// in error.
+template <class T>
+std::shared_ptr<MeshGeometry<T>> loadMesh(const std::string& path,
+                                          std::string& error,
+                                          MeshLoadStats* stats = nullptr) {
+    auto start = std::chrono::steady_clock::now();
+    std::vector<Point3<T>> vertices;
+    std::vector<uint32_t> indices;
+    size_t bytes = 0;
+
+    auto ext = path.size() >= 4 ? path.substr(path.size() - 4) : "";
+    for (auto& c : ext)
+        c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+    bool loaded;
+    if (ext == ".obj")
+        loaded = loadObj(path, vertices, indices, error, &bytes);
+    else if (ext == ".ply")
+        loaded = loadPly(path, vertices, indices, error, &bytes);
+    else {
+        error = "unsupported mesh format";
+        loaded = false;
+    }
+    if (!loaded) {
+        error = path + ": " + error;
+        return nullptr;
+    }
+
+    vertices.shrink_to_fit();
+    indices.shrink_to_fit();
+    std::chrono::duration<double> readTime =
+        std::chrono::steady_clock::now() - start;
+    auto geometry = std::make_shared<MeshGeometry<T>>(
+        std::move(vertices), std::move(indices), path);
+
+    if (stats) {
+        stats->bytes = bytes;
+        stats->vertices = geometry->vertexCount();
+        stats->triangles = geometry->triangleCount();
+        stats->readSeconds = readTime.count();
+        stats->bvhSeconds = geometry->bvhStats().seconds;
+        stats->memoryBytes = geometry->memoryBytes();
+    }
+    return geometry;
+}
+
+inline void printMeshLoadStats(std::ostream& out, const std::string& path,
+                               const MeshLoadStats& stats) {
+    double millions = stats.triangles * 1e-6;
+    out << "Mesh " << path << ": " << stats.vertices << " vertices, "
+        << stats.triangles << " triangles, read "
+        << stats.bytes / (1024.0 * 1024.0) << " MiB in "
+        << stats.readSeconds * 1e3 << "ms";
+    if (millions > 0)
+        out << " (" << stats.readSeconds / millions
+            << "s per million triangles)";
+    out << ", BVH " << stats.bvhSeconds * 1e3 << "ms, "
+        << stats.memoryBytes / (1024.0 * 1024.0) << " MiB";
+    if (stats.triangles > 0)
+        out << " (" << double(stats.memoryBytes) / stats.triangles
+            << " bytes per triangle)";
+    out << '\n';
+}
+
+} // namespace raytrace
+
+#endif // MESHLOADER_H
@@ -0,0 +1,309 @@
+#ifndef OPTIONS_H
+#define OPTIONS_H
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "Integrator.hpp"
+#include "Profile.hpp"
+#include "Resolve.hpp"
+#include "Sampler.hpp"
+#include "SceneFile.hpp"
+#include "Scenes.hpp"
+#include "Simd.hpp"
+#include "TileRenderer.hpp"
+
+namespace raytrace {
+
+// Command line options shared by the raytrace executables.
+struct Options {
+    unsigned threads = 0; // 0 picks one worker per core.
+    int width = 0; // 0 keeps the scene's image size.
+    std::vector<std::string> outputs; // .ppm, .png or .pfm files.
+    bool packed = false;  // Store the small spheres as SoA sphere sets.
+    SimdLevel simd = detectSimd();
+    IntegratorKind integrator = IntegratorKind::Path;
+    int rouletteDepth = 5; // Bounces before Russian roulette.
+    SamplerKind sampler = SamplerKind::Random;
+    int samplesPerPixel = 0; // 0 keeps the scene's.
+    bool progressive = false; // Whole frame passes instead of tile by tile.
+    int samplesPerPass = 0; // 0 picks 1, or 4 for adaptive passes.
+    double timeBudget = 0; // Seconds, 0 renders to samplesPerPixel.
+    bool adaptive = false; // Stop sampling pixels that have converged.
+    int minSamples = 16;
+    double noiseThreshold = 0.02;
+    std::string heatmap; // Adaptive samples per pixel image, if set.
+    std::string scene;     // Text or binary scene file, else builtin.
+    std::string builtin = "random"; // Scene built in, see builtinScene.
+    bool lightSampling = true; // Next event estimation, path only.
+    std::string saveScene; // Write the scene out, .bscene for binary.
+    std::string coordinator; // Listen here and hand tiles to workers.
+    std::string worker;      // Render tiles for the coordinator here.
+    int spawnWorkers = 0;    // Local worker processes the coordinator starts.
+    bool sequence = false;   // Render the scene's animation frame by frame.
+    int firstFrame = 0;
+    int lastFrame = -1;      // Inclusive, -1 for the animation's last.
+    bool rebuildBvh = false; // Rebuild between frames instead of refitting.
+    bool denoise = false;    // Filter the finished frame before output.
+    std::string aov;         // Write albedo, normal and depth beside this.
+    Precision precision = Precision::Float;
+    bool comparePrecision = false; // Render in both, report the difference.
+    std::string trace; // Chrome trace of the stage timers, profile builds.
+    double displayFps = 30; // Most window refreshes a second while rendering.
+    ResolveSettings resolve; // Tone map of the window and 8 bit files.
+
+    int passSamples() const {
+        if (samplesPerPass > 0)
+            return samplesPerPass;
+        return adaptive ? 4 : 1;
+    }
+
+    // Returns false (after printing usage) on unknown or malformed options.
+    bool parse(int argc, char** argv) {
+        for (int i = 1; i < argc; ++i) {
+            std::string arg = argv[i];
+            auto value = [&]() -> std::string {
+                return i + 1 < argc ? argv[++i] : "";
+            };
+
+            if (arg == "--threads") {
+                threads = static_cast<unsigned>(std::atoi(value().c_str()));
+            } else if (arg == "--packed") {
+                packed = true;
+            } else if (arg == "--simd") {
+                std::string level = value();
+                if (level == "scalar")
+                    simd = SimdLevel::Scalar;
+                else if (level == "sse")
+                    simd = SimdLevel::Sse;
+                else if (level == "avx2")
+                    simd = SimdLevel::Avx2;
+                else
+                    return usage(argv[0]);
+            } else if (arg == "--integrator") {
+                std::string kind = value();
+                if (kind == "path")
+                    integrator = IntegratorKind::Path;
+                else if (kind == "recursive")
+                    integrator = IntegratorKind::Recursive;
+                else if (kind == "wavefront")
+                    integrator = IntegratorKind::Wavefront;
+                else
+                    return usage(argv[0]);
+            } else if (arg == "--sampler") {
+                std::string kind = value();
+                if (kind == "random")
+                    sampler = SamplerKind::Random;
+                else if (kind == "sobol")
+                    sampler = SamplerKind::Sobol;
+                else if (kind == "bluenoise")
+                    sampler = SamplerKind::BlueNoise;
+                else
+                    return usage(argv[0]);
+            } else if (arg == "--roulette-depth") {
+                rouletteDepth = std::max(1, std::atoi(value().c_str()));
+            } else if (arg == "--width") {
+                width = std::max(2, std::atoi(value().c_str()));
+            } else if (arg == "--output" || arg == "-o") {
+                outputs.push_back(value());
+            } else if (arg == "--spp") {
+                samplesPerPixel = std::atoi(value().c_str());
+            } else if (arg == "--progressive") {
+                progressive = true;
+            } else if (arg == "--pass-spp") {
+                samplesPerPass = std::max(1, std::atoi(value().c_str()));
+            } else if (arg == "--time-budget") {
+                timeBudget = std::atof(value().c_str());
+            } else if (arg == "--tonemap") {
+                std::string kind = value();
+                if (kind == "gamma2")
+                    resolve.toneMap = ToneMap::Gamma2;
+                else if (kind == "srgb")
+                    resolve.toneMap = ToneMap::Srgb;
+                else if (kind == "filmic")
+                    resolve.toneMap = ToneMap::Filmic;
+                else
+                    return usage(argv[0]);
+            } else if (arg == "--exposure") {
+                resolve.exposure =
+                    static_cast<float>(std::atof(value().c_str()));
+            } else if (arg == "--display-fps") {
+                displayFps = std::max(1.0, std::atof(value().c_str()));
+            } else if (arg == "--adaptive") {
+                adaptive = true;
+            } else if (arg == "--min-spp") {
+                minSamples = std::max(1, std::atoi(value().c_str()));
+            } else if (arg == "--noise-threshold") {
+                noiseThreshold = std::atof(value().c_str());
+            } else if (arg == "--heatmap") {
+                heatmap = value();
+            } else if (arg == "--scene") {
+                scene = value();
+            } else if (arg == "--builtin") {
+                builtin = value();
+            } else if (arg == "--no-nee") {
+                lightSampling = false;
+            } else if (arg == "--save-scene") {
+                saveScene = value();
+            } else if (arg == "--coordinator") {
+                coordinator = value();
+            } else if (arg == "--worker") {
+                worker = value();
+            } else if (arg == "--spawn-workers") {
+                spawnWorkers = std::max(0, std::atoi(value().c_str()));
+            } else if (arg == "--sequence") {
+                sequence = true;
+            } else if (arg == "--frames") {
+                std::string range = value();
+                auto colon = range.find(':');
+                firstFrame = std::max(0, std::atoi(range.c_str()));
+                lastFrame = colon == std::string::npos
+                                ? firstFrame
+                                : std::atoi(range.c_str() + colon + 1);
+                sequence = true;
+            } else if (arg == "--rebuild-bvh") {
+                rebuildBvh = true;
+            } else if (arg == "--denoise") {
+                denoise = true;
+            } else if (arg == "--aov") {
+                aov = value();
+            } else if (arg == "--precision") {
+                std::string p = value();
+                if (p == "float")
+                    precision = Precision::Float;
+                else if (p == "double")
+                    precision = Precision::Double;
+                else
+                    return usage(argv[0]);
+            } else if (arg == "--compare-precision") {
+                comparePrecision = true;
+            } else if (arg == "--trace") {
+                trace = value();
+            } else {
+                return usage(argv[0]);
+            }
+        }
+
+        // Modes that do not combine.
+        if (adaptive && (sequence || !coordinator.empty())) {
+            std::cerr << "--adaptive renders single frames locally\n";
+            return false;
+        }
+        if (sequence && !coordinator.empty()) {
+            std::cerr << "--sequence is not distributed\n";
+            return false;
+        }
+        if ((denoise || !aov.empty()) &&
+            (adaptive || sequence || !coordinator.empty())) {
+            std::cerr << "--denoise and --aov need a single, uniformly "
+                         "sampled local frame\n";
+            return false;
+        }
+        if (!trace.empty() && !profiling) {
+            std::cerr << "--trace needs a build with RAYTRACE_PROFILE\n";
+            return false;
+        }
+        if (comparePrecision && (adaptive || progressive || sequence ||
+                                 !coordinator.empty())) {
+            std::cerr << "--compare-precision renders a single frame "
+                         "locally, tile by tile\n";
+            return false;
+        }
+        return true;
+    }
+
+  private:
+    bool usage(const char* program) const {
+        std::cerr << "Usage: " << program << " [options]\n"
+                  << "  --threads N        worker threads (default: cores)\n"
+                  << "  --scene FILE       load a text or .bscene scene file\n"
+                  << "  --builtin NAME     random (default), bouncing or cornell\n"
+                  << "  --save-scene FILE  write the scene, .bscene for binary\n"
+                  << "  --width N          image width (default: scene's)\n"
+                  << "  -o, --output FILE  write .ppm, .png or .pfm, repeatable\n"
+                  << "  --packed           SoA sphere sets for small spheres\n"
+                  << "  --simd LEVEL       scalar, sse or avx2\n"
+                  << "  --integrator KIND  path, recursive or wavefront\n"
+                  << "  --roulette-depth N bounces before Russian roulette (5)\n"
+                  << "  --sampler KIND     random (default), sobol or bluenoise\n"
+                  << "  --no-nee           do not sample lights directly\n"
+                  << "  --spp N            samples per pixel (default: scene's)\n"
+                  << "  --progressive      refine the whole frame in passes\n"
+                  << "  --pass-spp N       samples per progressive pass\n"
+                  << "  --time-budget S    stop progressive passes after S s\n"
+                  << "  --tonemap KIND     gamma2 (default), srgb or filmic\n"
+                  << "  --exposure STOPS   scale before the tone map (0)\n"
+                  << "  --display-fps N    most window refreshes a second (30)\n"
+                  << "  --adaptive         stop sampling converged pixels,\n"
+                  << "                     --spp becomes the per pixel maximum\n"
+                  << "  --min-spp N        adaptive minimum (default 16)\n"
+                  << "  --noise-threshold E  adaptive target error (default 0.02)\n"
+                  << "  --heatmap FILE     write adaptive samples per pixel\n"
+                  << "  --coordinator ADDR hand tiles to workers connecting to\n"
+                  << "                     host:port or unix:/path\n"
+                  << "  --spawn-workers N  start N local workers for it\n"
+                  << "  --worker ADDR      render tiles for a coordinator\n"
+                  << "  --sequence         render every frame of the animation,\n"
+                  << "                     numbered into # runs of -o names\n"
+                  << "  --frames A:B       only frames A to B, inclusive\n"
+                  << "  --rebuild-bvh      rebuild between frames, not refit\n"
+                  << "  --denoise          filter the frame guided by albedo,\n"
+                  << "                     normal and depth before output\n"
+                  << "  --aov FILE         also write those as FILE_albedo etc.\n"
+                  << "  --precision P      float (default) or double\n"
+                  << "  --compare-precision  render in both and report the\n"
+                  << "                     time and image difference\n"
+                  << "  --trace FILE       write stage timings as a Chrome\n"
+                  << "                     trace (RAYTRACE_PROFILE builds)\n";
+        return false;
+    }
+};
+
+// The scene the options name, built in or from a scene file.
+template <class T>
+bool loadOptionsScene(const Options& options, Scene<T>& scene) {
+    if (options.scene.empty()) {
+        if (!builtinScene(options.builtin, scene, options.packed)) {
+            std::cerr << "Unknown scene " << options.builtin << std::endl;
+            return false;
+        }
+        return true;
+    }
+    std::string error;
+    SceneLoadStats loadStats;
+    if (!loadScene(options.scene, scene, error, &loadStats)) {
+        std::cerr << error << std::endl;
+        return false;
+    }
+    printSceneLoadStats(std::cerr, options.scene, loadStats);
+    return true;
+}
+
+// Image, as the scene asks unless overridden.
+template <class T>
+RenderSettings sceneSettings(const Options& options, const Scene<T>& scene) {
+    RenderSettings settings;
+    settings.width = scene.width;
+    settings.height = scene.height;
+    if (options.width > 0) {
+        settings.height = static_cast<int>(double(options.width) *
+                                           scene.height / scene.width);
+        settings.width = options.width;
+    }
+    settings.samplesPerPixel = options.samplesPerPixel > 0
+                                   ? options.samplesPerPixel
+                                   : scene.samplesPerPixel;
+    settings.maxDepth = scene.maxDepth;
+    settings.tileSize = 32;
+    settings.integrator = options.integrator;
+    settings.sampler = options.sampler;
+    settings.rouletteDepth = options.rouletteDepth;
+    return settings;
+}
+
+} // namespace raytrace
+
+#endif // OPTIONS_H
@@ -0,0 +1,92 @@
+#ifndef PARSENUMBER_H
+#define PARSENUMBER_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+namespace raytrace {
+
+// Decimal numbers as scene and mesh files write them, correctly rounded.
+// Digits that fit in 53 bits with a power of ten up to 1e22 take one exact
+// multiply or divide, far faster than strtod; anything else, such as most
+// %.17g output, is handed to strtod.
+inline bool parseNumber(const char*& p, const char* end, double& out) {
+    static const double powers[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,
+                                    1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+                                    1e12, 1e13, 1e14, 1e15, 1e16, 1e17,
+                                    1e18, 1e19, 1e20, 1e21, 1e22};
+    const char* start = p;
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+'))
+        negative = *p++ == '-';
+
+    uint64_t mantissa = 0;
+    int exponent = 0;
+    int digits = 0;
+    bool dropped = false; // Digits past what the mantissa holds.
+    for (; p < end && *p >= '0' && *p <= '9'; ++p, ++digits) {
+        if (mantissa < 100000000000000000ULL)
+            mantissa = mantissa * 10 + (*p - '0');
+        else {
+            exponent++;
+            dropped = true;
+        }
+    }
+    if (p < end && *p == '.') {
+        for (++p; p < end && *p >= '0' && *p <= '9'; ++p, ++digits) {
+            if (mantissa < 100000000000000000ULL) {
+                mantissa = mantissa * 10 + (*p - '0');
+                exponent--;
+            } else
+                dropped = true;
+        }
+    }
+    if (digits == 0) {
+        p = start;
+        return false;
+    }
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        const char* e = p + 1;
+        bool negativeExp = false;
+        if (e < end && (*e == '-' || *e == '+'))
+            negativeExp = *e++ == '-';
+        int value = 0;
+        const char* digitsStart = e;
+        for (; e < end && *e >= '0' && *e <= '9'; ++e)
+            value = std::min(value * 10 + (*e - '0'), 9999);
+        if (e > digitsStart) {
+            exponent += negativeExp ? -value : value;
+            p = e;
+        }
+    }
+
+    // Both operands exact, so the one rounding is the right one.
+    if (!dropped && mantissa <= (uint64_t(1) << 53) && exponent >= -22 &&
+        exponent <= 22) {
+        double v = static_cast<double>(mantissa);
+        if (exponent >= 0)
+            v *= powers[exponent];
+        else
+            v /= powers[-exponent];
+        out = negative ? -v : v;
+        return true;
+    }
+
+    // strtod wants a terminated string, which a mapped file is not.
+    char buffer[64];
+    size_t length = size_t(p - start);
+    if (length < sizeof(buffer)) {
+        std::memcpy(buffer, start, length);
+        buffer[length] = 0;
+        out = std::strtod(buffer, nullptr);
+    } else
+        out = std::strtod(std::string(start, p).c_str(), nullptr);
+    return true;
+}
+
+} // namespace raytrace
+
+#endif // PARSENUMBER_H
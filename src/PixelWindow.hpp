@@ -1,12 +1,21 @@
 #ifndef PIXELWINDOW_H
 #define PIXELWINDOW_H
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <thread>
 #include <vector>
 
 #include <SDL.h>
 
 #include "Color.hpp"
+#include "DisplayBuffer.hpp"
 #include "Pixel.hpp"
+#include "Profile.hpp"
 
 namespace raytrace {
 
@@ -29,9 +38,9 @@ template <class T> class PixelWindow {
             return;
         }
 
-        // Creating a renderer
-        ren = SDL_CreateRenderer(
-            win, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
+        // Creating a renderer. Not synced to vsync, presents are paced by
+        // presentWhile instead and must not stall the thread handling events.
+        ren = SDL_CreateRenderer(win, -1, SDL_RENDERER_ACCELERATED);
         if (ren == nullptr) {
             SDL_DestroyWindow(win);
             std::cout << "SDL_CreateRenderer Error: " << SDL_GetError()
@@ -61,6 +70,7 @@ template <class T> class PixelWindow {
     }
 
     void draw() {
+        ScopedTimer timer(Stage::Present);
         SDL_RenderClear(ren);
         SDL_RenderCopy(ren, tex, NULL, NULL);
         SDL_RenderPresent(ren);
@@ -113,6 +123,7 @@ template <class T> class PixelWindow {
     // Using bottom left coordinate system.
     void setPixels(const std::vector<Pixel<T>>& pixels,
                    int samplesPerPixel = 1) {
+        ScopedTimer timer(Stage::Upload);
         int pitch;
         uint8_t* pixelsPtr;
         SDL_LockTexture(tex, NULL, (void**)&pixelsPtr, &pitch);
@@ -124,6 +135,108 @@ template <class T> class PixelWindow {
         SDL_UnlockTexture(tex);
     }
 
+    // Upload what changed in buffer since the last call, locking only that
+    // part of the texture, and show it. Does nothing if nothing changed.
+    void present(DisplayBuffer& buffer) {
+        DisplayRect rect;
+        if (!buffer.swap(rect))
+            return;
+        auto start = std::chrono::steady_clock::now();
+        {
+            ScopedTimer timer(Stage::Upload);
+            SDL_Rect area{rect.x0, rect.y0, rect.width(), rect.height()};
+            int pitch;
+            uint8_t* pixels;
+            SDL_LockTexture(tex, &area, (void**)&pixels, &pitch);
+            for (int y = rect.y0; y < rect.y1; ++y)
+                std::memcpy(pixels + size_t(pitch) * (y - rect.y0),
+                            buffer.frontRow(y) + rect.x0,
+                            sizeof(uint32_t) * rect.width());
+            SDL_UnlockTexture(tex);
+        }
+        draw();
+        std::chrono::duration<double> busy =
+            std::chrono::steady_clock::now() - start;
+        presentSeconds += busy.count();
+        presentCount++;
+        uploadedPixels += size_t(rect.width()) * rect.height();
+    }
+
+    // Run render(quit) on a thread of its own while this one presents
+    // buffer at most fps times a second and handles events, until render
+    // returns. Quitting sets quit, a std::atomic<bool>&, which render should
+    // check to stop early. Rendering never waits for the window: at worst
+    // it finds the buffer's lock taken for the length of a copy. Returns
+    // whether quit was requested.
+    template <class F>
+    bool presentWhile(DisplayBuffer& buffer, double fps, F render) {
+        std::atomic<bool> quit{false}, finished{false};
+        std::thread thread([&] {
+            profileThreadName("render");
+            render(quit);
+            finished = true;
+        });
+        auto period = std::chrono::duration<double>(1 / fps);
+        auto next = std::chrono::steady_clock::now();
+        while (!finished) {
+            auto now = std::chrono::steady_clock::now();
+            if (now >= next) {
+                present(buffer);
+                next = now + std::chrono::duration_cast<
+                                 std::chrono::steady_clock::duration>(period);
+            }
+            // Wake for events at once, else for the next present or to
+            // see render finish.
+            auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(
+                next - std::chrono::steady_clock::now());
+            int ms = static_cast<int>(std::max<long long>(
+                1, std::min<long long>(wait.count(), 10)));
+            if (waitQuit(ms))
+                quit = true;
+        }
+        thread.join();
+        present(buffer);
+        return quit;
+    }
+
+    // Presents since construction, for the closing statistics.
+    void printStats(std::ostream& out, const DisplayBuffer& buffer) const {
+        out << "Display: " << presentCount << " presents of "
+            << buffer.updates() << " updates, " << std::fixed
+            << std::setprecision(1) << uploadedPixels * 1e-6
+            << " Mpixels uploaded, " << presentSeconds * 1e3
+            << " ms presenting\n"
+            << std::defaultfloat << std::flush;
+    }
+
+    // Wait up to ms for an event, true if it was quit.
+    bool waitQuit(int ms) {
+        SDL_Event event;
+        bool quit = false;
+        if (!SDL_WaitEventTimeout(&event, ms))
+            return false;
+        do {
+            if (event.type == SDL_QUIT) {
+                std::cerr << "\nQuit Raytrace" << std::endl;
+                quit = true;
+            }
+        } while (SDL_PollEvent(&event));
+        return quit;
+    }
+
+    // Drain pending events without blocking, true if quit was requested.
+    bool pollQuit() {
+        SDL_Event event;
+        bool quit = false;
+        while (SDL_PollEvent(&event)) {
+            if (event.type == SDL_QUIT) {
+                std::cerr << "\nQuit Raytrace" << std::endl;
+                quit = true;
+            }
+        }
+        return quit;
+    }
+
     // Spin till quit requested
     void awaitQuit() {
         SDL_Event event;
@@ -148,6 +261,9 @@ template <class T> class PixelWindow {
     SDL_Window* win;
     SDL_Renderer* ren;
     SDL_Texture* tex;
+    size_t presentCount = 0;
+    size_t uploadedPixels = 0;
+    double presentSeconds = 0;
 
     inline void setPixelUnlocked(int pitch, uint8_t* pixels, int x, int y,
                                  const Color<T>& color,
@@ -0,0 +1,286 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Hot path counters and stage timers, compiled in with RAYTRACE_PROFILE=1
+// (cmake -DRAYTRACE_PROFILE=ON). Otherwise every call below is an empty
+// inline function and the renderer is the same code as without them.
+#ifndef RAYTRACE_PROFILE
+#define RAYTRACE_PROFILE 0
+#endif
+
+namespace raytrace {
+
+constexpr bool profiling = RAYTRACE_PROFILE != 0;
+
+// Events counted on the rendering threads.
+enum class Counter : uint32_t {
+    CameraRays,
+    IntersectionTests, // Primitives tested: spheres, set entries, triangles.
+    PrimitiveHits,     // Tests that found a hit inside the ray's interval.
+    ScatterLambertian,
+    ScatterMetal,
+    ScatterDielectric,
+    Absorbed,       // Scatter calls that returned no ray, emitters included.
+    SphereSamples,  // Points warped onto the unit sphere or into the ball,
+    DiskSamples,    // and onto the unit disk, hemispheres included.
+    Count
+};
+
+// Spans of time, summed per stage and kept as trace events when tracing.
+enum class Stage : uint32_t {
+    Render,  // One TileRenderer::render call, a pass over every tile.
+    Tile,    // A tile on a worker.
+    Pixels,  // Sums gathered or converted for display.
+    Upload,  // Pixels copied into the window's texture.
+    Present, // PixelWindow::draw.
+    Denoise,
+    Write,   // An image file encoded and written.
+    Count
+};
+
+inline const char* counterName(Counter c) {
+    static const char* names[] = {
+        "camera rays", "intersection tests", "primitive hits",
+        "lambertian",  "metal",              "dielectric",
+        "absorbed",    "sphere samples",     "disk samples"};
+    return names[static_cast<size_t>(c)];
+}
+
+inline const char* stageName(Stage s) {
+    static const char* names[] = {"render", "tile",    "pixels", "upload",
+                                  "present", "denoise", "write"};
+    return names[static_cast<size_t>(s)];
+}
+
+constexpr size_t counterCount = static_cast<size_t>(Counter::Count);
+constexpr size_t stageCount = static_cast<size_t>(Stage::Count);
+
+// Counts and stage times, of one thread or merged over all of them.
+struct ProfileCounts {
+    uint64_t counters[counterCount] = {};
+    uint64_t stageCalls[stageCount] = {};
+    uint64_t stageNanos[stageCount] = {};
+
+    uint64_t operator[](Counter c) const {
+        return counters[static_cast<size_t>(c)];
+    }
+};
+
+// A timed span on one thread, in nanoseconds since the profiler started.
+struct TraceEvent {
+    Stage stage;
+    uint32_t thread;
+    int64_t start;
+    int64_t duration;
+};
+
+// Owner of every thread's counts. A thread registers on its first count
+// and from then on only touches its own block, so counting takes no locks;
+// blocks outlive their threads so nothing counted is lost. Counts are
+// relaxed atomics with one writer each, plain adds on the hot path, so
+// collect() may read them while other threads still count.
+class Profiler {
+  public:
+    static Profiler& instance() {
+        static Profiler profiler;
+        return profiler;
+    }
+
+    // Running totals, only ever added to by their own thread.
+    struct ThreadCounts {
+        std::atomic<uint64_t> counters[counterCount] = {};
+        std::atomic<uint64_t> stageCalls[stageCount] = {};
+        std::atomic<uint64_t> stageNanos[stageCount] = {};
+    };
+
+    struct ThreadData {
+        uint32_t id;
+        std::string name;
+        ThreadCounts counts;
+        ProfileCounts collected; // Totals at the last collect.
+        std::vector<TraceEvent> events;
+    };
+
+    // Add on the owning thread. No other thread writes, so no locked add.
+    static void add(std::atomic<uint64_t>& total, uint64_t n) {
+        total.store(total.load(std::memory_order_relaxed) + n,
+                    std::memory_order_relaxed);
+    }
+
+    ThreadData& thread() {
+        thread_local ThreadData* data = registerThread();
+        return *data;
+    }
+
+    int64_t now() const {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::steady_clock::now() - epoch)
+            .count();
+    }
+
+    void record(Stage stage, int64_t start, int64_t end) {
+        ThreadData& data = thread();
+        size_t s = static_cast<size_t>(stage);
+        add(data.counts.stageCalls[s], 1);
+        add(data.counts.stageNanos[s], uint64_t(end - start));
+        if (tracing)
+            data.events.push_back({stage, data.id, start, end - start});
+    }
+
+    // Keep every timed span for writeTrace, from now on.
+    void setTracing(bool on) { tracing = on; }
+
+    // Counts of every thread since the last collect, merged.
+    ProfileCounts collect() {
+        std::lock_guard<std::mutex> lock(mutex);
+        ProfileCounts total;
+        auto since = [](const std::atomic<uint64_t>& now, uint64_t& last) {
+            uint64_t value = now.load(std::memory_order_relaxed);
+            uint64_t n = value - last;
+            last = value;
+            return n;
+        };
+        for (auto& data : threads) {
+            const ThreadCounts& c = data->counts;
+            ProfileCounts& last = data->collected;
+            for (size_t i = 0; i < counterCount; ++i)
+                total.counters[i] += since(c.counters[i], last.counters[i]);
+            for (size_t i = 0; i < stageCount; ++i) {
+                total.stageCalls[i] +=
+                    since(c.stageCalls[i], last.stageCalls[i]);
+                total.stageNanos[i] +=
+                    since(c.stageNanos[i], last.stageNanos[i]);
+            }
+        }
+        return total;
+    }
+
+    // Every span kept since tracing began as Chrome trace event JSON, for
+    // chrome://tracing or ui.perfetto.dev.
+    bool writeTrace(const std::string& path, std::string& error) {
+        std::ofstream out(path);
+        if (!out) {
+            error = "could not open " + path;
+            return false;
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [";
+        const char* separator = "\n";
+        for (const auto& data : threads) {
+            out << separator << "{\"name\": \"thread_name\", \"ph\": \"M\", "
+                << "\"pid\": 0, \"tid\": " << data->id
+                << ", \"args\": {\"name\": \"" << data->name << "\"}}";
+            separator = ",\n";
+        }
+        out << std::fixed << std::setprecision(3);
+        for (const auto& data : threads)
+            for (const auto& e : data->events)
+                out << separator << "{\"name\": \"" << stageName(e.stage)
+                    << "\", \"ph\": \"X\", \"pid\": 0, \"tid\": " << e.thread
+                    << ", \"ts\": " << e.start * 1e-3
+                    << ", \"dur\": " << e.duration * 1e-3 << "}";
+        out << "\n]}\n";
+        if (!out) {
+            error = "could not write " + path;
+            return false;
+        }
+        return true;
+    }
+
+  private:
+    std::mutex mutex;
+    std::vector<std::unique_ptr<ThreadData>> threads;
+    std::chrono::steady_clock::time_point epoch =
+        std::chrono::steady_clock::now();
+    bool tracing = false;
+
+    ThreadData* registerThread() {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto id = static_cast<uint32_t>(threads.size());
+        threads.push_back(std::unique_ptr<ThreadData>(
+            new ThreadData{id, "thread " + std::to_string(id), {}, {}, {}}));
+        return threads.back().get();
+    }
+};
+
+inline void profileCount(Counter c, uint64_t n = 1) {
+    if constexpr (profiling) {
+        auto& counters = Profiler::instance().thread().counts.counters;
+        Profiler::add(counters[static_cast<size_t>(c)], n);
+    }
+}
+
+// Name of the calling thread in traces.
+inline void profileThreadName(const std::string& name) {
+    if constexpr (profiling)
+        Profiler::instance().thread().name = name;
+}
+
+// Times its scope as a span of stage.
+class ScopedTimer {
+  public:
+    explicit ScopedTimer(Stage stage) : stage(stage) {
+        if constexpr (profiling)
+            start = Profiler::instance().now();
+    }
+
+    ~ScopedTimer() {
+        if constexpr (profiling)
+            Profiler::instance().record(stage, start,
+                                        Profiler::instance().now());
+    }
+
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+  private:
+    Stage stage;
+    int64_t start = 0;
+};
+
+// Merged counts since the last call, printed as the frame's profile. rays
+// is the frame's ray count, for per ray figures. Prints nothing in builds
+// without profiling.
+inline void printProfile(std::ostream& out, uint64_t rays) {
+    if constexpr (!profiling)
+        return;
+    ProfileCounts p = Profiler::instance().collect();
+    auto per = [](uint64_t n, uint64_t d) { return d ? double(n) / d : 0.0; };
+    out << std::fixed << std::setprecision(3) << "Profile: " << rays
+        << " rays, " << p[Counter::CameraRays] << " camera rays, "
+        << per(p[Counter::IntersectionTests], rays) << " tests/ray, "
+        << per(p[Counter::PrimitiveHits], p[Counter::IntersectionTests]) *
+               100
+        << "% hit\n  scatters:";
+    for (Counter c : {Counter::ScatterLambertian, Counter::ScatterMetal,
+                      Counter::ScatterDielectric, Counter::Absorbed})
+        out << ' ' << counterName(c) << ' ' << p[c];
+    out << "\n  samples: sphere " << p[Counter::SphereSamples] << ", disk "
+        << p[Counter::DiskSamples] << '\n';
+    for (size_t s = 0; s < stageCount; ++s) {
+        if (p.stageCalls[s] == 0)
+            continue;
+        double ms = p.stageNanos[s] * 1e-6;
+        out << "  " << std::left << std::setw(8)
+            << stageName(static_cast<Stage>(s)) << std::right
+            << std::setw(8) << p.stageCalls[s] << " x " << std::setw(10)
+            << ms / p.stageCalls[s] << "ms = " << std::setw(10) << ms
+            << "ms\n";
+    }
+    out << std::defaultfloat << std::flush;
+}
+
+} // namespace raytrace
+
+#endif // PROFILE_H
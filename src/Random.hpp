@@ -0,0 +1,75 @@
+#ifndef RANDOM_H
+#define RANDOM_H
+
+#include <cstdint>
+
+namespace raytrace {
+
+// SplitMix64 finaliser, used to decorrelate seeds built from small integers.
+inline uint64_t mix64(uint64_t x) {
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+// Uniform in [0, 1) from 32 random bits. Floats keep the top 24, so float
+// and double see the same numbers to float precision.
+template <class T> T bitsToUnit(uint32_t bits);
+
+template <> inline float bitsToUnit<float>(uint32_t bits) {
+    return static_cast<float>(bits >> 8) * 0x1p-24f;
+}
+
+template <> inline double bitsToUnit<double>(uint32_t bits) {
+    return static_cast<double>(bits) * 0x1p-32;
+}
+
+// PCG32 (XSH RR), 64 bits of state and a selectable stream.
+// See https://www.pcg-random.org/ - small, fast and statistically solid.
+class Pcg32 {
+  public:
+    Pcg32() { seed(0x853c49e6748fea9bULL, 0xda3e39cb94b95bdbULL); }
+    Pcg32(uint64_t initState, uint64_t initSeq) { seed(initState, initSeq); }
+
+    void seed(uint64_t initState, uint64_t initSeq) {
+        state = 0;
+        inc = (initSeq << 1u) | 1u;
+        next();
+        state += initState;
+        next();
+    }
+
+    uint32_t next() {
+        uint64_t old = state;
+        state = old * 6364136223846793005ULL + inc;
+        uint32_t xorShifted = static_cast<uint32_t>(((old >> 18u) ^ old) >> 27u);
+        uint32_t rot = static_cast<uint32_t>(old >> 59u);
+        return (xorShifted >> rot) | (xorShifted << ((-rot) & 31));
+    }
+
+    // Uniform in [0, 1), from a single draw in either precision so float
+    // and double renders consume the same stream.
+    template <class T> T uniform() { return bitsToUnit<T>(next()); }
+
+  private:
+    uint64_t state;
+    uint64_t inc;
+};
+
+// Generator owned by the calling thread, never shared between threads.
+inline Pcg32& threadRng() {
+    thread_local Pcg32 rng;
+    return rng;
+}
+
+// Restart the calling thread's generator on the stream for a single camera
+// sample, so a sample's random numbers depend only on (frame, pixel, sample)
+// and not on which thread or in which order it is rendered.
+inline void seedSample(uint64_t frame, uint64_t pixel, uint64_t sample) {
+    threadRng().seed(mix64(sample ^ mix64(frame)), mix64(pixel));
+}
+
+} // namespace raytrace
+
+#endif // RANDOM_H
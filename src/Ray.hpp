@@ -5,20 +5,25 @@
 
 namespace raytrace {
 
+// Ray with the time it samples, within the camera's shutter interval.
+// Rays scattered from a hit keep the time of the ray that hit, so a whole
+// path sees moving objects where they are at one instant.
 template <class T> class Ray {
   public:
     Ray() {}
-    Ray(const Point3<T>& origin, const Vec3<T>& direction)
-        : orig(origin), dir(direction) {}
+    Ray(const Point3<T>& origin, const Vec3<T>& direction, T time = 0)
+        : orig(origin), dir(direction), tm(time) {}
 
     Point3<T> origin() const { return orig; }
     Vec3<T> direction() const { return dir; }
+    T time() const { return tm; }
 
     Point3<T> at(T t) const { return orig + t * dir; }
 
   private:
     Point3<T> orig;
     Vec3<T> dir;
+    T tm = 0;
 };
 
 } // namespace raytrace
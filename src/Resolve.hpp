@@ -0,0 +1,338 @@
+#ifndef RESOLVE_H
+#define RESOLVE_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+#include "Common.hpp"
+
+#include "Color.hpp"
+#include "Framebuffer.hpp"
+#include "Simd.hpp"
+#include "ThreadPool.hpp"
+
+namespace raytrace {
+
+// How linear averages become displayed 8 bit values.
+enum class ToneMap : uint32_t {
+    Gamma2, // Square root, as convertRGBA has always done.
+    Srgb,   // The sRGB transfer curve.
+    Filmic  // Narkowicz's fit of the ACES filmic curve, then sRGB.
+};
+
+inline const char* toneMapName(ToneMap toneMap) {
+    switch (toneMap) {
+    case ToneMap::Srgb:
+        return "srgb";
+    case ToneMap::Filmic:
+        return "filmic";
+    default:
+        return "gamma2";
+    }
+}
+
+struct ResolveSettings {
+    ToneMap toneMap = ToneMap::Gamma2;
+    float exposure = 0; // Stops, scaling the average before the curve.
+};
+
+// Converts accumulated sums to RGBA8 words laid out as convertRGBA's,
+// whole rows at a time. Gamma 2 does convertRGBA's arithmetic eight (AVX2)
+// or four (SSE) channels at once in float, so it gives the same bytes. The
+// other curves go through a table built once: indexed by the exponent and
+// top mantissa bits of the average, each bucket holds its byte and the
+// mantissa bits past which the byte is one more, which is exactly the
+// curve evaluated in double and quantised as convertRGBA does. AVX2
+// gathers from it; there are no SSE gathers, so SSE looks up one by one.
+class Resolver {
+  public:
+    explicit Resolver(const ResolveSettings& settings = ResolveSettings())
+        : settings(settings), exposureScale(std::exp2(settings.exposure)) {
+        if (settings.toneMap != ToneMap::Gamma2)
+            buildTable();
+    }
+
+    const ResolveSettings& getSettings() const { return settings; }
+
+    // Pixels [0, n) of row, sums of samples each, into out.
+    template <class T>
+    void row(const Color<T>* in, int n, int samples, uint32_t* out) const {
+        int x = 0;
+#if RAYTRACE_X86_SIMD
+        if constexpr (std::is_same<T, float>::value) {
+            static_assert(sizeof(Color<float>) == 3 * sizeof(float),
+                          "rows are read as packed floats");
+            const float* channels = reinterpret_cast<const float*>(in);
+            float scale = scaleFor<float>(samples);
+            SimdLevel level = activeSimd();
+            bool gamma2 = settings.toneMap == ToneMap::Gamma2;
+            if (level == SimdLevel::Avx2)
+                x = gamma2 ? gamma2Avx2(channels, n, scale, out)
+                           : tableAvx2(channels, n, scale, out);
+            if (level >= SimdLevel::Sse && gamma2)
+                x = gamma2Sse(channels, x, n, scale, out);
+        }
+#endif
+        T scale = scaleFor<T>(samples);
+        for (; x < n; ++x)
+            out[x] = pixel(in[x], scale);
+    }
+
+    // The whole frame into out, top row first, in bands of rows on pool
+    // when given.
+    template <class T>
+    void frame(const Framebuffer<T>& fb, uint32_t* out,
+               ThreadPool* pool = nullptr) const {
+        int w = fb.width(), h = fb.height();
+        auto rows = [&fb, out, w, h, this](int y0, int y1) {
+            for (int y = y0; y < y1; ++y)
+                row(&fb.at(0, y), w, fb.samples(),
+                    out + size_t(h - 1 - y) * w);
+        };
+        if (!pool) {
+            rows(0, h);
+            return;
+        }
+        for (int y0 = 0; y0 < h; y0 += bandRows) {
+            int y1 = std::min(h, y0 + bandRows);
+            pool->submit([=, &rows] { rows(y0, y1); });
+        }
+        pool->wait();
+    }
+
+    // One channel's byte for its average v under the curve, evaluated
+    // directly rather than from the table, for checking it.
+    uint32_t curveByte(double v) const {
+        double x = v * double(exposureScale);
+        // Negatives and NaN to 0, as the fit turns up again below it, and
+        // the top to where both curves are long since white.
+        x = x > 0 ? std::min(x, 1e4) : 0.0;
+        if (settings.toneMap == ToneMap::Filmic)
+            x = std::min(std::max(x * (2.51 * x + 0.03) /
+                                      (x * (2.43 * x + 0.59) + 0.14),
+                                  0.0),
+                         1.0);
+        double e = x <= 0.0031308 ? 12.92 * x
+                                  : 1.055 * std::pow(x, 1 / 2.4) - 0.055;
+        return quantise(static_cast<float>(e));
+    }
+
+  private:
+    static constexpr int bandRows = 16;
+    // Buckets split each power of two 2^9 ways. The curves rise by at most
+    // a fifth of a byte across one, so never by two.
+    static constexpr int fineBits = 23 - 9;
+    static constexpr int32_t fineMask = (1 << fineBits) - 1;
+
+    ResolveSettings settings;
+    float exposureScale;
+    std::vector<uint32_t> table; // Byte | threshold << 8 per bucket.
+    int32_t lowBits = 0, highBits = 0;
+
+    // Gamma 2 folds the exposure into the scale, which for 0 stops is
+    // convertRGBA's 1 / samples. The tables include it.
+    template <class T> T scaleFor(int samples) const {
+        T exposure = settings.toneMap == ToneMap::Gamma2
+                         ? static_cast<T>(exposureScale)
+                         : T(1);
+        return exposure / T(samples);
+    }
+
+    static uint32_t quantise(float v) {
+        const float top = 255.999f, most = 0.999f;
+        return static_cast<uint8_t>(top * clamp<float>(v, 0, most));
+    }
+
+    template <class T> uint32_t pixel(const Color<T>& c, T scale) const {
+        if (settings.toneMap == ToneMap::Gamma2)
+            return gamma2Pixel(c, scale);
+        return lookup(static_cast<float>(scale * c.x())) << 24 |
+               lookup(static_cast<float>(scale * c.y())) << 16 |
+               lookup(static_cast<float>(scale * c.z())) << 8;
+    }
+
+    // convertRGBA with the scale given.
+    template <class T>
+    static uint32_t gamma2Pixel(const Color<T>& c, T scale) {
+        const T top = T(255.999), most = T(0.999);
+        uint32_t out = 0;
+        for (int i = 0; i < 3; ++i) {
+            T v = std::sqrt(scale * c[i]);
+            out = out << 8 |
+                  static_cast<uint8_t>(top * clamp<T>(v, 0, most));
+        }
+        return out << 8;
+    }
+
+    uint32_t lookup(float v) const {
+        // NaN, which as bits sorts above infinity, goes black with the
+        // negatives.
+        v = v > 0 ? v : 0.0f;
+        int32_t bits;
+        std::memcpy(&bits, &v, sizeof(bits));
+        bits = std::min(std::max(bits, lowBits), highBits);
+        uint32_t entry = table[size_t(bits - lowBits) >> fineBits];
+        return (entry & 0xff) + ((bits & fineMask) >= int32_t(entry >> 8));
+    }
+
+    static float floatBits(int32_t bits) {
+        float v;
+        std::memcpy(&v, &bits, sizeof(v));
+        return v;
+    }
+
+    // Table over the powers of two from the highest whose byte is 0 to the
+    // lowest whose byte is 255; below and above, the byte stays so.
+    void buildTable() {
+        int low = 0;
+        while (low > -120 && curveByte(std::ldexp(1.0, low)) != 0)
+            low--;
+        while (low < 60 && curveByte(std::ldexp(1.0, low + 1)) == 0)
+            low++;
+        int high = low;
+        while (high < low + 60 && curveByte(std::ldexp(1.0, high)) != 255)
+            high++;
+        lowBits = (low + 127) << 23;
+        highBits = ((high + 1 + 127) << 23) - 1;
+
+        table.resize(size_t(highBits - lowBits + 1) >> fineBits);
+        for (size_t i = 0; i < table.size(); ++i) {
+            int32_t start = lowBits + int32_t(i << fineBits);
+            uint32_t byte = curveByte(floatBits(start));
+            int32_t threshold = fineMask + 1;
+            if (curveByte(floatBits(start + fineMask)) != byte) {
+                // First fine step past the byte.
+                int32_t lo = 0, hi = fineMask;
+                while (lo < hi) {
+                    int32_t mid = (lo + hi) / 2;
+                    if (curveByte(floatBits(start + mid)) != byte)
+                        hi = mid;
+                    else
+                        lo = mid + 1;
+                }
+                threshold = lo;
+            }
+            table[i] = byte | uint32_t(threshold) << 8;
+        }
+    }
+
+#if RAYTRACE_X86_SIMD
+    // The kernels return the first pixel they did not convert.
+
+    // Twelve channel values of four pixels, as 32 bit lanes of bytes,
+    // narrowed and spread into RGBA words.
+    RAYTRACE_TARGET_AVX2 static void packAvx2(__m128i a, __m128i b,
+                                              __m128i c, uint32_t* out) {
+        const __m128i spread = _mm_setr_epi8(-1, 2, 1, 0, -1, 5, 4, 3, -1,
+                                             8, 7, 6, -1, 11, 10, 9);
+        __m128i bytes = _mm_packus_epi16(_mm_packs_epi32(a, b),
+                                         _mm_packs_epi32(c, c));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out),
+                         _mm_shuffle_epi8(bytes, spread));
+    }
+
+    // Eight pixels' 24 channel values, in order across v.
+    RAYTRACE_TARGET_AVX2 static void packAvx2(const __m256i v[3],
+                                              uint32_t* out) {
+        packAvx2(_mm256_castsi256_si128(v[0]),
+                 _mm256_extracti128_si256(v[0], 1),
+                 _mm256_castsi256_si128(v[1]), out);
+        packAvx2(_mm256_extracti128_si256(v[1], 1),
+                 _mm256_castsi256_si128(v[2]),
+                 _mm256_extracti128_si256(v[2], 1), out + 4);
+    }
+
+    RAYTRACE_TARGET_AVX2 static int gamma2Avx2(const float* in, int n,
+                                               float scale, uint32_t* out) {
+        const __m256 s = _mm256_set1_ps(scale);
+        const __m256 zero = _mm256_setzero_ps();
+        const __m256 most = _mm256_set1_ps(0.999f);
+        const __m256 top = _mm256_set1_ps(255.999f);
+        int x = 0;
+        for (; x + 8 <= n; x += 8) {
+            __m256i bytes[3];
+            for (int k = 0; k < 3; ++k) {
+                __m256 v = _mm256_loadu_ps(in + 3 * x + 8 * k);
+                v = _mm256_sqrt_ps(_mm256_mul_ps(s, v));
+                // NaN, from negative sums, becomes 0 as the cast makes it.
+                v = _mm256_min_ps(_mm256_max_ps(v, zero), most);
+                bytes[k] = _mm256_cvttps_epi32(_mm256_mul_ps(top, v));
+            }
+            packAvx2(bytes, out + x);
+        }
+        return x;
+    }
+
+    RAYTRACE_TARGET_AVX2 int tableAvx2(const float* in, int n, float scale,
+                                       uint32_t* out) const {
+        const __m256 s = _mm256_set1_ps(scale);
+        const __m256i low = _mm256_set1_epi32(lowBits);
+        const __m256i high = _mm256_set1_epi32(highBits);
+        const __m256i fine = _mm256_set1_epi32(fineMask);
+        const __m256i byteMask = _mm256_set1_epi32(0xff);
+        const __m256i one = _mm256_set1_epi32(1);
+        const int* entries = reinterpret_cast<const int*>(table.data());
+        int x = 0;
+        for (; x + 8 <= n; x += 8) {
+            __m256i bytes[3];
+            for (int k = 0; k < 3; ++k) {
+                __m256 v =
+                    _mm256_mul_ps(s, _mm256_loadu_ps(in + 3 * x + 8 * k));
+                // Negatives and NaN to 0, as lookup does.
+                v = _mm256_max_ps(v, _mm256_setzero_ps());
+                __m256i bits = _mm256_castps_si256(v);
+                bits = _mm256_min_epi32(_mm256_max_epi32(bits, low), high);
+                __m256i index =
+                    _mm256_srli_epi32(_mm256_sub_epi32(bits, low), fineBits);
+                __m256i entry = _mm256_i32gather_epi32(entries, index, 4);
+                __m256i threshold = _mm256_srli_epi32(entry, 8);
+                // All ones, -1, where the bits reach the threshold.
+                __m256i past = _mm256_cmpgt_epi32(
+                    _mm256_and_si256(bits, fine),
+                    _mm256_sub_epi32(threshold, one));
+                bytes[k] = _mm256_sub_epi32(_mm256_and_si256(entry, byteMask),
+                                            past);
+            }
+            packAvx2(bytes, out + x);
+        }
+        return x;
+    }
+
+    static int gamma2Sse(const float* in, int x, int n, float scale,
+                         uint32_t* out) {
+        const __m128 s = _mm_set1_ps(scale);
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 most = _mm_set1_ps(0.999f);
+        const __m128 top = _mm_set1_ps(255.999f);
+        alignas(16) uint8_t bytes[16];
+        for (; x + 4 <= n; x += 4) {
+            __m128i lanes[3];
+            for (int k = 0; k < 3; ++k) {
+                __m128 v = _mm_loadu_ps(in + 3 * x + 4 * k);
+                v = _mm_sqrt_ps(_mm_mul_ps(s, v));
+                v = _mm_min_ps(_mm_max_ps(v, zero), most);
+                lanes[k] = _mm_cvttps_epi32(_mm_mul_ps(top, v));
+            }
+            // No byte shuffle before SSSE3, so the words are put together
+            // from the narrowed bytes.
+            _mm_store_si128(
+                reinterpret_cast<__m128i*>(bytes),
+                _mm_packus_epi16(_mm_packs_epi32(lanes[0], lanes[1]),
+                                 _mm_packs_epi32(lanes[2], lanes[2])));
+            for (int i = 0; i < 4; ++i)
+                out[x + i] = uint32_t(bytes[3 * i]) << 24 |
+                             uint32_t(bytes[3 * i + 1]) << 16 |
+                             uint32_t(bytes[3 * i + 2]) << 8;
+        }
+        return x;
+    }
+#endif
+};
+
+} // namespace raytrace
+
+#endif // RESOLVE_H
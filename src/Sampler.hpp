@@ -0,0 +1,283 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "Common.hpp"
+
+#include "Vec2.hpp"
+
+namespace raytrace {
+
+// Where the numbers of a camera sample come from.
+enum class SamplerKind : uint32_t { Random, Sobol, BlueNoise };
+
+inline const char* samplerName(SamplerKind kind) {
+    switch (kind) {
+    case SamplerKind::Sobol:
+        return "sobol";
+    case SamplerKind::BlueNoise:
+        return "bluenoise";
+    default:
+        return "random";
+    }
+}
+
+inline uint32_t reverseBits(uint32_t x) {
+    x = (x << 16) | (x >> 16);
+    x = ((x & 0x00ff00ffu) << 8) | ((x & 0xff00ff00u) >> 8);
+    x = ((x & 0x0f0f0f0fu) << 4) | ((x & 0xf0f0f0f0u) >> 4);
+    x = ((x & 0x33333333u) << 2) | ((x & 0xccccccccu) >> 2);
+    x = ((x & 0x55555555u) << 1) | ((x & 0xaaaaaaaau) >> 1);
+    return x;
+}
+
+// Owen scrambling of a 32 bit fraction keyed by seed, on its bits
+// reversed: each bit flips or not by a hash of the bits above it, which
+// keeps every power of two stratum of a sequence a stratum. The hash of
+// Laine and Karras as improved by Burley ("Practical Hash-based Owen
+// Scrambling", 2020) only carries towards the high bits, the fraction's
+// low bits reversed. Working on reversed bits saves reversing back and
+// forth between steps.
+inline uint32_t owenScrambleReversed(uint32_t x, uint32_t seed) {
+    x ^= x * 0x3d20adeau;
+    x += seed;
+    x *= (seed >> 16) | 1u;
+    x ^= x * 0x05526c56u;
+    x ^= x * 0x53a22864u;
+    return x;
+}
+
+// The second dimension of Sobol's sequence at index i, a 32 bit fraction
+// with its bits reversed. Its generator matrix has the rows of Pascal's
+// triangle mod 2 as columns, applied a byte at a time from tables. The
+// first dimension is van der Corput's radical inverse, i itself reversed.
+inline uint32_t sobol1Reversed(uint32_t i) {
+    static const std::array<uint32_t, 4 * 256> table = [] {
+        std::array<uint32_t, 32> columns;
+        uint32_t v = 1u << 31;
+        for (auto& c : columns) {
+            c = reverseBits(v);
+            v ^= v >> 1;
+        }
+        std::array<uint32_t, 4 * 256> t{};
+        for (int byte = 0; byte < 4; ++byte)
+            for (uint32_t b = 0; b < 256; ++b)
+                for (int bit = 0; bit < 8; ++bit)
+                    if (b >> bit & 1)
+                        t[byte * 256 + b] ^= columns[byte * 8 + bit];
+        return t;
+    }();
+    return table[i & 255] ^ table[256 + (i >> 8 & 255)] ^
+           table[512 + (i >> 16 & 255)] ^ table[768 + (i >> 24)];
+}
+
+// A 64 x 64 tile of blue noise: the ranks 0 to 4095 once each, placed by
+// Ulichney's void and cluster method so the pixels under any threshold are
+// evenly spread, without clumps or holes. Built on first use.
+class BlueNoise {
+  public:
+    static constexpr int size = 64;
+
+    static const BlueNoise& instance() {
+        static const BlueNoise noise;
+        return noise;
+    }
+
+    // Rank at (x, y), the tile repeating in both directions.
+    uint32_t rank(uint32_t x, uint32_t y) const {
+        return ranks[(y % size) * size + x % size];
+    }
+
+  private:
+    static constexpr int count = size * size;
+    std::vector<uint16_t> ranks;
+    std::vector<double> kernel; // Gaussian of the wrapped offset.
+    std::vector<double> energy; // Kernel summed over the set pixels.
+    std::vector<uint8_t> set;
+
+    BlueNoise() : ranks(count), kernel(count), energy(count), set(count) {
+        const double sigma = 1.5;
+        for (int dy = 0; dy < size; ++dy)
+            for (int dx = 0; dx < size; ++dx) {
+                int wx = std::min(dx, size - dx);
+                int wy = std::min(dy, size - dy);
+                kernel[dy * size + dx] =
+                    std::exp(-(wx * wx + wy * wy) / (2 * sigma * sigma));
+            }
+
+        // A tenth of the pixels at random, then spread out by moving the
+        // most crowded one to the emptiest spot until that changes nothing.
+        Pcg32 rng(2021, 7);
+        int initial = 0;
+        while (initial < count / 10) {
+            int i = static_cast<int>(rng.next() % count);
+            if (!set[i]) {
+                toggle(i);
+                initial++;
+            }
+        }
+        for (int step = 0; step < count; ++step) {
+            int cluster = extreme(true);
+            toggle(cluster);
+            int voidSpot = extreme(false);
+            toggle(voidSpot);
+            if (voidSpot == cluster)
+                break;
+        }
+
+        // Rank the initial pixels from the most crowded down, then fill
+        // the emptiest spot again and again. Past half full this is also
+        // the tightest cluster of the pixels left unset.
+        std::vector<uint8_t> initialSet = set;
+        std::vector<double> initialEnergy = energy;
+        for (int rank = initial - 1; rank >= 0; --rank) {
+            int i = extreme(true);
+            toggle(i);
+            ranks[i] = static_cast<uint16_t>(rank);
+        }
+        set = initialSet;
+        energy = initialEnergy;
+        for (int rank = initial; rank < count; ++rank) {
+            int i = extreme(false);
+            toggle(i);
+            ranks[i] = static_cast<uint16_t>(rank);
+        }
+    }
+
+    void toggle(int i) {
+        double sign = set[i] ? -1 : 1;
+        set[i] = !set[i];
+        int x = i % size, y = i / size;
+        for (int qy = 0; qy < size; ++qy) {
+            const double* row = &kernel[((qy - y + size) % size) * size];
+            for (int qx = 0; qx < size; ++qx)
+                energy[qy * size + qx] += sign * row[(qx - x + size) % size];
+        }
+    }
+
+    // The set pixel of most energy, or the unset one of least.
+    int extreme(bool ofSet) const {
+        int best = -1;
+        for (int i = 0; i < count; ++i)
+            if (bool(set[i]) == ofSet &&
+                (best < 0 || (ofSet ? energy[i] > energy[best]
+                                    : energy[i] < energy[best])))
+                best = i;
+        return best;
+    }
+};
+
+// The numbers of one camera sample, handed out one slot at a time: each
+// get1D or get2D call takes the next slot. The camera takes the first
+// (pixel position, lens, time) and every bounce starts at a fixed slot, so
+// a bounce's numbers do not depend on how many the ones before drew.
+//
+// Random draws from the thread's generator as before. Sobol gives each
+// slot a 1D or 2D Sobol sequence, Owen scrambled and its order shuffled by
+// hashes of the pixel and slot, so pixels and slots are independent but
+// the samples of one pixel in one slot are stratified at every power of
+// two. BlueNoise scrambles by slot only, so every pixel sees the same
+// points, and shifts them (toroidally) by the blue noise tile's value at
+// the pixel, the tile offset per slot: the error of neighbouring pixels
+// differs as blue noise, high frequency noise that looks finer and blurs
+// away.
+//
+// All state is per sample and derived from (frame, pixel, sample), so it
+// needs no locks and passes and workers add up to the same image.
+class PixelSampler {
+  public:
+    static constexpr uint32_t firstBounceSlot = 4;
+    static constexpr uint32_t bounceSlots = 8;
+
+    // Start sample index of pixel (x, y), numbered pixel in the image.
+    // Also seeds the thread's generator for the sample, see seedSample.
+    void start(SamplerKind sampler, uint64_t frame, int x, int y,
+               uint64_t pixel, uint32_t sample) {
+        seedSample(frame, pixel, sample);
+        kind = sampler;
+        reversedIndex = reverseBits(sample);
+        slot = 0;
+        px = uint32_t(x);
+        py = uint32_t(y);
+        seed = kind == SamplerKind::Sobol ? mix64(pixel ^ mix64(frame))
+                                          : mix64(frame);
+    }
+
+    // Move to the slots of bounce depth, 0 for the camera ray's hit.
+    void startBounce(int depth) {
+        slot = firstBounceSlot + uint32_t(depth) * bounceSlots;
+    }
+
+    template <class T> T get1D() {
+        if (kind == SamplerKind::Random)
+            return threadRng().uniform<T>();
+        uint64_t h = mix64(seed + slot++);
+        uint32_t i = shuffle(uint32_t(h));
+        uint32_t v = reverseBits(owenScrambleReversed(i, uint32_t(h >> 32)));
+        return bitsToUnit<T>(v + shift(h, 0));
+    }
+
+    template <class T> Vec2<T> get2D() {
+        if (kind == SamplerKind::Random) {
+            T u1 = threadRng().uniform<T>();
+            T u2 = threadRng().uniform<T>();
+            return Vec2<T>(u1, u2);
+        }
+        uint64_t h = mix64(seed + slot++), h2 = mix64(h);
+        uint32_t i = shuffle(uint32_t(h));
+        uint32_t v1 =
+            reverseBits(owenScrambleReversed(i, uint32_t(h >> 32)));
+        uint32_t v2 = reverseBits(
+            owenScrambleReversed(sobol1Reversed(i), uint32_t(h2)));
+        return Vec2<T>(bitsToUnit<T>(v1 + shift(h2, 0)),
+                       bitsToUnit<T>(v2 + shift(h2, 1)));
+    }
+
+  private:
+    SamplerKind kind = SamplerKind::Random;
+    uint64_t seed = 0;
+    uint32_t reversedIndex = 0;
+    uint32_t slot = 0;
+    uint32_t px = 0, py = 0;
+
+    // The sample's index in the slot's sequence, Owen scrambled by seed
+    // into an order whose power of two prefixes are still strata.
+    uint32_t shuffle(uint32_t seed) const {
+        return reverseBits(owenScrambleReversed(reversedIndex, seed));
+    }
+
+    // Blue noise shift of dimension d of the slot hashed to h, 0 unless
+    // BlueNoise. Added as integers the shift wraps around mod 1.
+    uint32_t shift(uint64_t h, int d) const {
+        if (kind != SamplerKind::BlueNoise)
+            return 0;
+        uint32_t offset = uint32_t(h >> (16 * d));
+        uint32_t rank = BlueNoise::instance().rank(px + (offset & 0xff),
+                                                   py + (offset >> 8 & 0xff));
+        return (rank << 20) | (1u << 19);
+    }
+};
+
+// Sampler of the calling thread's current camera sample.
+inline PixelSampler& threadSampler() {
+    thread_local PixelSampler sampler;
+    return sampler;
+}
+
+// The next numbers of the calling thread's camera sample.
+template <class T> inline T sample1D() {
+    return threadSampler().get1D<T>();
+}
+
+template <class T> inline Vec2<T> sample2D() {
+    return threadSampler().get2D<T>();
+}
+
+} // namespace raytrace
+
+#endif // SAMPLER_H
@@ -0,0 +1,150 @@
+#ifndef SAMPLING_H
+#define SAMPLING_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#include "Common.hpp"
+
+#include "Vec2.hpp"
+
+namespace raytrace {
+
+// Warps of uniform samples in [0, 1)^2 onto the domains the renderer
+// samples, each in closed form at a fixed cost: no rejection loops, and
+// only selects where the mapping has cases, so a batch of samples takes
+// the same path through the code. Taking the sample as input lets any
+// sequence drive them, not just the thread's generator.
+
+// Sine and cosine of x in [-pi/4, pi/4], the range the warps below reduce
+// their angles to, by Taylor polynomials: no range reduction or library
+// call, so they vectorise. Floats stop at the terms below their rounding,
+// doubles go on to within 1e-11.
+template <class T> inline void quarterSinCos(T x, T& sin, T& cos) {
+    T x2 = x * x;
+    if constexpr (sizeof(T) <= sizeof(float)) {
+        sin = x * (1 + x2 * (T(-1) / 6 +
+                             x2 * (T(1) / 120 + x2 * (T(-1) / 5040))));
+        cos = 1 + x2 * (T(-1) / 2 +
+                        x2 * (T(1) / 24 +
+                              x2 * (T(-1) / 720 + x2 * (T(1) / 40320))));
+        return;
+    }
+    sin = x * (1 + x2 * (T(-1) / 6 +
+                         x2 * (T(1) / 120 +
+                               x2 * (T(-1) / 5040 +
+                                     x2 * (T(1) / 362880 +
+                                           x2 * (T(-1) / 39916800))))));
+    cos = 1 + x2 * (T(-1) / 2 +
+                    x2 * (T(1) / 24 +
+                          x2 * (T(-1) / 720 +
+                                x2 * (T(1) / 40320 +
+                                      x2 * (T(-1) / 3628800 +
+                                            x2 * (T(1) / 479001600))))));
+}
+
+// Cube root of x in [0, 1]. Floats start from the bits divided by three,
+// about right as they hold the exponent (Kahan's guess), and take two
+// Newton steps to within 2e-6, a fraction of std::cbrt's time. Doubles
+// use std::cbrt.
+template <class T> inline T unitCbrt(T x) {
+    if constexpr (sizeof(T) == sizeof(uint32_t)) {
+        x = std::max(x, T(1e-30)); // A guess of 0 would divide by 0.
+        uint32_t bits;
+        std::memcpy(&bits, &x, sizeof(bits));
+        bits = bits / 3 + 709921077u;
+        T y;
+        std::memcpy(&y, &bits, sizeof(y));
+        y -= (y * y * y - x) / (3 * y * y);
+        y -= (y * y * y - x) / (3 * y * y);
+        return y;
+    } else {
+        return std::cbrt(x);
+    }
+}
+
+// x where mask is 1 and y where it is 0. Compilers turn a ?: on a coin
+// flip into a branch mispredicted half the time, and so a mask from a
+// comparison too; the masks below come from sign bits and truncation, and
+// this stays arithmetic, and exact, as one of the products is 0.
+template <class T> inline T blend(T mask, T x, T y) {
+    return mask * x + (1 - mask) * y;
+}
+
+// Two uniform numbers from the calling thread's generator, in order.
+template <class T> inline Vec2<T> randomSample2() {
+    T u1 = randomReal<T>();
+    T u2 = randomReal<T>();
+    return Vec2<T>(u1, u2);
+}
+
+// Uniform on the unit disk in the z = 0 plane, by Shirley and Chiu's
+// concentric mapping of squares to circles, which keeps neighbouring
+// samples neighbours and so keeps the strata of a stratified sequence.
+template <class T> inline Vec3<T> sampleConcentricDisk(const Vec2<T>& u) {
+    profileCount(Counter::DiskSamples);
+    T a = 2 * u.x() - 1, b = 2 * u.y() - 1;
+    // The square's rings map to circles, the radius from whichever of a
+    // and b is larger and the angle from the other. On the narrow side the
+    // angle is pi/2 - x for this x, which swaps its sine and cosine. r is
+    // only 0 at the centre, where any angle will do.
+    T wide = T(std::signbit(b * b - a * a));
+    T r = blend(wide, a, b);
+    T x = (pi<T> / 4) * (blend(wide, b, a) / (r + T(r == 0)));
+    T sin, cos;
+    quarterSinCos(x, sin, cos);
+    return Vec3<T>(r * blend(wide, cos, sin), r * blend(wide, sin, cos), 0);
+}
+
+// Uniform on the unit sphere. Half of u.x picks the hemisphere and the
+// disk point for the rest lifts onto it by an equal area map (Clarberg
+// 2008): z = 1 - r^2 is uniform as Archimedes' hat box theorem needs.
+template <class T> inline Vec3<T> sampleUniformSphere(const Vec2<T>& u) {
+    profileCount(Counter::SphereSamples);
+    T lower = T(int(2 * u.x()));
+    Vec3<T> d = sampleConcentricDisk(Vec2<T>(2 * u.x() - lower, u.y()));
+    T r2 = d.x() * d.x() + d.y() * d.y();
+    T s = std::sqrt(std::max<T>(0, 2 - r2));
+    return Vec3<T>(d.x() * s, d.y() * s, (1 - r2) * (1 - 2 * lower));
+}
+
+// Uniform in the unit ball: a direction on the sphere, and a radius whose
+// cube is uniform since the volume within r grows as r^3.
+template <class T>
+inline Vec3<T> sampleUniformBall(const Vec2<T>& u, T u3) {
+    return unitCbrt(u3) * sampleUniformSphere(u);
+}
+
+// Over the hemisphere around +z with density cos(theta) / pi: a uniform
+// disk point lifted onto the hemisphere (Malley's method).
+template <class T>
+inline Vec3<T> sampleCosineHemisphere(const Vec2<T>& u) {
+    Vec3<T> d = sampleConcentricDisk(u);
+    T z = std::sqrt(std::max<T>(0, 1 - d.x() * d.x() - d.y() * d.y()));
+    return Vec3<T>(d.x(), d.y(), z);
+}
+
+// Orthonormal basis around a unit normal, without branches (Duff et al.
+// 2017, "Building an Orthonormal Basis, Revisited").
+template <class T> struct Onb {
+    Vec3<T> s, t, n;
+
+    explicit Onb(const Vec3<T>& normal) : n(normal) {
+        T sign = std::copysign(T(1), n.z());
+        T a = -1 / (sign + n.z());
+        T b = n.x() * n.y() * a;
+        s = Vec3<T>(1 + sign * n.x() * n.x() * a, sign * b, -sign * n.x());
+        t = Vec3<T>(b, sign + n.y() * n.y() * a, -n.y());
+    }
+
+    // v given in the basis, with z along the normal, in world space.
+    Vec3<T> toWorld(const Vec3<T>& v) const {
+        return v.x() * s + v.y() * t + v.z() * n;
+    }
+};
+
+} // namespace raytrace
+
+#endif // SAMPLING_H
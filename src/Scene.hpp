@@ -0,0 +1,33 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include <memory>
+
+#include "Animation.hpp"
+#include "Camera.hpp"
+#include "HittableList.hpp"
+#include "Material.hpp"
+
+namespace raytrace {
+
+// Objects together with the material table their hit records index into,
+// and the view and image settings the scene is meant to be rendered with.
+template <class T> class Scene {
+  public:
+    // Memory the objects point into, e.g. a mapped scene file. Declared
+    // first so it is released last.
+    std::shared_ptr<const void> storage;
+
+    MaterialTable<T> materials;
+    HittableList<T> objects;
+    CameraSettings<T> camera;
+    int width = 1024;
+    int height = 576;
+    int samplesPerPixel = 100;
+    int maxDepth = 50;
+    Animation<T> animation; // Keyed camera and objects, for sequences.
+};
+
+} // namespace raytrace
+
+#endif // SCENE_H
@@ -0,0 +1,1055 @@
+#ifndef SCENEFILE_H
+#define SCENEFILE_H
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "Common.hpp"
+
+#include "Animation.hpp"
+#include "BvhTree.hpp"
+#include "Instance.hpp"
+#include "MappedFile.hpp"
+#include "Material.hpp"
+#include "MeshLoader.hpp"
+#include "ParseNumber.hpp"
+#include "Scene.hpp"
+#include "Sphere.hpp"
+#include "SphereSet.hpp"
+#include "TriangleMesh.hpp"
+
+namespace raytrace {
+
+// Scenes are stored in two forms, chosen by the first bytes of the file.
+//
+// Text, for authoring. One directive per line, '#' starts a comment and
+// materials are numbered from 0 in the order they appear:
+//
+//   camera <from x y z> <at x y z> <up x y z> <vfov> <aperture> <focus>
+//   image <width> <height> <spp> <max depth>
+//   lambertian <r g b>
+//   metal <r g b> <fuzz>
+//   dielectric <index of refraction>
+//   emissive <r g b>
+//   sphere <x y z> <radius> <material>
+//   moving_sphere <x y z at time 0> <x y z at time 1> <radius> <material>
+//   mesh <.obj or .ply file> <material>
+//   instance <.obj or .ply file> <material> <transform>...
+//   frames <count>
+//   key <frame> <transform>...
+//   camera_key <frame> <from x y z> <at x y z> <focus>
+//   shutter <open> <close>
+//
+// Mesh paths are relative to the scene file and may not contain spaces. A
+// file is loaded once however many lines name it. Each instance places a
+// copy of it by a list of transforms, applied in order to the mesh:
+//
+//   scale <s> | scale <x y z> | rotate <axis x y z> <degrees>
+//   translate <x y z> | matrix <3x4 matrix, row major>
+//
+// frames makes the scene an animation of that many frames. A key moves the
+// last sphere or instance above it from where its line puts it, by
+// transforms as above, at a frame. Frames between keys blend the steps, so
+// each object's keys list the same steps, in frame order. Camera keys, in
+// frame order too, give the path the camera follows.
+//
+// A moving sphere travels in a straight line over times 0 to 1, and the
+// camera's shutter is open for part of that, 0 <= open <= close <= 1, so
+// the sphere blurs along its path. Without a shutter line both are 0 and
+// every ray sees time 0.
+//
+// Binary (.bscene), for loading. A header followed by 64 byte aligned
+// sections: the material records, then the spheres as structure of arrays
+// in BVH leaf order, then the BVH nodes. Loading maps the file and points a
+// SphereSet straight at those sections, nothing is parsed or copied.
+//
+// Either way the still spheres end up in a single SphereSet, so there is no
+// heap allocation per object. Keyed and moving spheres are Sphere objects
+// of their own, so a refit follows them and each is bounded over its path.
+// Binary files hold still spheres only.
+
+struct SceneFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder; // byteOrderMark as written, detects swapped files.
+    uint32_t realBytes; // sizeof(T) of the writer, the loader must match.
+    uint32_t nodeBytes;
+    int32_t width;
+    int32_t height;
+    int32_t samplesPerPixel;
+    int32_t maxDepth;
+    double camera[12]; // lookFrom, lookAt, vUp, vFovDeg, aperture, focusDist
+    uint64_t materialCount;
+    uint64_t sphereCount;
+    uint64_t nodeCount;
+    uint64_t materialOffset;
+    uint64_t sphereOffset[5]; // x, y, z, radius, material index
+    uint64_t nodeOffset;
+    uint64_t fileSize;
+
+    static constexpr char magicText[8] = {'R', 'T', 'S', 'C', 'E', 'N', 'E', 1};
+    static constexpr uint32_t currentVersion = 1;
+    static constexpr uint32_t byteOrderMark = 0x01020304;
+    static constexpr uint64_t alignment = 64;
+};
+
+// What loading a scene file took.
+struct SceneLoadStats {
+    size_t bytes = 0;
+    size_t spheres = 0;
+    size_t triangles = 0; // Stored, instances add none.
+    size_t instances = 0;
+    size_t materials = 0;
+    bool binary = false;
+    double parseSeconds = 0; // Including the material table.
+    double bvhSeconds = 0;   // 0 for binary files, the BVH is stored.
+    std::vector<std::pair<std::string, MeshLoadStats>> meshes;
+};
+
+struct SceneMaterialRecord {
+    uint32_t kind; // Material<T>::Kind
+    uint32_t reserved;
+    double params[4]; // Albedo and fuzz, or index of refraction.
+};
+
+namespace detail {
+
+class SceneTextParser {
+  public:
+    SceneTextParser(const char* begin, const char* end) : p(begin), end(end) {}
+
+    int line() const { return lineNumber; }
+
+    // Next directive keyword, skipping blank lines and comments. Returns
+    // false at the end of the input.
+    bool keyword(std::string& word) {
+        while (true) {
+            skipSpaces();
+            if (p == end)
+                return false;
+            if (*p == '#') {
+                while (p < end && *p != '\n')
+                    ++p;
+            }
+            if (p < end && (*p == '\n' || *p == '\r')) {
+                if (*p == '\n')
+                    lineNumber++;
+                ++p;
+                continue;
+            }
+            break;
+        }
+        const char* start = p;
+        while (p < end && *p > ' ')
+            ++p;
+        word.assign(start, p);
+        return true;
+    }
+
+    // Integral fields, counts and indices, take only whole numbers that
+    // fit.
+    template <class T> bool number(T& value) {
+        skipSpaces();
+        double v;
+        if (!parseNumber(p, end, v))
+            return false;
+        if constexpr (std::is_integral<T>::value) {
+            if (!(v >= double(std::numeric_limits<T>::min()) &&
+                  v < double(std::numeric_limits<T>::max()) + 1) ||
+                v != std::floor(v))
+                return false;
+        }
+        value = static_cast<T>(v);
+        return true;
+    }
+
+    template <class T> bool vec(Vec3<T>& v) {
+        T x, y, z;
+        if (!number(x) || !number(y) || !number(z))
+            return false;
+        v = Vec3<T>(x, y, z);
+        return true;
+    }
+
+    // Next run of non-space characters on the line.
+    bool token(std::string& word) {
+        skipSpaces();
+        const char* start = p;
+        while (p < end && *p > ' ')
+            ++p;
+        word.assign(start, p);
+        return p > start;
+    }
+
+    // A transform as a list of scale, rotate, translate and matrix steps up
+    // to the end of the line, each applied after the ones before it.
+    template <class T> bool transformSteps(std::vector<TransformStep<T>>& steps) {
+        steps.clear();
+        std::string word;
+        while (!endOfLine()) {
+            token(word);
+            TransformStep<T> step;
+            std::fill(std::begin(step.values), std::end(step.values), T(0));
+            if (word == "scale") {
+                step.kind = TransformStep<T>::Scale;
+                if (!number(step.values[0]))
+                    return false;
+                const char* mark = p;
+                if (!number(step.values[1]) || !number(step.values[2])) {
+                    p = mark;
+                    step.values[1] = step.values[2] = step.values[0];
+                }
+            } else if (word == "rotate" || word == "translate" ||
+                       word == "matrix") {
+                step.kind = word == "rotate"      ? TransformStep<T>::Rotate
+                            : word == "translate" ? TransformStep<T>::Translate
+                                                  : TransformStep<T>::Matrix;
+                for (int i = 0; i < step.size(); ++i)
+                    if (!number(step.values[i]))
+                        return false;
+            } else {
+                return false;
+            }
+            steps.push_back(step);
+        }
+        return composeSteps(steps).determinant() != 0;
+    }
+
+    template <class T> bool transform(Transform<T>& t) {
+        std::vector<TransformStep<T>> steps;
+        if (!transformSteps(steps))
+            return false;
+        t = composeSteps(steps);
+        return true;
+    }
+
+    // Only whitespace or a comment may follow the directive.
+    bool endOfLine() {
+        skipSpaces();
+        return p == end || *p == '\n' || *p == '\r' || *p == '#';
+    }
+
+  private:
+    const char* p;
+    const char* end;
+    int lineNumber = 1;
+
+    void skipSpaces() {
+        while (p < end && (*p == ' ' || *p == '\t'))
+            ++p;
+    }
+};
+
+inline uint64_t alignUp(uint64_t offset) {
+    const uint64_t a = SceneFileHeader::alignment;
+    return (offset + a - 1) / a * a;
+}
+
+// Mesh loaded from a file, as a file can refer to it.
+template <class T> const TriangleMesh<T>* fileMesh(const Hittable<T>* object) {
+    auto mesh = dynamic_cast<const TriangleMesh<T>*>(object);
+    return mesh && !mesh->getGeometry()->source().empty() ? mesh : nullptr;
+}
+
+// Every sphere of the scene in one set, and the meshes and instances of
+// them if wanted, for writing. Objects the animation moves are left to it.
+template <class T>
+bool collectSpheres(const HittableList<T>& objects, SphereSet<T>& out,
+                    std::string& error,
+                    std::vector<const TriangleMesh<T>*>* meshes = nullptr,
+                    std::vector<const Instance<T>*>* instances = nullptr,
+                    const Animation<T>* animation = nullptr,
+                    std::vector<const Sphere<T>*>* moving = nullptr) {
+    for (const auto& object : objects.getObjects()) {
+        if (animation && animation->tracked(object.get()))
+            continue;
+        auto instance = dynamic_cast<const Instance<T>*>(object.get());
+        if (meshes && fileMesh(object.get())) {
+            meshes->push_back(fileMesh(object.get()));
+        } else if (instances && instance &&
+                   fileMesh(instance->getGeometry().get())) {
+            instances->push_back(instance);
+        } else if (auto sphere =
+                       dynamic_cast<const Sphere<T>*>(object.get());
+                   sphere && moving && sphere->moving()) {
+            moving->push_back(sphere);
+        } else if (auto sphere =
+                       dynamic_cast<const Sphere<T>*>(object.get());
+                   sphere && !sphere->moving()) {
+            out.add(sphere->getCenter(), sphere->getRadius(),
+                    sphere->getMaterial());
+        } else if (auto set =
+                       dynamic_cast<const SphereSet<T>*>(object.get())) {
+            for (size_t i = 0; i < set->size(); ++i)
+                out.add(set->center(i), set->radius(i), set->material(i));
+        } else {
+            error = meshes ? "scene files only hold spheres, meshes and "
+                             "instances of meshes"
+                           : "binary scene files only hold still spheres";
+            return false;
+        }
+    }
+    return true;
+}
+
+template <class T>
+bool materialRecord(const Material<T>& m, SceneMaterialRecord& record) {
+    record = SceneMaterialRecord();
+    record.kind = m.kind();
+    if (auto lambertian = m.template as<Lambertian<T>>()) {
+        Color<T> a = lambertian->getAlbedo();
+        record.params[0] = a.x();
+        record.params[1] = a.y();
+        record.params[2] = a.z();
+    } else if (auto metal = m.template as<Metal<T>>()) {
+        Color<T> a = metal->getAlbedo();
+        record.params[0] = a.x();
+        record.params[1] = a.y();
+        record.params[2] = a.z();
+        record.params[3] = metal->getFuzz();
+    } else if (auto dielectric = m.template as<Dielectric<T>>()) {
+        record.params[0] = dielectric->getIndex();
+    } else if (auto emissive = m.template as<Emissive<T>>()) {
+        Color<T> radiance = emissive->getRadiance();
+        record.params[0] = radiance.x();
+        record.params[1] = radiance.y();
+        record.params[2] = radiance.z();
+    } else {
+        return false;
+    }
+    return true;
+}
+
+template <class T>
+bool addMaterial(MaterialTable<T>& table, const SceneMaterialRecord& record) {
+    const double* p = record.params;
+    switch (record.kind) {
+    case Material<T>::LambertianKind:
+        table.add(Lambertian<T>(Color<T>(p[0], p[1], p[2])));
+        return true;
+    case Material<T>::MetalKind:
+        table.add(Metal<T>(Color<T>(p[0], p[1], p[2]), p[3]));
+        return true;
+    case Material<T>::DielectricKind:
+        table.add(Dielectric<T>(p[0]));
+        return true;
+    case Material<T>::EmissiveKind:
+        table.add(Emissive<T>(Color<T>(p[0], p[1], p[2])));
+        return true;
+    }
+    return false;
+}
+
+// Image settings either form accepts.
+template <class T> bool validImage(const Scene<T>& scene) {
+    return scene.width >= 2 && scene.height >= 2 &&
+           scene.samplesPerPixel >= 1 && scene.maxDepth >= 1;
+}
+
+// A tree read from a file, in one pass: leaves in range with materials
+// that exist, second children after their parents so there are no cycles,
+// and no path deeper than traversal's stack.
+template <class T>
+bool validTree(const BvhNode<T>* nodes, uint64_t nodeCount,
+               const uint32_t* materials, uint64_t primitives,
+               uint64_t materialCount) {
+    std::vector<uint8_t> depth(nodeCount, 0);
+    for (uint64_t i = 0; i < nodeCount; ++i) {
+        const BvhNode<T>& node = nodes[i];
+        if (node.count > 0) {
+            if (node.offset + uint64_t(node.count) > primitives)
+                return false;
+            for (uint32_t j = node.offset; j < node.offset + node.count; ++j)
+                if (materials[j] >= materialCount)
+                    return false;
+            continue;
+        }
+        if (node.axis > 2 || node.offset <= i + 1 || node.offset >= nodeCount)
+            return false;
+        int below = depth[i] + 1;
+        if (below >= BvhTree<T>::maxStackDepth)
+            return false;
+        depth[i + 1] = uint8_t(std::max<int>(depth[i + 1], below));
+        depth[node.offset] =
+            uint8_t(std::max<int>(depth[node.offset], below));
+    }
+    return true;
+}
+
+} // namespace detail
+
+template <class T>
+bool loadSceneText(const MappedFile& file, const std::string& directory,
+                   Scene<T>& scene, SceneLoadStats& stats,
+                   std::string& error) {
+    const char* begin = reinterpret_cast<const char*>(file.data());
+    detail::SceneTextParser in(begin, begin + file.size());
+    auto set = std::make_shared<SphereSet<T>>();
+    // Roughly one line per sphere, so this usually avoids regrowing.
+    set->reserve(file.size() / 32);
+    bool haveCamera = false;
+    // A mesh used more than once is loaded once and shared, instances
+    // share one TriangleMesh of it too.
+    std::vector<std::shared_ptr<MeshGeometry<T>>> meshes;
+    std::vector<std::shared_ptr<const TriangleMesh<T>>> shapes;
+    // The line key lines move, and spheres that keys took out of the set.
+    enum { NoObject, SphereLine, InstanceLine } last = NoObject;
+    bool lastKeyed = false;
+    std::shared_ptr<Instance<T>> lastInstance;
+    std::vector<uint8_t> keyedSpheres;
+    auto& animation = scene.animation;
+
+    std::string word;
+    auto fail = [&](const std::string& what) {
+        error = "line " + std::to_string(in.line()) + ": " + what;
+        return false;
+    };
+
+    while (in.keyword(word)) {
+        if (word == "sphere") {
+            Point3<T> center;
+            T radius;
+            uint32_t mat;
+            if (!in.vec(center) || !in.number(radius) || !in.number(mat))
+                return fail("expected sphere <x y z> <radius> <material>");
+            if (mat >= scene.materials.size())
+                return fail("undefined material " + std::to_string(mat));
+            set->add(center, radius, mat);
+            last = SphereLine;
+            lastKeyed = false;
+        } else if (word == "moving_sphere") {
+            Point3<T> center0, center1;
+            T radius;
+            uint32_t mat;
+            if (!in.vec(center0) || !in.vec(center1) || !in.number(radius) ||
+                !in.number(mat))
+                return fail("expected moving_sphere <x y z at time 0> "
+                            "<x y z at time 1> <radius> <material>");
+            if (mat >= scene.materials.size())
+                return fail("undefined material " + std::to_string(mat));
+            scene.objects.add(
+                std::make_shared<Sphere<T>>(center0, center1, radius, mat));
+            stats.spheres++;
+            last = NoObject;
+        } else if (word == "mesh" || word == "instance") {
+            std::string file;
+            uint32_t mat;
+            if (!in.token(file) || !in.number(mat))
+                return fail("expected " + word + " <file> <material>");
+            if (mat >= scene.materials.size())
+                return fail("undefined material " + std::to_string(mat));
+
+            // Kept as written, so a saved scene names it the same way.
+            std::shared_ptr<MeshGeometry<T>> geometry;
+            for (const auto& loaded : meshes)
+                if (loaded->source() == file)
+                    geometry = loaded;
+            if (!geometry) {
+                std::string path = file;
+                if (!directory.empty() && file[0] != '/')
+                    path = directory + "/" + file;
+                std::string meshError;
+                MeshLoadStats meshStats;
+                geometry = loadMesh<T>(path, meshError, &meshStats);
+                if (!geometry)
+                    return fail(meshError);
+                geometry->setSource(file);
+                meshes.push_back(geometry);
+                stats.meshes.emplace_back(path, meshStats);
+                stats.triangles += geometry->triangleCount();
+                stats.bvhSeconds += geometry->bvhStats().seconds;
+            }
+
+            if (word == "mesh") {
+                scene.objects.add(
+                    std::make_shared<TriangleMesh<T>>(geometry, mat));
+                last = NoObject;
+            } else {
+                Transform<T> transform;
+                if (!in.transform(transform))
+                    return fail("expected instance transforms: scale, "
+                                "rotate, translate or matrix, not singular");
+                std::shared_ptr<const TriangleMesh<T>> shape;
+                for (const auto& existing : shapes)
+                    if (existing->getGeometry() == geometry)
+                        shape = existing;
+                if (!shape) {
+                    shape = std::make_shared<TriangleMesh<T>>(geometry, mat);
+                    shapes.push_back(shape);
+                }
+                lastInstance =
+                    std::make_shared<Instance<T>>(shape, transform, mat);
+                scene.objects.add(lastInstance);
+                stats.instances++;
+                last = InstanceLine;
+                lastKeyed = false;
+            }
+        } else if (word == "key") {
+            TransformKey<T> key;
+            if (!in.number(key.frame) || !in.transformSteps(key.steps))
+                return fail("expected key <frame> <transform steps>");
+            if (last == NoObject)
+                return fail("key must follow a sphere or instance");
+            if (!lastKeyed) {
+                typename Animation<T>::Track track;
+                if (last == SphereLine) {
+                    size_t i = set->size() - 1;
+                    track.center = set->center(i);
+                    track.sphere = std::make_shared<Sphere<T>>(
+                        track.center, set->radius(i), set->material(i));
+                    keyedSpheres.resize(set->size());
+                    keyedSpheres[i] = 1;
+                } else {
+                    track.instance = lastInstance;
+                    track.placement = lastInstance->getTransform();
+                }
+                animation.tracks.push_back(std::move(track));
+                lastKeyed = true;
+            }
+            auto& keys = animation.tracks.back().keys;
+            if (!keys.empty() &&
+                (!keys.back().matches(key) || key.frame <= keys.back().frame))
+                return fail("keys of an object need the same steps, in "
+                            "frame order");
+            keys.push_back(std::move(key));
+        } else if (word == "frames") {
+            if (!in.number(animation.frames) || animation.frames < 1)
+                return fail("expected frames <count>");
+        } else if (word == "camera_key") {
+            CameraKey<T> key;
+            if (!in.number(key.frame) || !in.vec(key.lookFrom) ||
+                !in.vec(key.lookAt) || !in.number(key.focusDist))
+                return fail("expected camera_key <frame> <from x y z> "
+                            "<at x y z> <focus>");
+            if (!animation.cameraKeys.empty() &&
+                key.frame <= animation.cameraKeys.back().frame)
+                return fail("camera keys must be in frame order");
+            animation.cameraKeys.push_back(key);
+        } else if (word == "lambertian") {
+            Color<T> albedo;
+            if (!in.vec(albedo))
+                return fail("expected lambertian <r g b>");
+            scene.materials.add(Lambertian<T>(albedo));
+        } else if (word == "metal") {
+            Color<T> albedo;
+            T fuzz;
+            if (!in.vec(albedo) || !in.number(fuzz))
+                return fail("expected metal <r g b> <fuzz>");
+            scene.materials.add(Metal<T>(albedo, fuzz));
+        } else if (word == "dielectric") {
+            T ir;
+            if (!in.number(ir))
+                return fail("expected dielectric <index of refraction>");
+            scene.materials.add(Dielectric<T>(ir));
+        } else if (word == "emissive") {
+            Color<T> radiance;
+            if (!in.vec(radiance))
+                return fail("expected emissive <r g b>");
+            scene.materials.add(Emissive<T>(radiance));
+        } else if (word == "camera") {
+            auto& c = scene.camera;
+            if (!in.vec(c.lookFrom) || !in.vec(c.lookAt) || !in.vec(c.vUp) ||
+                !in.number(c.vFovDeg) || !in.number(c.aperture) ||
+                !in.number(c.focusDist))
+                return fail("expected camera <from x y z> <at x y z> "
+                            "<up x y z> <vfov> <aperture> <focus>");
+            haveCamera = true;
+        } else if (word == "shutter") {
+            // Moving spheres are bounded over times 0 to 1 only.
+            auto& c = scene.camera;
+            if (!in.number(c.shutterOpen) || !in.number(c.shutterClose) ||
+                c.shutterOpen < 0 || c.shutterClose > 1 ||
+                c.shutterClose < c.shutterOpen)
+                return fail("expected shutter <open> <close>, "
+                            "0 <= open <= close <= 1");
+        } else if (word == "image") {
+            if (!in.number(scene.width) || !in.number(scene.height) ||
+                !in.number(scene.samplesPerPixel) ||
+                !in.number(scene.maxDepth) || !detail::validImage(scene))
+                return fail("expected image <width> <height> <spp> <depth>");
+        } else {
+            return fail("unknown directive '" + word + "'");
+        }
+        if (!in.endOfLine())
+            return fail("unexpected text after " + word);
+    }
+
+    if (!haveCamera)
+        return fail("no camera");
+    if (!keyedSpheres.empty()) {
+        // Moving spheres are objects of their own, so a refit follows them.
+        auto still = std::make_shared<SphereSet<T>>();
+        still->reserve(set->size());
+        for (size_t i = 0; i < set->size(); ++i)
+            if (i >= keyedSpheres.size() || !keyedSpheres[i])
+                still->add(set->center(i), set->radius(i), set->material(i));
+        set = still;
+    }
+    for (const auto& track : animation.tracks)
+        if (track.sphere) {
+            scene.objects.add(track.sphere);
+            stats.spheres++;
+        }
+    animation.apply(0);
+    set->buildBvh();
+    scene.objects.add(set);
+    stats.spheres += set->size();
+    stats.bvhSeconds += set->bvhStats().seconds;
+    return true;
+}
+
+template <class T>
+bool loadSceneBinary(const std::shared_ptr<MappedFile>& file, Scene<T>& scene,
+                     SceneLoadStats& stats, std::string& error) {
+    SceneFileHeader h;
+    if (file->size() < sizeof(h)) {
+        error = "truncated header";
+        return false;
+    }
+    std::memcpy(&h, file->data(), sizeof(h));
+
+    if (h.byteOrder != SceneFileHeader::byteOrderMark ||
+        h.version != SceneFileHeader::currentVersion) {
+        error = "unsupported version or byte order";
+        return false;
+    }
+    if (h.realBytes != sizeof(T) || h.nodeBytes != sizeof(BvhNode<T>)) {
+        error = "written with " + std::to_string(h.realBytes * 8) +
+                " bit reals, convert it from the text form";
+        return false;
+    }
+    if (h.fileSize != file->size()) {
+        error = "truncated file";
+        return false;
+    }
+
+    // Sections must lie in the file and be aligned for their element type.
+    // Counts are bounded first so their sizes in bytes cannot overflow.
+    auto section = [&](uint64_t offset, uint64_t bytes) {
+        return offset % SceneFileHeader::alignment == 0 &&
+               offset <= h.fileSize && bytes <= h.fileSize - offset;
+    };
+    uint64_t n = h.sphereCount;
+    bool valid =
+        h.materialCount <= h.fileSize / sizeof(SceneMaterialRecord) &&
+        h.nodeCount <= std::min<uint64_t>(h.fileSize / sizeof(BvhNode<T>),
+                                          UINT32_MAX) &&
+        n <= h.fileSize / sizeof(uint32_t);
+    valid = valid && section(h.materialOffset,
+                         h.materialCount * sizeof(SceneMaterialRecord)) &&
+                 section(h.nodeOffset, h.nodeCount * sizeof(BvhNode<T>));
+    for (int i = 0; i < 4; ++i)
+        valid = valid && section(h.sphereOffset[i], n * sizeof(T));
+    valid = valid && section(h.sphereOffset[4], n * sizeof(uint32_t));
+    if (!valid || (n > 0 && h.nodeCount == 0)) {
+        error = "corrupt section table";
+        return false;
+    }
+
+    const uint8_t* base = file->data();
+    for (uint64_t i = 0; i < h.materialCount; ++i) {
+        SceneMaterialRecord record;
+        std::memcpy(&record,
+                    base + h.materialOffset + i * sizeof(SceneMaterialRecord),
+                    sizeof(record));
+        if (!detail::addMaterial(scene.materials, record)) {
+            error = "unknown material kind";
+            return false;
+        }
+    }
+
+    auto& c = scene.camera;
+    c.lookFrom = Point3<T>(h.camera[0], h.camera[1], h.camera[2]);
+    c.lookAt = Point3<T>(h.camera[3], h.camera[4], h.camera[5]);
+    c.vUp = Vec3<T>(h.camera[6], h.camera[7], h.camera[8]);
+    c.vFovDeg = h.camera[9];
+    c.aperture = h.camera[10];
+    c.focusDist = h.camera[11];
+    scene.width = h.width;
+    scene.height = h.height;
+    scene.samplesPerPixel = h.samplesPerPixel;
+    scene.maxDepth = h.maxDepth;
+    if (!detail::validImage(scene)) {
+        error = "bad image size, samples or depth";
+        return false;
+    }
+
+    auto array = [&](int i) {
+        return reinterpret_cast<const T*>(base + h.sphereOffset[i]);
+    };
+    auto materials =
+        reinterpret_cast<const uint32_t*>(base + h.sphereOffset[4]);
+    auto nodes = reinterpret_cast<const BvhNode<T>*>(base + h.nodeOffset);
+    if (!detail::validTree(nodes, h.nodeCount, materials, n,
+                           h.materialCount)) {
+        error = "corrupt BVH or material index";
+        return false;
+    }
+    scene.objects.add(std::make_shared<SphereSet<T>>(
+        n, array(0), array(1), array(2), array(3), materials, nodes,
+        h.nodeCount));
+    scene.storage = file;
+    stats.spheres = n;
+    return true;
+}
+
+// Load a scene from a file already opened or filled, text or binary by its
+// magic. Meshes and instances are read relative to directory. Keeps file
+// alive for as long as the scene needs it.
+template <class T>
+bool loadSceneData(const std::shared_ptr<MappedFile>& file,
+                   const std::string& directory, Scene<T>& scene,
+                   std::string& error, SceneLoadStats* stats = nullptr) {
+    auto start = std::chrono::steady_clock::now();
+    scene = Scene<T>();
+    bool binary = file->size() >= sizeof(SceneFileHeader::magicText) &&
+                  std::memcmp(file->data(), SceneFileHeader::magicText,
+                              sizeof(SceneFileHeader::magicText)) == 0;
+    SceneLoadStats loadStats;
+    bool loaded =
+        binary ? loadSceneBinary(file, scene, loadStats, error)
+               : loadSceneText(*file, directory, scene, loadStats, error);
+    if (!loaded)
+        return false;
+
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    loadStats.bytes = file->size();
+    loadStats.materials = scene.materials.size();
+    loadStats.binary = binary;
+    loadStats.parseSeconds = elapsed.count() - loadStats.bvhSeconds;
+    if (stats)
+        *stats = loadStats;
+    return true;
+}
+
+// Load a text or binary scene file, replacing scene. On failure returns
+// false with a message in error.
+template <class T>
+bool loadScene(const std::string& path, Scene<T>& scene, std::string& error,
+               SceneLoadStats* stats = nullptr) {
+    auto start = std::chrono::steady_clock::now();
+    auto file = std::make_shared<MappedFile>();
+    if (!file->open(path)) {
+        error = "could not open " + path;
+        return false;
+    }
+
+    auto slash = path.find_last_of('/');
+    std::string directory =
+        slash == std::string::npos ? "" : path.substr(0, slash);
+    if (!loadSceneData(file, directory, scene, error, stats)) {
+        error = path + ": " + error;
+        return false;
+    }
+    if (stats) {
+        // Mapping the file counts as parsing.
+        std::chrono::duration<double> elapsed =
+            std::chrono::steady_clock::now() - start;
+        stats->parseSeconds = elapsed.count() - stats->bvhSeconds;
+    }
+    return true;
+}
+
+inline void printSceneLoadStats(std::ostream& out, const std::string& path,
+                               const SceneLoadStats& stats) {
+    out << "Loaded " << path << " (" << (stats.binary ? "binary" : "text")
+        << ", " << stats.bytes / (1024.0 * 1024.0) << " MiB): "
+        << stats.spheres << " spheres, " << stats.triangles
+        << " triangles, " << stats.instances << " instances, "
+        << stats.materials
+        << " materials, parsed in " << stats.parseSeconds * 1e3 << "ms";
+    if (!stats.binary)
+        out << ", BVH built in " << stats.bvhSeconds * 1e3 << "ms";
+    out << '\n';
+    for (const auto& mesh : stats.meshes)
+        printMeshLoadStats(out, mesh.first, mesh.second);
+}
+
+template <class T>
+bool saveSceneText(const std::string& path, const Scene<T>& scene,
+                   std::string& error) {
+    SphereSet<T> spheres;
+    std::vector<const TriangleMesh<T>*> meshes;
+    std::vector<const Instance<T>*> instances;
+    std::vector<const Sphere<T>*> moving;
+    if (!detail::collectSpheres(scene.objects, spheres, error, &meshes,
+                                &instances, &scene.animation, &moving))
+        return false;
+    for (const auto& track : scene.animation.tracks) {
+        if (track.instance &&
+            !detail::fileMesh(track.instance->getGeometry().get())) {
+            error = "scene files only hold instances of meshes";
+            return false;
+        }
+    }
+
+    std::FILE* f = std::fopen(path.c_str(), "w");
+    if (!f) {
+        error = "could not open " + path;
+        return false;
+    }
+    // Enough digits to tell every value apart; parseNumber rounds them
+    // back to the same value.
+    const int digits = sizeof(T) == 4 ? 9 : 17;
+    auto vec = [&](const Vec3<T>& v) {
+        std::fprintf(f, " %.*g %.*g %.*g", digits, double(v.x()), digits,
+                     double(v.y()), digits, double(v.z()));
+    };
+
+    const auto& c = scene.camera;
+    std::fprintf(f, "# raytrace scene\ncamera");
+    vec(c.lookFrom);
+    vec(c.lookAt);
+    vec(c.vUp);
+    std::fprintf(f, " %.*g %.*g %.*g\n", digits, double(c.vFovDeg), digits,
+                 double(c.aperture), digits, double(c.focusDist));
+    if (c.shutterOpen != 0 || c.shutterClose != 0)
+        std::fprintf(f, "shutter %.*g %.*g\n", digits, double(c.shutterOpen),
+                     digits, double(c.shutterClose));
+    std::fprintf(f, "image %d %d %d %d\n", scene.width, scene.height,
+                 scene.samplesPerPixel, scene.maxDepth);
+    const auto& animation = scene.animation;
+    if (animation.frames > 0)
+        std::fprintf(f, "frames %d\n", animation.frames);
+    for (const auto& key : animation.cameraKeys) {
+        std::fprintf(f, "camera_key %.*g", digits, double(key.frame));
+        vec(key.lookFrom);
+        vec(key.lookAt);
+        std::fprintf(f, " %.*g\n", digits, double(key.focusDist));
+    }
+
+    static const char* names[] = {"lambertian", "metal", "dielectric",
+                                  "emissive"};
+    for (uint32_t i = 0; i < scene.materials.size(); ++i) {
+        SceneMaterialRecord r;
+        detail::materialRecord(scene.materials[i], r);
+        const double* p = r.params;
+        std::fprintf(f, "%s", names[r.kind]);
+        if (r.kind == Material<T>::DielectricKind)
+            std::fprintf(f, " %.*g\n", digits, p[0]);
+        else if (r.kind == Material<T>::MetalKind)
+            std::fprintf(f, " %.*g %.*g %.*g %.*g\n", digits, p[0], digits,
+                         p[1], digits, p[2], digits, p[3]);
+        else
+            std::fprintf(f, " %.*g %.*g %.*g\n", digits, p[0], digits, p[1],
+                         digits, p[2]);
+    }
+
+    for (size_t i = 0; i < spheres.size(); ++i) {
+        std::fprintf(f, "sphere");
+        vec(spheres.center(i));
+        std::fprintf(f, " %.*g %u\n", digits, double(spheres.radius(i)),
+                     spheres.material(i));
+    }
+    for (const auto* sphere : moving) {
+        std::fprintf(f, "moving_sphere");
+        vec(sphere->getCenter());
+        vec(sphere->getCenter() + sphere->getMotion());
+        std::fprintf(f, " %.*g %u\n", digits, double(sphere->getRadius()),
+                     sphere->getMaterial());
+    }
+    for (const auto* mesh : meshes)
+        std::fprintf(f, "mesh %s %u\n", mesh->getGeometry()->source().c_str(),
+                     mesh->getMaterial());
+    auto matrix = [&](const Transform<T>& t) {
+        std::fprintf(f, " matrix");
+        for (int i = 0; i < 3; ++i)
+            for (int j = 0; j < 4; ++j)
+                std::fprintf(f, " %.*g", digits, double(t(i, j)));
+    };
+    for (const auto* instance : instances) {
+        auto mesh = detail::fileMesh(instance->getGeometry().get());
+        uint32_t mat = instance->getMaterial();
+        if (mat == Instance<T>::keepMaterial)
+            mat = mesh->getMaterial();
+        std::fprintf(f, "instance %s %u",
+                     mesh->getGeometry()->source().c_str(), mat);
+        matrix(instance->getTransform());
+        std::fprintf(f, "\n");
+    }
+
+    // Keyed objects as placed, each followed by its keys.
+    static const char* stepNames[] = {"scale", "rotate", "translate",
+                                      "matrix"};
+    for (const auto& track : animation.tracks) {
+        if (track.sphere) {
+            std::fprintf(f, "sphere");
+            vec(track.center);
+            std::fprintf(f, " %.*g %u\n", digits,
+                         double(track.sphere->getRadius()),
+                         track.sphere->getMaterial());
+        } else {
+            const auto& instance = *track.instance;
+            auto mesh = detail::fileMesh(instance.getGeometry().get());
+            uint32_t mat = instance.getMaterial();
+            if (mat == Instance<T>::keepMaterial)
+                mat = mesh->getMaterial();
+            std::fprintf(f, "instance %s %u",
+                         mesh->getGeometry()->source().c_str(), mat);
+            matrix(track.placement);
+            std::fprintf(f, "\n");
+        }
+        for (const auto& key : track.keys) {
+            std::fprintf(f, "key %.*g", digits, double(key.frame));
+            for (const auto& step : key.steps) {
+                std::fprintf(f, " %s", stepNames[step.kind]);
+                for (int i = 0; i < step.size(); ++i)
+                    std::fprintf(f, " %.*g", digits, double(step.values[i]));
+            }
+            std::fprintf(f, "\n");
+        }
+    }
+
+    bool ok = std::fclose(f) == 0;
+    if (!ok)
+        error = "could not write " + path;
+    return ok;
+}
+
+template <class T>
+bool saveSceneBinary(const std::string& path, const Scene<T>& scene,
+                     std::string& error) {
+    if (!scene.animation.empty()) {
+        error = "binary scene files hold no animation, use the text form";
+        return false;
+    }
+    if (scene.camera.shutterClose > scene.camera.shutterOpen) {
+        error = "binary scene files hold no shutter, use the text form";
+        return false;
+    }
+    // Reuse the set's BVH if the scene is one already, e.g. loaded from text.
+    const SphereSet<T>* spheres = nullptr;
+    SphereSet<T> collected;
+    const auto& objects = scene.objects.getObjects();
+    if (objects.size() == 1)
+        spheres = dynamic_cast<const SphereSet<T>*>(objects[0].get());
+    if (!spheres || spheres->bvh().empty()) {
+        if (!detail::collectSpheres(scene.objects, collected, error))
+            return false;
+        collected.buildBvh();
+        spheres = &collected;
+    }
+
+    SceneFileHeader h;
+    std::memset(&h, 0, sizeof(h));
+    std::memcpy(h.magic, SceneFileHeader::magicText, sizeof(h.magic));
+    h.version = SceneFileHeader::currentVersion;
+    h.byteOrder = SceneFileHeader::byteOrderMark;
+    h.realBytes = sizeof(T);
+    h.nodeBytes = sizeof(BvhNode<T>);
+    h.width = scene.width;
+    h.height = scene.height;
+    h.samplesPerPixel = scene.samplesPerPixel;
+    h.maxDepth = scene.maxDepth;
+
+    const auto& c = scene.camera;
+    const Vec3<T> vectors[] = {c.lookFrom, c.lookAt, c.vUp};
+    for (int i = 0; i < 3; ++i)
+        for (int j = 0; j < 3; ++j)
+            h.camera[3 * i + j] = vectors[i][j];
+    h.camera[9] = c.vFovDeg;
+    h.camera[10] = c.aperture;
+    h.camera[11] = c.focusDist;
+
+    const auto& tree = spheres->bvh();
+    uint64_t n = spheres->size();
+    h.materialCount = scene.materials.size();
+    h.sphereCount = n;
+    h.nodeCount = tree.nodeCount();
+    uint64_t offset = detail::alignUp(sizeof(h));
+    h.materialOffset = offset;
+    offset = detail::alignUp(offset +
+                             h.materialCount * sizeof(SceneMaterialRecord));
+    for (int i = 0; i < 5; ++i) {
+        h.sphereOffset[i] = offset;
+        offset = detail::alignUp(offset +
+                                 n * (i < 4 ? sizeof(T) : sizeof(uint32_t)));
+    }
+    h.nodeOffset = offset;
+    h.fileSize = offset + h.nodeCount * sizeof(BvhNode<T>);
+
+    std::ofstream out(path, std::ios::binary);
+    if (!out) {
+        error = "could not open " + path;
+        return false;
+    }
+    uint64_t written = 0;
+    auto write = [&](const void* data, uint64_t bytes) {
+        out.write(static_cast<const char*>(data),
+                  static_cast<std::streamsize>(bytes));
+        written += bytes;
+    };
+    auto padTo = [&](uint64_t target) {
+        static const char zeros[SceneFileHeader::alignment] = {};
+        write(zeros, target - written);
+    };
+
+    write(&h, sizeof(h));
+    padTo(h.materialOffset);
+    for (uint32_t i = 0; i < h.materialCount; ++i) {
+        SceneMaterialRecord record;
+        detail::materialRecord(scene.materials[i], record);
+        write(&record, sizeof(record));
+    }
+
+    // Written in chunks through a small buffer, not one copy of each array.
+    std::vector<char> buffer;
+    auto writeArray = [&](int section, auto get) {
+        using V = decltype(get(size_t(0)));
+        padTo(h.sphereOffset[section]);
+        const size_t chunk = 4096;
+        buffer.resize(chunk * sizeof(V));
+        for (size_t i = 0; i < n; i += chunk) {
+            size_t count = std::min<size_t>(chunk, n - i);
+            for (size_t j = 0; j < count; ++j) {
+                V v = get(i + j);
+                std::memcpy(&buffer[j * sizeof(V)], &v, sizeof(V));
+            }
+            write(buffer.data(), count * sizeof(V));
+        }
+    };
+    writeArray(0, [&](size_t i) { return spheres->center(i).x(); });
+    writeArray(1, [&](size_t i) { return spheres->center(i).y(); });
+    writeArray(2, [&](size_t i) { return spheres->center(i).z(); });
+    writeArray(3, [&](size_t i) { return spheres->radius(i); });
+    writeArray(4, [&](size_t i) { return spheres->material(i); });
+    padTo(h.nodeOffset);
+    write(tree.nodeData(), h.nodeCount * sizeof(BvhNode<T>));
+
+    if (!out.flush()) {
+        error = "could not write " + path;
+        return false;
+    }
+    return true;
+}
+
+// Binary for .bscene, text otherwise.
+template <class T>
+bool saveScene(const std::string& path, const Scene<T>& scene,
+               std::string& error) {
+    const std::string ext = ".bscene";
+    bool binary = path.size() >= ext.size() &&
+                  path.compare(path.size() - ext.size(), ext.size(), ext) == 0;
+    bool saved = binary ? saveSceneBinary(path, scene, error)
+                        : saveSceneText(path, scene, error);
+    if (!saved)
+        error = path + ": " + error;
+    return saved;
+}
+
+} // namespace raytrace
+
+#endif // SCENEFILE_H
@@ -0,0 +1,352 @@
+#ifndef SCENES_H
+#define SCENES_H
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Common.hpp"
+
+#include "Camera.hpp"
+#include "Instance.hpp"
+#include "Material.hpp"
+#include "Sampling.hpp"
+#include "Scene.hpp"
+#include "Sphere.hpp"
+#include "SphereSet.hpp"
+#include "TriangleMesh.hpp"
+
+namespace raytrace {
+
+// View of randomScene.
+template <class T> CameraSettings<T> randomSceneCameraSettings() {
+    Point3<T> lookFrom(13, 2, 3);
+    Point3<T> lookAt(0, 0, 0);
+    Vec3<T> vUp(0, 1, 0);
+    T distToFocus = 10.0;
+    T aperture = 0.1;
+
+    return {lookFrom, lookAt, vUp, 20, aperture, distToFocus};
+}
+
+// View down across the corner of a sphereFieldScene.
+template <class T> CameraSettings<T> sphereFieldCameraSettings(size_t count) {
+    T half = std::sqrt(T(count)) / 2;
+    Point3<T> lookFrom(half + 2, half / 4 + 2, half + 2);
+    Point3<T> lookAt(0, 0, 0);
+    Vec3<T> vUp(0, 1, 0);
+
+    return {lookFrom, lookAt, vUp, 40, 0, (lookFrom - lookAt).length()};
+}
+
+// Final scene of ray tracing in one weekend.
+// With packed set, each row of small spheres goes into one SphereSet rather
+// than a Sphere per object. Both variants draw the same random numbers.
+template <class T> Scene<T> randomScene(bool packed = false) {
+    using std::make_shared;
+
+    Scene<T> scene;
+    auto& world = scene.objects;
+    auto& materials = scene.materials;
+
+    auto groundMaterial = materials.add(Lambertian<T>(Color<T>(0.5, 0.5, 0.5)));
+    world.add(
+        make_shared<Sphere<T>>(Point3<T>(0, -1000, 0), 1000, groundMaterial));
+
+    // Scattered little spheres.
+    for (int a = -11; a < 11; ++a) {
+        auto row = make_shared<SphereSet<T>>();
+        auto addSphere = [&](const Point3<T>& center, uint32_t mat) {
+            if (packed)
+                row->add(center, 0.2, mat);
+            else
+                world.add(make_shared<Sphere<T>>(center, 0.2, mat));
+        };
+
+        for (int b = -11; b < 11; ++b) {
+            auto chooseMat = randomReal<T>();
+            Point3<T> center(a + T(0.9) * randomReal<T>(), 0.2,
+                             b + T(0.9) * randomReal<T>());
+
+            if ((center - Point3<T>(4, 0.2, 0)).length() > T(0.9)) {
+                if (chooseMat < T(0.8)) {
+                    // Diffuse
+                    auto albedo = Color<T>::random() * Color<T>::random();
+                    addSphere(center, materials.add(Lambertian<T>(albedo)));
+                } else if (chooseMat < T(0.95)) {
+                    // Metal
+                    auto albedo = Color<T>::random(0.5, 1);
+                    auto fuzz = randomReal<T>(0, 0.5);
+                    addSphere(center, materials.add(Metal<T>(albedo, fuzz)));
+                } else {
+                    // Glass
+                    addSphere(center, materials.add(Dielectric<T>(1.5)));
+                }
+            }
+        }
+
+        if (packed && row->size() > 0)
+            world.add(row);
+    }
+
+    // Three big lads.
+    auto mat1 = materials.add(Dielectric<T>(1.5));
+    world.add(make_shared<Sphere<T>>(Point3<T>(0, 1, 0), 1.0, mat1));
+
+    auto mat2 = materials.add(Lambertian<T>(Color<T>(0.4, 0.2, 0.1)));
+    world.add(make_shared<Sphere<T>>(Point3<T>(-4, 1, 0), 1.0, mat2));
+
+    auto mat3 = materials.add(Metal<T>(Color<T>(0.7, 0.6, 0.5), 0.0));
+    world.add(make_shared<Sphere<T>>(Point3<T>(4, 1, 0), 1.0, mat3));
+
+    scene.camera = randomSceneCameraSettings<T>();
+    return scene;
+}
+
+// Book two's bouncing spheres: randomScene with the small diffuse spheres
+// hopping up during a shutter open from time 0 to 1.
+template <class T> Scene<T> bouncingScene() {
+    Scene<T> scene = randomScene<T>();
+    for (const auto& object : scene.objects.getObjects()) {
+        auto sphere = std::dynamic_pointer_cast<Sphere<T>>(object);
+        if (sphere && sphere->getRadius() == T(0.2) &&
+            scene.materials[sphere->getMaterial()]
+                .template as<Lambertian<T>>())
+            sphere->setMotion(Vec3<T>(0, randomReal<T>(0, 0.5), 0));
+    }
+    scene.camera.shutterOpen = 0;
+    scene.camera.shutterClose = 1;
+    return scene;
+}
+
+// Camera used for randomScene.
+template <class T> Camera<T> randomSceneCamera(T aspectRatio) {
+    return randomSceneCameraSettings<T>().camera(aspectRatio);
+}
+
+// Adds size random materials mixed like randomScene's, returning the index
+// of the first.
+template <class T> uint32_t addPalette(MaterialTable<T>& materials,
+                                       uint32_t size) {
+    uint32_t first = static_cast<uint32_t>(materials.size());
+    for (uint32_t i = 0; i < size; ++i) {
+        auto chooseMat = randomReal<T>();
+        if (chooseMat < T(0.8))
+            materials.add(
+                Lambertian<T>(Color<T>::random() * Color<T>::random()));
+        else if (chooseMat < T(0.95))
+            materials.add(
+                Metal<T>(Color<T>::random(0.5, 1), randomReal<T>(0, 0.5)));
+        else
+            materials.add(Dielectric<T>(1.5));
+    }
+    return first;
+}
+
+// count small spheres scattered over a square of ground at about one per
+// unit of area, for measuring how the renderer scales with scene size. The
+// spheres share a palette of materials mixed like randomScene's. Reseeds the
+// calling thread's generator, so a given (count, seed) is always the same
+// scene. With packed, the spheres go into a single SphereSet with its own
+// BVH rather than a Sphere per object.
+template <class T>
+Scene<T> sphereFieldScene(size_t count, uint64_t seed, bool packed = false) {
+    using std::make_shared;
+    threadRng().seed(mix64(seed), mix64(count));
+
+    Scene<T> scene;
+    auto& world = scene.objects;
+    auto& materials = scene.materials;
+
+    T half = std::sqrt(T(count)) / 2;
+    auto groundMaterial = materials.add(Lambertian<T>(Color<T>(0.5, 0.5, 0.5)));
+    T groundRadius = std::max(T(1000), 20 * half);
+    world.add(make_shared<Sphere<T>>(Point3<T>(0, -groundRadius, 0),
+                                     groundRadius, groundMaterial));
+
+    const uint32_t paletteSize = 64;
+    uint32_t palette = addPalette(materials, paletteSize);
+
+    auto set = make_shared<SphereSet<T>>();
+    for (size_t i = 0; i < count; ++i) {
+        Point3<T> center(randomReal<T>(-half, half), 0.2,
+                         randomReal<T>(-half, half));
+        uint32_t mat = palette + (threadRng().next() % paletteSize);
+        if (packed)
+            set->add(center, 0.2, mat);
+        else
+            world.add(make_shared<Sphere<T>>(center, 0.2, mat));
+    }
+    if (packed) {
+        set->buildBvh();
+        world.add(set);
+    }
+
+    scene.camera = sphereFieldCameraSettings<T>(count);
+    return scene;
+}
+
+// Torus about the y axis, rings segments around it and sides around the
+// tube, two triangles per quad.
+template <class T>
+std::shared_ptr<MeshGeometry<T>> torusMesh(T majorRadius, T minorRadius,
+                                           uint32_t rings, uint32_t sides) {
+    std::vector<Point3<T>> vertices;
+    std::vector<uint32_t> indices;
+    vertices.reserve(size_t(rings) * sides);
+    indices.reserve(size_t(rings) * sides * 6);
+    for (uint32_t i = 0; i < rings; ++i) {
+        T u = 2 * pi<T> * i / rings;
+        for (uint32_t j = 0; j < sides; ++j) {
+            T v = 2 * pi<T> * j / sides;
+            T r = majorRadius + minorRadius * std::cos(v);
+            vertices.emplace_back(r * std::cos(u), minorRadius * std::sin(v),
+                                  -r * std::sin(u));
+
+            uint32_t a = i * sides + j;
+            uint32_t b = (i + 1) % rings * sides + j;
+            uint32_t c = (i + 1) % rings * sides + (j + 1) % sides;
+            uint32_t d = i * sides + (j + 1) % sides;
+            indices.insert(indices.end(), {a, b, c, a, c, d});
+        }
+    }
+    return std::make_shared<MeshGeometry<T>>(std::move(vertices),
+                                             std::move(indices));
+}
+
+// sphereFieldScene with count instances of one torus mesh in place of the
+// spheres, each turned and scaled at random and with its own material.
+// Memory grows with the one mesh, not the copies. Reseeds the calling
+// thread's generator like sphereFieldScene.
+template <class T>
+Scene<T> instanceFieldScene(size_t count, uint64_t seed,
+                            uint32_t rings = 64, uint32_t sides = 32) {
+    using std::make_shared;
+    threadRng().seed(mix64(seed), mix64(count));
+
+    Scene<T> scene;
+    auto& world = scene.objects;
+    auto& materials = scene.materials;
+
+    T half = std::sqrt(T(count)) / 2;
+    auto groundMaterial = materials.add(Lambertian<T>(Color<T>(0.5, 0.5, 0.5)));
+    T groundRadius = std::max(T(1000), 20 * half);
+    world.add(make_shared<Sphere<T>>(Point3<T>(0, -groundRadius, 0),
+                                     groundRadius, groundMaterial));
+
+    const uint32_t paletteSize = 64;
+    uint32_t palette = addPalette(materials, paletteSize);
+
+    std::shared_ptr<const Hittable<T>> torus = make_shared<TriangleMesh<T>>(
+        torusMesh<T>(0.3, 0.1, rings, sides), palette);
+    for (size_t i = 0; i < count; ++i) {
+        T scale = randomReal<T>(0.5, 1);
+        Point3<T> position(randomReal<T>(-half, half), T(0.4) * scale,
+                           randomReal<T>(-half, half));
+        Vec3<T> axis = sampleUniformSphere(randomSample2<T>());
+        auto place = Transform<T>::translate(position) *
+                     Transform<T>::rotate(axis, randomReal<T>(0, 360)) *
+                     Transform<T>::scale(scale);
+        uint32_t mat = palette + (threadRng().next() % paletteSize);
+        world.add(make_shared<Instance<T>>(torus, place, mat));
+    }
+
+    scene.camera = sphereFieldCameraSettings<T>(count);
+    return scene;
+}
+
+// Quads from a corner and two edges each, as one mesh of two triangles per
+// quad. Counterclockwise seen from the side edgeA x edgeB points to.
+template <class T>
+std::shared_ptr<MeshGeometry<T>>
+quadsMesh(const std::vector<std::array<Vec3<T>, 3>>& quads) {
+    std::vector<Point3<T>> vertices;
+    std::vector<uint32_t> indices;
+    for (const auto& q : quads) {
+        uint32_t first = static_cast<uint32_t>(vertices.size());
+        vertices.push_back(q[0]);
+        vertices.push_back(q[0] + q[1]);
+        vertices.push_back(q[0] + q[1] + q[2]);
+        vertices.push_back(q[0] + q[2]);
+        indices.insert(indices.end(), {first, first + 1, first + 2, first,
+                                       first + 2, first + 3});
+    }
+    return std::make_shared<MeshGeometry<T>>(std::move(vertices),
+                                             std::move(indices));
+}
+
+// Closed box lit only by a small square light in the ceiling, 1/16 of its
+// area, with a diffuse, a brushed metal and a glass sphere. Rays find
+// nothing to escape to, so without sampling the light directly it is
+// very slow to converge.
+template <class T> Scene<T> cornellScene() {
+    using std::make_shared;
+    using V = Vec3<T>;
+
+    Scene<T> scene;
+    auto& world = scene.objects;
+    auto& materials = scene.materials;
+
+    auto white = materials.add(Lambertian<T>(Color<T>(0.73, 0.73, 0.73)));
+    auto red = materials.add(Lambertian<T>(Color<T>(0.65, 0.05, 0.05)));
+    auto green = materials.add(Lambertian<T>(Color<T>(0.12, 0.45, 0.15)));
+    auto light = materials.add(Emissive<T>(Color<T>(15, 15, 15)));
+
+    // x in [-1, 1], y in [0, 2], z in [-1, 3], the camera inside at z 2.9.
+    auto wall = [&](std::vector<std::array<V, 3>> quads, uint32_t mat) {
+        world.add(make_shared<TriangleMesh<T>>(quadsMesh<T>(quads), mat));
+    };
+    wall({{V(-1, 0, -1), V(0, 0, 4), V(2, 0, 0)},   // Floor
+          {V(-1, 2, -1), V(2, 0, 0), V(0, 0, 4)},   // Ceiling
+          {V(-1, 0, -1), V(2, 0, 0), V(0, 2, 0)},   // Back
+          {V(-1, 0, 3), V(0, 2, 0), V(2, 0, 0)}},   // Front
+         white);
+    wall({{V(-1, 0, -1), V(0, 2, 0), V(0, 0, 4)}}, red);
+    wall({{V(1, 0, -1), V(0, 0, 4), V(0, 2, 0)}}, green);
+    wall({{V(-0.25, 1.999, -0.25), V(0.5, 0, 0), V(0, 0, 0.5)}}, light);
+
+    world.add(make_shared<Sphere<T>>(Point3<T>(-0.45, 0.35, -0.3), 0.35,
+                                     white));
+    world.add(make_shared<Sphere<T>>(
+        Point3<T>(0.45, 0.35, 0.1), 0.35,
+        materials.add(Metal<T>(Color<T>(0.8, 0.85, 0.88), 0.2))));
+    world.add(make_shared<Sphere<T>>(Point3<T>(0, 0.25, 0.8), 0.25,
+                                     materials.add(Dielectric<T>(1.5))));
+
+    Point3<T> lookFrom(0, 1, 2.9);
+    Point3<T> lookAt(0, 1, -1);
+    scene.camera = {lookFrom, lookAt, V(0, 1, 0), 55, 0, 3.9};
+    scene.width = 512;
+    scene.height = 512;
+    scene.samplesPerPixel = 64;
+    return scene;
+}
+
+// Built in scene by name, random (randomScene), bouncing (bouncingScene)
+// or cornell. False for an unknown name.
+template <class T>
+bool builtinScene(const std::string& name, Scene<T>& scene,
+                  bool packed = false) {
+    if (name == "random")
+        scene = randomScene<T>(packed);
+    else if (name == "bouncing")
+        scene = bouncingScene<T>();
+    else if (name == "cornell")
+        scene = cornellScene<T>();
+    else
+        return false;
+    return true;
+}
+
+// Camera looking down across the corner of a sphereFieldScene.
+template <class T> Camera<T> sphereFieldCamera(size_t count, T aspectRatio) {
+    return sphereFieldCameraSettings<T>(count).camera(aspectRatio);
+}
+
+} // namespace raytrace
+
+#endif // SCENES_H
@@ -0,0 +1,183 @@
+#ifndef SEQUENCE_H
+#define SEQUENCE_H
+
+#include <chrono>
+#include <cstdio>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "Common.hpp"
+
+#include "Bvh.hpp"
+#include "Framebuffer.hpp"
+#include "Light.hpp"
+#include "Scene.hpp"
+#include "ThreadPool.hpp"
+#include "TileRenderer.hpp"
+
+namespace raytrace {
+
+// Output path for a frame of a sequence: a run of # in path becomes the
+// zero padded frame number, otherwise it goes before the extension.
+inline std::string framePath(const std::string& path, int frame) {
+    auto first = path.find('#');
+    if (first != std::string::npos) {
+        auto last = path.find_first_not_of('#', first);
+        size_t width = (last == std::string::npos ? path.size() : last) - first;
+        std::string number = std::to_string(frame);
+        if (number.size() < width)
+            number.insert(0, width - number.size(), '0');
+        return path.substr(0, first) + number + path.substr(first + width);
+    }
+    char number[16];
+    std::snprintf(number, sizeof(number), "_%04d", frame);
+    auto dot = path.find_last_of('.');
+    auto slash = path.find_last_of('/');
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+        return path + number;
+    return path.substr(0, dot) + number + path.substr(dot);
+}
+
+// Frames of a scene's animation rendered one after another, keeping the
+// scene, its BVH and the pool resident. Between frames the keyed objects
+// move and the BVH is refit to their new bounds. Refitting keeps the tree
+// as built, so objects travelling far stretch its boxes until rays visit
+// many more nodes; once node areas have grown by maxAreaGrowth on average
+// the BVH is rebuilt instead.
+template <class T> class SequenceRenderer {
+  public:
+    static constexpr double maxAreaGrowth = 2;
+
+    struct FrameStats {
+        int frame = 0;
+        double seconds = 0;    // Whole frame.
+        double bvhSeconds = 0; // Refit and any rebuild.
+        bool rebuilt = false;
+        double areaGrowth = 1; // See BvhTree::areaGrowth.
+        uint64_t rays = 0;
+        double nodesPerRay = 0;
+    };
+
+    SequenceRenderer(Scene<T>& scene, Bvh<T>& world, ThreadPool& pool,
+                     const RenderSettings& settings, bool lightSampling,
+                     bool rebuild)
+        : scene(scene), world(world), pool(pool), settings(settings),
+          lightSampling(lightSampling), rebuild(rebuild),
+          buildSeconds(world.buildStats().seconds),
+          lights(scene.objects, scene.materials) {}
+
+    // Render every sample of frame into fb, which is cleared first.
+    // onTileDone as for TileRenderer::render.
+    template <class F>
+    void render(int frame, Framebuffer<T>& fb, F onTileDone) {
+        auto start = std::chrono::steady_clock::now();
+        FrameStats stats;
+        stats.frame = frame;
+        if (!scene.animation.tracks.empty()) {
+            scene.animation.apply(T(frame));
+            if (!rebuild) {
+                stats.bvhSeconds = world.refit();
+                stats.areaGrowth = world.areaGrowth();
+            }
+            if (rebuild || stats.areaGrowth > maxAreaGrowth) {
+                world.build(scene.objects.getObjects());
+                stats.bvhSeconds += world.buildStats().seconds;
+                stats.rebuilt = true;
+            }
+            // Emitters may have moved with the objects.
+            lights = LightList<T>(scene.objects, scene.materials);
+        }
+
+        RenderSettings frameSettings = settings;
+        frameSettings.frame = settings.frame + uint64_t(frame);
+        TileRenderer<T> renderer(pool, frameSettings);
+        if (lightSampling && !lights.empty())
+            renderer.setLights(&lights);
+        auto cam = scene.animation.camera(scene.camera, T(frame))
+                       .camera(T(settings.width) / settings.height);
+
+        world.resetTraversalStats();
+        fb.clear();
+        renderer.render(world, scene.materials, cam, fb, 0,
+                        settings.samplesPerPixel, onTileDone);
+        fb.addSamples(settings.samplesPerPixel);
+
+        std::chrono::duration<double> elapsed =
+            std::chrono::steady_clock::now() - start;
+        stats.seconds = elapsed.count();
+        stats.rays = renderer.rays();
+        const auto& traversal = world.traversalStats();
+        if (traversal.rays() > 0)
+            stats.nodesPerRay =
+                double(traversal.nodesVisited()) / traversal.rays();
+        frames.push_back(stats);
+    }
+
+    const std::vector<FrameStats>& frameStats() const { return frames; }
+
+    void printFrame(std::ostream& out) const {
+        if (frames.empty())
+            return;
+        const FrameStats& f = frames.back();
+        out << std::fixed << std::setprecision(3) << "Frame " << f.frame
+            << ": " << f.seconds << "s, " << f.rays / f.seconds * 1e-6
+            << " Mrays/s, " << f.nodesPerRay << " nodes/ray";
+        if (!scene.animation.tracks.empty()) {
+            out << ", BVH ";
+            if (!rebuild)
+                out << "refit (area x" << f.areaGrowth << ")"
+                    << (f.rebuilt ? " and rebuilt" : "");
+            else
+                out << "rebuilt";
+            out << " in " << f.bvhSeconds * 1000 << "ms";
+        }
+        out << '\n' << std::defaultfloat << std::flush;
+    }
+
+    // Mean frame time, and what refitting saved against the first build.
+    void printSummary(std::ostream& out) const {
+        if (frames.empty())
+            return;
+        double seconds = 0, bvhSeconds = 0, nodes = 0;
+        size_t rebuilds = 0;
+        for (const auto& f : frames) {
+            seconds += f.seconds;
+            bvhSeconds += f.bvhSeconds;
+            nodes += f.nodesPerRay;
+            rebuilds += f.rebuilt;
+        }
+        size_t n = frames.size();
+        out << std::fixed << std::setprecision(3) << "Sequence: " << n
+            << " frames in " << seconds << "s, " << seconds / n
+            << "s/frame, " << nodes / n << " nodes/ray\n";
+        if (!scene.animation.tracks.empty()) {
+            double mean = bvhSeconds / n;
+            out << "BVH: " << scene.animation.tracks.size()
+                << " moving objects, " << rebuilds << " of " << n
+                << " frames rebuilt, " << mean * 1000
+                << "ms/frame against " << buildSeconds * 1000
+                << "ms for the first build";
+            if (!rebuild && mean > 0)
+                out << " (" << buildSeconds / mean << "x faster)";
+            out << '\n';
+        }
+        out << std::defaultfloat << std::flush;
+    }
+
+  private:
+    Scene<T>& scene;
+    Bvh<T>& world;
+    ThreadPool& pool;
+    RenderSettings settings;
+    bool lightSampling;
+    bool rebuild;
+    double buildSeconds;
+    LightList<T> lights;
+    std::vector<FrameStats> frames;
+};
+
+} // namespace raytrace
+
+#endif // SEQUENCE_H
@@ -0,0 +1,54 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+// Vector kernels are compiled per function with target attributes and picked
+// at runtime, so the binary still runs on CPUs without AVX2.
+#if (defined(__GNUC__) || defined(__clang__)) &&                              \
+    (defined(__x86_64__) || defined(__i386__))
+#define RAYTRACE_X86_SIMD 1
+#include <immintrin.h>
+#define RAYTRACE_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define RAYTRACE_X86_SIMD 0
+#endif
+
+namespace raytrace {
+
+enum class SimdLevel { Scalar = 0, Sse = 1, Avx2 = 2 };
+
+inline const char* simdName(SimdLevel level) {
+    switch (level) {
+    case SimdLevel::Avx2:
+        return "avx2";
+    case SimdLevel::Sse:
+        return "sse";
+    default:
+        return "scalar";
+    }
+}
+
+inline SimdLevel detectSimd() {
+#if RAYTRACE_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return SimdLevel::Avx2;
+    if (__builtin_cpu_supports("sse2"))
+        return SimdLevel::Sse;
+#endif
+    return SimdLevel::Scalar;
+}
+
+// Level used by the vector kernels, detected once. Can be lowered (never
+// raised above what the CPU supports) to compare against the scalar path.
+inline SimdLevel& activeSimd() {
+    static SimdLevel level = detectSimd();
+    return level;
+}
+
+inline void setSimd(SimdLevel level) {
+    activeSimd() = level <= detectSimd() ? level : detectSimd();
+}
+
+} // namespace raytrace
+
+#endif // SIMD_H
@@ -5,14 +5,19 @@
 
 namespace raytrace {
 
+// Sphere, optionally moving: its center travels motion over a time of 1
+// from where it is at time 0, and rays meet it where it is at their time.
 template <class T> class Sphere : public Hittable<T> {
   public:
     Sphere() {}
-    Sphere(Point3<T> cen, T r, std::shared_ptr<Material<T>> m)
-        : center(cen), radius(r), mat(m) {}
+    Sphere(Point3<T> cen, T r, uint32_t m) : center(cen), radius(r), mat(m) {}
+    Sphere(Point3<T> center0, Point3<T> center1, T r, uint32_t m)
+        : center(center0), motion(center1 - center0), radius(r), mat(m) {}
 
     virtual bool hit(const Ray<T>& r, T tMin, T tMax,
                      HitRecord<T>& rec) const override {
+        profileCount(Counter::IntersectionTests);
+        Point3<T> center = centerAt(r.time());
         Vec3<T> oc = r.origin() - center;
         auto a = r.direction().lengthSquared();
         auto halfB = dot(oc, r.direction());
@@ -39,14 +44,36 @@ template <class T> class Sphere : public Hittable<T> {
         Vec3<T> outwardNormal = (rec.p - center) / radius;
         rec.setFaceNormal(r, outwardNormal);
         rec.mat = mat;
+        profileCount(Counter::PrimitiveHits);
 
         return true;
     }
 
+    // Covers the whole motion, so one BVH serves rays of any time.
+    virtual Aabb<T> boundingBox() const override {
+        Vec3<T> extent(radius, radius, radius);
+        Aabb<T> box(center - extent, center + extent);
+        box.expand(Aabb<T>(center + motion - extent, center + motion + extent));
+        return box;
+    }
+
+    Point3<T> centerAt(T time) const { return center + time * motion; }
+
+    Point3<T> getCenter() const { return center; }
+    void setCenter(const Point3<T>& c) { center = c; }
+    const Vec3<T>& getMotion() const { return motion; }
+    void setMotion(const Vec3<T>& m) { motion = m; }
+    bool moving() const {
+        return motion.x() != 0 || motion.y() != 0 || motion.z() != 0;
+    }
+    T getRadius() const { return radius; }
+    uint32_t getMaterial() const { return mat; }
+
   private:
-    Point3<T> center;
+    Point3<T> center; // At time 0.
+    Vec3<T> motion{0, 0, 0};
     T radius;
-    std::shared_ptr<Material<T>> mat;
+    uint32_t mat;
 };
 
 } // namespace raytrace
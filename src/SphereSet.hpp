@@ -0,0 +1,350 @@
+#ifndef SPHERESET_H
+#define SPHERESET_H
+
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+#include "BvhTree.hpp"
+#include "Hittable.hpp"
+#include "Simd.hpp"
+
+namespace raytrace {
+
+// Packed set of spheres in structure of arrays form. Intersects a ray against
+// 8 (AVX2) or 4 (SSE) spheres at once, with the kernel chosen at runtime.
+// The winning sphere's record is filled in by the same scalar code as
+// Sphere::hit, so the closest hit matches a list of Spheres exactly.
+template <class T> class SphereSet : public Hittable<T> {
+  public:
+    SphereSet() {}
+    SphereSet(const SphereSet&) = delete;
+    SphereSet& operator=(const SphereSet&) = delete;
+
+    // Spheres and BVH nodes held elsewhere, e.g. a mapped scene file, with
+    // the spheres already in the nodes' leaf order. Nothing is copied, so
+    // the memory must outlive the set, which cannot be added to.
+    SphereSet(size_t count, const T* x, const T* y, const T* z,
+              const T* radius, const uint32_t* material,
+              const BvhNode<T>* nodes, size_t nodeCount)
+        : cx(x), cy(y), cz(z), rad(radius), matIndex(material),
+          count(count) {
+        tree.attach(nodes, nodeCount);
+    }
+
+    void add(const Point3<T>& center, T radius, uint32_t material) {
+        storage.cx.push_back(center.x());
+        storage.cy.push_back(center.y());
+        storage.cz.push_back(center.z());
+        storage.rad.push_back(radius);
+        storage.mat.push_back(material);
+        tree = BvhTree<T>();
+        useStorage();
+    }
+
+    void reserve(size_t n) {
+        storage.cx.reserve(n);
+        storage.cy.reserve(n);
+        storage.cz.reserve(n);
+        storage.rad.reserve(n);
+        storage.mat.reserve(n);
+        useStorage();
+    }
+
+    size_t size() const { return count; }
+    Point3<T> center(size_t i) const { return Point3<T>(cx[i], cy[i], cz[i]); }
+    T radius(size_t i) const { return rad[i]; }
+    uint32_t material(size_t i) const { return matIndex[i]; }
+
+    // Build an internal BVH and reorder the spheres so every leaf is a
+    // contiguous run for the vector kernel. Worth it for large sets.
+    void buildBvh() {
+        std::vector<Aabb<T>> bounds(size());
+        for (size_t i = 0; i < size(); ++i)
+            bounds[i] = sphereBox(i);
+        tree.build(bounds);
+
+        const auto& order = tree.primitiveOrder();
+        auto permute = [&](auto& values) {
+            auto copy = values;
+            for (size_t i = 0; i < order.size(); ++i)
+                values[i] = copy[order[i]];
+        };
+        permute(storage.cx);
+        permute(storage.cy);
+        permute(storage.cz);
+        permute(storage.rad);
+        permute(storage.mat);
+    }
+
+    const BvhTree<T>& bvh() const { return tree; }
+    const BvhBuildStats& bvhStats() const { return tree.stats(); }
+
+    virtual bool hit(const Ray<T>& r, T tMin, T tMax,
+                     HitRecord<T>& rec) const override {
+        int64_t best = -1;
+        if (tree.empty()) {
+            best = closestInRange(r, tMin, tMax, 0,
+                                  static_cast<uint32_t>(size()));
+        } else {
+            tree.traverse(r, tMin, tMax,
+                          [&](uint32_t first, uint32_t count, T& closest) {
+                              int64_t i = closestInRange(r, tMin, closest,
+                                                         first, first + count);
+                              if (i < 0)
+                                  return false;
+                              best = i;
+                              return true;
+                          });
+        }
+        if (best < 0)
+            return false;
+
+        // Any tMax at or beyond the winner's root picks the same root again.
+        hitSphere(r, static_cast<size_t>(best), tMin, infinity<T>, rec);
+        return true;
+    }
+
+    virtual bool occluded(const Ray<T>& r, T tMin, T tMax) const override {
+        if (tree.empty())
+            return closestInRange(r, tMin, tMax, 0,
+                                  static_cast<uint32_t>(size())) >= 0;
+        return tree.traverseAny(
+            r, tMin, tMax, [&](uint32_t first, uint32_t count, T& tMaxLeaf) {
+                return closestInRange(r, tMin, tMaxLeaf, first,
+                                      first + count) >= 0;
+            });
+    }
+
+    virtual Aabb<T> boundingBox() const override {
+        if (!tree.empty())
+            return tree.bounds();
+        Aabb<T> box;
+        for (size_t i = 0; i < size(); ++i)
+            box.expand(sphereBox(i));
+        return box;
+    }
+
+  private:
+    // Owned spheres, unless the set is a view of someone else's memory.
+    struct Storage {
+        std::vector<T> cx, cy, cz, rad;
+        std::vector<uint32_t> mat;
+    } storage;
+
+    // What the kernels read, pointing into storage or the viewed memory.
+    const T* cx = nullptr;
+    const T* cy = nullptr;
+    const T* cz = nullptr;
+    const T* rad = nullptr;
+    const uint32_t* matIndex = nullptr;
+    size_t count = 0;
+    BvhTree<T> tree;
+
+    void useStorage() {
+        cx = storage.cx.data();
+        cy = storage.cy.data();
+        cz = storage.cz.data();
+        rad = storage.rad.data();
+        matIndex = storage.mat.data();
+        count = storage.cx.size();
+    }
+
+    Aabb<T> sphereBox(size_t i) const {
+        Vec3<T> extent(rad[i], rad[i], rad[i]);
+        return Aabb<T>(center(i) - extent, center(i) + extent);
+    }
+
+    // Same arithmetic as Sphere::hit, in the same order.
+    bool hitSphere(const Ray<T>& r, size_t i, T tMin, T tMax,
+                   HitRecord<T>& rec) const {
+        T root;
+        if (!sphereRoot(r, i, tMin, tMax, root))
+            return false;
+
+        rec.t = root;
+        rec.p = r.at(rec.t);
+        Vec3<T> outwardNormal = (rec.p - center(i)) / rad[i];
+        rec.setFaceNormal(r, outwardNormal);
+        rec.mat = matIndex[i];
+        return true;
+    }
+
+    bool sphereRoot(const Ray<T>& r, size_t i, T tMin, T tMax,
+                    T& root) const {
+        Vec3<T> oc = r.origin() - center(i);
+        auto a = r.direction().lengthSquared();
+        auto halfB = dot(oc, r.direction());
+        auto c = oc.lengthSquared() - rad[i] * rad[i];
+
+        auto discriminant = halfB * halfB - a * c;
+        if (discriminant < 0)
+            return false;
+        auto sqrtd = std::sqrt(discriminant);
+
+        root = (-halfB - sqrtd) / a;
+        if (root < tMin || root > tMax) {
+            root = (-halfB + sqrtd) / a;
+            if (root < tMin || root > tMax)
+                return false;
+        }
+        return true;
+    }
+
+    // Index of the closest sphere in [begin, end) hit within [tMin, tMax],
+    // or -1. Shrinks tMax to the hit distance. Ties go to the later sphere,
+    // as they do when scanning a HittableList.
+    int64_t closestInRange(const Ray<T>& r, T tMin, T& tMax, uint32_t begin,
+                           uint32_t end) const {
+        profileCount(Counter::IntersectionTests, end - begin);
+        int64_t best = -1;
+        uint32_t i = begin;
+#if RAYTRACE_X86_SIMD
+        if constexpr (std::is_same<T, float>::value) {
+            SimdLevel level = activeSimd();
+            if (level == SimdLevel::Avx2)
+                i = closestAvx2(r, tMin, tMax, i, end, best);
+            if (level >= SimdLevel::Sse)
+                i = closestSse(r, tMin, tMax, i, end, best);
+        }
+#endif
+        for (; i < end; ++i) {
+            T root;
+            if (sphereRoot(r, i, tMin, tMax, root)) {
+                tMax = root;
+                best = i;
+            }
+        }
+        if (best >= 0)
+            profileCount(Counter::PrimitiveHits);
+        return best;
+    }
+
+#if RAYTRACE_X86_SIMD
+    // Both kernels return the first index they did not process.
+    RAYTRACE_TARGET_AVX2 uint32_t closestAvx2(const Ray<float>& r, float tMin,
+                                              float& tMax, uint32_t i,
+                                              uint32_t end,
+                                              int64_t& best) const {
+        const Vec3<float> o = r.origin();
+        const Vec3<float> d = r.direction();
+        const __m256 ox = _mm256_set1_ps(o.x()), oy = _mm256_set1_ps(o.y()),
+                     oz = _mm256_set1_ps(o.z());
+        const __m256 dx = _mm256_set1_ps(d.x()), dy = _mm256_set1_ps(d.y()),
+                     dz = _mm256_set1_ps(d.z());
+        const __m256 a = _mm256_set1_ps(d.lengthSquared());
+        const __m256 lo = _mm256_set1_ps(tMin);
+        const __m256 zero = _mm256_setzero_ps();
+        alignas(32) float roots[8];
+
+        for (; i + 8 <= end; i += 8) {
+            const __m256 hi = _mm256_set1_ps(tMax);
+            __m256 ocx = _mm256_sub_ps(ox, _mm256_loadu_ps(&cx[i]));
+            __m256 ocy = _mm256_sub_ps(oy, _mm256_loadu_ps(&cy[i]));
+            __m256 ocz = _mm256_sub_ps(oz, _mm256_loadu_ps(&cz[i]));
+            __m256 radius = _mm256_loadu_ps(&rad[i]);
+
+            __m256 halfB = _mm256_add_ps(
+                _mm256_add_ps(_mm256_mul_ps(ocx, dx), _mm256_mul_ps(ocy, dy)),
+                _mm256_mul_ps(ocz, dz));
+            __m256 c = _mm256_sub_ps(
+                _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ocx, ocx),
+                                            _mm256_mul_ps(ocy, ocy)),
+                              _mm256_mul_ps(ocz, ocz)),
+                _mm256_mul_ps(radius, radius));
+            __m256 disc = _mm256_sub_ps(_mm256_mul_ps(halfB, halfB),
+                                        _mm256_mul_ps(a, c));
+            __m256 valid = _mm256_cmp_ps(disc, zero, _CMP_GE_OQ);
+            if (_mm256_movemask_ps(valid) == 0)
+                continue;
+
+            __m256 sqrtd = _mm256_sqrt_ps(_mm256_max_ps(disc, zero));
+            __m256 negB = _mm256_sub_ps(zero, halfB);
+            __m256 root1 = _mm256_div_ps(_mm256_sub_ps(negB, sqrtd), a);
+            __m256 root2 = _mm256_div_ps(_mm256_add_ps(negB, sqrtd), a);
+            __m256 in1 = _mm256_and_ps(_mm256_cmp_ps(root1, lo, _CMP_GE_OQ),
+                                       _mm256_cmp_ps(root1, hi, _CMP_LE_OQ));
+            __m256 in2 = _mm256_and_ps(_mm256_cmp_ps(root2, lo, _CMP_GE_OQ),
+                                       _mm256_cmp_ps(root2, hi, _CMP_LE_OQ));
+            valid = _mm256_and_ps(valid, _mm256_or_ps(in1, in2));
+            int mask = _mm256_movemask_ps(valid);
+            if (mask == 0)
+                continue;
+
+            _mm256_store_ps(roots, _mm256_blendv_ps(root2, root1, in1));
+            for (int lane = 0; lane < 8; ++lane) {
+                if ((mask >> lane) & 1 && roots[lane] <= tMax) {
+                    tMax = roots[lane];
+                    best = i + lane;
+                }
+            }
+        }
+        return i;
+    }
+
+    uint32_t closestSse(const Ray<float>& r, float tMin, float& tMax,
+                        uint32_t i, uint32_t end, int64_t& best) const {
+        const Vec3<float> o = r.origin();
+        const Vec3<float> d = r.direction();
+        const __m128 ox = _mm_set1_ps(o.x()), oy = _mm_set1_ps(o.y()),
+                     oz = _mm_set1_ps(o.z());
+        const __m128 dx = _mm_set1_ps(d.x()), dy = _mm_set1_ps(d.y()),
+                     dz = _mm_set1_ps(d.z());
+        const __m128 a = _mm_set1_ps(d.lengthSquared());
+        const __m128 lo = _mm_set1_ps(tMin);
+        const __m128 zero = _mm_setzero_ps();
+        alignas(16) float roots[4];
+
+        for (; i + 4 <= end; i += 4) {
+            const __m128 hi = _mm_set1_ps(tMax);
+            __m128 ocx = _mm_sub_ps(ox, _mm_loadu_ps(&cx[i]));
+            __m128 ocy = _mm_sub_ps(oy, _mm_loadu_ps(&cy[i]));
+            __m128 ocz = _mm_sub_ps(oz, _mm_loadu_ps(&cz[i]));
+            __m128 radius = _mm_loadu_ps(&rad[i]);
+
+            __m128 halfB = _mm_add_ps(
+                _mm_add_ps(_mm_mul_ps(ocx, dx), _mm_mul_ps(ocy, dy)),
+                _mm_mul_ps(ocz, dz));
+            __m128 c = _mm_sub_ps(
+                _mm_add_ps(
+                    _mm_add_ps(_mm_mul_ps(ocx, ocx), _mm_mul_ps(ocy, ocy)),
+                    _mm_mul_ps(ocz, ocz)),
+                _mm_mul_ps(radius, radius));
+            __m128 disc =
+                _mm_sub_ps(_mm_mul_ps(halfB, halfB), _mm_mul_ps(a, c));
+            __m128 valid = _mm_cmpge_ps(disc, zero);
+            if (_mm_movemask_ps(valid) == 0)
+                continue;
+
+            __m128 sqrtd = _mm_sqrt_ps(_mm_max_ps(disc, zero));
+            __m128 negB = _mm_sub_ps(zero, halfB);
+            __m128 root1 = _mm_div_ps(_mm_sub_ps(negB, sqrtd), a);
+            __m128 root2 = _mm_div_ps(_mm_add_ps(negB, sqrtd), a);
+            __m128 in1 = _mm_and_ps(_mm_cmpge_ps(root1, lo),
+                                    _mm_cmple_ps(root1, hi));
+            __m128 in2 = _mm_and_ps(_mm_cmpge_ps(root2, lo),
+                                    _mm_cmple_ps(root2, hi));
+            valid = _mm_and_ps(valid, _mm_or_ps(in1, in2));
+            int mask = _mm_movemask_ps(valid);
+            if (mask == 0)
+                continue;
+
+            // SSE2 has no blendv, select with and/andnot.
+            _mm_store_ps(roots, _mm_or_ps(_mm_and_ps(in1, root1),
+                                          _mm_andnot_ps(in1, root2)));
+            for (int lane = 0; lane < 4; ++lane) {
+                if ((mask >> lane) & 1 && roots[lane] <= tMax) {
+                    tMax = roots[lane];
+                    best = i + lane;
+                }
+            }
+        }
+        return i;
+    }
+#endif
+};
+
+} // namespace raytrace
+
+#endif // SPHERESET_H
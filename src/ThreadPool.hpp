@@ -0,0 +1,158 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Profile.hpp"
+
+namespace raytrace {
+
+// Fixed size pool of workers, each with its own task deque.
+// Workers pop from the back of their own deque and steal from the front of
+// the others when idle, so uneven tasks (e.g. tiles of sky vs glass) balance.
+class ThreadPool {
+  public:
+    explicit ThreadPool(unsigned numThreads = 0) {
+        if (numThreads == 0)
+            numThreads = std::max(1u, std::thread::hardware_concurrency());
+
+        for (unsigned i = 0; i < numThreads; ++i)
+            queues.push_back(std::make_unique<WorkQueue>());
+        for (unsigned i = 0; i < numThreads; ++i)
+            threads.emplace_back([this, i] { workerLoop(i); });
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(m);
+            stopping = true;
+        }
+        wakeCv.notify_all();
+        for (auto& thread : threads)
+            thread.join();
+    }
+
+    unsigned size() const { return static_cast<unsigned>(threads.size()); }
+
+    // Index of the calling worker, or -1 when called from outside the pool.
+    static int currentWorker() { return workerIndex(); }
+
+    // Queue a task. Tasks submitted from a worker go to its own deque,
+    // otherwise they are distributed round robin.
+    void submit(std::function<void()> task) {
+        int self = currentWorker();
+        size_t target = self >= 0 ? static_cast<size_t>(self)
+                                  : nextQueue++ % queues.size();
+        pending.fetch_add(1);
+        // Count before publishing so queued never undercounts the deques.
+        {
+            std::lock_guard<std::mutex> lock(m);
+            ++queued;
+        }
+        {
+            std::lock_guard<std::mutex> lock(queues[target]->m);
+            queues[target]->tasks.push_back(std::move(task));
+        }
+        wakeCv.notify_one();
+    }
+
+    // Block until every submitted task has completed.
+    void wait() {
+        std::unique_lock<std::mutex> lock(m);
+        doneCv.wait(lock, [this] { return pending.load() == 0; });
+    }
+
+    ThreadPool(const ThreadPool& other) = delete;
+    ThreadPool(ThreadPool&& other) = delete;
+    ThreadPool& operator=(const ThreadPool& other) = delete;
+    ThreadPool& operator=(ThreadPool&& other) = delete;
+
+  private:
+    struct WorkQueue {
+        std::mutex m;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    std::vector<std::unique_ptr<WorkQueue>> queues;
+    std::vector<std::thread> threads;
+
+    std::mutex m;
+    std::condition_variable wakeCv;
+    std::condition_variable doneCv;
+    size_t queued = 0; // Guarded by m.
+    bool stopping = false;
+    std::atomic<size_t> pending{0};
+    std::atomic<size_t> nextQueue{0};
+
+    static int& workerIndex() {
+        thread_local int index = -1;
+        return index;
+    }
+
+    bool popLocal(size_t i, std::function<void()>& task) {
+        std::lock_guard<std::mutex> lock(queues[i]->m);
+        if (queues[i]->tasks.empty())
+            return false;
+        task = std::move(queues[i]->tasks.back());
+        queues[i]->tasks.pop_back();
+        return true;
+    }
+
+    bool steal(size_t thief, std::function<void()>& task) {
+        for (size_t k = 1; k < queues.size(); ++k) {
+            size_t victim = (thief + k) % queues.size();
+            std::lock_guard<std::mutex> lock(queues[victim]->m);
+            if (queues[victim]->tasks.empty())
+                continue;
+            task = std::move(queues[victim]->tasks.front());
+            queues[victim]->tasks.pop_front();
+            return true;
+        }
+        return false;
+    }
+
+    void workerLoop(unsigned i) {
+        workerIndex() = static_cast<int>(i);
+        profileThreadName("worker " + std::to_string(i));
+        std::function<void()> task;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(m);
+                wakeCv.wait(lock, [this] { return queued > 0 || stopping; });
+                if (queued == 0 && stopping)
+                    return;
+            }
+
+            if (!popLocal(i, task) && !steal(i, task)) {
+                // Not yet published, or taken by another worker.
+                std::this_thread::yield();
+                continue;
+            }
+            {
+                std::lock_guard<std::mutex> lock(m);
+                --queued;
+            }
+
+            task();
+            task = nullptr;
+
+            if (pending.fetch_sub(1) == 1) {
+                std::lock_guard<std::mutex> lock(m);
+                doneCv.notify_all();
+            }
+        }
+    }
+};
+
+} // namespace raytrace
+
+#endif // THREADPOOL_H
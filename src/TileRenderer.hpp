@@ -0,0 +1,338 @@
+#ifndef TILERENDERER_H
+#define TILERENDERER_H
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <vector>
+
+#include "Common.hpp"
+
+#include "Camera.hpp"
+#include "Framebuffer.hpp"
+#include "Hittable.hpp"
+#include "Integrator.hpp"
+#include "Light.hpp"
+#include "Profile.hpp"
+#include "Sampler.hpp"
+#include "ThreadPool.hpp"
+#include "Wavefront.hpp"
+
+namespace raytrace {
+
+struct RenderSettings {
+    int width = 1024;
+    int height = 576;
+    int samplesPerPixel = 100; // Target, a frame may be rendered in passes.
+    int maxDepth = 50;
+    int rouletteDepth = 5; // Bounces before Russian roulette, path only.
+    int tileSize = 32;
+    uint64_t frame = 0; // Part of every sample's seed.
+    SamplerKind sampler = SamplerKind::Random;
+    IntegratorKind integrator = IntegratorKind::Path;
+};
+
+// Rectangular block of the image, [x0, x1) x [y0, y1) in bottom left
+// coordinates.
+class Tile {
+  public:
+    Tile(int x0, int y0, int x1, int y1) : x0(x0), y0(y0), x1(x1), y1(y1) {}
+
+    int width() const { return x1 - x0; }
+    int height() const { return y1 - y0; }
+
+    int x0, y0, x1, y1;
+    int worker = -1; // Worker that rendered it last.
+};
+
+// The frame's tiles, top to bottom so the preview fills in the same order
+// as scanlines.
+inline std::vector<Tile> makeTiles(const RenderSettings& settings) {
+    std::vector<Tile> tiles;
+    for (int y1 = settings.height; y1 > 0; y1 -= settings.tileSize) {
+        int y0 = std::max(0, y1 - settings.tileSize);
+        for (int x0 = 0; x0 < settings.width; x0 += settings.tileSize) {
+            int x1 = std::min(settings.width, x0 + settings.tileSize);
+            tiles.emplace_back(x0, y0, x1, y1);
+        }
+    }
+    return tiles;
+}
+
+// Splits the frame into tiles and renders them on a work stealing pool.
+template <class T> class TileRenderer {
+  public:
+    TileRenderer(ThreadPool& pool, const RenderSettings& settings)
+        : pool(pool), settings(settings), tiles(makeTiles(settings)),
+          workerStats(pool.size()), wavefront(pool.size()) {}
+
+    // Add samples [sampleBegin, sampleEnd) of every pixel to fb. Samples
+    // are seeded by index, so rendering a frame in several passes gives the
+    // same sums as one pass. onTileDone(const Tile&) is invoked on the
+    // calling thread as each tile completes, so it is safe to touch SDL
+    // from there.
+    template <class F>
+    void render(const Hittable<T>& world, const MaterialTable<T>& materials,
+                const Camera<T>& cam, Framebuffer<T>& fb, int sampleBegin,
+                int sampleEnd, F onTileDone) {
+        ScopedTimer timer(Stage::Render);
+        {
+            std::lock_guard<std::mutex> lock(doneMutex);
+            done.clear();
+        }
+        auto start = std::chrono::steady_clock::now();
+
+        for (size_t i = 0; i < tiles.size(); ++i) {
+            pool.submit([=, &world, &materials, &cam, &fb] {
+                auto tileStart = std::chrono::steady_clock::now();
+                uint64_t raysBefore = raysTraced();
+                PathHistogram pathsBefore = pathHistogram();
+                renderTile(tiles[i], world, materials, cam, fb, sampleBegin,
+                           sampleEnd);
+                std::chrono::duration<double> busy =
+                    std::chrono::steady_clock::now() - tileStart;
+
+                auto& stats = workerStats[tiles[i].worker];
+                stats.tiles++;
+                stats.rays += raysTraced() - raysBefore;
+                stats.paths.addDelta(pathHistogram(), pathsBefore);
+                stats.busySeconds += busy.count();
+                {
+                    std::lock_guard<std::mutex> lock(doneMutex);
+                    done.push_back(i);
+                }
+                doneCv.notify_one();
+            });
+        }
+
+        for (size_t completed = 0; completed < tiles.size(); ++completed) {
+            size_t i;
+            {
+                std::unique_lock<std::mutex> lock(doneMutex);
+                doneCv.wait(lock, [this] { return !done.empty(); });
+                i = done.front();
+                done.pop_front();
+            }
+            onTileDone(tiles[i]);
+        }
+        pool.wait();
+
+        std::chrono::duration<double> elapsed =
+            std::chrono::steady_clock::now() - start;
+        wallSeconds += elapsed.count();
+        passCount++;
+    }
+
+    // Add samples [sampleBegin, sampleEnd) of one tile's pixels to fb, for
+    // callers that hand out tiles themselves. Must run in a task on the
+    // pool, and is not counted in the statistics.
+    void renderSingleTile(Tile tile, const Hittable<T>& world,
+                          const MaterialTable<T>& materials,
+                          const Camera<T>& cam, Framebuffer<T>& fb,
+                          int sampleBegin, int sampleEnd) {
+        renderTile(tile, world, materials, cam, fb, sampleBegin, sampleEnd);
+    }
+
+    // Restrict rendering to pixels whose entry (indexed y * width + x) is
+    // non-zero, nullptr renders every pixel. The mask must outlive render().
+    void setActivePixels(const std::vector<uint8_t>* mask) { active = mask; }
+
+    // Lights the path integrator samples directly, nullptr or an empty list
+    // leaves them to be found by scattering. Must outlive render().
+    void setLights(const LightList<T>* list) { lights = list; }
+
+    // Also add the first hit features of every sample to buffer, nullptr
+    // for none. The buffer must outlive render().
+    void setFeatures(FeatureBuffer<T>* buffer) { features = buffer; }
+
+    // Statistics accumulate over render() calls until reset.
+    void resetStats() {
+        std::fill(workerStats.begin(), workerStats.end(), WorkerStats());
+        wallSeconds = 0;
+        passCount = 0;
+    }
+
+    uint64_t rays() const {
+        uint64_t total = 0;
+        for (const auto& stats : workerStats)
+            total += stats.rays;
+        return total;
+    }
+
+    // Path lengths since the last reset, path integrator only.
+    PathHistogram pathLengths() const {
+        PathHistogram total;
+        for (const auto& stats : workerStats)
+            total.addDelta(stats.paths, PathHistogram());
+        return total;
+    }
+
+    double seconds() const { return wallSeconds; }
+    size_t passes() const { return passCount; }
+
+    // Per worker throughput since the last reset, to check scaling.
+    void printStats(std::ostream& out) const {
+        size_t tilesRendered = tiles.size() * passCount;
+        out << "Tiles: " << tilesRendered << " (" << settings.tileSize
+            << "px) on " << pool.size() << " workers in " << std::fixed
+            << std::setprecision(3) << wallSeconds << "s, "
+            << tilesRendered / wallSeconds << " tiles/s, "
+            << rays() / wallSeconds * 1e-6 << " Mrays/s ("
+            << integratorName(settings.integrator) << ")\n";
+        for (size_t w = 0; w < workerStats.size(); ++w) {
+            const auto& stats = workerStats[w];
+            out << "  worker " << w << ": " << stats.tiles << " tiles, "
+                << stats.tiles / wallSeconds << " tiles/s, "
+                << stats.rays / wallSeconds * 1e-6 << " Mrays/s, "
+                << 100.0 * stats.busySeconds / wallSeconds << "% busy\n";
+        }
+        printPathLengths(out);
+        out << std::defaultfloat << std::flush;
+    }
+
+    // Share of paths by length in rays, for the lengths that occurred.
+    void printPathLengths(std::ostream& out) const {
+        PathHistogram histogram = pathLengths();
+        uint64_t paths = histogram.paths();
+        if (paths == 0)
+            return;
+
+        double length = 0;
+        for (int i = 1; i < PathHistogram::bins; ++i)
+            length += double(i) * histogram.lengths[i];
+
+        out << std::fixed << std::setprecision(3) << "Paths: " << paths
+            << ", " << length / paths << " rays/path, "
+            << 100.0 * histogram.roulette / paths
+            << "% ended by roulette\n  length %:";
+        for (int i = 1; i < PathHistogram::bins; ++i)
+            if (histogram.lengths[i] > 0)
+                out << ' ' << i << ':' << 100.0 * histogram.lengths[i] / paths;
+        out << '\n';
+    }
+
+  private:
+    struct WorkerStats {
+        size_t tiles = 0;
+        uint64_t rays = 0;
+        double busySeconds = 0;
+        PathHistogram paths;
+    };
+
+    ThreadPool& pool;
+    RenderSettings settings;
+    std::vector<Tile> tiles;
+    // Each slot is only touched by its own worker.
+    std::vector<WorkerStats> workerStats;
+    std::vector<WavefrontIntegrator<T>> wavefront;
+    double wallSeconds = 0;
+    size_t passCount = 0;
+    const std::vector<uint8_t>* active = nullptr;
+    const LightList<T>* lights = nullptr;
+    FeatureBuffer<T>* features = nullptr;
+
+    std::mutex doneMutex;
+    std::condition_variable doneCv;
+    std::deque<size_t> done;
+
+    void renderTile(Tile& tile, const Hittable<T>& world,
+                    const MaterialTable<T>& materials, const Camera<T>& cam,
+                    Framebuffer<T>& fb, int sampleBegin, int sampleEnd) {
+        ScopedTimer timer(Stage::Tile);
+        tile.worker = ThreadPool::currentWorker();
+        if (settings.integrator == IntegratorKind::Wavefront)
+            renderTileWavefront(tile, world, materials, cam, fb, sampleBegin,
+                                sampleEnd);
+        else
+            renderTileDepthFirst(tile, world, materials, cam, fb, sampleBegin,
+                                 sampleEnd);
+    }
+
+    // One whole path after another, by the path or recursive integrator.
+    void renderTileDepthFirst(const Tile& tile, const Hittable<T>& world,
+                              const MaterialTable<T>& materials,
+                              const Camera<T>& cam, Framebuffer<T>& fb,
+                              int sampleBegin, int sampleEnd) const {
+        for (int y = tile.y1 - 1; y >= tile.y0; --y) {
+            for (int x = tile.x0; x < tile.x1; ++x) {
+                uint64_t pixel = uint64_t(y) * settings.width + x;
+                if (active && !(*active)[pixel])
+                    continue;
+
+                // Continue the running sum, so passes add up exactly.
+                Color<T> pixelColor = fb.at(x, y);
+                Features<T> pixelFeatures;
+                Features<T>* f = nullptr;
+                if (features) {
+                    pixelFeatures = features->at(x, y);
+                    f = &pixelFeatures;
+                }
+                PixelSampler& sampler = threadSampler();
+                for (int s = sampleBegin; s < sampleEnd; ++s) {
+                    sampler.start(settings.sampler, settings.frame, x, y,
+                                  pixel, s);
+                    Vec2<T> jitter = sampler.get2D<T>();
+                    auto u = (T(x) + jitter.x()) / (settings.width - 1);
+                    auto v = (T(y) + jitter.y()) / (settings.height - 1);
+                    Ray<T> r = cam.getRay(u, v);
+                    if (settings.integrator == IntegratorKind::Path)
+                        pixelColor += pathColor(r, world, materials,
+                                                settings.maxDepth,
+                                                settings.rouletteDepth, lights,
+                                                f);
+                    else {
+                        FeatureTracker<T> tracker(f);
+                        pixelColor += rayColor(r, world, materials,
+                                               settings.maxDepth,
+                                               f ? &tracker : nullptr);
+                    }
+                }
+                fb.at(x, y) = pixelColor;
+                if (features)
+                    features->at(x, y) = pixelFeatures;
+            }
+        }
+    }
+
+    void renderTileWavefront(const Tile& tile, const Hittable<T>& world,
+                             const MaterialTable<T>& materials,
+                             const Camera<T>& cam, Framebuffer<T>& fb,
+                             int sampleBegin, int sampleEnd) {
+        std::vector<uint64_t> ids;
+        std::vector<Point2<int>> coords;
+        std::vector<Color<T>> colors;
+        std::vector<Features<T>> pixelFeatures;
+        for (int y = tile.y1 - 1; y >= tile.y0; --y) {
+            for (int x = tile.x0; x < tile.x1; ++x) {
+                uint64_t pixel = uint64_t(y) * settings.width + x;
+                if (active && !(*active)[pixel])
+                    continue;
+                ids.push_back(pixel);
+                coords.emplace_back(x, y);
+                colors.push_back(fb.at(x, y));
+                if (features)
+                    pixelFeatures.push_back(features->at(x, y));
+            }
+        }
+
+        wavefront[tile.worker].render(ids, coords, colors, world, materials,
+                                      cam, settings.width, settings.height,
+                                      sampleBegin, sampleEnd,
+                                      settings.maxDepth, settings.frame,
+                                      settings.sampler,
+                                      features ? &pixelFeatures : nullptr);
+        for (size_t i = 0; i < ids.size(); ++i) {
+            fb.at(coords[i].x(), coords[i].y()) = colors[i];
+            if (features)
+                features->at(coords[i].x(), coords[i].y()) = pixelFeatures[i];
+        }
+    }
+};
+
+} // namespace raytrace
+
+#endif // TILERENDERER_H
@@ -0,0 +1,147 @@
+#ifndef TRANSFORM_H
+#define TRANSFORM_H
+
+#include <cmath>
+
+#include "Common.hpp"
+
+#include "Aabb.hpp"
+
+namespace raytrace {
+
+// Affine transform, a 3x4 matrix: a linear part and a translation in the
+// last column. Composed with *, where (a * b) applies b first.
+template <class T> class Transform {
+  public:
+    Transform() : m{{1, 0, 0, 0}, {0, 1, 0, 0}, {0, 0, 1, 0}} {}
+
+    static Transform translate(const Vec3<T>& offset) {
+        Transform t;
+        for (int i = 0; i < 3; ++i)
+            t.m[i][3] = offset[i];
+        return t;
+    }
+
+    static Transform scale(const Vec3<T>& factors) {
+        Transform t;
+        for (int i = 0; i < 3; ++i)
+            t.m[i][i] = factors[i];
+        return t;
+    }
+
+    static Transform scale(T factor) {
+        return scale(Vec3<T>(factor, factor, factor));
+    }
+
+    // Counterclockwise about axis, looking down it towards the origin.
+    static Transform rotate(const Vec3<T>& axis, T degrees) {
+        Vec3<T> a = unit(axis);
+        T radians = degToRad(degrees);
+        T s = std::sin(radians), c = std::cos(radians);
+        Transform t;
+        for (int i = 0; i < 3; ++i)
+            for (int j = 0; j < 3; ++j)
+                t.m[i][j] = a[i] * a[j] * (1 - c) + (i == j ? c : 0);
+        t.m[0][1] -= a.z() * s;
+        t.m[0][2] += a.y() * s;
+        t.m[1][0] += a.z() * s;
+        t.m[1][2] -= a.x() * s;
+        t.m[2][0] -= a.y() * s;
+        t.m[2][1] += a.x() * s;
+        return t;
+    }
+
+    // Row major, the three rows of the 3x4 matrix.
+    static Transform fromRows(const T (&values)[12]) {
+        Transform t;
+        for (int i = 0; i < 3; ++i)
+            for (int j = 0; j < 4; ++j)
+                t.m[i][j] = values[4 * i + j];
+        return t;
+    }
+
+    T operator()(int row, int column) const { return m[row][column]; }
+
+    inline friend Transform operator*(const Transform& a, const Transform& b) {
+        Transform t;
+        for (int i = 0; i < 3; ++i) {
+            for (int j = 0; j < 4; ++j) {
+                t.m[i][j] = a.m[i][0] * b.m[0][j] + a.m[i][1] * b.m[1][j] +
+                            a.m[i][2] * b.m[2][j];
+            }
+            t.m[i][3] += a.m[i][3];
+        }
+        return t;
+    }
+
+    Point3<T> point(const Point3<T>& p) const {
+        return Point3<T>(row(0, p) + m[0][3], row(1, p) + m[1][3],
+                         row(2, p) + m[2][3]);
+    }
+
+    Vec3<T> vector(const Vec3<T>& v) const {
+        return Vec3<T>(row(0, v), row(1, v), row(2, v));
+    }
+
+    // Multiplies by the transposed linear part. Called on the inverse, this
+    // carries a normal through the forward transform, unnormalised.
+    Vec3<T> transposedVector(const Vec3<T>& v) const {
+        return Vec3<T>(m[0][0] * v.x() + m[1][0] * v.y() + m[2][0] * v.z(),
+                       m[0][1] * v.x() + m[1][1] * v.y() + m[2][1] * v.z(),
+                       m[0][2] * v.x() + m[1][2] * v.y() + m[2][2] * v.z());
+    }
+
+    T determinant() const {
+        return m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1]) -
+               m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0]) +
+               m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+    }
+
+    // The transform undoing this one, which must not be singular.
+    Transform inverse() const {
+        T invDet = 1 / determinant();
+        Transform t;
+        for (int i = 0; i < 3; ++i) {
+            int i1 = (i + 1) % 3, i2 = (i + 2) % 3;
+            for (int j = 0; j < 3; ++j) {
+                int j1 = (j + 1) % 3, j2 = (j + 2) % 3;
+                // Cofactor of m[j][i], so t is the adjugate over det.
+                t.m[i][j] =
+                    (m[j1][i1] * m[j2][i2] - m[j1][i2] * m[j2][i1]) * invDet;
+            }
+        }
+        for (int i = 0; i < 3; ++i)
+            t.m[i][3] = -(t.m[i][0] * m[0][3] + t.m[i][1] * m[1][3] +
+                          t.m[i][2] * m[2][3]);
+        return t;
+    }
+
+    // Smallest box holding the transformed box (Arvo 1990): each output
+    // extent picks the smaller and larger product per matrix entry.
+    Aabb<T> box(const Aabb<T>& b) const {
+        if (b.empty())
+            return b;
+        Point3<T> lo, hi;
+        for (int i = 0; i < 3; ++i) {
+            lo[i] = hi[i] = m[i][3];
+            for (int j = 0; j < 3; ++j) {
+                T a = m[i][j] * b.min()[j];
+                T c = m[i][j] * b.max()[j];
+                lo[i] += a < c ? a : c;
+                hi[i] += a < c ? c : a;
+            }
+        }
+        return Aabb<T>(lo, hi);
+    }
+
+  private:
+    T m[3][4];
+
+    T row(int i, const Vec3<T>& v) const {
+        return m[i][0] * v.x() + m[i][1] * v.y() + m[i][2] * v.z();
+    }
+};
+
+} // namespace raytrace
+
+#endif // TRANSFORM_H
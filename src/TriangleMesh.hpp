@@ -0,0 +1,209 @@
+#ifndef TRIANGLEMESH_H
+#define TRIANGLEMESH_H
+
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "BvhTree.hpp"
+#include "Hittable.hpp"
+
+namespace raytrace {
+
+// Vertex and index buffers of a triangle mesh with a BVH over its
+// triangles. Built once and shared, read only, by every TriangleMesh that
+// shows it.
+template <class T> class MeshGeometry {
+  public:
+    // Takes the buffers, three indices per triangle. Builds the BVH and
+    // reorders the triangles so every leaf is a contiguous run.
+    MeshGeometry(std::vector<Point3<T>> vertices,
+                 std::vector<uint32_t> indices, std::string source = "")
+        : vertices(std::move(vertices)), indices(std::move(indices)),
+          sourcePath(std::move(source)) {
+        std::vector<Aabb<T>> bounds(triangleCount());
+        for (size_t i = 0; i < bounds.size(); ++i) {
+            bounds[i].expand(vertex(i, 0));
+            bounds[i].expand(vertex(i, 1));
+            bounds[i].expand(vertex(i, 2));
+        }
+        tree.build(bounds);
+
+        const auto& order = tree.primitiveOrder();
+        std::vector<uint32_t> original = this->indices;
+        for (size_t i = 0; i < order.size(); ++i)
+            for (int k = 0; k < 3; ++k)
+                this->indices[3 * i + k] = original[3 * order[i] + k];
+    }
+
+    size_t vertexCount() const { return vertices.size(); }
+    size_t triangleCount() const { return indices.size() / 3; }
+    const std::string& source() const { return sourcePath; }
+    // The path as a scene file names it, before the geometry is shared.
+    void setSource(std::string path) { sourcePath = std::move(path); }
+    const BvhBuildStats& bvhStats() const { return tree.stats(); }
+    Aabb<T> bounds() const { return tree.bounds(); }
+
+    // Bytes held for vertices, indices and BVH nodes.
+    size_t memoryBytes() const {
+        return vertices.capacity() * sizeof(Point3<T>) +
+               indices.capacity() * sizeof(uint32_t) +
+               tree.nodeCount() * sizeof(BvhNode<T>);
+    }
+
+    Point3<T> vertex(size_t triangle, int corner) const {
+        return vertices[indices[3 * triangle + corner]];
+    }
+
+    // Unit normal, counterclockwise winding faces out.
+    Vec3<T> normal(size_t triangle) const {
+        Point3<T> a = vertex(triangle, 0);
+        return unit(cross(vertex(triangle, 1) - a, vertex(triangle, 2) - a));
+    }
+
+    // Closest triangle hit within [tMin, tMax], with its distance.
+    bool intersect(const Ray<T>& r, T tMin, T tMax, uint32_t& triangle,
+                   T& t) const {
+        RaySetup setup(r);
+        bool hitAnything = false;
+        tree.traverse(r, tMin, tMax,
+                      [&](uint32_t first, uint32_t count, T& closest) {
+                          bool hitLeaf = false;
+                          for (uint32_t i = first; i < first + count; ++i) {
+                              if (hitTriangle(setup, i, tMin, closest)) {
+                                  triangle = i;
+                                  t = closest;
+                                  hitLeaf = true;
+                              }
+                          }
+                          hitAnything = hitAnything || hitLeaf;
+                          return hitLeaf;
+                      });
+        return hitAnything;
+    }
+
+    // Whether any triangle is hit within [tMin, tMax].
+    bool occluded(const Ray<T>& r, T tMin, T tMax) const {
+        RaySetup setup(r);
+        return tree.traverseAny(
+            r, tMin, tMax, [&](uint32_t first, uint32_t count, T& tMaxLeaf) {
+                for (uint32_t i = first; i < first + count; ++i)
+                    if (hitTriangle(setup, i, tMin, tMaxLeaf))
+                        return true;
+                return false;
+            });
+    }
+
+  private:
+    std::vector<Point3<T>> vertices;
+    std::vector<uint32_t> indices;
+    std::string sourcePath;
+    BvhTree<T> tree;
+
+    // Per ray part of the watertight test (Woop, Benthin and Wald 2013):
+    // permute so the largest direction component is z, then shear the ray
+    // onto +z. Each triangle then reduces to 2D edge functions about the
+    // origin, which are exact on shared edges, so no ray slips between two
+    // triangles.
+    struct RaySetup {
+        Point3<T> origin;
+        int kx, ky, kz;
+        T sx, sy, sz;
+
+        RaySetup(const Ray<T>& r) : origin(r.origin()) {
+            Vec3<T> d = r.direction();
+            T ax = std::abs(d.x()), ay = std::abs(d.y()), az = std::abs(d.z());
+            kz = ax > ay ? (ax > az ? 0 : 2) : (ay > az ? 1 : 2);
+            kx = kz == 2 ? 0 : kz + 1;
+            ky = kx == 2 ? 0 : kx + 1;
+            sx = -d[kx] / d[kz];
+            sy = -d[ky] / d[kz];
+            sz = 1 / d[kz];
+        }
+    };
+
+    // Branch free up to the edge sign test, apart from the rare double
+    // precision retry.
+    bool hitTriangle(const RaySetup& s, uint32_t triangle, T tMin,
+                     T& tMax) const {
+        profileCount(Counter::IntersectionTests);
+        Vec3<T> p0 = vertex(triangle, 0) - s.origin;
+        Vec3<T> p1 = vertex(triangle, 1) - s.origin;
+        Vec3<T> p2 = vertex(triangle, 2) - s.origin;
+
+        T p0x = p0[s.kx] + s.sx * p0[s.kz], p0y = p0[s.ky] + s.sy * p0[s.kz];
+        T p1x = p1[s.kx] + s.sx * p1[s.kz], p1y = p1[s.ky] + s.sy * p1[s.kz];
+        T p2x = p2[s.kx] + s.sx * p2[s.kz], p2y = p2[s.ky] + s.sy * p2[s.kz];
+
+        T e0 = p1x * p2y - p1y * p2x;
+        T e1 = p2x * p0y - p2y * p0x;
+        T e2 = p0x * p1y - p0y * p1x;
+
+        // An exact zero in float may be rounding, settle it in double.
+        if constexpr (std::is_same<T, float>::value) {
+            if (e0 == 0 || e1 == 0 || e2 == 0) {
+                e0 = T(double(p1x) * double(p2y) - double(p1y) * double(p2x));
+                e1 = T(double(p2x) * double(p0y) - double(p2y) * double(p0x));
+                e2 = T(double(p0x) * double(p1y) - double(p0y) * double(p1x));
+            }
+        }
+
+        if ((e0 < 0 || e1 < 0 || e2 < 0) && (e0 > 0 || e1 > 0 || e2 > 0))
+            return false;
+        T det = e0 + e1 + e2;
+        if (det == 0)
+            return false;
+
+        T tScaled = s.sz * (e0 * p0[s.kz] + e1 * p1[s.kz] + e2 * p2[s.kz]);
+        T t = tScaled / det;
+        if (t < tMin || t > tMax)
+            return false;
+        tMax = t;
+        profileCount(Counter::PrimitiveHits);
+        return true;
+    }
+};
+
+// A mesh in the scene: shared geometry drawn with one material.
+template <class T> class TriangleMesh : public Hittable<T> {
+  public:
+    TriangleMesh(std::shared_ptr<const MeshGeometry<T>> geometry,
+                 uint32_t material)
+        : geometry(std::move(geometry)), mat(material) {}
+
+    virtual bool hit(const Ray<T>& r, T tMin, T tMax,
+                     HitRecord<T>& rec) const override {
+        uint32_t triangle;
+        T t;
+        if (!geometry->intersect(r, tMin, tMax, triangle, t))
+            return false;
+
+        rec.t = t;
+        rec.p = r.at(t);
+        rec.setFaceNormal(r, geometry->normal(triangle));
+        rec.mat = mat;
+        return true;
+    }
+
+    virtual bool occluded(const Ray<T>& r, T tMin, T tMax) const override {
+        return geometry->occluded(r, tMin, tMax);
+    }
+
+    virtual Aabb<T> boundingBox() const override { return geometry->bounds(); }
+
+    const std::shared_ptr<const MeshGeometry<T>>& getGeometry() const {
+        return geometry;
+    }
+    uint32_t getMaterial() const { return mat; }
+
+  private:
+    std::shared_ptr<const MeshGeometry<T>> geometry;
+    uint32_t mat;
+};
+
+} // namespace raytrace
+
+#endif // TRIANGLEMESH_H
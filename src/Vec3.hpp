@@ -35,7 +35,7 @@ template <class T> class Vec3 {
         return *this;
     }
 
-    Vec3& operator/=(const T t) { return *this *= 1.0 / t; }
+    Vec3& operator/=(const T t) { return *this *= 1 / t; }
 
     T lengthSquared() const { return e[0] * e[0] + e[1] * e[1] + e[2] * e[2]; }
 
@@ -43,8 +43,8 @@ template <class T> class Vec3 {
 
     // Check if the vector is near zero in all dimensions
     bool nearZero() const {
-        return (std::abs(e[0]) < epsilon) && (std::abs(e[1]) < epsilon) &&
-               (std::abs(e[2]) < epsilon);
+        return (std::abs(e[0]) < epsilon<T>) &&
+               (std::abs(e[1]) < epsilon<T>) && (std::abs(e[2]) < epsilon<T>);
     }
 
     // Utility functions
@@ -71,7 +71,7 @@ template <class T> class Vec3 {
 
     inline friend Vec3 operator*(const Vec3& v, T t) { return t * v; }
 
-    inline friend Vec3 operator/(const Vec3& v, T t) { return (1.0 / t) * v; }
+    inline friend Vec3 operator/(const Vec3& v, T t) { return (1 / t) * v; }
 
     inline friend T dot(const Vec3& u, const Vec3& v) {
         return u.e[0] * v.e[0] + u.e[1] * v.e[1] + u.e[2] * v.e[2];
@@ -92,53 +92,19 @@ template <class T> class Vec3 {
 
     // Refract, using Snell's law
     inline friend Vec3 refract(const Vec3& uv, const Vec3& n, T etaiOverEtat) {
-        auto cosTheta = std::min<T>(dot(-uv, n), 1.0);
+        auto cosTheta = std::min<T>(dot(-uv, n), 1);
         Vec3<T> rOutPerp = etaiOverEtat * (uv + cosTheta * n);
         Vec3<T> rOutParallel =
-            -std::sqrt(std::abs(1.0 - rOutPerp.lengthSquared())) * n;
+            -std::sqrt(std::abs(1 - rOutPerp.lengthSquared())) * n;
         return rOutPerp + rOutParallel;
     }
 
-    // Stochasitic Utility
-    inline static Vec3 random(T min = 0.0, T max = 1.0) {
+    // Stochasitic Utility, points on disks and spheres are in Sampling.hpp.
+    inline static Vec3 random(T min = 0, T max = 1) {
         return Vec3<T>(randomReal<T>(min, max), randomReal<T>(min, max),
                        randomReal<T>(min, max));
     }
 
-    // Simple random sample in unit square, reject untill within circle
-    inline static Vec3 randomInUnitDisk() {
-        while (true) {
-            auto p = Vec3<T>(randomReal<T>(-1, 1), randomReal<T>(-1, 1), 0);
-            if (p.lengthSquared() >= 1)
-                continue; // Not in disk.
-            return p;
-        }
-    }
-
-    // Simple random sample in unit cube, reject untill within sphere
-    inline static Vec3 randomInUnitSphere() {
-        while (true) {
-            auto p = Vec3<T>::random(-1, 1);
-            if (p.lengthSquared() >= 1)
-                continue; // Not in sphere.
-            return p;
-        }
-    }
-
-    // For true Lambertian reflection.
-    inline static Vec3 randomUnitVec() { return unit(randomInUnitSphere()); }
-
-    // Alternative diffuse formulation
-    inline static Vec3 randomInHemisphere(const Vec3& normal) {
-        Vec3 inUnitSphere = randomInUnitSphere();
-        if (dot(inUnitSphere, normal) >
-            0.0) { // If in the same hemisphere as the normal.
-            return inUnitSphere;
-        } else {
-            return -inUnitSphere;
-        }
-    }
-
   private:
     T e[3];
 };
@@ -0,0 +1,139 @@
+#ifndef WAVEFRONT_H
+#define WAVEFRONT_H
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "Common.hpp"
+
+#include "Camera.hpp"
+#include "Hittable.hpp"
+#include "Integrator.hpp"
+#include "Material.hpp"
+#include "Sampler.hpp"
+
+namespace raytrace {
+
+// Breadth first path tracer. Rather than following one path to the end it
+// advances a whole batch of paths one bounce at a time: intersect every
+// live path, shade the misses, group the hits by material, scatter them and
+// compact the survivors. Each path carries its own random stream and
+// sampler, so the result does not depend on batch order.
+template <class T> class WavefrontIntegrator {
+  public:
+    static constexpr size_t batchSize = 4096;
+
+    // Trace samples [sampleBegin, sampleEnd) for each of the given pixels
+    // and add their radiance to colors. pixelIds are image pixel indices
+    // (for seeding), pixelCoords the matching (x, y). Given features, also
+    // adds the features of the samples to them, see FeatureTracker.
+    void render(const std::vector<uint64_t>& pixelIds,
+                const std::vector<Point2<int>>& pixelCoords,
+                std::vector<Color<T>>& colors, const Hittable<T>& world,
+                const MaterialTable<T>& materials, const Camera<T>& cam,
+                int width, int height, int sampleBegin, int sampleEnd,
+                int maxDepth, uint64_t frame, SamplerKind sampler,
+                std::vector<Features<T>>* features = nullptr) {
+        int samplesPerPixel = sampleEnd - sampleBegin;
+        size_t total = pixelIds.size() * samplesPerPixel;
+        for (size_t start = 0; start < total; start += batchSize) {
+            size_t end = std::min(total, start + batchSize);
+
+            // Primary rays, drawn exactly as the recursive path draws them.
+            paths.clear();
+            for (size_t k = start; k < end; ++k) {
+                uint32_t local = static_cast<uint32_t>(k / samplesPerPixel);
+                int s = sampleBegin + static_cast<int>(k % samplesPerPixel);
+                const auto& xy = pixelCoords[local];
+                threadSampler().start(sampler, frame, xy.x(), xy.y(),
+                                      pixelIds[local], uint32_t(s));
+
+                Vec2<T> jitter = sample2D<T>();
+                auto u = (T(xy.x()) + jitter.x()) / (width - 1);
+                auto v = (T(xy.y()) + jitter.y()) / (height - 1);
+                FeatureTracker<T> tracker(features ? &(*features)[local]
+                                                   : nullptr);
+                paths.push_back({cam.getRay(u, v), Color<T>(1, 1, 1), local,
+                                 threadRng(), threadSampler(), tracker});
+            }
+
+            for (int depth = 0; depth < maxDepth && !paths.empty(); ++depth)
+                bounce(world, materials, colors, depth);
+            for (auto& path : paths)
+                path.features.end();
+        }
+    }
+
+  private:
+    struct PathState {
+        Ray<T> ray;
+        Color<T> throughput;
+        uint32_t pixel;
+        Pcg32 rng;
+        PixelSampler sampler;
+        FeatureTracker<T> features;
+    };
+
+    std::vector<PathState> paths;
+    std::vector<PathState> survivors;
+    std::vector<HitRecord<T>> hits;
+    std::vector<uint32_t> order;
+
+    void bounce(const Hittable<T>& world, const MaterialTable<T>& materials,
+                std::vector<Color<T>>& colors, int depth) {
+        // Intersect, the environment terminates every path that escapes.
+        hits.resize(paths.size());
+        order.clear();
+        raysTraced() += paths.size();
+        for (size_t i = 0; i < paths.size(); ++i) {
+            auto& path = paths[i];
+            if (world.hit(path.ray, T(0.001), infinity<T>, hits[i])) {
+                order.push_back(static_cast<uint32_t>(i));
+            } else {
+                colors[path.pixel] +=
+                    path.throughput * environment(path.ray);
+                path.features.miss(path.throughput);
+            }
+        }
+
+        // Shade paths of the same material type, then instance, together.
+        auto key = [&](uint32_t i) {
+            return uint64_t(materials[hits[i].mat].kind()) << 32 |
+                   hits[i].mat;
+        };
+        std::sort(order.begin(), order.end(),
+                  [&](uint32_t a, uint32_t b) { return key(a) < key(b); });
+
+        survivors.clear();
+        for (uint32_t i : order) {
+            auto& path = paths[i];
+            Ray<T> scattered;
+            Color<T> attenuation;
+
+            const Material<T>& material = materials[hits[i].mat];
+            colors[path.pixel] += path.throughput * material.emitted();
+            path.features.hit(path.ray, hits[i], material, path.throughput);
+            threadRng() = path.rng;
+            threadSampler() = path.sampler;
+            threadSampler().startBounce(depth);
+            bool alive =
+                material.scatter(path.ray, hits[i], attenuation, scattered);
+            path.rng = threadRng();
+            path.sampler = threadSampler();
+
+            if (alive) {
+                path.ray = scattered;
+                path.throughput = path.throughput * attenuation;
+                survivors.push_back(path);
+            } else {
+                path.features.end();
+            }
+        }
+        std::swap(paths, survivors);
+    }
+};
+
+} // namespace raytrace
+
+#endif // WAVEFRONT_H